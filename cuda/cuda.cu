@@ -6,6 +6,7 @@
 #include <cuda_runtime.h>
 #include "../helpers/image.h"
 #include "../helpers/kernels.h"
+#include "../helpers/preview.h"
 
 using namespace std;
 using namespace std::chrono;
@@ -41,21 +42,21 @@ __global__ void convolutionKernel(const double* input, double* output,
             int iy = min(max(y + ky, 0), height - 1);
             int ix = min(max(x + kx, 0), width - 1);
             int kidx = (ky + padding) * kernelSize + (kx + padding);
-            sum += input[iy * width + ix] * d_kernel[kidx];
+            sum += input[static_cast<long long>(iy) * width + ix] * d_kernel[kidx];
         }
     }
     
-    output[y * width + x] = sum / divisor;
+    output[static_cast<long long>(y) * width + x] = sum / divisor;
 }
 
 // reduction kernel to find the min and max values
-__global__ void findMinMaxKernel(const double* data, double* minVals, double* maxVals, int size) {
+__global__ void findMinMaxKernel(const double* data, double* minVals, double* maxVals, long long size) {
     extern __shared__ double sdata[];
     double* smin = sdata;
     double* smax = sdata + blockDim.x;
     
     unsigned int tid = threadIdx.x;
-    unsigned int i = blockIdx.x * blockDim.x * 2 + threadIdx.x;
+    long long i = static_cast<long long>(blockIdx.x) * blockDim.x * 2 + threadIdx.x;
     
     // initializing with extreme values before comparison
     double localMin = DBL_MAX;
@@ -93,16 +94,16 @@ __global__ void findMinMaxKernel(const double* data, double* minVals, double* ma
 }
 
 // kernel for normalizing the pixel values
-__global__ void normalizeKernel(double* data, int size, double minVal, double range) {
-    int idx = blockIdx.x * blockDim.x + threadIdx.x;
+__global__ void normalizeKernel(double* data, long long size, double minVal, double range) {
+    long long idx = static_cast<long long>(blockIdx.x) * blockDim.x + threadIdx.x;
     if (idx < size) {
         data[idx] = 255.0 * (data[idx] - minVal) / range;
     }
 }
 
-void normalizeMatrixGPU(double* d_data, int size) {
+void normalizeMatrixGPU(double* d_data, long long size) {
     int blockSize = 256;
-    int numBlocks = (size + blockSize * 2 - 1) / (blockSize * 2);
+    int numBlocks = static_cast<int>((size + blockSize * 2 - 1) / (blockSize * 2));
     
     double *d_minVals, *d_maxVals;
     CUDA_CHECK(cudaMalloc(&d_minVals, numBlocks * sizeof(double)));
@@ -127,7 +128,7 @@ void normalizeMatrixGPU(double* d_data, int size) {
     double range = (maxVal - minVal == 0.0) ? 1.0 : (maxVal - minVal);
     
     // applying the normalization kernel
-    int normalizeBlocks = (size + blockSize - 1) / blockSize;
+    int normalizeBlocks = static_cast<int>((size + blockSize - 1) / blockSize);
     normalizeKernel<<<normalizeBlocks, blockSize>>>(d_data, size, minVal, range);
     CUDA_CHECK(cudaGetLastError());
     
@@ -160,19 +161,24 @@ void applyKernelGPU(double* d_input, double* d_output, int width, int height,
     CUDA_CHECK(cudaGetLastError());
     
     // normalizing the result matrix
-    normalizeMatrixGPU(d_output, width * height);
+    normalizeMatrixGPU(d_output, static_cast<long long>(width) * height);
     
     CUDA_CHECK(cudaDeviceSynchronize());
 }
 
-int main() {
+int main(int argc, char** argv) {
+    // --png-level <0-9>, --png-filter <name>, --png-fast, --png-threads <n> pick how the output is encoded
+    setDefaultPngOptions(parsePngOptions(argc, argv));
+    // --preview 2|4|8 runs on the input box-downsampled by that factor, for a quick look
+    setPreviewFactor(parsePreviewFactor(argc, argv));
+
     auto start = high_resolution_clock::now();
 
     GreyScaleImage img("../images/image.png");
     
     int width = img.getWidth();
     int height = img.getHeight();
-    int size = width * height;
+    long long size = static_cast<long long>(width) * height;
     
     // converting the image to a flattened matrix for CUDA
     vector<double> h_data = img.getFlattenedMatrix();
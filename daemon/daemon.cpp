@@ -0,0 +1,89 @@
+#include <iostream>
+#include <csignal>
+#include <string>
+#include "../helpers/png_writer.h"
+#include "infrastructure/client.h"
+#include "infrastructure/server.h"
+
+using namespace std;
+
+// how long --request waits for a daemon that is still starting
+#define DAEMON_CONNECT_WAIT_MS 5000
+
+static FeatureServer* activeServer = nullptr;
+
+static void onSignal(int) {
+    if (activeServer) {
+        activeServer->requestStop();
+    }
+}
+
+int main(int argc, char** argv) {
+    // usage: daemon [--socket <path>] [--workers <n>] [--threads <n>] [--queue <jobs>]
+    //               [--max-clients <n>] [--arena-mb <mb>] [--cache-dir <dir>] [--cache-mb <mb>]
+    //               [--tile-size <n>] [--tile-cache <tiles>] [png flags]
+    //        daemon [--socket <path>] --request "<line>"   (sends one request and prints the reply)
+    DaemonOptions options;
+    string request;
+    // --png-level <0-9>, --png-filter <name>, --png-fast, --png-threads <n> pick how PNG results are encoded
+    options.png = parsePngOptions(argc, argv);
+
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--socket" && i + 1 < argc) {
+            options.socketPath = argv[++i];
+        } else if (arg == "--workers" && i + 1 < argc) {
+            options.workers = max(1, stoi(argv[++i]));
+        } else if (arg == "--threads" && i + 1 < argc) {
+            options.threads = max(0, stoi(argv[++i]));
+        } else if (arg == "--queue" && i + 1 < argc) {
+            options.queueDepth = max(1, stoi(argv[++i]));
+        } else if (arg == "--max-clients" && i + 1 < argc) {
+            options.maxClients = max(1, stoi(argv[++i]));
+        } else if (arg == "--arena-mb" && i + 1 < argc) {
+            options.arenaBytes = static_cast<size_t>(max(0, stoi(argv[++i]))) << 20;
+        } else if (arg == "--cache-dir" && i + 1 < argc) {
+            options.cacheDir = argv[++i];
+        } else if (arg == "--cache-mb" && i + 1 < argc) {
+            options.cacheBytes = static_cast<size_t>(max(0, stoi(argv[++i]))) << 20;
+        } else if (arg == "--tile-size" && i + 1 < argc) {
+            options.tileSize = max(8, stoi(argv[++i]));
+        } else if (arg == "--tile-cache" && i + 1 < argc) {
+            options.tileCache = static_cast<size_t>(max(0, stoi(argv[++i])));
+        } else if (arg == "--request" && i + 1 < argc) {
+            request = argv[++i];
+        }
+    }
+
+    // client mode, for scripts and the run target
+    if (!request.empty()) {
+        try {
+            string reply = sendRequest(options.socketPath, request, DAEMON_CONNECT_WAIT_MS);
+            cout << reply << endl;
+            return (reply.rfind("ERR", 0) == 0 || reply.rfind("BUSY", 0) == 0) ? 1 : 0;
+        } catch (const exception& e) {
+            cerr << e.what() << endl;
+            return 1;
+        }
+    }
+
+    try {
+        FeatureServer server(options);
+        activeServer = &server;
+
+        // SIGINT / SIGTERM drain the queue before exiting, clients that hang up never kill the daemon
+        signal(SIGINT, onSignal);
+        signal(SIGTERM, onSignal);
+        signal(SIGPIPE, SIG_IGN);
+
+        cout << "Listening on " << options.socketPath << " (" << options.workers << " workers)" << endl;
+        server.serve();
+        activeServer = nullptr;
+    } catch (const exception& e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
+
+    cout << "Daemon stopped" << endl;
+    return 0;
+}
@@ -0,0 +1,86 @@
+#include "client.h"
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace std;
+using namespace std::chrono;
+
+// pause between connection attempts
+#define CLIENT_RETRY_MS 50
+
+string sendRequest(const string& socketPath, const string& request, int waitMs, const vector<int>& descriptors) {
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path)) {
+        throw runtime_error("Socket path too long: " + socketPath);
+    }
+    strncpy(address.sun_path, socketPath.c_str(), sizeof(address.sun_path) - 1);
+
+    // the daemon may still be starting, keep trying until the deadline
+    auto deadline = steady_clock::now() + milliseconds(waitMs);
+    int fd = -1;
+    while (true) {
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) {
+            throw runtime_error(string("Cannot create socket: ") + strerror(errno));
+        }
+        if (connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0) {
+            break;
+        }
+        close(fd);
+        if (steady_clock::now() >= deadline) {
+            throw runtime_error("No daemon listening on " + socketPath);
+        }
+        this_thread::sleep_for(milliseconds(CLIENT_RETRY_MS));
+    }
+
+    string data = request + "\n";
+    size_t sent = 0;
+
+    // the descriptors ride on the first chunk of the line
+    vector<char> control(descriptors.empty() ? 0 : CMSG_SPACE(sizeof(int) * descriptors.size()));
+    while (sent < data.size()) {
+        iovec chunk{ const_cast<char*>(data.data()) + sent, data.size() - sent };
+        msghdr message{};
+        message.msg_iov = &chunk;
+        message.msg_iovlen = 1;
+        if (sent == 0 && !control.empty()) {
+            message.msg_control = control.data();
+            message.msg_controllen = control.size();
+            cmsghdr* header = CMSG_FIRSTHDR(&message);
+            header->cmsg_level = SOL_SOCKET;
+            header->cmsg_type = SCM_RIGHTS;
+            header->cmsg_len = CMSG_LEN(sizeof(int) * descriptors.size());
+            memcpy(CMSG_DATA(header), descriptors.data(), sizeof(int) * descriptors.size());
+        }
+        ssize_t n = sendmsg(fd, &message, MSG_NOSIGNAL);
+        if (n < 0 && errno != EINTR) {
+            close(fd);
+            throw runtime_error("Lost the connection to " + socketPath);
+        }
+        if (n > 0) {
+            sent += n;
+        }
+    }
+
+    string reply;
+    char c;
+    while (true) {
+        ssize_t n = read(fd, &c, 1);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0 || c == '\n') {
+            break;
+        }
+        reply += c;
+    }
+    close(fd);
+    return reply;
+}
@@ -0,0 +1,12 @@
+#pragma once
+#include <string>
+#include <vector>
+
+/*
+    sends one request line to a daemon and returns its reply line (without the newline)
+    @param waitMs: how long to keep retrying while nothing listens on the socket yet
+    @param descriptors: sent along with the line (SCM_RIGHTS), fd:<i> in a FRAME request names the i-th
+    throws runtime_error when no daemon answers
+*/
+std::string sendRequest(const std::string& socketPath, const std::string& request, int waitMs,
+                        const std::vector<int>& descriptors = {});
@@ -0,0 +1,105 @@
+#include "image_arena.h"
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+
+using namespace std;
+
+// blocks are rounded up so images of nearby sizes share them
+#define ARENA_GRANULE (1 << 20)
+
+ImageArena::Lease::Lease(Lease&& other) noexcept
+    : arena(other.arena), block(other.block), capacity(other.capacity) {
+    other.arena = nullptr;
+    other.block = nullptr;
+    other.capacity = 0;
+}
+
+ImageArena::Lease& ImageArena::Lease::operator=(Lease&& other) noexcept {
+    if (this != &other) {
+        release();
+        arena = other.arena;
+        block = other.block;
+        capacity = other.capacity;
+        other.arena = nullptr;
+        other.block = nullptr;
+        other.capacity = 0;
+    }
+    return *this;
+}
+
+ImageArena::Lease::~Lease() {
+    release();
+}
+
+void ImageArena::Lease::release() {
+    if (arena && block) {
+        arena->giveBack(block, capacity);
+    }
+    arena = nullptr;
+    block = nullptr;
+    capacity = 0;
+}
+
+ImageArena::ImageArena(size_t cacheLimit) : cacheLimit(cacheLimit) {}
+
+ImageArena::~ImageArena() {
+    for (auto& entry : idle) {
+        free(entry.second);
+    }
+}
+
+ImageArena::Lease ImageArena::acquire(size_t bytes) {
+    size_t capacity = (max<size_t>(bytes, 1) + ARENA_GRANULE - 1) / ARENA_GRANULE * ARENA_GRANULE;
+
+    Lease lease;
+    lease.arena = this;
+    {
+        lock_guard<mutex> lock(arenaMutex);
+        auto it = idle.lower_bound(capacity);
+        if (it != idle.end()) {
+            lease.capacity = it->first;
+            lease.block = it->second;
+            cachedBytes -= it->first;
+            idle.erase(it);
+            ++hits;
+            return lease;
+        }
+        ++misses;
+    }
+
+    lease.block = static_cast<unsigned char*>(aligned_alloc(64, capacity));
+    if (!lease.block) {
+        lease.arena = nullptr;
+        throw bad_alloc();
+    }
+    lease.capacity = capacity;
+    return lease;
+}
+
+void ImageArena::giveBack(unsigned char* block, size_t capacity) {
+    {
+        lock_guard<mutex> lock(arenaMutex);
+        if (cachedBytes + capacity <= cacheLimit) {
+            idle.emplace(capacity, block);
+            cachedBytes += capacity;
+            return;
+        }
+    }
+    free(block);
+}
+
+long long ImageArena::getHits() const {
+    lock_guard<mutex> lock(arenaMutex);
+    return hits;
+}
+
+long long ImageArena::getMisses() const {
+    lock_guard<mutex> lock(arenaMutex);
+    return misses;
+}
+
+size_t ImageArena::getCachedBytes() const {
+    lock_guard<mutex> lock(arenaMutex);
+    return cachedBytes;
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include <cstddef>
+#include <map>
+#include <mutex>
+
+/*
+    recycles the large per-image buffers between jobs: a released block is kept (up to a byte
+    limit) and handed to the next request it fits, so warm jobs reuse pages that are already
+    faulted in instead of mapping fresh ones
+*/
+class ImageArena {
+public:
+    // a block on loan, returned to the arena when the lease goes away
+    class Lease {
+    public:
+        Lease() = default;
+        Lease(Lease&& other) noexcept;
+        Lease& operator=(Lease&& other) noexcept;
+        ~Lease();
+
+        Lease(const Lease&) = delete;
+        Lease& operator=(const Lease&) = delete;
+
+        unsigned char* bytes() const { return block; }
+        double* doubles() const { return reinterpret_cast<double*>(block); }
+        size_t size() const { return capacity; }
+
+    private:
+        friend class ImageArena;
+        ImageArena* arena = nullptr;
+        unsigned char* block = nullptr;
+        size_t capacity = 0;
+
+        void release();
+    };
+
+    // @param cacheLimit: bytes of idle blocks kept for reuse, larger blocks are freed on release
+    explicit ImageArena(size_t cacheLimit);
+    ~ImageArena();
+
+    ImageArena(const ImageArena&) = delete;
+    ImageArena& operator=(const ImageArena&) = delete;
+
+    // a block of at least bytes bytes, 64-byte aligned: the smallest idle one that fits, or a new one
+    Lease acquire(size_t bytes);
+
+    long long getHits() const;
+    long long getMisses() const;
+    size_t getCachedBytes() const;
+
+private:
+    size_t cacheLimit;
+    mutable std::mutex arenaMutex;
+    std::multimap<size_t, unsigned char*> idle; // capacity -> block
+    size_t cachedBytes = 0;
+    long long hits = 0;
+    long long misses = 0;
+
+    void giveBack(unsigned char* block, size_t capacity);
+};
@@ -0,0 +1,583 @@
+#include "server.h"
+#include "../helpers/image.h"
+#include "../helpers/mapped_image.h"
+#include "../helpers/row_source.h"
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace std;
+using namespace std::chrono;
+
+// how often blocked loops look at the stop flag
+#define DAEMON_POLL_MS 200
+#define SHM_PREFIX "shm:"
+#define SHM_DIR "/dev/shm/"
+#define FD_PREFIX "fd:"
+// descriptors accepted with one read of a connection
+#define FRAME_MAX_DESCRIPTORS 8
+
+namespace {
+
+bool isShm(const string& path) {
+    return path.compare(0, strlen(SHM_PREFIX), SHM_PREFIX) == 0;
+}
+
+string resolvePath(const string& path) {
+    return isShm(path) ? SHM_DIR + path.substr(strlen(SHM_PREFIX)) : path;
+}
+
+double millisSince(steady_clock::time_point start) {
+    return duration<double, milli>(steady_clock::now() - start).count();
+}
+
+// writes the whole reply, false once the client has gone away
+bool sendLine(int fd, const string& line) {
+    string data = line + "\n";
+    size_t sent = 0;
+    while (sent < data.size()) {
+        ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        sent += n;
+    }
+    return true;
+}
+
+vector<string> splitFields(const string& line) {
+    vector<string> fields;
+    char separator = line.find('\t') != string::npos ? '\t' : ' ';
+    size_t start = 0;
+    while (start <= line.size()) {
+        size_t end = line.find(separator, start);
+        if (end == string::npos) {
+            end = line.size();
+        }
+        if (end > start) {
+            fields.push_back(line.substr(start, end - start));
+        }
+        start = end + 1;
+    }
+    return fields;
+}
+
+sockaddr_un socketAddress(const string& path) {
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) {
+        throw runtime_error("Socket path too long: " + path);
+    }
+    strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+    return address;
+}
+
+// reads like read(), keeping the descriptors that came along as SCM_RIGHTS
+ssize_t receive(int fd, char* buffer, size_t size, vector<int>& descriptors) {
+    iovec data{ buffer, size };
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * FRAME_MAX_DESCRIPTORS)];
+    msghdr message{};
+    message.msg_iov = &data;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    ssize_t n;
+    do {
+        n = recvmsg(fd, &message, MSG_CMSG_CLOEXEC);
+    } while (n < 0 && errno == EINTR);
+
+    for (cmsghdr* header = CMSG_FIRSTHDR(&message); header; header = CMSG_NXTHDR(&message, header)) {
+        if (header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_RIGHTS) {
+            size_t count = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            const int* received = reinterpret_cast<const int*>(CMSG_DATA(header));
+            descriptors.insert(descriptors.end(), received, received + count);
+        }
+    }
+    return n;
+}
+
+void closeAll(vector<int>& descriptors) {
+    for (int descriptor : descriptors) {
+        close(descriptor);
+    }
+    descriptors.clear();
+}
+
+// shm:<name> or fd:<i> (index into the descriptors of the request)
+unique_ptr<SharedFrame> openFrame(const string& handle, const vector<int>& descriptors,
+                                  int width, int height, size_t stride, bool writable) {
+    if (isShm(handle)) {
+        return unique_ptr<SharedFrame>(new SharedFrame(handle.substr(strlen(SHM_PREFIX)), width, height, stride, writable));
+    }
+    if (handle.compare(0, strlen(FD_PREFIX), FD_PREFIX) == 0) {
+        size_t index = stoul(handle.substr(strlen(FD_PREFIX)));
+        if (index >= descriptors.size()) {
+            throw runtime_error("no descriptor " + to_string(index) + " was sent with the request");
+        }
+        return unique_ptr<SharedFrame>(new SharedFrame(descriptors[index], width, height, stride, writable));
+    }
+    throw runtime_error("frame handles are shm:<name> or fd:<index>, not " + handle);
+}
+
+} // namespace
+
+FeatureServer::FeatureServer(const DaemonOptions& options)
+    : options(options), arena(options.arenaBytes),
+      tiles(options.tileSize, options.tileCache, DAEMON_TILE_SOURCES, options.cacheDir), latencies() {
+    latencies.reserve(DAEMON_LATENCY_WINDOW);
+    if (!options.cacheDir.empty()) {
+        cache.reset(new ResultCache(options.cacheDir, options.cacheBytes));
+    }
+}
+
+FeatureServer::~FeatureServer() {
+    if (listenFd >= 0) {
+        close(listenFd);
+    }
+}
+
+void FeatureServer::serve() {
+    sockaddr_un address = socketAddress(options.socketPath);
+
+    // a socket file nobody answers on is left over from a daemon that died, a live one is not stolen
+    int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (probe >= 0) {
+        bool live = connect(probe, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0;
+        close(probe);
+        if (live) {
+            throw runtime_error("A daemon is already listening on " + options.socketPath);
+        }
+    }
+    unlink(options.socketPath.c_str());
+
+    listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listenFd < 0
+        || bind(listenFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0
+        || listen(listenFd, SOMAXCONN) < 0) {
+        throw runtime_error("Cannot listen on " + options.socketPath + ": " + strerror(errno));
+    }
+
+    for (int i = 0; i < options.workers; ++i) {
+        workers.emplace_back(&FeatureServer::workerLoop, this);
+    }
+
+    while (!stopping.load()) {
+        pollfd ready{ listenFd, POLLIN, 0 };
+        int events = poll(&ready, 1, DAEMON_POLL_MS);
+        reapConnections(false);
+        if (events <= 0) {
+            continue;
+        }
+
+        int fd = accept(listenFd, nullptr, nullptr);
+        if (fd < 0) {
+            continue;
+        }
+
+        // every connection holds a thread, past the limit clients are told to come back later
+        if (static_cast<int>(connections.size()) >= options.maxClients) {
+            sendLine(fd, "BUSY " + to_string(connections.size()) + " " + to_string(options.maxClients));
+            close(fd);
+            lock_guard<std::mutex> lock(statsMutex);
+            ++rejected;
+            continue;
+        }
+
+        Connection connection;
+        connection.finished = make_shared<atomic<bool>>(false);
+        auto finished = connection.finished;
+        connection.thread = thread([this, fd, finished]() {
+            handleClient(fd);
+            close(fd);
+            finished->store(true);
+        });
+        connections.push_back(move(connection));
+    }
+
+    // no new connections, clients finish the request they are in, then the queue is drained
+    close(listenFd);
+    listenFd = -1;
+    unlink(options.socketPath.c_str());
+    reapConnections(true);
+
+    {
+        lock_guard<std::mutex> lock(queueMutex);
+        draining = true;
+    }
+    queueReady.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    workers.clear();
+}
+
+void FeatureServer::reapConnections(bool all) {
+    for (auto it = connections.begin(); it != connections.end();) {
+        if (all || it->finished->load()) {
+            it->thread.join();
+            it = connections.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void FeatureServer::workerLoop() {
+    mfe_options engineOptions = mfe_default_options();
+    engineOptions.backend = options.threads == 1 ? MFE_BACKEND_SERIAL : MFE_BACKEND_THREADS;
+    engineOptions.threads = options.threads;
+    mfe::Context engine(engineOptions);
+
+    while (true) {
+        shared_ptr<Job> job;
+        {
+            unique_lock<std::mutex> lock(queueMutex);
+            queueReady.wait(lock, [this]() { return !queue.empty() || draining; });
+            if (queue.empty()) {
+                return;
+            }
+            job = queue.front();
+            queue.pop_front();
+        }
+
+        double waitMs = millisSince(job->queuedAt);
+        {
+            lock_guard<std::mutex> lock(statsMutex);
+            peakRunning = max(peakRunning, ++running);
+        }
+        JobResult result;
+        try {
+            result = execute(engine, *job);
+        } catch (const exception& e) {
+            result.ok = false;
+            result.error = e.what();
+        }
+        {
+            lock_guard<std::mutex> lock(statsMutex);
+            --running;
+        }
+        result.waitMs = waitMs;
+        record(result, waitMs + result.runMs);
+        job->result.set_value(result);
+    }
+}
+
+FeatureServer::JobResult FeatureServer::execute(mfe::Context& engine, const Job& job) {
+    auto start = steady_clock::now();
+
+    if (job.inputFrame) {
+        const SharedFrame& in = *job.inputFrame;
+        const SharedFrame& out = *job.outputFrame;
+        compute(engine, in.data(), in.getWidth(), in.getHeight(), in.getStride(), out.data(), out.getStride());
+
+        JobResult result;
+        result.ok = true;
+        result.runMs = millisSince(start);
+        return result;
+    }
+
+    string input = resolvePath(job.input);
+    string output = resolvePath(job.output);
+
+    if (job.tileX >= 0) {
+        ImageArena::Lease tile = arena.acquire(static_cast<size_t>(tiles.getTileSize()) * tiles.getTileSize());
+        int width, height;
+        tiles.render(engine, input, job.tileX, job.tileY, tile.bytes(), width, height);
+        GreyScaleImage::saveBytes(output, tile.bytes(), width, height, options.png);
+
+        JobResult result;
+        result.ok = true;
+        result.runMs = millisSince(start);
+        return result;
+    }
+
+    // mapped formats are convolved straight from the page cache, the rest is decoded into a warm buffer
+    unique_ptr<MappedGreyImage> mapped;
+    ImageArena::Lease staged;
+    const unsigned char* pixels = nullptr;
+    int width = 0, height = 0;
+    if (detectGreyFormat(input) != GREY_FORMAT_NONE) {
+        mapped.reset(new MappedGreyImage(input));
+        pixels = mapped->pixels();
+        width = mapped->getWidth();
+        height = mapped->getHeight();
+    } else {
+        size_t offset = 0;
+        bool decoded = streamGreyRows(input,
+            [&](int w, int h) {
+                width = w;
+                height = h;
+                staged = arena.acquire(static_cast<size_t>(w) * h);
+            },
+            [&](const unsigned char* row) {
+                memcpy(staged.bytes() + offset, row, width);
+                offset += width;
+            });
+        if (!decoded) {
+            throw runtime_error("cannot read " + job.input);
+        }
+        pixels = staged.bytes();
+    }
+    if (width <= 0 || height <= 0) {
+        throw runtime_error("empty image " + job.input);
+    }
+
+    GREY_FORMAT format = isShm(job.output) ? GREY_FORMAT_RAW : greyFormatForPath(output);
+    if (format != GREY_FORMAT_NONE) {
+        MappedGreyOutput result(output, width, height, format);
+        compute(engine, pixels, width, height, width, result.pixels(), width);
+        result.finish();
+    } else {
+        ImageArena::Lease result = arena.acquire(static_cast<size_t>(width) * height);
+        compute(engine, pixels, width, height, width, result.bytes(), width);
+        GreyScaleImage::saveBytes(output, result.bytes(), width, height, options.png);
+    }
+
+    JobResult result;
+    result.ok = true;
+    result.runMs = millisSince(start);
+    return result;
+}
+
+void FeatureServer::compute(mfe::Context& engine, const unsigned char* pixels, int width, int height, size_t stride,
+                            unsigned char* output, size_t outputStride) {
+    if (!cache) {
+        engine.run(mfe_image{ pixels, width, height, stride }, mfe_output{ output, outputStride });
+        return;
+    }
+
+    // hashing the input is one pass over it, a fraction of the three convolutions it may save
+    CacheKey key = ResultCache::key(pixels, width, height, stride);
+    unique_ptr<CachedResult> hit = cache->lookup(key);
+    if (hit) {
+        for (int y = 0; y < height; ++y) {
+            memcpy(output + y * outputStride, hit->pixels() + static_cast<size_t>(y) * width, width);
+        }
+        return;
+    }
+    engine.run(mfe_image{ pixels, width, height, stride }, mfe_output{ output, outputStride });
+    cache->store(key, output, outputStride);
+}
+
+void FeatureServer::record(const JobResult& result, double totalMs) {
+    lock_guard<std::mutex> lock(statsMutex);
+    if (!result.ok) {
+        ++failed;
+        return;
+    }
+    ++completed;
+    if (latencies.size() < DAEMON_LATENCY_WINDOW) {
+        latencies.push_back(totalMs);
+    } else {
+        latencies[latencyNext] = totalMs;
+    }
+    latencyNext = (latencyNext + 1) % DAEMON_LATENCY_WINDOW;
+}
+
+void FeatureServer::handleClient(int fd) {
+    string pending;
+    char buffer[4096];
+    vector<int> descriptors; // received with the request being read, closed once it is answered
+
+    // a request in progress is always answered, the stop flag is only checked between requests
+    while (!stopping.load()) {
+        pollfd ready{ fd, POLLIN, 0 };
+        int events = poll(&ready, 1, DAEMON_POLL_MS);
+        if (events < 0 && errno != EINTR) {
+            return;
+        }
+        if (events <= 0) {
+            continue;
+        }
+
+        ssize_t n = receive(fd, buffer, sizeof(buffer), descriptors);
+        if (n <= 0) {
+            closeAll(descriptors);
+            return;
+        }
+        pending.append(buffer, n);
+
+        size_t end;
+        while ((end = pending.find('\n')) != string::npos) {
+            string line = pending.substr(0, end);
+            pending.erase(0, end + 1);
+            if (!line.empty() && line.back() == '\r') {
+                line.pop_back();
+            }
+            if (line.empty()) {
+                continue;
+            }
+            string reply = handleRequest(line, descriptors);
+            closeAll(descriptors);
+            if (!sendLine(fd, reply)) {
+                return;
+            }
+        }
+    }
+    closeAll(descriptors);
+}
+
+string FeatureServer::handleRequest(const string& line, const vector<int>& descriptors) {
+    vector<string> fields = splitFields(line);
+    if (fields.empty()) {
+        return "ERR empty request";
+    }
+
+    const string& command = fields[0];
+    if (command == "RUN") {
+        if (fields.size() != 3) {
+            return "ERR usage: RUN <input> <output>";
+        }
+        auto job = make_shared<Job>();
+        job->input = fields[1];
+        job->output = fields[2];
+        return submit(job);
+    }
+    if (command == "FRAME") {
+        return submitFrame(fields, descriptors);
+    }
+    if (command == "TILE") {
+        if (fields.size() != 5) {
+            return "ERR usage: TILE <input> <tx> <ty> <output>";
+        }
+        auto job = make_shared<Job>();
+        job->input = fields[1];
+        job->output = fields[4];
+        try {
+            job->tileX = stoi(fields[2]);
+            job->tileY = stoi(fields[3]);
+        } catch (const logic_error&) {
+            return "ERR bad TILE arguments";
+        }
+        if (job->tileX < 0 || job->tileY < 0) {
+            return "ERR bad TILE arguments";
+        }
+        return submit(job);
+    }
+    if (command == "STATS") {
+        return stats();
+    }
+    if (command == "PING") {
+        return "PONG";
+    }
+    if (command == "SHUTDOWN") {
+        requestStop();
+        return "BYE";
+    }
+    return "ERR unknown command " + command;
+}
+
+string FeatureServer::submitFrame(const vector<string>& fields, const vector<int>& descriptors) {
+    if (fields.size() != 6 && fields.size() != 7) {
+        return "ERR usage: FRAME <input> <width> <height> <stride> <output> [<output-stride>]";
+    }
+
+    // the segments are mapped here, so a bad handle or a short segment is refused before queueing
+    auto job = make_shared<Job>();
+    try {
+        int width = stoi(fields[2]);
+        int height = stoi(fields[3]);
+        size_t stride = stoull(fields[4]);
+        size_t outputStride = fields.size() == 7 ? stoull(fields[6]) : static_cast<size_t>(width);
+        job->input = fields[1];
+        job->output = fields[5];
+        job->inputFrame = openFrame(fields[1], descriptors, width, height, stride, false);
+        job->outputFrame = openFrame(fields[5], descriptors, width, height, outputStride, true);
+    } catch (const logic_error&) {
+        return "ERR bad FRAME arguments";
+    } catch (const exception& e) {
+        return string("ERR ") + e.what();
+    }
+    return submit(job);
+}
+
+string FeatureServer::submit(shared_ptr<Job> job) {
+    future<JobResult> pending = job->result.get_future();
+
+    // admission: a full queue is answered at once so callers can back off instead of piling up
+    {
+        lock_guard<std::mutex> lock(queueMutex);
+        if (draining || stopping.load()) {
+            return "ERR shutting down";
+        }
+        if (static_cast<int>(queue.size()) >= options.queueDepth) {
+            size_t queued = queue.size();
+            lock_guard<std::mutex> statsLock(statsMutex);
+            ++rejected;
+            return "BUSY " + to_string(queued) + " " + to_string(options.queueDepth);
+        }
+        job->queuedAt = steady_clock::now();
+        queue.push_back(job);
+    }
+    queueReady.notify_one();
+
+    JobResult result = pending.get();
+    if (!result.ok) {
+        return "ERR " + result.error;
+    }
+    ostringstream reply;
+    reply << fixed << setprecision(2) << "OK " << result.waitMs << " " << result.runMs;
+    return reply.str();
+}
+
+string FeatureServer::stats() {
+    vector<double> window;
+    long long jobs, busy, errors;
+    int active, peak;
+    {
+        lock_guard<std::mutex> lock(statsMutex);
+        active = running;
+        peak = peakRunning;
+        window = latencies;
+        jobs = completed;
+        busy = rejected;
+        errors = failed;
+    }
+    size_t queued;
+    {
+        lock_guard<std::mutex> lock(queueMutex);
+        queued = queue.size();
+    }
+
+    sort(window.begin(), window.end());
+    auto percentile = [&](double p) {
+        if (window.empty()) {
+            return 0.0;
+        }
+        size_t rank = static_cast<size_t>(ceil(p * window.size()));
+        return window[max<size_t>(rank, 1) - 1];
+    };
+
+    ostringstream reply;
+    reply << fixed << setprecision(2)
+          << "STATS jobs=" << jobs
+          << " rejected=" << busy
+          << " failed=" << errors
+          << " queued=" << queued
+          << " running=" << active
+          << " peak_running=" << peak
+          << " p50=" << percentile(0.50)
+          << " p99=" << percentile(0.99)
+          << " arena_hits=" << arena.getHits()
+          << " arena_misses=" << arena.getMisses()
+          << " arena_cached_mb=" << (arena.getCachedBytes() >> 20);
+    if (cache) {
+        reply << " cache_hits=" << cache->getHits()
+              << " cache_misses=" << cache->getMisses()
+              << " cache_evictions=" << cache->getEvictions()
+              << " cache_mb=" << (cache->getBytes() >> 20);
+    }
+    return reply.str();
+}
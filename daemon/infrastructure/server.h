@@ -0,0 +1,152 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../helpers/png_writer.h"
+#include "../helpers/result_cache.h"
+#include "mfe.h"
+#include "image_arena.h"
+#include "shared_frame.h"
+#include "tile_sources.h"
+
+#define DAEMON_DEFAULT_SOCKET "/tmp/mfe.sock"
+#define DAEMON_DEFAULT_QUEUE 16
+#define DAEMON_DEFAULT_CLIENTS 64
+#define DAEMON_DEFAULT_ARENA_MB 1024
+#define DAEMON_DEFAULT_CACHE_MB 4096
+#define DAEMON_DEFAULT_TILE_SIZE 256
+#define DAEMON_DEFAULT_TILE_CACHE 1024
+// images kept open for TILE requests
+#define DAEMON_TILE_SOURCES 16
+// recent job latencies kept for the percentiles of STATS
+#define DAEMON_LATENCY_WINDOW 4096
+
+struct DaemonOptions {
+    std::string socketPath = DAEMON_DEFAULT_SOCKET;
+    int workers = 1;                          // jobs processed at the same time, each on its own context and pool
+    int threads = 0;                          // pool threads of every worker (0 = one per hardware thread)
+    int queueDepth = DAEMON_DEFAULT_QUEUE;    // jobs waiting for a worker before RUN is answered BUSY
+    int maxClients = DAEMON_DEFAULT_CLIENTS;  // open connections before new ones are answered BUSY
+    size_t arenaBytes = (size_t)DAEMON_DEFAULT_ARENA_MB << 20; // idle buffers kept between jobs
+    PngOptions png;                           // how PNG results are encoded
+    std::string cacheDir;                     // result cache directory, none when empty
+    size_t cacheBytes = (size_t)DAEMON_DEFAULT_CACHE_MB << 20; // result cache budget on disk
+    int tileSize = DAEMON_DEFAULT_TILE_SIZE;  // edge of the tiles TILE addresses
+    size_t tileCache = DAEMON_DEFAULT_TILE_CACHE; // raw tiles kept per open image
+};
+
+/*
+    feature-extraction service on a UNIX stream socket: workers, each with a libmfe context (warm
+    thread pool and scratch layers), take jobs from a bounded queue and borrow their image buffers
+    from a shared ImageArena, so a job only pays for the convolutions and not for process start,
+    thread creation or page faults
+
+    one request per line, fields separated by tabs when the line has one (paths with spaces),
+    by spaces otherwise:
+        RUN <input> <output>   -> OK <wait-ms> <run-ms> | BUSY <queued> <limit> | ERR <message>
+        FRAME <input> <width> <height> <stride> <output> [<output-stride>]
+                               -> same replies as RUN
+        TILE <input> <tx> <ty> <output>
+                               -> same replies as RUN
+        STATS                  -> STATS jobs=.. rejected=.. failed=.. queued=.. p50=.. p99=.. ...
+        PING                   -> PONG
+        SHUTDOWN               -> BYE, then queued jobs are finished and the daemon exits
+    shm:<name> stands for /dev/shm/<name> holding a headered raw image (see RAW_MAGIC); mapped
+    inputs (raw, PGM) are read in place and mapped outputs are written in place
+
+    FRAME takes raw 8-bit frames in shared memory, as co-located producers already hold them:
+    <input> and <output> are shm:<name> (a POSIX shm segment) or fd:<i>, the i-th descriptor
+    sent with the request as SCM_RIGHTS ancillary data (a memfd, say); the input is convolved
+    where it lies and the feature map is quantized straight into the caller's output segment,
+    nothing is encoded, decoded or copied
+
+    TILE renders one output tile on demand (TileSources): only its input region and the halo of
+    the kernels are read, normalized with a per-image layer summary computed by the first TILE
+    of an image (and kept in the cache directory, when there is one)
+
+    with a cache directory, every decoded input is hashed first and a result computed before, by
+    this daemon or an earlier one, is copied out of the ResultCache instead of running the layers
+*/
+class FeatureServer {
+public:
+    explicit FeatureServer(const DaemonOptions& options);
+    ~FeatureServer();
+
+    FeatureServer(const FeatureServer&) = delete;
+    FeatureServer& operator=(const FeatureServer&) = delete;
+
+    // binds the socket and serves until SHUTDOWN or requestStop(), throws runtime_error if it cannot bind
+    void serve();
+
+    // async-signal-safe: makes serve() drain and return
+    void requestStop() { stopping.store(true); }
+
+private:
+    struct JobResult {
+        bool ok = false;
+        std::string error;
+        double waitMs = 0.0;
+        double runMs = 0.0;
+    };
+
+    struct Job {
+        std::string input;
+        std::string output;
+        std::unique_ptr<SharedFrame> inputFrame;  // set for FRAME jobs, input / output unused then
+        std::unique_ptr<SharedFrame> outputFrame;
+        int tileX = -1;                           // set for TILE jobs
+        int tileY = -1;
+        std::chrono::steady_clock::time_point queuedAt;
+        std::promise<JobResult> result;
+    };
+
+    struct Connection {
+        std::thread thread;
+        std::shared_ptr<std::atomic<bool>> finished;
+    };
+
+    DaemonOptions options;
+    ImageArena arena;
+    std::unique_ptr<ResultCache> cache;
+    TileSources tiles;
+    std::atomic<bool> stopping{false};
+    int listenFd = -1;
+
+    std::mutex queueMutex;
+    std::condition_variable queueReady;
+    std::deque<std::shared_ptr<Job>> queue;
+    bool draining = false;
+    std::vector<std::thread> workers;
+
+    std::vector<Connection> connections;
+
+    std::mutex statsMutex;
+    long long completed = 0;
+    long long rejected = 0;
+    long long failed = 0;
+    int running = 0;     // jobs in a worker right now
+    int peakRunning = 0; // most jobs ever in workers at once, shows whether the workers overlap
+    std::vector<double> latencies; // ring of the last DAEMON_LATENCY_WINDOW totals, in ms
+    size_t latencyNext = 0;
+
+    void workerLoop();
+    JobResult execute(mfe::Context& engine, const Job& job);
+    void compute(mfe::Context& engine, const unsigned char* pixels, int width, int height, size_t stride,
+                 unsigned char* output, size_t outputStride);
+    void record(const JobResult& result, double totalMs);
+
+    void handleClient(int fd);
+    std::string handleRequest(const std::string& line, const std::vector<int>& descriptors);
+    std::string submit(std::shared_ptr<Job> job);
+    std::string submitFrame(const std::vector<std::string>& fields, const std::vector<int>& descriptors);
+    std::string stats();
+
+    void reapConnections(bool all);
+};
@@ -0,0 +1,73 @@
+#include "shared_frame.h"
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+SharedFrame::SharedFrame(int fd, int width, int height, size_t stride, bool writable)
+    : width(width), height(height), stride(stride) {
+    map(fd, "descriptor " + to_string(fd), writable);
+}
+
+SharedFrame::SharedFrame(const string& name, int width, int height, size_t stride, bool writable)
+    : width(width), height(height), stride(stride) {
+    string shmName = (!name.empty() && name[0] == '/') ? name : "/" + name;
+    int fd = shm_open(shmName.c_str(), writable ? O_RDWR : O_RDONLY, 0);
+    if (fd < 0) {
+        throw runtime_error("Cannot open shared memory " + shmName + ": " + strerror(errno));
+    }
+    try {
+        map(fd, shmName, writable);
+    } catch (...) {
+        close(fd);
+        throw;
+    }
+    // the mapping keeps the segment alive
+    close(fd);
+}
+
+SharedFrame::~SharedFrame() {
+    if (base) {
+        munmap(base, length);
+    }
+}
+
+size_t SharedFrame::requiredBytes(int width, int height, size_t stride) {
+    return (static_cast<size_t>(height) - 1) * stride + width;
+}
+
+void SharedFrame::map(int fd, const string& what, bool writable) {
+    // the last row ends at (height - 1) * stride + width, which must not wrap
+    if (width <= 0 || height <= 0 || stride < static_cast<size_t>(width)
+        || static_cast<size_t>(height) - 1 > (SIZE_MAX - width) / stride) {
+        throw runtime_error("Invalid frame geometry for " + what);
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) < 0) {
+        throw runtime_error("Cannot stat " + what + ": " + strerror(errno));
+    }
+    if (stride > static_cast<size_t>(info.st_size)) {
+        throw runtime_error("Stride " + to_string(stride) + " is larger than shared segment " + what + " ("
+                            + to_string(info.st_size) + " bytes)");
+    }
+    length = requiredBytes(width, height, stride);
+    if (static_cast<size_t>(info.st_size) < length) {
+        throw runtime_error("Shared segment " + what + " holds " + to_string(info.st_size)
+                            + " bytes, the frame needs " + to_string(length));
+    }
+
+    int protection = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+    void* mapping = mmap(nullptr, length, protection, MAP_SHARED, fd, 0);
+    if (mapping == MAP_FAILED) {
+        length = 0;
+        throw runtime_error("Cannot map " + what + ": " + strerror(errno));
+    }
+    base = static_cast<unsigned char*>(mapping);
+}
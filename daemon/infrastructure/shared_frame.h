@@ -0,0 +1,44 @@
+#pragma once
+#include <cstddef>
+#include <string>
+
+/*
+    an 8-bit greyscale frame living in a shared-memory segment (POSIX shm or memfd) owned by
+    another process, mapped in place: rows are stride bytes apart and only the first width bytes
+    of each are pixels, so producers can hand over their capture buffers as they are
+*/
+class SharedFrame {
+public:
+    /*
+        maps a segment received as a descriptor, the descriptor stays owned by the caller
+        @param writable: map for writing (outputs), read-only otherwise
+        throws runtime_error when the segment cannot be mapped, is smaller than the frame or than
+        one stride, or when the frame's extent does not fit in a size_t
+    */
+    SharedFrame(int fd, int width, int height, size_t stride, bool writable);
+
+    // same for a POSIX shm name ("frame" or "/frame")
+    SharedFrame(const std::string& name, int width, int height, size_t stride, bool writable);
+
+    ~SharedFrame();
+
+    SharedFrame(const SharedFrame&) = delete;
+    SharedFrame& operator=(const SharedFrame&) = delete;
+
+    unsigned char* data() const { return base; }
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+    size_t getStride() const { return stride; }
+
+    // bytes a frame of these dimensions needs in its segment, for a geometry map accepted
+    static size_t requiredBytes(int width, int height, size_t stride);
+
+private:
+    unsigned char* base = nullptr;
+    size_t length = 0;
+    int width = 0;
+    int height = 0;
+    size_t stride = 0;
+
+    void map(int fd, const std::string& what, bool writable);
+};
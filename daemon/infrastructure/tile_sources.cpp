@@ -0,0 +1,95 @@
+#include "tile_sources.h"
+#include "image_source.h"
+#include "../helpers/result_cache.h"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+
+using namespace std;
+
+TileSources::TileSources(int tileSize, size_t cacheTiles, size_t capacity, const string& summaryDirectory)
+    : tileSize(tileSize), cacheTiles(cacheTiles), capacity(max<size_t>(1, capacity)),
+      summaryDirectory(summaryDirectory) {}
+
+shared_ptr<TileSources::Source> TileSources::open(mfe::Context& engine, const string& input) {
+    // a rewritten file gets a new key, so neither its tiles nor its summary are stale
+    error_code error;
+    auto size = filesystem::file_size(input, error);
+    if (error) {
+        throw runtime_error("cannot read " + input);
+    }
+    auto modified = filesystem::last_write_time(input, error).time_since_epoch().count();
+    string key = input + "\t" + to_string(size) + "\t" + to_string(modified);
+
+    shared_ptr<Source> source;
+    {
+        lock_guard<std::mutex> lock(sourcesMutex);
+        shared_ptr<Source>& slot = sources[key];
+        if (!slot) {
+            slot = make_shared<Source>();
+        }
+        source = slot;
+        source->lastUse = ++useClock;
+
+        // a closed image stays alive for the requests still rendering from it
+        while (sources.size() > capacity) {
+            auto oldest = min_element(sources.begin(), sources.end(), [](const auto& a, const auto& b) {
+                return a.second->lastUse < b.second->lastUse;
+            });
+            sources.erase(oldest);
+        }
+    }
+
+    lock_guard<std::mutex> lock(source->ready);
+    if (source->tiles) {
+        return source;
+    }
+
+    unique_ptr<GreyScaleImage> image(new GreyScaleImage(input));
+    if (image->getWidth() <= 0) {
+        throw runtime_error("cannot read " + input);
+    }
+    mfe_source region = imageSource(*image);
+
+    string summaryPath;
+    if (!summaryDirectory.empty()) {
+        char name[32];
+        snprintf(name, sizeof(name), "%016llx.mfs", static_cast<unsigned long long>(hash64(key.data(), key.size(), 0)));
+        summaryPath = (filesystem::path(summaryDirectory) / name).string();
+    }
+    mfe_summary summary;
+    if (summaryPath.empty() || !loadSummary(summaryPath, region.width, region.height, summary)) {
+        if (mfe_summarize(engine.get(), &region, tileSize, &summary) != MFE_OK) {
+            throw runtime_error(mfe_last_error(engine.get()));
+        }
+        if (!summaryPath.empty()) {
+            filesystem::create_directories(summaryDirectory, error);
+            saveSummary(summaryPath, region.width, region.height, summary);
+        }
+    }
+
+    mfe_tiles* tiles = nullptr;
+    if (mfe_tiles_create(&region, &summary, tileSize, cacheTiles, &tiles) != MFE_OK) {
+        throw runtime_error("cannot create the tiles of " + input);
+    }
+    source->image = move(image);
+    source->tiles = tiles;
+    return source;
+}
+
+void TileSources::render(mfe::Context& engine, const string& input, int tx, int ty, unsigned char* output,
+                         int& width, int& height) {
+    shared_ptr<Source> source = open(engine, input);
+    width = min(tileSize, source->image->getWidth() - tx * tileSize);
+    height = min(tileSize, source->image->getHeight() - ty * tileSize);
+    if (width <= 0 || height <= 0 || tx < 0 || ty < 0) {
+        throw runtime_error("tile " + to_string(tx) + "," + to_string(ty) + " is outside " + input);
+    }
+
+    // rows are written packed, the output stride is the tile width
+    mfe_output out{ output, static_cast<size_t>(width) };
+    if (mfe_tiles_render(engine.get(), source->tiles, tx, ty, &out) != MFE_OK) {
+        throw runtime_error(mfe_last_error(engine.get()));
+    }
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include "mfe.h"
+#include "../helpers/image.h"
+
+/*
+    images opened by TILE requests, kept between requests: the input stays open (a tiled
+    container only holds its index), its layer summary is computed by the first request or read
+    from the summary directory, and its tile set keeps the raw last layer of recent tiles; an
+    image is reopened when its file changes, the least recently used are closed beyond capacity
+*/
+class TileSources {
+public:
+    /*
+        @param cacheTiles: raw tiles kept per image
+        @param capacity: images kept open
+        @param summaryDirectory: where summaries are kept across restarts, none when empty
+    */
+    TileSources(int tileSize, size_t cacheTiles, size_t capacity, const std::string& summaryDirectory);
+
+    TileSources(const TileSources&) = delete;
+    TileSources& operator=(const TileSources&) = delete;
+
+    /*
+        renders tile (tx, ty) of input on the worker's context, throws runtime_error on failure
+        @param output: at least tileSize * tileSize bytes, filled with width * height packed rows
+    */
+    void render(mfe::Context& engine, const std::string& input, int tx, int ty, unsigned char* output,
+                int& width, int& height);
+
+    int getTileSize() const { return tileSize; }
+
+private:
+    struct Source {
+        std::mutex ready; // held while the first request opens and summarizes the image
+        std::unique_ptr<GreyScaleImage> image;
+        mfe_tiles* tiles = nullptr;
+        unsigned long long lastUse = 0;
+
+        ~Source() { mfe_tiles_destroy(tiles); }
+    };
+
+    int tileSize;
+    size_t cacheTiles;
+    size_t capacity;
+    std::string summaryDirectory;
+
+    std::mutex sourcesMutex;
+    std::map<std::string, std::shared_ptr<Source>> sources; // by path, size and modification time
+    unsigned long long useClock = 0;
+
+    std::shared_ptr<Source> open(mfe::Context& engine, const std::string& input);
+};
@@ -0,0 +1,48 @@
+#include "batch_inputs.h"
+#include <algorithm>
+#include <cctype>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+namespace fs = std::filesystem;
+
+static bool isImageExtension(std::string ext) {
+    std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+    return ext == ".png" || ext == ".jpg" || ext == ".jpeg" || ext == ".bmp" || ext == ".tga" ||
+           ext == ".pgm" || ext == ".ppm" || ext == ".raw" || ext == ".gray" || ext == ".mft";
+}
+
+std::vector<std::string> listBatchInputs(const std::string& inputs) {
+    std::vector<std::string> paths;
+
+    // a directory is scanned for images, anything else is read as a manifest with one path per line
+    if (fs::is_directory(inputs)) {
+        for (const auto& entry : fs::directory_iterator(inputs)) {
+            if (entry.is_regular_file() && isImageExtension(entry.path().extension().string())) {
+                paths.push_back(entry.path().string());
+            }
+        }
+        std::sort(paths.begin(), paths.end());
+        return paths;
+    }
+
+    std::ifstream manifest(inputs);
+    if (!manifest) {
+        std::cerr << "Cannot open batch input: " << inputs << std::endl;
+        return paths;
+    }
+
+    std::string line;
+    while (std::getline(manifest, line)) {
+        line.erase(line.find_last_not_of(" \t\r") + 1);
+        if (!line.empty() && line[0] != '#') {
+            paths.push_back(line);
+        }
+    }
+    return paths;
+}
+
+std::string batchOutputPath(const std::string& outputDir, const std::string& inputPath) {
+    return (fs::path(outputDir) / fs::path(inputPath).filename()).replace_extension(".png").string();
+}
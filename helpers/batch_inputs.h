@@ -0,0 +1,14 @@
+#pragma once
+#include <string>
+#include <vector>
+
+/*
+    lists the images of a batch run
+    @param inputs: a directory, scanned (not recursively) for image files and sorted by name,
+                   or a manifest with one path per line ('#' starts a comment line)
+    @return the image paths, empty when the manifest cannot be opened (reported on stderr)
+*/
+std::vector<std::string> listBatchInputs(const std::string& inputs);
+
+// output path of a batch input: same file name in outputDir, with a .png extension
+std::string batchOutputPath(const std::string& outputDir, const std::string& inputPath);
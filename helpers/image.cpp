@@ -1,16 +1,18 @@
 #include "image.h"
+#include "png_reader.h"
+#include "thread_pool.h"
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <stdexcept>
 
 #define STB_IMAGE_IMPLEMENTATION
-#define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb/stb_image.h"
-#include "stb/stb_image_write.h"
 
 GreyScaleImage::GreyScaleImage() = default;
 
-GreyScaleImage::GreyScaleImage(const std::string& filename) {
-    load(filename);
+GreyScaleImage::GreyScaleImage(const std::string& filename, int threads) {
+    load(filename, previewFactor(), threads);
 }
 
 GreyScaleImage::~GreyScaleImage() {
@@ -18,62 +20,280 @@ GreyScaleImage::~GreyScaleImage() {
         stbi_image_free(data);
 }
 
-bool GreyScaleImage::load(const std::string& filename) {
+void GreyScaleImage::releaseInput() {
+    if (data) {
+        stbi_image_free(data);
+        data = nullptr;
+    }
+    mapped.reset();
+    tiled.reset();
+    pixelsReady = true;
+}
+
+bool GreyScaleImage::load(const std::string& filename, int preview, int threads) {
+    poolThreads = threads;
+    // a preview never needs the full-size doubles, only the bytes it is averaged from
+    if (!loadSource(filename, preview <= 1)) {
+        return false;
+    }
+    if (preview > 1) {
+        shrink(preview);
+    }
+    return true;
+}
+
+void GreyScaleImage::shrink(int factor) {
+    const unsigned char* bytes = getBytes();
+    int smallWidth = previewSize(width, factor);
+    int smallHeight = previewSize(height, factor);
+
+    // malloc, so the destructor can release it like stb's buffers
+    unsigned char* small = static_cast<unsigned char*>(malloc(static_cast<size_t>(smallWidth) * smallHeight));
+    boxDownsample(bytes, width, height, width, factor, small, poolThreads);
+    releaseInput();
+    data = small;
+    width = smallWidth;
+    height = smallHeight;
+    pixels.clear();
+    pixelsReady = false;
+}
+
+bool GreyScaleImage::loadSource(const std::string& filename, bool keepDoubles) {
+    releaseInput();
+    channels = CHANNELS;
+
+    // uncompressed inputs need no decode: keep the mapping, doubles are built when asked for
+    if (detectGreyFormat(filename) != GREY_FORMAT_NONE) {
+        try {
+            mapped = std::make_unique<MappedGreyImage>(filename);
+        } catch (const std::runtime_error& e) {
+            std::cerr << e.what() << std::endl;
+            return false;
+        }
+        width = mapped->getWidth();
+        height = mapped->getHeight();
+        pixels.clear();
+        pixelsReady = false;
+        return true;
+    }
+
+    // tiled inputs keep only the index until pixels are needed, then decode tile-parallel
+    if (isTiledImage(filename)) {
+        try {
+            tiled = std::make_unique<TiledImageReader>(filename);
+        } catch (const std::runtime_error& e) {
+            std::cerr << e.what() << std::endl;
+            return false;
+        }
+        width = tiled->getWidth();
+        height = tiled->getHeight();
+        pixels.clear();
+        pixelsReady = false;
+        return true;
+    }
+
+    // greyscale PNGs are decoded row by row, each row converted to doubles while still in cache
+    bool decoded = readGreyscalePng(filename, width, height, [this, keepDoubles](int y, const unsigned char* row) {
+        if (y == 0) {
+            // malloc, so the destructor can release it like stb's buffers
+            data = static_cast<unsigned char*>(malloc(static_cast<size_t>(width) * height));
+            if (keepDoubles) {
+                pixels.assign(height, std::vector<double>(width));
+            }
+        }
+        memcpy(data + static_cast<size_t>(y) * width, row, width);
+        if (!keepDoubles) {
+            return;
+        }
+
+        double* out = pixels[y].data();
+        for (int x = 0; x < width; ++x) {
+            out[x] = row[x];
+        }
+    });
+    if (decoded) {
+        return true;
+    }
+
+    // anything else (colour, 16-bit, interlaced, other formats) goes through stb
+    if (data) {
+        stbi_image_free(data);
+    }
+
     int w, h, c;
     data = stbi_load(filename.c_str(), &w, &h, &c, CHANNELS);
     if (!data) {
+        // a PNG that failed half way already set the size from its header
+        width = 0;
+        height = 0;
+        pixels.clear();
         std::cerr << "Failed to load image: " << filename << std::endl;
         return false;
     }
 
     width = w;
     height = h;
-    channels = CHANNELS;
+    if (!keepDoubles) {
+        pixels.clear();
+        pixelsReady = false;
+        return true;
+    }
 
     pixels.assign(height, std::vector<double>(width, 0));
     for (int y = 0; y < height; ++y) {
         for (int x = 0; x < width; ++x) {
-            pixels[y][x] = static_cast<double>(data[y * width + x]);
+            pixels[y][x] = static_cast<double>(data[static_cast<size_t>(y) * width + x]);
         }
     }
 
     return true;
 }
 
-void GreyScaleImage::setMatrix(const std::vector<std::vector<double>>& matrix) {
-    pixels = matrix;
-    height = static_cast<int>(matrix.size());
-    width = height > 0 ? static_cast<int>(matrix[0].size()) : 0;
+// header of the file itself, before any preview
+static bool probeSource(const std::string& filename, int& width, int& height) {
+    if (detectGreyFormat(filename) != GREY_FORMAT_NONE) {
+        try {
+            MappedGreyImage header(filename);
+            width = header.getWidth();
+            height = header.getHeight();
+            return true;
+        } catch (const std::runtime_error&) {
+            return false;
+        }
+    }
 
-    if (data) {
-        stbi_image_free(data);
+    if (isTiledImage(filename)) {
+        try {
+            TiledImageReader header(filename);
+            width = header.getWidth();
+            height = header.getHeight();
+            return true;
+        } catch (const std::runtime_error&) {
+            return false;
+        }
     }
 
-    data = new unsigned char[width * height * channels];
-    for (int y = 0; y < height; ++y) {
+    int c;
+    return stbi_info(filename.c_str(), &width, &height, &c) != 0;
+}
+
+bool GreyScaleImage::probe(const std::string& filename, int& width, int& height) {
+    if (!probeSource(filename, width, height)) {
+        return false;
+    }
+    width = previewSize(width, previewFactor());
+    height = previewSize(height, previewFactor());
+    return true;
+}
+
+void GreyScaleImage::decodeTiles() const {
+    if (!tiled) {
+        return;
+    }
+
+    // malloc, so the destructor can release it like stb's buffers
+    data = static_cast<unsigned char*>(malloc(static_cast<size_t>(width) * height));
+    tiled->readRegion(0, 0, width, height, data, poolThreads);
+    tiled.reset();
+}
+
+void GreyScaleImage::materialize() const {
+    if (pixelsReady) {
+        return;
+    }
+
+    const unsigned char* bytes = getBytes();
+    pixels.assign(height, std::vector<double>(width));
+    ThreadPool::sharedFor(height, [&](int y) {
+        const unsigned char* row = bytes + static_cast<size_t>(y) * width;
+        double* out = pixels[y].data();
         for (int x = 0; x < width; ++x) {
-            data[y * width + x] = static_cast<unsigned char>(pixels[y][x]);
+            out[x] = row[x];
         }
+    }, poolThreads);
+    pixelsReady = true;
+}
+
+const unsigned char* GreyScaleImage::getBytes() const {
+    decodeTiles();
+    return mapped ? mapped->pixels() : data;
+}
+
+const TiledImageReader* GreyScaleImage::getTiledInput() const {
+    return tiled.get();
+}
+
+void GreyScaleImage::setMatrix(const std::vector<std::vector<double>>& matrix) {
+    releaseInput();
+    height = static_cast<int>(matrix.size());
+    width = height > 0 ? static_cast<int>(matrix[0].size()) : 0;
+
+    // malloc, so the destructor can release it like stb's buffers
+    data = static_cast<unsigned char*>(malloc(static_cast<size_t>(width) * height * channels));
+    bool copy = (&matrix != &pixels);
+    if (copy) {
+        pixels.resize(height);
     }
+    Quantizer truncate;
+    ThreadPool::sharedFor(height, [&](int y) {
+        if (copy) {
+            pixels[y] = matrix[y];
+        }
+        quantizeRow(pixels[y].data(), width, data + static_cast<size_t>(y) * width, truncate);
+    }, poolThreads);
 }
 
-void GreyScaleImage::save(const std::string& filename) const {
-    if (!data) {
+void GreyScaleImage::setQuantizedMatrix(const std::vector<std::vector<double>>& matrix, const Quantizer& quantizer) {
+    releaseInput();
+    height = static_cast<int>(matrix.size());
+    width = height > 0 ? static_cast<int>(matrix[0].size()) : 0;
+
+    data = static_cast<unsigned char*>(malloc(static_cast<size_t>(width) * height * channels));
+    quantizeRows(matrix, data, quantizer, poolThreads);
+    pixels.clear();
+    pixelsReady = false;
+}
+
+void GreyScaleImage::save(const std::string& filename, const PngOptions& options) const {
+    const unsigned char* bytes = getBytes();
+    if (!bytes) {
         throw std::runtime_error("No image data to save.");
     }
 
-    if (!stbi_write_png(filename.c_str(), width, height, channels, data, width * channels)) {
-        throw std::runtime_error("Failed to save image: " + filename);
+    saveBytes(filename, bytes, width, height, options);
+}
+
+void GreyScaleImage::saveBytes(const std::string& filename, const unsigned char* pixels, int width, int height,
+                               const PngOptions& options) {
+    GREY_FORMAT format = greyFormatForPath(filename);
+    if (format != GREY_FORMAT_NONE) {
+        writeMappedGrey(filename, pixels, width, height, format);
+        return;
     }
+    if (isTiledPath(filename)) {
+        TiledOptions tiledOptions;
+        tiledOptions.threads = options.threads;
+        writeTiledImage(filename, pixels, width, height, tiledOptions);
+        return;
+    }
+
+    writePng(filename, pixels, width, height, options);
 }
 
 const std::vector<std::vector<double>>& GreyScaleImage::getMatrix() const {
+    materialize();
     return pixels;
 }
 
 const std::vector<double> GreyScaleImage::getFlattenedMatrix() const {
+    // mapped and tiled inputs flatten straight from the bytes, without building the rows first
+    if (!pixelsReady) {
+        const unsigned char* bytes = getBytes();
+        return std::vector<double>(bytes, bytes + static_cast<size_t>(width) * height);
+    }
+
     std::vector<double> flatMatrix;
-    flatMatrix.reserve(width * height);
+    flatMatrix.reserve(static_cast<size_t>(width) * height);
     for (const auto& row : pixels) {
         flatMatrix.insert(flatMatrix.end(), row.begin(), row.end());
     }
@@ -81,24 +301,25 @@ const std::vector<double> GreyScaleImage::getFlattenedMatrix() const {
 }
 
 void GreyScaleImage::setFlattenedMatrix(const std::vector<double>& flatMatrix) {
+    releaseInput();
 
-    pixels.assign(height, std::vector<double>(width, 0));
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
-            pixels[y][x] = flatMatrix[y * width + x];
-        }
-    }
+    data = static_cast<unsigned char*>(malloc(static_cast<size_t>(width) * height * channels));
+    pixels.resize(height);
+    Quantizer truncate;
+    ThreadPool::sharedFor(height, [&](int y) {
+        size_t offset = static_cast<size_t>(y) * width;
+        pixels[y].assign(flatMatrix.begin() + offset, flatMatrix.begin() + offset + width);
+        quantizeRow(pixels[y].data(), width, data + offset, truncate);
+    }, poolThreads);
+}
 
-    if (data) {
-        stbi_image_free(data);
-    }
+void GreyScaleImage::setQuantizedFlattenedMatrix(const std::vector<double>& flatMatrix, const Quantizer& quantizer) {
+    releaseInput();
 
-    data = new unsigned char[width * height * channels];
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
-            data[y * width + x] = static_cast<unsigned char>(pixels[y][x]);
-        }
-    }
+    data = static_cast<unsigned char*>(malloc(static_cast<size_t>(width) * height * channels));
+    quantizeImage(flatMatrix.data(), width, height, data, quantizer, poolThreads);
+    pixels.clear();
+    pixelsReady = false;
 }
 
 int GreyScaleImage::getWidth() const {
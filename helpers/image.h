@@ -3,6 +3,12 @@
 #include <vector>
 #include <iostream>
 #include <stdexcept>
+#include <memory>
+#include "png_writer.h"
+#include "mapped_image.h"
+#include "quantize.h"
+#include "tiled_image.h"
+#include "preview.h"
 
 #define CHANNELS 1
 
@@ -16,8 +22,9 @@ public:
     /*
         constructor that loads an image from a file using stb_image library
         @param filename: path to the image file
+        @param threads: see load
     */
-    GreyScaleImage(const std::string& filename);
+    GreyScaleImage(const std::string& filename, int threads = 0);
 
     /*
         destructor to free image data
@@ -25,31 +32,100 @@ public:
     ~GreyScaleImage();
 
     /*
-        loads an image from a file
+        loads an image from a file, binary PGM and headered raw files are memory mapped and
+        only converted to doubles when getMatrix / getFlattenedMatrix is first called,
+        tiled containers (.mft) only read their index until pixels are first asked for
         @param filename: path to the image file
+        @param preview: box-downsampling factor applied on load (see preview.h), 1 keeps the image as it is
+        @param threads: threads of the shared pool this image uses from now on, to decode tiles,
+                        downsample, convert and quantize (0 = the whole pool, 1 = the calling thread
+                        only, which never starts the pool); save takes its own in PngOptions
         @return true if loading is successful, false otherwise
     */
-    bool load(const std::string& filename);
+    bool load(const std::string& filename, int preview = previewFactor(), int threads = 0);
 
+    /*
+        reads only the header of an image file
+        @param filename: path to the image file
+        @param width, height: filled with the image dimensions, as load would give them in preview mode
+        @return true if the header could be read, false otherwise
+    */
+    static bool probe(const std::string& filename, int& width, int& height);
 
+
+    /*
+        replaces the image, rows are copied and truncated to bytes by the same task on the
+        shared thread pool (threads as given to load) while they are still in cache
+    */
     void setMatrix(const std::vector<std::vector<double>>& matrix);
 
     const std::vector<std::vector<double>>& getMatrix() const;
 
+    // same as setMatrix for a flattened image of the current width and height
     void setFlattenedMatrix(const std::vector<double>& flatMatrix);
 
     const std::vector<double> getFlattenedMatrix() const;
 
-    void save(const std::string& filename) const;
+    /*
+        replaces the image with quantized values only, written in parallel straight into the
+        buffer save() encodes from; the doubles are not kept, getMatrix rebuilds them from the bytes
+        @param quantizer: normalizingQuantizer() applies the final normalization on the way, so the
+                          last layer is never normalized in place
+    */
+    void setQuantizedMatrix(const std::vector<std::vector<double>>& matrix, const Quantizer& quantizer);
+
+    // same as setQuantizedMatrix for a flattened image of the current width and height
+    void setQuantizedFlattenedMatrix(const std::vector<double>& flatMatrix, const Quantizer& quantizer);
+
+    /*
+        saves the image as a PNG, encoded in parallel (see writePng), through a mapped
+        output file when the path ends in .pgm, .raw or .gray, or as a tiled container (.mft)
+        @param filename: output path
+        @param options: compression level, filter and threads (tiled containers use the threads only),
+                        process defaults when omitted
+    */
+    void save(const std::string& filename, const PngOptions& options = defaultPngOptions()) const;
+
+    /*
+        saves 8-bit pixels that are not held by a GreyScaleImage, with the same choice of format as save
+        @param pixels: width * height bytes, row by row
+    */
+    static void saveBytes(const std::string& filename, const unsigned char* pixels, int width, int height,
+                          const PngOptions& options = defaultPngOptions());
+
+    /*
+        8-bit pixels, row by row: straight from the page cache for mapped inputs
+        @return nullptr when no image is loaded
+    */
+    const unsigned char* getBytes() const;
+
+    /*
+        reader of a tiled input that has not been decoded yet, so callers can read only the
+        regions they need instead of the whole image
+        @return nullptr for any other input
+    */
+    const TiledImageReader* getTiledInput() const;
 
     int getWidth() const;
 
     int getHeight() const;
 
 private:
-    unsigned char* data = nullptr;
+    mutable unsigned char* data = nullptr; // decoded on first use for tiled inputs
     int width = 0;
     int height = 0;
     int channels = 0;
-    std::vector<std::vector<double>> pixels;
+    std::unique_ptr<MappedGreyImage> mapped; // mapped PGM / raw input, replaces data
+    mutable std::unique_ptr<TiledImageReader> tiled; // tiled input, dropped once decoded into data
+    int poolThreads = 0; // see load
+
+    // built on first use for mapped inputs
+    mutable std::vector<std::vector<double>> pixels;
+    mutable bool pixelsReady = true;
+
+    bool loadSource(const std::string& filename, bool keepDoubles);
+    void shrink(int factor);
+    void materialize() const;
+    void decodeTiles() const;
+    void releaseInput();
 };
\ No newline at end of file
@@ -0,0 +1,197 @@
+#include "mapped_image.h"
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static void putLittleEndian(unsigned char* out, unsigned int value) {
+    out[0] = static_cast<unsigned char>(value);
+    out[1] = static_cast<unsigned char>(value >> 8);
+    out[2] = static_cast<unsigned char>(value >> 16);
+    out[3] = static_cast<unsigned char>(value >> 24);
+}
+
+static unsigned int getLittleEndian(const unsigned char* in) {
+    return static_cast<unsigned int>(in[0]) | (static_cast<unsigned int>(in[1]) << 8) |
+           (static_cast<unsigned int>(in[2]) << 16) | (static_cast<unsigned int>(in[3]) << 24);
+}
+
+// reads one decimal field of a PGM header, skipping whitespace and comments, -1 on error
+static long parsePgmField(const unsigned char* data, size_t length, size_t& pos) {
+    while (pos < length) {
+        if (data[pos] == '#') {
+            while (pos < length && data[pos] != '\n') ++pos;
+        } else if (isspace(data[pos])) {
+            ++pos;
+        } else {
+            break;
+        }
+    }
+
+    long value = 0;
+    size_t start = pos;
+    while (pos < length && isdigit(data[pos]) && value < (1L << 30)) {
+        value = value * 10 + (data[pos] - '0');
+        ++pos;
+    }
+    return pos > start ? value : -1;
+}
+
+GREY_FORMAT detectGreyFormat(const std::string& filename) {
+    FILE* file = fopen(filename.c_str(), "rb");
+    if (!file) {
+        return GREY_FORMAT_NONE;
+    }
+
+    unsigned char magic[4] = { 0, 0, 0, 0 };
+    size_t read = fread(magic, 1, sizeof(magic), file);
+    fclose(file);
+
+    if (read >= 3 && magic[0] == 'P' && magic[1] == '5' && isspace(magic[2])) {
+        return GREY_FORMAT_PGM;
+    }
+    if (read == 4 && memcmp(magic, RAW_MAGIC, 4) == 0) {
+        return GREY_FORMAT_RAW;
+    }
+    return GREY_FORMAT_NONE;
+}
+
+GREY_FORMAT greyFormatForPath(const std::string& filename) {
+    size_t dot = filename.find_last_of('.');
+    std::string extension = (dot == std::string::npos) ? "" : filename.substr(dot + 1);
+    for (auto& c : extension) {
+        c = static_cast<char>(tolower(c));
+    }
+
+    if (extension == "pgm") return GREY_FORMAT_PGM;
+    if (extension == "raw" || extension == "gray") return GREY_FORMAT_RAW;
+    return GREY_FORMAT_NONE;
+}
+
+MappedGreyImage::MappedGreyImage(const std::string& filename) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Failed to open image: " + filename);
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size <= 0) {
+        close(fd);
+        throw std::runtime_error("Failed to read image: " + filename);
+    }
+    length = static_cast<size_t>(info.st_size);
+
+    void* mapping = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        throw std::runtime_error("Failed to map image: " + filename);
+    }
+    base = static_cast<unsigned char*>(mapping);
+
+    // rows are consumed top to bottom, let the kernel read ahead aggressively
+    madvise(base, length, MADV_SEQUENTIAL);
+
+    long w = -1, h = -1;
+    if (length >= RAW_HEADER_SIZE && memcmp(base, RAW_MAGIC, 4) == 0) {
+        w = getLittleEndian(base + 4);
+        h = getLittleEndian(base + 8);
+        headerSize = RAW_HEADER_SIZE;
+    } else if (length >= 3 && base[0] == 'P' && base[1] == '5') {
+        size_t pos = 2;
+        w = parsePgmField(base, length, pos);
+        h = parsePgmField(base, length, pos);
+        long maxval = parsePgmField(base, length, pos);
+
+        // a single whitespace byte separates the header from the samples
+        if (maxval <= 0 || maxval > 255 || pos >= length || !isspace(base[pos])) {
+            w = -1;
+        }
+        headerSize = pos + 1;
+    }
+
+    if (w <= 0 || h <= 0 || w > (1L << 30) || h > (1L << 30) ||
+        headerSize + static_cast<size_t>(w) * static_cast<size_t>(h) > length) {
+        munmap(base, length);
+        base = nullptr;
+        throw std::runtime_error("Unsupported or truncated image: " + filename);
+    }
+
+    width = static_cast<int>(w);
+    height = static_cast<int>(h);
+}
+
+MappedGreyImage::~MappedGreyImage() {
+    if (base) {
+        munmap(base, length);
+    }
+}
+
+MappedGreyOutput::MappedGreyOutput(const std::string& filename, int width, int height, GREY_FORMAT format)
+    : filename(filename) {
+    char pgmHeader[64];
+    if (format == GREY_FORMAT_PGM) {
+        headerSize = static_cast<size_t>(snprintf(pgmHeader, sizeof(pgmHeader), "P5\n%d %d\n255\n", width, height));
+    } else if (format == GREY_FORMAT_RAW) {
+        headerSize = RAW_HEADER_SIZE;
+    } else {
+        throw std::runtime_error("Not a mapped output format: " + filename);
+    }
+    length = headerSize + static_cast<size_t>(width) * static_cast<size_t>(height);
+
+    fd = open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        throw std::runtime_error("Failed to save image: " + filename);
+    }
+
+    void* mapping = MAP_FAILED;
+    if (ftruncate(fd, static_cast<off_t>(length)) == 0) {
+        mapping = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    if (mapping == MAP_FAILED) {
+        close(fd);
+        fd = -1;
+        throw std::runtime_error("Failed to map output image: " + filename);
+    }
+    base = static_cast<unsigned char*>(mapping);
+    madvise(base, length, MADV_SEQUENTIAL);
+
+    if (format == GREY_FORMAT_PGM) {
+        memcpy(base, pgmHeader, headerSize);
+    } else {
+        memcpy(base, RAW_MAGIC, 4);
+        putLittleEndian(base + 4, static_cast<unsigned int>(width));
+        putLittleEndian(base + 8, static_cast<unsigned int>(height));
+    }
+}
+
+MappedGreyOutput::~MappedGreyOutput() {
+    if (base) {
+        munmap(base, length);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+void MappedGreyOutput::finish() {
+    // the pages are written back by the kernel, munmap only reports invalid mappings
+    bool failed = munmap(base, length) != 0;
+    base = nullptr;
+    failed = (close(fd) != 0) || failed;
+    fd = -1;
+
+    if (failed) {
+        throw std::runtime_error("Failed to save image: " + filename);
+    }
+}
+
+void writeMappedGrey(const std::string& filename, const unsigned char* pixels, int width, int height,
+                     GREY_FORMAT format) {
+    MappedGreyOutput output(filename, width, height, format);
+    memcpy(output.pixels(), pixels, static_cast<size_t>(width) * height);
+    output.finish();
+}
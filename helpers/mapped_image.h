@@ -0,0 +1,91 @@
+#pragma once
+#include <cstddef>
+#include <string>
+
+// magic of the headered raw format: "MFEG", then width and height as little-endian uint32
+#define RAW_MAGIC "MFEG"
+#define RAW_HEADER_SIZE 12
+
+// uncompressed greyscale formats that are read and written through mmap
+enum GREY_FORMAT {
+    GREY_FORMAT_NONE, // not one of the mapped formats (PNG and the rest go through the codecs)
+    GREY_FORMAT_PGM,  // binary PGM (P5), maxval up to 255
+    GREY_FORMAT_RAW   // headered raw, see RAW_MAGIC
+};
+
+/*
+    format of an existing file, from its first bytes
+    @return GREY_FORMAT_NONE when the file is missing or not a mapped format
+*/
+GREY_FORMAT detectGreyFormat(const std::string& filename);
+
+// format to write for an output path, from its extension (.pgm, .raw / .gray)
+GREY_FORMAT greyFormatForPath(const std::string& filename);
+
+/*
+    read-only mapping of a PGM or raw image, the pixels are served straight from the page cache
+    the mapping is advised as sequential, so the kernel reads ahead while rows are consumed
+*/
+class MappedGreyImage {
+public:
+    /*
+        maps the file and parses its header, throws runtime_error when that fails
+        @param filename: path to a PGM (P5) or headered raw file
+    */
+    explicit MappedGreyImage(const std::string& filename);
+    ~MappedGreyImage();
+
+    MappedGreyImage(const MappedGreyImage&) = delete;
+    MappedGreyImage& operator=(const MappedGreyImage&) = delete;
+
+    // width * height bytes, row by row, valid while the object lives
+    const unsigned char* pixels() const { return base + headerSize; }
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+
+private:
+    unsigned char* base = nullptr;
+    size_t length = 0;
+    size_t headerSize = 0;
+    int width = 0;
+    int height = 0;
+};
+
+/*
+    writable mapping of a new PGM or raw file: producers fill pixels() in place and the kernel
+    writes the pages back, no staging buffer and no write() copies
+*/
+class MappedGreyOutput {
+public:
+    /*
+        creates (or truncates) the file, sizes it and writes the header, throws runtime_error on failure
+        @param format: GREY_FORMAT_PGM or GREY_FORMAT_RAW
+    */
+    MappedGreyOutput(const std::string& filename, int width, int height, GREY_FORMAT format);
+
+    // unmaps and closes the file if finish() was not called
+    ~MappedGreyOutput();
+
+    MappedGreyOutput(const MappedGreyOutput&) = delete;
+    MappedGreyOutput& operator=(const MappedGreyOutput&) = delete;
+
+    // width * height bytes to fill, row by row
+    unsigned char* pixels() { return base + headerSize; }
+
+    // unmaps and closes the file, throws runtime_error if the data could not be written back
+    void finish();
+
+private:
+    std::string filename;
+    int fd = -1;
+    unsigned char* base = nullptr;
+    size_t length = 0;
+    size_t headerSize = 0;
+};
+
+/*
+    writes a greyscale image through MappedGreyOutput
+    @param pixels: width * height bytes, row by row
+*/
+void writeMappedGrey(const std::string& filename, const unsigned char* pixels, int width, int height,
+                     GREY_FORMAT format);
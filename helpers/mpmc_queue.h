@@ -0,0 +1,129 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// bounded multi-producer / multi-consumer ring buffer, lock-free: every slot carries a sequence
+// number telling whether it is free for the producer of that lap or full for its consumer,
+// so producers and consumers only contend on their own position counter
+template <typename T>
+class MpmcQueue {
+public:
+    // capacity is rounded up to a power of two, at least 2: with a single slot the sequence of a
+    // full slot would match the one a producer of the next lap waits for
+    explicit MpmcQueue(size_t capacity) : slots(roundUp(capacity)), mask(slots.size() - 1) {
+        for (size_t i = 0; i < slots.size(); ++i) {
+            slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    MpmcQueue(const MpmcQueue&) = delete;
+    MpmcQueue& operator=(const MpmcQueue&) = delete;
+
+    // returns false when the queue is full
+    bool push(T value) {
+        size_t position = tailIdx.load(std::memory_order_relaxed);
+        for (;;) {
+            Slot& slot = slots[position & mask];
+            size_t sequence = slot.sequence.load(std::memory_order_acquire);
+            long long lag = static_cast<long long>(sequence) - static_cast<long long>(position);
+            if (lag == 0) {
+                if (tailIdx.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    slot.value = std::move(value);
+                    slot.sequence.store(position + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (lag < 0) {
+                return false;
+            } else {
+                position = tailIdx.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // returns false when the queue is empty
+    bool pop(T& value) {
+        size_t position = headIdx.load(std::memory_order_relaxed);
+        for (;;) {
+            Slot& slot = slots[position & mask];
+            size_t sequence = slot.sequence.load(std::memory_order_acquire);
+            long long lag = static_cast<long long>(sequence) - static_cast<long long>(position + 1);
+            if (lag == 0) {
+                if (headIdx.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    value = std::move(slot.value);
+                    slot.sequence.store(position + mask + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (lag < 0) {
+                return false;
+            } else {
+                position = headIdx.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    size_t capacity() const { return slots.size(); }
+
+private:
+    struct Slot {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    std::vector<Slot> slots;
+    size_t mask;
+
+    // kept on separate cache lines so producers and consumers do not false-share
+    alignas(64) std::atomic<size_t> headIdx{0};
+    alignas(64) std::atomic<size_t> tailIdx{0};
+
+    static size_t roundUp(size_t capacity) {
+        size_t size = 2;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        return size;
+    }
+};
+
+// a pipeline stage with nothing to do spins briefly, then sleeps so it does not steal the compute cores
+inline void queueBackoff(int attempt) {
+    if (attempt < 64) {
+        std::this_thread::yield();
+    } else {
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+}
+
+// blocks until a value arrives, false once the producers are done and the queue is drained
+template <typename T>
+bool popOrFinish(MpmcQueue<T>& queue, const std::atomic<bool>& producersDone, T& value) {
+    for (int attempt = 0;; ++attempt) {
+        if (queue.pop(value)) {
+            return true;
+        }
+        // everything pushed before the flag was raised is visible once it is seen
+        if (producersDone.load(std::memory_order_acquire)) {
+            return queue.pop(value);
+        }
+        queueBackoff(attempt);
+    }
+}
+
+template <typename T>
+void pushWaiting(MpmcQueue<T>& queue, T value) {
+    for (int attempt = 0; !queue.push(value); ++attempt) {
+        queueBackoff(attempt);
+    }
+}
+
+template <typename T>
+void popWaiting(MpmcQueue<T>& queue, T& value) {
+    for (int attempt = 0; !queue.pop(value); ++attempt) {
+        queueBackoff(attempt);
+    }
+}
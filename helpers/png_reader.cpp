@@ -0,0 +1,228 @@
+#include "png_reader.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <zlib.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// compressed bytes read from the file per inflate call
+#define PNG_READ_SIZE (1 << 16)
+
+static const unsigned char PNG_SIGNATURE[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+
+static unsigned int getBigEndian(const unsigned char* in) {
+    return (static_cast<unsigned int>(in[0]) << 24) | (static_cast<unsigned int>(in[1]) << 16) |
+           (static_cast<unsigned int>(in[2]) << 8) | static_cast<unsigned int>(in[3]);
+}
+
+// p = a + b - c, so the three distances reduce to |b - c|, |a - c| and |a + b - 2c|
+static inline int paethPredictor(int a, int b, int c) {
+    int pa = abs(b - c);
+    int pb = abs(a - c);
+    int pc = abs(a + b - 2 * c);
+    int ab = (pb < pa) ? b : a;
+    int abDistance = (pb < pa) ? pb : pa;
+    return (pc < abDistance) ? c : ab;
+}
+
+// running sum of the row, 16 bytes at a time with a log-step prefix sum per vector
+static void unfilterSub(unsigned char* row, int width) {
+    int x = 0;
+    unsigned char carry = 0;
+
+#if defined(__SSE2__)
+    for (; x + 16 <= width; x += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x));
+        v = _mm_add_epi8(v, _mm_slli_si128(v, 1));
+        v = _mm_add_epi8(v, _mm_slli_si128(v, 2));
+        v = _mm_add_epi8(v, _mm_slli_si128(v, 4));
+        v = _mm_add_epi8(v, _mm_slli_si128(v, 8));
+        v = _mm_add_epi8(v, _mm_set1_epi8(static_cast<char>(carry)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(row + x), v);
+        carry = row[x + 15];
+    }
+#endif
+
+    for (; x < width; ++x) {
+        row[x] = static_cast<unsigned char>(row[x] + carry);
+        carry = row[x];
+    }
+}
+
+static void unfilterUp(unsigned char* row, const unsigned char* previous, int width) {
+    int x = 0;
+
+#if defined(__SSE2__)
+    for (; x + 16 <= width; x += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x));
+        __m128i up = _mm_loadu_si128(reinterpret_cast<const __m128i*>(previous + x));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(row + x), _mm_add_epi8(v, up));
+    }
+#endif
+
+    for (; x < width; ++x) {
+        row[x] = static_cast<unsigned char>(row[x] + previous[x]);
+    }
+}
+
+bool unfilterPngRow(int filter, unsigned char* row, const unsigned char* previous, int width) {
+    // on the first row the missing row above reads as zeros: Up is None, Paeth is Sub
+    switch (filter) {
+        case 0:
+            return true;
+        case 1:
+            unfilterSub(row, width);
+            return true;
+        case 2:
+            if (previous) {
+                unfilterUp(row, previous, width);
+            }
+            return true;
+        case 3: {
+            // 1 byte per pixel: every pixel depends on the one just decoded, so it stays scalar
+            if (!previous) {
+                for (int x = 1; x < width; ++x) {
+                    row[x] = static_cast<unsigned char>(row[x] + (row[x - 1] >> 1));
+                }
+                return true;
+            }
+            row[0] = static_cast<unsigned char>(row[0] + (previous[0] >> 1));
+            for (int x = 1; x < width; ++x) {
+                row[x] = static_cast<unsigned char>(row[x] + ((row[x - 1] + previous[x]) >> 1));
+            }
+            return true;
+        }
+        case 4: {
+            if (!previous) {
+                unfilterSub(row, width);
+                return true;
+            }
+            row[0] = static_cast<unsigned char>(row[0] + previous[0]);
+            for (int x = 1; x < width; ++x) {
+                row[x] = static_cast<unsigned char>(row[x] + paethPredictor(row[x - 1], previous[x], previous[x - 1]));
+            }
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+// inflate state and row buffers of one decode
+struct PngDecodeState {
+    z_stream stream{};
+    std::vector<unsigned char> current;  // filter byte + row being inflated
+    std::vector<unsigned char> previous; // filter byte + last complete row
+    size_t filled = 0;
+    int row = 0;
+    bool ended = false;
+};
+
+// inflates one piece of IDAT data, unfiltering and delivering every row it completes
+static bool inflatePiece(PngDecodeState& state, unsigned char* data, size_t length, int width, int height,
+                         const std::function<void(int, const unsigned char*)>& onRow) {
+    z_stream& stream = state.stream;
+    stream.next_in = data;
+    stream.avail_in = static_cast<uInt>(length);
+
+    while (stream.avail_in > 0 && !state.ended) {
+        // once every row is in, only the adler32 trailer may be left: any output is an error
+        unsigned char overflow;
+        bool complete = state.row >= height;
+        stream.next_out = complete ? &overflow : state.current.data() + state.filled;
+        stream.avail_out = complete ? 1 : static_cast<uInt>(state.current.size() - state.filled);
+
+        int status = inflate(&stream, Z_NO_FLUSH);
+        if ((status != Z_OK && status != Z_STREAM_END) || (complete && stream.avail_out == 0)) {
+            return false;
+        }
+        state.ended = (status == Z_STREAM_END);
+        if (complete) {
+            continue;
+        }
+        state.filled = state.current.size() - stream.avail_out;
+
+        if (state.filled == state.current.size()) {
+            unsigned char* pixels = state.current.data() + 1;
+            const unsigned char* above = state.row > 0 ? state.previous.data() + 1 : nullptr;
+            if (!unfilterPngRow(state.current[0], pixels, above, width)) {
+                return false;
+            }
+            onRow(state.row, pixels);
+
+            ++state.row;
+            state.filled = 0;
+            state.current.swap(state.previous);
+        }
+    }
+
+    return true;
+}
+
+bool readGreyscalePng(const std::string& filename, int& width, int& height,
+                      const std::function<void(int, const unsigned char*)>& onRow) {
+    FILE* file = fopen(filename.c_str(), "rb");
+    if (!file) {
+        return false;
+    }
+
+    unsigned char signature[8];
+    unsigned char header[8];
+    unsigned char ihdr[13 + 4];
+    bool supported = fread(signature, 1, 8, file) == 8 && memcmp(signature, PNG_SIGNATURE, 8) == 0 &&
+                     fread(header, 1, 8, file) == 8 && getBigEndian(header) == 13 &&
+                     memcmp(header + 4, "IHDR", 4) == 0 && fread(ihdr, 1, sizeof(ihdr), file) == sizeof(ihdr);
+
+    // 8-bit greyscale, deflate, standard filters, no interlacing
+    supported = supported && ihdr[8] == 8 && ihdr[9] == 0 && ihdr[10] == 0 && ihdr[11] == 0 && ihdr[12] == 0;
+    int w = supported ? static_cast<int>(getBigEndian(ihdr)) : 0;
+    int h = supported ? static_cast<int>(getBigEndian(ihdr + 4)) : 0;
+    if (!supported || w <= 0 || h <= 0) {
+        fclose(file);
+        return false;
+    }
+    width = w;
+    height = h;
+
+    PngDecodeState state;
+    state.current.resize(static_cast<size_t>(width) + 1);
+    state.previous.resize(static_cast<size_t>(width) + 1);
+    if (inflateInit(&state.stream) != Z_OK) {
+        fclose(file);
+        return false;
+    }
+
+    std::vector<unsigned char> buffer(PNG_READ_SIZE);
+    bool ok = true;
+    while (ok && !state.ended) {
+        if (fread(header, 1, 8, file) != 8) {
+            ok = false;
+            break;
+        }
+        unsigned int length = getBigEndian(header);
+
+        if (memcmp(header + 4, "IDAT", 4) == 0) {
+            // chunk data in pieces, the crc is left to zlib's adler32 over the whole stream
+            while (ok && length > 0) {
+                size_t piece = length < buffer.size() ? length : buffer.size();
+                ok = fread(buffer.data(), 1, piece, file) == piece &&
+                     inflatePiece(state, buffer.data(), piece, width, height, onRow);
+                length -= static_cast<unsigned int>(piece);
+            }
+            ok = ok && fseek(file, 4, SEEK_CUR) == 0;
+        } else if (memcmp(header + 4, "IEND", 4) == 0) {
+            break;
+        } else {
+            // ancillary chunks carry nothing a greyscale decode needs
+            ok = fseek(file, static_cast<long>(length) + 4, SEEK_CUR) == 0;
+        }
+    }
+
+    inflateEnd(&state.stream);
+    fclose(file);
+    return ok && state.ended && state.row == height;
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include <functional>
+#include <string>
+
+/*
+    unfilters one greyscale row (1 byte per pixel) in place, Up and Sub use SSE2 when available
+    @param filter: PNG filter type byte of the row
+    @param row: width filtered bytes, replaced by the pixel values
+    @param previous: unfiltered row above, or nullptr for the first row
+    @return false for an unknown filter type
+*/
+bool unfilterPngRow(int filter, unsigned char* row, const unsigned char* previous, int width);
+
+/*
+    decodes an 8-bit greyscale, non interlaced PNG one row at a time: the IDAT stream is
+    inflated straight into a row buffer, unfiltered and handed to onRow, so callers can
+    convert rows to their own pixel type while they are still in cache
+    @param filename: path to the image file
+    @param width, height: filled with the image dimensions before the first row is delivered
+    @param onRow: called for rows 0 .. height - 1 in order with width bytes each
+    @return false when the file is not a PNG of that kind or is corrupt, callers are expected
+            to fall back to a general decoder (rows may already have been delivered)
+*/
+bool readGreyscalePng(const std::string& filename, int& width, int& height,
+                      const std::function<void(int, const unsigned char*)>& onRow);
@@ -0,0 +1,378 @@
+#include "png_writer.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+// size of the IDAT chunks written to the file
+#define PNG_IDAT_SIZE (1 << 16)
+
+// filtered bytes per block of the parallel writer (pigz uses the same 128K)
+#define PNG_BLOCK_SIZE (1 << 17)
+
+// deflate window, the tail of the previous block primes the next one
+#define PNG_DICTIONARY_SIZE (1 << 15)
+
+static const unsigned char PNG_SIGNATURE[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+
+static void putBigEndian(unsigned char* out, unsigned int value) {
+    out[0] = static_cast<unsigned char>(value >> 24);
+    out[1] = static_cast<unsigned char>(value >> 16);
+    out[2] = static_cast<unsigned char>(value >> 8);
+    out[3] = static_cast<unsigned char>(value);
+}
+
+static inline unsigned char paethPredictor(int a, int b, int c) {
+    int p = a + b - c;
+    int pa = abs(p - a);
+    int pb = abs(p - b);
+    int pc = abs(p - c);
+    if (pa <= pb && pa <= pc) return static_cast<unsigned char>(a);
+    if (pb <= pc) return static_cast<unsigned char>(b);
+    return static_cast<unsigned char>(c);
+}
+
+// applies a single (non adaptive) filter, returns the sum of the residuals seen as signed bytes
+static long applyFilter(int filter, const unsigned char* row, const unsigned char* previous,
+                        int width, unsigned char* out) {
+    out[0] = static_cast<unsigned char>(filter);
+    unsigned char* residuals = out + 1;
+
+    // one loop per filter, the first row (no previous) and first pixel (no left) are edge cases
+    switch (filter) {
+        case PNG_FILTER_SUB:
+            if (width > 0) residuals[0] = row[0];
+            for (int x = 1; x < width; ++x) residuals[x] = static_cast<unsigned char>(row[x] - row[x - 1]);
+            break;
+        case PNG_FILTER_UP:
+            if (!previous) {
+                memcpy(residuals, row, width);
+                break;
+            }
+            for (int x = 0; x < width; ++x) residuals[x] = static_cast<unsigned char>(row[x] - previous[x]);
+            break;
+        case PNG_FILTER_AVERAGE:
+            for (int x = 0; x < width; ++x) {
+                int a = x > 0 ? row[x - 1] : 0;
+                int b = previous ? previous[x] : 0;
+                residuals[x] = static_cast<unsigned char>(row[x] - ((a + b) >> 1));
+            }
+            break;
+        case PNG_FILTER_PAETH:
+            for (int x = 0; x < width; ++x) {
+                int a = x > 0 ? row[x - 1] : 0;
+                int b = previous ? previous[x] : 0;
+                int c = (x > 0 && previous) ? previous[x - 1] : 0;
+                residuals[x] = static_cast<unsigned char>(row[x] - paethPredictor(a, b, c));
+            }
+            break;
+        default:
+            memcpy(residuals, row, width);
+            break;
+    }
+
+    long cost = 0;
+    for (int x = 0; x < width; ++x) {
+        cost += abs(static_cast<signed char>(residuals[x]));
+    }
+    return cost;
+}
+
+// adaptive filtering with a caller provided scratch row, so encoders do not allocate per row
+static void filterRow(PNG_FILTER filter, const unsigned char* row, const unsigned char* previous,
+                      int width, unsigned char* out, unsigned char* candidate) {
+    if (filter != PNG_FILTER_ADAPTIVE) {
+        applyFilter(filter, row, previous, width, out);
+        return;
+    }
+
+    // same heuristic as stb and libpng: keep the filter with the smallest residual sum
+    long bestCost = -1;
+    for (int f = PNG_FILTER_NONE; f <= PNG_FILTER_PAETH; ++f) {
+        long cost = applyFilter(f, row, previous, width, candidate);
+        if (bestCost < 0 || cost < bestCost) {
+            bestCost = cost;
+            memcpy(out, candidate, width + 1);
+        }
+    }
+}
+
+void filterPngRow(PNG_FILTER filter, const unsigned char* row, const unsigned char* previous,
+                  int width, unsigned char* out) {
+    std::vector<unsigned char> candidate(width + 1);
+    filterRow(filter, row, previous, width, out, candidate.data());
+}
+
+static void writeChunk(FILE* file, const char* type, const unsigned char* data, size_t length) {
+    unsigned char field[4];
+    putBigEndian(field, static_cast<unsigned int>(length));
+    fwrite(field, 1, 4, file);
+    fwrite(type, 1, 4, file);
+    if (length > 0) {
+        fwrite(data, 1, length, file);
+    }
+
+    uLong crc = crc32(0L, reinterpret_cast<const Bytef*>(type), 4);
+    if (length > 0) {
+        crc = crc32(crc, data, static_cast<uInt>(length));
+    }
+    putBigEndian(field, static_cast<unsigned int>(crc));
+    fwrite(field, 1, 4, file);
+}
+
+// signature and IHDR of an 8-bit greyscale, non interlaced image
+static void writeHeader(FILE* file, int width, int height) {
+    unsigned char header[13];
+    putBigEndian(header, static_cast<unsigned int>(width));
+    putBigEndian(header + 4, static_cast<unsigned int>(height));
+    header[8] = 8;
+    header[9] = 0;
+    header[10] = 0;
+    header[11] = 0;
+    header[12] = 0;
+
+    fwrite(PNG_SIGNATURE, 1, sizeof(PNG_SIGNATURE), file);
+    writeChunk(file, "IHDR", header, sizeof(header));
+}
+
+PngOptions fastPngOptions() {
+    PngOptions options;
+    options.level = PNG_FAST_LEVEL;
+    options.filter = PNG_FILTER_UP;
+    options.strategy = Z_RLE;
+    return options;
+}
+
+static PngOptions& mutableDefaultPngOptions() {
+    static PngOptions options;
+    return options;
+}
+
+const PngOptions& defaultPngOptions() {
+    return mutableDefaultPngOptions();
+}
+
+void setDefaultPngOptions(const PngOptions& options) {
+    mutableDefaultPngOptions() = options;
+}
+
+PngOptions parsePngOptions(int argc, char** argv) {
+    PngOptions options = defaultPngOptions();
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--png-fast") {
+            int threads = options.threads;
+            options = fastPngOptions();
+            options.threads = threads;
+        } else if (arg == "--png-level" && i + 1 < argc) {
+            options.level = std::min(9, std::max(0, atoi(argv[++i])));
+        } else if (arg == "--png-threads" && i + 1 < argc) {
+            options.threads = std::max(0, atoi(argv[++i]));
+        } else if (arg == "--png-filter" && i + 1 < argc) {
+            std::string name = argv[++i];
+            if (name == "none") options.filter = PNG_FILTER_NONE;
+            else if (name == "sub") options.filter = PNG_FILTER_SUB;
+            else if (name == "up") options.filter = PNG_FILTER_UP;
+            else if (name == "average") options.filter = PNG_FILTER_AVERAGE;
+            else if (name == "paeth") options.filter = PNG_FILTER_PAETH;
+            else options.filter = PNG_FILTER_ADAPTIVE;
+        }
+    }
+
+    return options;
+}
+
+// compressed form of a block of rows, ready to be written as one IDAT chunk
+struct PngBlock {
+    std::vector<unsigned char> compressed;
+    uLong adler = 1;
+    size_t length = 0;
+};
+
+void writePng(const std::string& filename, const unsigned char* pixels, int width, int height,
+              const PngOptions& options) {
+    // PNG has no empty images, and without rows there would be no IDAT chunk at all
+    if (width <= 0 || height <= 0) {
+        throw std::runtime_error("Cannot save an empty image: " + filename);
+    }
+
+    size_t stride = static_cast<size_t>(width) + 1;
+    int blockRows = static_cast<int>(std::max<size_t>(1, PNG_BLOCK_SIZE / stride));
+    int numBlocks = (height + blockRows - 1) / blockRows;
+
+    std::vector<unsigned char> filtered(stride * height);
+    std::vector<PngBlock> blocks(numBlocks);
+
+    // filters only depend on the unfiltered rows, so every block filters on its own
+    ThreadPool::sharedFor(numBlocks, [&](int b) {
+        std::vector<unsigned char> candidate(stride);
+        int first = b * blockRows;
+        int last = std::min(height, first + blockRows);
+        for (int y = first; y < last; ++y) {
+            const unsigned char* row = pixels + static_cast<size_t>(y) * width;
+            const unsigned char* previous = y > 0 ? row - width : nullptr;
+            filterRow(options.filter, row, previous, width, &filtered[y * stride], candidate.data());
+        }
+    }, options.threads);
+
+    // blocks end on a sync flush (byte aligned, empty stored block), the last one finishes the
+    // stream, so the raw deflate outputs can simply be concatenated
+    ThreadPool::sharedFor(numBlocks, [&](int b) {
+        PngBlock& block = blocks[b];
+        size_t start = static_cast<size_t>(b) * blockRows * stride;
+        size_t end = std::min(filtered.size(), start + static_cast<size_t>(blockRows) * stride);
+        block.length = end - start;
+        block.adler = adler32(1L, &filtered[start], static_cast<uInt>(block.length));
+
+        z_stream stream{};
+        if (deflateInit2(&stream, options.level, Z_DEFLATED, -15, 8, options.strategy) != Z_OK) {
+            throw std::runtime_error("Failed to initialize deflate for: " + filename);
+        }
+
+        // the previous block's tail is what a single stream would have had in its window
+        if (b > 0) {
+            size_t dictionary = std::min<size_t>(start, PNG_DICTIONARY_SIZE);
+            deflateSetDictionary(&stream, &filtered[start - dictionary], static_cast<uInt>(dictionary));
+        }
+
+        bool last = (b == numBlocks - 1);
+        block.compressed.resize(deflateBound(&stream, static_cast<uLong>(block.length)) + 16);
+        stream.next_in = &filtered[start];
+        stream.avail_in = static_cast<uInt>(block.length);
+        stream.next_out = block.compressed.data();
+        stream.avail_out = static_cast<uInt>(block.compressed.size());
+
+        int status = deflate(&stream, last ? Z_FINISH : Z_SYNC_FLUSH);
+        bool complete = last ? (status == Z_STREAM_END) : (status == Z_OK && stream.avail_in == 0);
+        block.compressed.resize(stream.total_out);
+        deflateEnd(&stream);
+
+        if (!complete) {
+            throw std::runtime_error("Deflate failed for: " + filename);
+        }
+    }, options.threads);
+
+    FILE* file = fopen(filename.c_str(), "wb");
+    if (!file) {
+        throw std::runtime_error("Failed to save image: " + filename);
+    }
+
+    writeHeader(file, width, height);
+
+    // zlib header: 32K window, compression level hint, check bits
+    int levelHint = options.level <= 1 ? 0 : options.level <= 5 ? 1 : options.level == 6 ? 2 : 3;
+    unsigned char zlibHeader[2] = { 0x78, static_cast<unsigned char>(levelHint << 6) };
+    zlibHeader[1] += 31 - ((zlibHeader[0] * 256 + zlibHeader[1]) % 31);
+
+    uLong adler = 1;
+    for (int b = 0; b < numBlocks; ++b) {
+        PngBlock& block = blocks[b];
+        adler = (b == 0) ? block.adler : adler32_combine(adler, block.adler, static_cast<z_off_t>(block.length));
+
+        if (b == 0) {
+            block.compressed.insert(block.compressed.begin(), zlibHeader, zlibHeader + 2);
+        }
+        if (b == numBlocks - 1) {
+            unsigned char trailer[4];
+            putBigEndian(trailer, static_cast<unsigned int>(adler));
+            block.compressed.insert(block.compressed.end(), trailer, trailer + 4);
+        }
+        writeChunk(file, "IDAT", block.compressed.data(), block.compressed.size());
+    }
+    writeChunk(file, "IEND", nullptr, 0);
+
+    bool failed = ferror(file) != 0;
+    failed = (fclose(file) != 0) || failed;
+    if (failed) {
+        throw std::runtime_error("Failed to save image: " + filename);
+    }
+}
+
+PngStreamWriter::PngStreamWriter(const std::string& filename, int width, int height, const PngOptions& options)
+    : filename(filename), width(width), height(height), filter(options.filter),
+      previous(width), filtered(width + 1), candidate(width + 1) {
+    if (width <= 0 || height <= 0) {
+        throw std::runtime_error("Cannot save an empty image: " + filename);
+    }
+
+    file = fopen(filename.c_str(), "wb");
+    if (!file) {
+        throw std::runtime_error("Failed to save image: " + filename);
+    }
+
+    if (deflateInit2(&stream, options.level, Z_DEFLATED, 15, 8, options.strategy) != Z_OK) {
+        fclose(file);
+        throw std::runtime_error("Failed to initialize deflate for: " + filename);
+    }
+
+    writeHeader(file, width, height);
+}
+
+PngStreamWriter::~PngStreamWriter() {
+    if (!finished) {
+        deflateEnd(&stream);
+        if (file) {
+            fclose(file);
+        }
+    }
+}
+
+void PngStreamWriter::writeRows(const unsigned char* rows, int count) {
+    for (int i = 0; i < count; ++i) {
+        const unsigned char* row = rows + static_cast<size_t>(i) * width;
+        filterRow(filter, row, rowsWritten > 0 ? previous.data() : nullptr, width, filtered.data(), candidate.data());
+        memcpy(previous.data(), row, width);
+        ++rowsWritten;
+
+        stream.next_in = filtered.data();
+        stream.avail_in = static_cast<uInt>(filtered.size());
+        deflateInput(Z_NO_FLUSH);
+    }
+}
+
+void PngStreamWriter::finish() {
+    if (rowsWritten != height) {
+        throw std::runtime_error("Incomplete image written to: " + filename);
+    }
+
+    stream.next_in = nullptr;
+    stream.avail_in = 0;
+    deflateInput(Z_FINISH);
+    if (!idat.empty()) {
+        writeChunk(file, "IDAT", idat.data(), idat.size());
+    }
+    writeChunk(file, "IEND", nullptr, 0);
+
+    deflateEnd(&stream);
+    bool failed = ferror(file) != 0;
+    failed = (fclose(file) != 0) || failed;
+    file = nullptr;
+    finished = true;
+
+    if (failed) {
+        throw std::runtime_error("Failed to save image: " + filename);
+    }
+}
+
+void PngStreamWriter::deflateInput(int flush) {
+    unsigned char buffer[PNG_IDAT_SIZE];
+    int status;
+
+    // drain deflate until it has consumed the input (and, when finishing, emitted the trailer)
+    do {
+        stream.next_out = buffer;
+        stream.avail_out = sizeof(buffer);
+        status = deflate(&stream, flush);
+        if (status == Z_STREAM_ERROR) {
+            throw std::runtime_error("Deflate failed for: " + filename);
+        }
+        idat.insert(idat.end(), buffer, buffer + (sizeof(buffer) - stream.avail_out));
+
+        while (idat.size() >= PNG_IDAT_SIZE) {
+            writeChunk(file, "IDAT", idat.data(), PNG_IDAT_SIZE);
+            idat.erase(idat.begin(), idat.begin() + PNG_IDAT_SIZE);
+        }
+    } while (stream.avail_out == 0 || (flush == Z_FINISH && status != Z_STREAM_END));
+}
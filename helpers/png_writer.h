@@ -0,0 +1,110 @@
+#pragma once
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <zlib.h>
+
+// zlib level used when none is given (stb writes with 8)
+#define PNG_DEFAULT_LEVEL 6
+
+// level of the fast mode, meant for intermediate outputs that are read back soon
+#define PNG_FAST_LEVEL 1
+
+// row filters defined by the PNG spec, PNG_FILTER_ADAPTIVE picks one per row
+enum PNG_FILTER {
+    PNG_FILTER_NONE,
+    PNG_FILTER_SUB,
+    PNG_FILTER_UP,
+    PNG_FILTER_AVERAGE,
+    PNG_FILTER_PAETH,
+    PNG_FILTER_ADAPTIVE
+};
+
+// how PNGs are encoded, see parsePngOptions() for the command line flags
+struct PngOptions {
+    int level = PNG_DEFAULT_LEVEL;           // zlib compression level (0 - 9)
+    PNG_FILTER filter = PNG_FILTER_ADAPTIVE; // row filter
+    int strategy = Z_DEFAULT_STRATEGY;       // zlib strategy (Z_RLE, Z_FILTERED, ...)
+    int threads = 0;                         // encoder threads, 0 = whole shared pool, 1 = serial
+};
+
+// near-store settings: level 1, Up filter and run-length matching only
+PngOptions fastPngOptions();
+
+/*
+    reads the PNG flags, other arguments are ignored
+        --png-level <0-9>, --png-filter none|sub|up|average|paeth|adaptive,
+        --png-fast, --png-threads <n>
+    @return the default options with the flags applied
+*/
+PngOptions parsePngOptions(int argc, char** argv);
+
+// options used by GreyScaleImage::save and PngStreamWriter when none are given
+const PngOptions& defaultPngOptions();
+void setDefaultPngOptions(const PngOptions& options);
+
+/*
+    writes an 8-bit greyscale PNG, filtering and deflating blocks of rows in parallel
+    blocks are compressed independently (each primed with the tail of the previous one as
+    dictionary) and joined with zlib sync flushes, the way pigz does
+    throws for an empty image, which PNG cannot hold
+    @param pixels: width * height bytes, row by row
+*/
+void writePng(const std::string& filename, const unsigned char* pixels, int width, int height,
+              const PngOptions& options = defaultPngOptions());
+
+/*
+    filters one greyscale row (1 byte per pixel)
+    @param filter: filter to apply, PNG_FILTER_ADAPTIVE keeps the one with the smallest sum of residuals
+    @param row: current row
+    @param previous: row above, or nullptr for the first row
+    @param out: width + 1 bytes, filter type byte followed by the residuals
+*/
+void filterPngRow(PNG_FILTER filter, const unsigned char* row, const unsigned char* previous,
+                  int width, unsigned char* out);
+
+/*
+    writes an 8-bit greyscale PNG incrementally: rows are filtered and deflated as they are
+    handed in, so the caller never needs the whole image in memory
+*/
+class PngStreamWriter {
+public:
+    /*
+        opens the file and writes the PNG header
+        @param filename: output path
+        @param width, height: image dimensions, both at least 1
+        @param options: level, filter and strategy (rows arrive in order, so this writer is serial)
+    */
+    PngStreamWriter(const std::string& filename, int width, int height,
+                    const PngOptions& options = defaultPngOptions());
+
+    ~PngStreamWriter();
+
+    /*
+        appends rows, top to bottom
+        @param rows: count rows of width bytes each, stored contiguously
+    */
+    void writeRows(const unsigned char* rows, int count);
+
+    /*
+        flushes the compressed stream and closes the file, all rows must have been written
+    */
+    void finish();
+
+private:
+    std::string filename;
+    FILE* file = nullptr;
+    z_stream stream{};
+    int width;
+    int height;
+    int rowsWritten = 0;
+    PNG_FILTER filter;
+    bool finished = false;
+
+    std::vector<unsigned char> previous; // last row written, input of the Up/Average/Paeth filters
+    std::vector<unsigned char> filtered; // filter byte + residuals of the current row
+    std::vector<unsigned char> candidate; // scratch row of the adaptive filter
+    std::vector<unsigned char> idat;     // compressed bytes waiting to be written as an IDAT chunk
+
+    void deflateInput(int flush);
+};
@@ -0,0 +1,141 @@
+#include "preview.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <cstdlib>
+#include <string>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+static int& mutablePreviewFactor() {
+    static int factor = 1;
+    return factor;
+}
+
+int previewFactor() {
+    return mutablePreviewFactor();
+}
+
+void setPreviewFactor(int factor) {
+    mutablePreviewFactor() = std::max(1, factor);
+}
+
+int parsePreviewFactor(int argc, char** argv) {
+    int factor = previewFactor();
+    for (int i = 1; i < argc; ++i) {
+        if (std::string(argv[i]) == "--preview" && i + 1 < argc) {
+            int wanted = std::min(PREVIEW_MAX_FACTOR, atoi(argv[++i]));
+            factor = 1;
+            while (factor * 2 <= wanted) {
+                factor *= 2;
+            }
+        }
+    }
+    return factor;
+}
+
+// adds a row to the 16-bit column sums (at most 8 rows of 255, far from overflowing)
+static void accumulateRow(uint16_t* sums, const unsigned char* row, int width) {
+    int x = 0;
+
+#if defined(__SSE2__)
+    __m128i zero = _mm_setzero_si128();
+    for (; x + 16 <= width; x += 16) {
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x));
+        __m128i* low = reinterpret_cast<__m128i*>(sums + x);
+        __m128i* high = reinterpret_cast<__m128i*>(sums + x + 8);
+        _mm_storeu_si128(low, _mm_add_epi16(_mm_loadu_si128(low), _mm_unpacklo_epi8(bytes, zero)));
+        _mm_storeu_si128(high, _mm_add_epi16(_mm_loadu_si128(high), _mm_unpackhi_epi8(bytes, zero)));
+    }
+#endif
+
+    for (; x < width; ++x) {
+        sums[x] += row[x];
+    }
+}
+
+// averages every factor column sums of a block of rows rows into one pixel
+static void emitRow(const uint16_t* sums, int width, int factor, int rows, unsigned char* out) {
+    int outWidth = previewSize(width, factor);
+    int ox = 0;
+
+#if defined(__SSE2__)
+    // full blocks hold factor^2 pixels, a power of two: pairs summed by madd, then pairs of pairs
+    if (rows == factor) {
+        int shift = 0;
+        while ((1 << shift) < factor * factor) {
+            ++shift;
+        }
+        int perStep = 8 / factor;
+        __m128i ones = _mm_set1_epi16(1);
+        __m128i half = _mm_set1_epi32(1 << (shift - 1));
+        for (; ox * factor + 8 <= width; ox += perStep) {
+            __m128i block = _mm_madd_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(sums + ox * factor)), ones);
+            if (factor >= 4) {
+                block = _mm_add_epi32(block, _mm_srli_epi64(block, 32));
+            }
+            if (factor == 8) {
+                block = _mm_add_epi32(block, _mm_srli_si128(block, 8));
+            }
+            block = _mm_srli_epi32(_mm_add_epi32(block, half), shift);
+            alignas(16) int32_t lanes[4];
+            _mm_store_si128(reinterpret_cast<__m128i*>(lanes), block);
+            for (int i = 0; i < perStep; ++i) {
+                out[ox + i] = static_cast<unsigned char>(lanes[i * factor / 2]);
+            }
+        }
+    }
+#endif
+
+    // the rest, and edge blocks, with the same rounded mean
+    for (; ox < outWidth; ++ox) {
+        int x0 = ox * factor;
+        int columns = std::min(factor, width - x0);
+        int sum = 0;
+        for (int x = x0; x < x0 + columns; ++x) {
+            sum += sums[x];
+        }
+        int count = columns * rows;
+        out[ox] = static_cast<unsigned char>((sum + count / 2) / count);
+    }
+}
+
+void boxDownsample(const unsigned char* pixels, int width, int height, size_t stride, int factor, unsigned char* out,
+                   int threads) {
+    int outWidth = previewSize(width, factor);
+    ThreadPool::sharedFor(previewSize(height, factor), [&](int oy) {
+        std::vector<uint16_t> sums(width, 0);
+        int y0 = oy * factor;
+        int rows = std::min(factor, height - y0);
+        for (int y = y0; y < y0 + rows; ++y) {
+            accumulateRow(sums.data(), pixels + y * stride, width);
+        }
+        emitRow(sums.data(), width, factor, rows, out + static_cast<size_t>(oy) * outWidth);
+    }, threads);
+}
+
+PreviewRows::PreviewRows(int factor, const std::function<void(int, int)>& begin,
+                         const std::function<void(const unsigned char*)>& row)
+    : factor(factor), begin(begin), emit(row) {}
+
+void PreviewRows::start(int width, int height) {
+    this->width = width;
+    this->height = height;
+    rowsIn = 0;
+    blockRows = 0;
+    sums.assign(width, 0);
+    out.resize(previewSize(width, factor));
+    begin(previewSize(width, factor), previewSize(height, factor));
+}
+
+void PreviewRows::push(const unsigned char* row) {
+    accumulateRow(sums.data(), row, width);
+    ++rowsIn;
+    if (++blockRows == factor || rowsIn == height) {
+        emitRow(sums.data(), width, factor, blockRows, out.data());
+        emit(out.data());
+        std::fill(sums.begin(), sums.end(), 0);
+        blockRows = 0;
+    }
+}
@@ -0,0 +1,65 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+/*
+    preview mode: inputs are box-downsampled by 2, 4 or 8 as they are loaded (GreyScaleImage,
+    streamGreyRows), so every implementation runs its usual pipeline on an image factor^2
+    times smaller and writes a preview of that size to its usual output; the kernels are
+    applied as they are, so the preview shows the features of the original at factor times
+    their scale
+    a block is the rounded mean of its pixels, edge blocks of the ones inside the image
+*/
+#define PREVIEW_MAX_FACTOR 8
+
+/*
+    reads --preview <factor>, other arguments are ignored; factors are powers of two up to
+    PREVIEW_MAX_FACTOR, anything else is rounded down to one (1 = off)
+*/
+int parsePreviewFactor(int argc, char** argv);
+
+// factor applied by GreyScaleImage::load, probe and streamGreyRows, 1 unless set
+int previewFactor();
+void setPreviewFactor(int factor);
+
+// size of an edge after downsampling, a partial block still gives a pixel
+inline int previewSize(int size, int factor) {
+    return (size + factor - 1) / factor;
+}
+
+/*
+    box-downsamples a whole image, column sums and block sums with SSE2, output rows spread
+    over the shared thread pool
+    @param stride: bytes from one input row to the next
+    @param out: previewSize(width) * previewSize(height) bytes, row by row
+    @param threads: threads of the shared pool used (0 = the whole pool, 1 = the calling thread only)
+*/
+void boxDownsample(const unsigned char* pixels, int width, int height, size_t stride, int factor, unsigned char* out,
+                   int threads = 0);
+
+// the same for images handed out row by row, see streamGreyRows
+class PreviewRows {
+public:
+    // @param begin, row: receive the downsampled size and rows
+    PreviewRows(int factor, const std::function<void(int, int)>& begin,
+                const std::function<void(const unsigned char*)>& row);
+
+    // size of the full image, before its first row
+    void start(int width, int height);
+
+    // one full row, top to bottom; every factor rows (and the last) emit a downsampled row
+    void push(const unsigned char* row);
+
+private:
+    int factor;
+    std::function<void(int, int)> begin;
+    std::function<void(const unsigned char*)> emit;
+    int width = 0;
+    int height = 0;
+    int rowsIn = 0;   // input rows seen
+    int blockRows = 0; // of them in the current block
+    std::vector<uint16_t> sums;
+    std::vector<unsigned char> out;
+};
@@ -0,0 +1,99 @@
+#include "quantize.h"
+#include "thread_pool.h"
+#include <cstddef>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+Quantizer normalizingQuantizer(double minVal, double maxVal) {
+    Quantizer quantizer;
+    quantizer.normalize = true;
+    quantizer.minVal = minVal;
+    quantizer.range = (maxVal - minVal == 0.0) ? 1.0 : (maxVal - minVal);
+    return quantizer;
+}
+
+// the scalar tail uses the same operations in the same order as the vector body, so the
+// result of a pixel does not depend on where it falls in the row
+static inline unsigned char quantizeValue(double v, const Quantizer& quantizer) {
+    if (quantizer.normalize) {
+        v = 255.0 * (v - quantizer.minVal) / quantizer.range;
+    }
+    v = v > 0.0 ? v : 0.0;
+    v = v < 255.0 ? v : 255.0;
+    return static_cast<unsigned char>(v);
+}
+
+#if defined(__SSE2__)
+// max(v, 0) returns its second operand for NaN, so NaN saturates to 0 like the scalar path
+static inline __m128d quantizePair(__m128d v, const Quantizer& quantizer) {
+    if (quantizer.normalize) {
+        v = _mm_sub_pd(v, _mm_set1_pd(quantizer.minVal));
+        v = _mm_div_pd(_mm_mul_pd(_mm_set1_pd(255.0), v), _mm_set1_pd(quantizer.range));
+    }
+    return _mm_min_pd(_mm_max_pd(v, _mm_setzero_pd()), _mm_set1_pd(255.0));
+}
+
+// 8 values in [0, 255] to 8 bytes
+static inline void storeBytes(__m128d v0, __m128d v1, __m128d v2, __m128d v3, unsigned char* dst) {
+    __m128i low = _mm_unpacklo_epi64(_mm_cvttpd_epi32(v0), _mm_cvttpd_epi32(v1));
+    __m128i high = _mm_unpacklo_epi64(_mm_cvttpd_epi32(v2), _mm_cvttpd_epi32(v3));
+    __m128i words = _mm_packs_epi32(low, high);
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(dst), _mm_packus_epi16(words, words));
+}
+#endif
+
+void quantizeRow(const double* src, int count, unsigned char* dst, const Quantizer& quantizer) {
+    int x = 0;
+
+#if defined(__SSE2__)
+    for (; x + 8 <= count; x += 8) {
+        storeBytes(quantizePair(_mm_loadu_pd(src + x), quantizer),
+                   quantizePair(_mm_loadu_pd(src + x + 2), quantizer),
+                   quantizePair(_mm_loadu_pd(src + x + 4), quantizer),
+                   quantizePair(_mm_loadu_pd(src + x + 6), quantizer), dst + x);
+    }
+#endif
+
+    for (; x < count; ++x) {
+        dst[x] = quantizeValue(src[x], quantizer);
+    }
+}
+
+void quantizeRow(const float* src, int count, unsigned char* dst, const Quantizer& quantizer) {
+    int x = 0;
+
+#if defined(__SSE2__)
+    // widened to doubles first, so float and double inputs of the same value agree
+    for (; x + 8 <= count; x += 8) {
+        __m128 first = _mm_loadu_ps(src + x);
+        __m128 second = _mm_loadu_ps(src + x + 4);
+        storeBytes(quantizePair(_mm_cvtps_pd(first), quantizer),
+                   quantizePair(_mm_cvtps_pd(_mm_movehl_ps(first, first)), quantizer),
+                   quantizePair(_mm_cvtps_pd(second), quantizer),
+                   quantizePair(_mm_cvtps_pd(_mm_movehl_ps(second, second)), quantizer), dst + x);
+    }
+#endif
+
+    for (; x < count; ++x) {
+        dst[x] = quantizeValue(src[x], quantizer);
+    }
+}
+
+void quantizeRows(const std::vector<std::vector<double>>& rows, unsigned char* dst,
+                  const Quantizer& quantizer, int threads) {
+    int height = static_cast<int>(rows.size());
+    int width = height > 0 ? static_cast<int>(rows[0].size()) : 0;
+    ThreadPool::sharedFor(height, [&](int y) {
+        quantizeRow(rows[y].data(), width, dst + static_cast<size_t>(y) * width, quantizer);
+    }, threads);
+}
+
+void quantizeImage(const double* pixels, int width, int height, unsigned char* dst,
+                   const Quantizer& quantizer, int threads) {
+    ThreadPool::sharedFor(height, [&](int y) {
+        size_t offset = static_cast<size_t>(y) * width;
+        quantizeRow(pixels + offset, width, dst + offset, quantizer);
+    }, threads);
+}
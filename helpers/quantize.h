@@ -0,0 +1,43 @@
+#pragma once
+#include <vector>
+
+/*
+    turns doubles (or floats) into 8-bit pixels: optionally normalized first with the same
+    expression as normalizeMatrix, 255 * (v - minVal) / range, then saturated to [0, 255]
+    (NaN becomes 0) and truncated, as the pipelines have always done
+*/
+struct Quantizer {
+    bool normalize = false;
+    double minVal = 0.0;
+    double range = 1.0;
+};
+
+/*
+    quantizer that applies the final normalization on the way, so the last layer is never
+    written back as normalized doubles
+    @param minVal, maxVal: global range of the layer, a flat layer gets range 1 like normalizeMatrix
+*/
+Quantizer normalizingQuantizer(double minVal, double maxVal);
+
+/*
+    quantizes one row, 8 values per step with SSE2 when available
+    @param dst: count bytes, typically the row buffer handed to an encoder
+*/
+void quantizeRow(const double* src, int count, unsigned char* dst, const Quantizer& quantizer);
+void quantizeRow(const float* src, int count, unsigned char* dst, const Quantizer& quantizer);
+
+/*
+    quantizes a whole image on the shared thread pool, one row per task
+    @param rows: height rows of width values each
+    @param dst: width * height bytes, row by row
+    @param threads: upper bound on the threads used (0 = the whole pool)
+*/
+void quantizeRows(const std::vector<std::vector<double>>& rows, unsigned char* dst,
+                  const Quantizer& quantizer, int threads = 0);
+
+/*
+    same for a flattened image
+    @param pixels: width * height values, row by row
+*/
+void quantizeImage(const double* pixels, int width, int height, unsigned char* dst,
+                   const Quantizer& quantizer, int threads = 0);
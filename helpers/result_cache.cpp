@@ -0,0 +1,292 @@
+#include "result_cache.h"
+#include "kernels.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+static const uint64_t PRIME1 = 11400714785074694791ULL;
+static const uint64_t PRIME2 = 14029467366897019727ULL;
+static const uint64_t PRIME3 = 1609587929392839161ULL;
+static const uint64_t PRIME4 = 9650029242287828579ULL;
+static const uint64_t PRIME5 = 2870177450012600261ULL;
+
+static inline uint64_t rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t read64(const unsigned char* p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t read32(const unsigned char* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t round64(uint64_t acc, uint64_t input) {
+    acc += input * PRIME2;
+    acc = rotl(acc, 31);
+    return acc * PRIME1;
+}
+
+static inline uint64_t merge64(uint64_t acc, uint64_t value) {
+    acc ^= round64(0, value);
+    return acc * PRIME1 + PRIME4;
+}
+
+uint64_t hash64(const void* data, size_t length, uint64_t seed) {
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    const unsigned char* end = p + length;
+    uint64_t h;
+
+    // four independent lanes of 8 bytes keep the multipliers busy
+    if (length >= 32) {
+        uint64_t v1 = seed + PRIME1 + PRIME2;
+        uint64_t v2 = seed + PRIME2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - PRIME1;
+        const unsigned char* limit = end - 32;
+        do {
+            v1 = round64(v1, read64(p));
+            v2 = round64(v2, read64(p + 8));
+            v3 = round64(v3, read64(p + 16));
+            v4 = round64(v4, read64(p + 24));
+            p += 32;
+        } while (p <= limit);
+        h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+        h = merge64(h, v1);
+        h = merge64(h, v2);
+        h = merge64(h, v3);
+        h = merge64(h, v4);
+    } else {
+        h = seed + PRIME5;
+    }
+    h += length;
+
+    for (; p + 8 <= end; p += 8) {
+        h ^= round64(0, read64(p));
+        h = rotl(h, 27) * PRIME1 + PRIME4;
+    }
+    if (p + 4 <= end) {
+        h ^= static_cast<uint64_t>(read32(p)) * PRIME1;
+        h = rotl(h, 23) * PRIME2 + PRIME3;
+        p += 4;
+    }
+    for (; p < end; ++p) {
+        h ^= (*p) * PRIME5;
+        h = rotl(h, 11) * PRIME1;
+    }
+
+    h ^= h >> 33;
+    h *= PRIME2;
+    h ^= h >> 29;
+    h *= PRIME3;
+    h ^= h >> 32;
+    return h;
+}
+
+uint64_t configurationHash() {
+    static const uint64_t hash = [] {
+        std::vector<double> config = { RESULT_CACHE_VERSION };
+        auto add = [&config](const std::vector<std::vector<int>>& kernel, double divisor, int padding) {
+            config.push_back(padding);
+            config.push_back(divisor);
+            for (const auto& row : kernel) {
+                config.insert(config.end(), row.begin(), row.end());
+            }
+        };
+        add(LAYER_1_KERNEL, LAYER_1_DIV, LAYER_1_PADDING);
+        add(LAYER_2_KERNEL, LAYER_2_DIV, LAYER_2_PADDING);
+        add(LAYER_3_KERNEL, LAYER_3_DIV, LAYER_3_PADDING);
+        return hash64(config.data(), config.size() * sizeof(double), 0);
+    }();
+    return hash;
+}
+
+CachedResult::~CachedResult() {
+    if (base) {
+        munmap(base, length);
+    }
+}
+
+ResultCache::ResultCache(const std::string& directory, size_t capacity) : directory(directory), capacity(capacity) {
+    std::error_code error;
+    fs::create_directories(directory, error);
+    if (!fs::is_directory(directory)) {
+        throw std::runtime_error("Cannot create cache directory: " + directory);
+    }
+
+    // entries left by earlier runs are ranked by modification time, the oldest evicted first
+    std::vector<std::pair<fs::file_time_type, std::pair<std::string, size_t>>> found;
+    for (const auto& file : fs::directory_iterator(directory, error)) {
+        std::string name = file.path().filename().string();
+        if (file.is_regular_file(error) && file.path().extension() == ".mfc") {
+            found.push_back({ file.last_write_time(error), { name, static_cast<size_t>(file.file_size(error)) } });
+        } else if (name.find(".mfc.tmp") != std::string::npos) {
+            fs::remove(file.path(), error); // left by a writer that died
+        }
+    }
+    std::sort(found.begin(), found.end());
+    for (const auto& file : found) {
+        touch(file.second.first, file.second.second);
+    }
+    evict();
+}
+
+CacheKey ResultCache::key(const unsigned char* pixels, int width, int height, size_t stride) {
+    CacheKey key;
+    key.width = width;
+    key.height = height;
+
+    // rows are chained, each seeding the next, so padded and packed copies of an image share a key
+    uint64_t hash = configurationHash() ^ (static_cast<uint64_t>(width) << 32 | static_cast<uint32_t>(height));
+    for (int y = 0; y < height; ++y) {
+        hash = hash64(pixels + y * stride, width, hash);
+    }
+    key.hash = hash;
+    return key;
+}
+
+std::string ResultCache::fileName(const CacheKey& key) const {
+    char name[64];
+    snprintf(name, sizeof(name), "%016llx-%dx%d.mfc", static_cast<unsigned long long>(key.hash), key.width, key.height);
+    return name;
+}
+
+std::unique_ptr<CachedResult> ResultCache::lookup(const CacheKey& key) {
+    std::string name = fileName(key);
+    std::string path = (fs::path(directory) / name).string();
+    size_t length = RESULT_CACHE_HEADER_SIZE + static_cast<size_t>(key.width) * key.height;
+
+    int fd = open(path.c_str(), O_RDONLY);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) < 0 || static_cast<size_t>(info.st_size) != length) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        ++misses;
+        return nullptr;
+    }
+    void* mapping = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        ++misses;
+        return nullptr;
+    }
+
+    std::unique_ptr<CachedResult> result(new CachedResult());
+    result->base = static_cast<unsigned char*>(mapping);
+    result->length = length;
+    result->width = key.width;
+    result->height = key.height;
+
+    // the header must agree with the key, anything else is a collision or a foreign file
+    const unsigned char* header = result->base;
+    uint32_t fields[3];
+    uint64_t hashes[2];
+    memcpy(fields, header + 4, sizeof(fields));
+    memcpy(hashes, header + 16, sizeof(hashes));
+    if (memcmp(header, RESULT_CACHE_MAGIC, 4) != 0 || fields[0] != RESULT_CACHE_VERSION
+        || static_cast<int>(fields[1]) != key.width || static_cast<int>(fields[2]) != key.height
+        || hashes[0] != configurationHash() || hashes[1] != key.hash) {
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        ++misses;
+        return nullptr;
+    }
+
+    // the readahead of a hit is the output itself, the page cache usually has it already
+    madvise(mapping, length, MADV_SEQUENTIAL);
+    utimensat(AT_FDCWD, path.c_str(), nullptr, 0);
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    ++hits;
+    touch(name, length);
+    return result;
+}
+
+bool ResultCache::store(const CacheKey& key, const unsigned char* pixels, size_t stride) {
+    std::string name = fileName(key);
+    std::string path = (fs::path(directory) / name).string();
+    size_t tempId = std::hash<std::thread::id>()(std::this_thread::get_id());
+    std::string temp = path + ".tmp." + std::to_string(getpid()) + "." + std::to_string(tempId);
+
+    unsigned char header[RESULT_CACHE_HEADER_SIZE];
+    uint32_t fields[3] = { RESULT_CACHE_VERSION, static_cast<uint32_t>(key.width), static_cast<uint32_t>(key.height) };
+    uint64_t hashes[2] = { configurationHash(), key.hash };
+    memcpy(header, RESULT_CACHE_MAGIC, 4);
+    memcpy(header + 4, fields, sizeof(fields));
+    memcpy(header + 16, hashes, sizeof(hashes));
+
+    FILE* file = fopen(temp.c_str(), "wb");
+    if (!file) {
+        return false;
+    }
+    bool written = fwrite(header, 1, sizeof(header), file) == sizeof(header);
+    for (int y = 0; written && y < key.height; ++y) {
+        written = fwrite(pixels + y * stride, 1, key.width, file) == static_cast<size_t>(key.width);
+    }
+    written = (fclose(file) == 0) && written;
+    if (!written || rename(temp.c_str(), path.c_str()) != 0) {
+        unlink(temp.c_str());
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    touch(name, RESULT_CACHE_HEADER_SIZE + static_cast<size_t>(key.width) * key.height);
+    evict();
+    return true;
+}
+
+void ResultCache::touch(const std::string& name, size_t size) {
+    Entry& entry = entries[name];
+    bytes = bytes - entry.size + size;
+    entry.size = size;
+    entry.lastUse = ++useClock;
+}
+
+void ResultCache::evict() {
+    while (bytes > capacity && !entries.empty()) {
+        auto oldest = std::min_element(entries.begin(), entries.end(), [](const auto& a, const auto& b) {
+            return a.second.lastUse < b.second.lastUse;
+        });
+        // a reader that mapped the entry keeps its pages, unlinking only removes the name
+        unlink((fs::path(directory) / oldest->first).c_str());
+        bytes -= oldest->second.size;
+        entries.erase(oldest);
+        ++evictions;
+    }
+}
+
+long long ResultCache::getHits() const {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    return hits;
+}
+
+long long ResultCache::getMisses() const {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    return misses;
+}
+
+long long ResultCache::getEvictions() const {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    return evictions;
+}
+
+size_t ResultCache::getBytes() const {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    return bytes;
+}
@@ -0,0 +1,112 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+/*
+    on-disk cache of final outputs, addressed by content: one file per result, named after a
+    64-bit hash of the decoded input pixels seeded with a hash of the pipeline configuration
+    (kernels, divisors, paddings of kernels.h and RESULT_CACHE_VERSION), so editing the kernels
+    never serves stale results
+        entry   "MFEC", version, width, height (uint32 each), configuration hash, pixel hash
+                (2 x uint64), then width * height output bytes
+    entries are written to a temporary file and renamed, so concurrent readers never see half of
+    one; least recently used entries are evicted once the directory exceeds its byte budget
+*/
+#define RESULT_CACHE_MAGIC "MFEC"
+// bump when the pipeline changes in a way kernels.h does not show
+#define RESULT_CACHE_VERSION 1
+#define RESULT_CACHE_HEADER_SIZE 32
+
+struct CacheKey {
+    uint64_t hash = 0;
+    int width = 0;
+    int height = 0;
+};
+
+// a cached output, served straight from its mapping
+class CachedResult {
+public:
+    ~CachedResult();
+
+    CachedResult(const CachedResult&) = delete;
+    CachedResult& operator=(const CachedResult&) = delete;
+
+    // width * height bytes, row by row
+    const unsigned char* pixels() const { return base + RESULT_CACHE_HEADER_SIZE; }
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+
+private:
+    friend class ResultCache;
+    CachedResult() = default;
+
+    unsigned char* base = nullptr;
+    size_t length = 0;
+    int width = 0;
+    int height = 0;
+};
+
+class ResultCache {
+public:
+    /*
+        opens (or creates) the cache directory and indexes the entries already in it
+        @param capacity: bytes of entries kept, the least recently used go first
+        throws runtime_error when the directory cannot be created
+    */
+    ResultCache(const std::string& directory, size_t capacity);
+
+    ResultCache(const ResultCache&) = delete;
+    ResultCache& operator=(const ResultCache&) = delete;
+
+    /*
+        key of an 8-bit image under the current configuration, one pass over the pixels
+        @param stride: bytes from one row to the next, the key does not depend on it
+    */
+    static CacheKey key(const unsigned char* pixels, int width, int height, size_t stride);
+
+    // the cached output for a key, or nullptr on a miss
+    std::unique_ptr<CachedResult> lookup(const CacheKey& key);
+
+    /*
+        adds an output, best effort: a failed write only costs the entry
+        @param pixels: width * height bytes, rows stride bytes apart
+        @return false when the entry could not be written
+    */
+    bool store(const CacheKey& key, const unsigned char* pixels, size_t stride);
+
+    long long getHits() const;
+    long long getMisses() const;
+    long long getEvictions() const;
+    size_t getBytes() const;
+
+private:
+    struct Entry {
+        size_t size = 0;
+        unsigned long long lastUse = 0;
+    };
+
+    std::string directory;
+    size_t capacity;
+
+    mutable std::mutex cacheMutex;
+    std::map<std::string, Entry> entries; // file name -> entry
+    size_t bytes = 0;
+    unsigned long long useClock = 0;
+    long long hits = 0;
+    long long misses = 0;
+    long long evictions = 0;
+
+    std::string fileName(const CacheKey& key) const;
+    void touch(const std::string& name, size_t size);
+    void evict();
+};
+
+// 64-bit content hash (xxHash64), also used to chain rows in ResultCache::key
+uint64_t hash64(const void* data, size_t length, uint64_t seed);
+
+// hash of everything in kernels.h that shapes the output and RESULT_CACHE_VERSION, for files derived from results
+uint64_t configurationHash();
@@ -0,0 +1,85 @@
+#include "row_source.h"
+#include "image.h"
+#include "mapped_image.h"
+#include "png_reader.h"
+#include "preview.h"
+#include "tiled_image.h"
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+// the rows of the file itself, before any preview
+static bool streamSourceRows(const std::string& filename, const std::function<void(int, int)>& begin,
+                             const std::function<void(const unsigned char*)>& row, int threads) {
+    // tiled: one band of tile rows at a time
+    if (isTiledImage(filename)) {
+        TiledImageReader reader(filename);
+        int width = reader.getWidth();
+        int height = reader.getHeight();
+        int band = reader.getTileHeight();
+        begin(width, height);
+
+        std::vector<unsigned char> rows(static_cast<size_t>(width) * band);
+        for (int y = 0; y < height; y += band) {
+            int count = std::min(band, height - y);
+            reader.readRows(y, count, rows.data(), threads);
+            for (int r = 0; r < count; ++r) {
+                row(rows.data() + static_cast<size_t>(r) * width);
+            }
+        }
+        return true;
+    }
+
+    // PGM / raw: rows straight from the page cache
+    if (detectGreyFormat(filename) != GREY_FORMAT_NONE) {
+        MappedGreyImage mapped(filename);
+        begin(mapped.getWidth(), mapped.getHeight());
+        for (int y = 0; y < mapped.getHeight(); ++y) {
+            row(mapped.pixels() + static_cast<size_t>(y) * mapped.getWidth());
+        }
+        return true;
+    }
+
+    // greyscale PNG: rows as they are inflated and unfiltered
+    int width = 0, height = 0;
+    bool started = false;
+    bool decoded = readGreyscalePng(filename, width, height, [&](int y, const unsigned char* pixels) {
+        if (y == 0) {
+            begin(width, height);
+            started = true;
+        }
+        row(pixels);
+    });
+    if (decoded) {
+        return true;
+    }
+    if (started) {
+        std::cerr << "Failed to decode image: " << filename << std::endl;
+        return false;
+    }
+
+    // anything else is decoded whole by stb, only the processing streams
+    GreyScaleImage image;
+    if (!image.load(filename, 1)) {
+        return false;
+    }
+    begin(image.getWidth(), image.getHeight());
+    for (int y = 0; y < image.getHeight(); ++y) {
+        row(image.getBytes() + static_cast<size_t>(y) * image.getWidth());
+    }
+    return true;
+}
+
+bool streamGreyRows(const std::string& filename, const std::function<void(int, int)>& begin,
+                    const std::function<void(const unsigned char*)>& row, int threads) {
+    int factor = previewFactor();
+    if (factor <= 1) {
+        return streamSourceRows(filename, begin, row, threads);
+    }
+
+    // preview: every factor rows are averaged into one as they arrive
+    PreviewRows preview(factor, begin, row);
+    return streamSourceRows(filename,
+        [&preview](int width, int height) { preview.start(width, height); },
+        [&preview](const unsigned char* source) { preview.push(source); }, threads);
+}
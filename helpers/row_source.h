@@ -0,0 +1,16 @@
+#pragma once
+#include <functional>
+#include <string>
+
+/*
+    decodes a greyscale image row by row, for pipelines that never hold the whole input:
+    PNG through readGreyscalePng, PGM / raw from their mapping, tiled containers one band of
+    tiles at a time; other formats are decoded whole by stb and then handed out row by row;
+    in preview mode (see preview.h) the rows handed out are already box-downsampled
+    @param begin: called once with the width and height, before the first row
+    @param row: called for every row, top to bottom, with width bytes (valid during the call)
+    @param threads: threads of the shared pool decoding tiled bands (0 = the whole pool, 1 = the calling thread only)
+    @return false when the input cannot be read
+*/
+bool streamGreyRows(const std::string& filename, const std::function<void(int, int)>& begin,
+                    const std::function<void(const unsigned char*)>& row, int threads = 0);
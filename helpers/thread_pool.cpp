@@ -0,0 +1,143 @@
+#include "thread_pool.h"
+#include <algorithm>
+
+// pools whose tasks the current thread is running, innermost last
+static thread_local std::vector<const ThreadPool*> runningPools;
+
+ThreadPool::ThreadPool(int threads) {
+    if (threads <= 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    // the thread calling parallelFor works too, so one less worker is needed
+    for (int i = 1; i < threads; ++i) {
+        workers.emplace_back(&ThreadPool::workerLoop, this);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+int ThreadPool::size() const {
+    return static_cast<int>(workers.size()) + 1;
+}
+
+ThreadPool& ThreadPool::shared() {
+    static ThreadPool pool;
+    return pool;
+}
+
+void ThreadPool::sharedFor(int count, const std::function<void(int)>& task, int maxThreads) {
+    if (maxThreads == 1) {
+        for (int i = 0; i < count; ++i) {
+            task(i);
+        }
+        return;
+    }
+    shared().parallelFor(count, task, maxThreads);
+}
+
+void ThreadPool::parallelFor(int count, const std::function<void(int)>& task, int maxThreads) {
+    if (count <= 0) {
+        return;
+    }
+
+    int helpers = std::min(static_cast<int>(workers.size()), count - 1);
+    if (maxThreads > 0) {
+        helpers = std::min(helpers, maxThreads - 1);
+    }
+
+    // nothing to share, skip the handshake; a nested call would wait for its own caller
+    if (helpers <= 0 || runningTask()) {
+        for (int i = 0; i < count; ++i) {
+            task(i);
+        }
+        return;
+    }
+
+    // one parallelFor at a time, callers from different threads queue up here
+    std::lock_guard<std::mutex> callerLock(callerMutex);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        this->task = &task;
+        taskCount = count;
+        allowedWorkers = helpers;
+        joinedWorkers = 0;
+        failure = nullptr;
+        nextIndex.store(0);
+        ++generation;
+    }
+    wake.notify_all();
+
+    drainTasks();
+
+    std::exception_ptr error;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        // late workers must not join once the caller is done, and running ones must finish
+        allowedWorkers = 0;
+        done.wait(lock, [this] { return busyWorkers == 0; });
+        this->task = nullptr;
+        error = failure;
+    }
+
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+void ThreadPool::workerLoop() {
+    unsigned long seen = 0;
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        wake.wait(lock, [&] { return stopping || generation != seen; });
+        if (stopping) {
+            return;
+        }
+        seen = generation;
+
+        if (joinedWorkers >= allowedWorkers) {
+            continue;
+        }
+        ++joinedWorkers;
+        ++busyWorkers;
+
+        lock.unlock();
+        drainTasks();
+        lock.lock();
+
+        if (--busyWorkers == 0) {
+            done.notify_all();
+        }
+    }
+}
+
+bool ThreadPool::runningTask() const {
+    return std::find(runningPools.begin(), runningPools.end(), this) != runningPools.end();
+}
+
+void ThreadPool::drainTasks() {
+    runningPools.push_back(this);
+    for (int i = nextIndex.fetch_add(1); i < taskCount; i = nextIndex.fetch_add(1)) {
+        try {
+            (*task)(i);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!failure) {
+                failure = std::current_exception();
+            }
+            // skip the remaining indices
+            nextIndex.store(taskCount);
+        }
+    }
+    runningPools.pop_back();
+}
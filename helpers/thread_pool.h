@@ -0,0 +1,69 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+    fixed set of worker threads for the helpers (image encoding and decoding), kept alive
+    between calls so repeated saves do not pay for thread creation
+*/
+class ThreadPool {
+public:
+    /*
+        starts the workers
+        @param threads: number of threads taking part in a parallelFor, including the caller
+                        (0 = one per hardware thread)
+    */
+    explicit ThreadPool(int threads = 0);
+
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // threads taking part in a parallelFor, the calling thread included
+    int size() const;
+
+    /*
+        runs task(i) for every i in [0, count) and returns once all of them are done,
+        the first exception thrown by a task is rethrown here; calls from different threads
+        take turns on one pool, other pools run at the same time, and a call made from inside
+        one of this pool's tasks runs inline on the calling thread
+        @param maxThreads: upper bound on the threads used (0 = the whole pool)
+    */
+    void parallelFor(int count, const std::function<void(int)>& task, int maxThreads = 0);
+
+    // pool shared by the helpers, created on first use
+    static ThreadPool& shared();
+
+    // parallelFor on the shared pool; with maxThreads 1 it runs inline and never creates the pool
+    static void sharedFor(int count, const std::function<void(int)>& task, int maxThreads = 0);
+
+private:
+    std::vector<std::thread> workers;
+    std::mutex callerMutex; // one parallelFor at a time on this pool
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    bool stopping = false;
+
+    // current parallelFor, guarded by mutex except for the index counter
+    const std::function<void(int)>* task = nullptr;
+    int taskCount = 0;
+    int allowedWorkers = 0;
+    int joinedWorkers = 0;
+    int busyWorkers = 0;
+    unsigned long generation = 0;
+    std::atomic<int> nextIndex{0};
+    std::exception_ptr failure;
+
+    void workerLoop();
+    void drainTasks();
+
+    // true while the current thread runs one of this pool's tasks
+    bool runningTask() const;
+};
@@ -0,0 +1,231 @@
+#include "tiled_image.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+
+static void putLittleEndian(unsigned char* out, unsigned long long value, int bytes) {
+    for (int i = 0; i < bytes; ++i) {
+        out[i] = static_cast<unsigned char>(value >> (8 * i));
+    }
+}
+
+static unsigned long long getLittleEndian(const unsigned char* in, int bytes) {
+    unsigned long long value = 0;
+    for (int i = bytes - 1; i >= 0; --i) {
+        value = (value << 8) | in[i];
+    }
+    return value;
+}
+
+// reads exactly length bytes at offset, false on a short read
+static bool readAt(int fd, unsigned char* out, size_t length, unsigned long long offset) {
+    while (length > 0) {
+        ssize_t got = pread(fd, out, length, static_cast<off_t>(offset));
+        if (got <= 0) {
+            return false;
+        }
+        out += got;
+        length -= static_cast<size_t>(got);
+        offset += static_cast<unsigned long long>(got);
+    }
+    return true;
+}
+
+bool isTiledImage(const std::string& filename) {
+    FILE* file = fopen(filename.c_str(), "rb");
+    if (!file) {
+        return false;
+    }
+    char magic[4];
+    bool tiled = fread(magic, 1, 4, file) == 4 && memcmp(magic, TILED_MAGIC, 4) == 0;
+    fclose(file);
+    return tiled;
+}
+
+bool isTiledPath(const std::string& filename) {
+    size_t dot = filename.find_last_of('.');
+    std::string extension = (dot == std::string::npos) ? "" : filename.substr(dot + 1);
+    for (auto& c : extension) {
+        c = static_cast<char>(tolower(c));
+    }
+    return extension == "mft";
+}
+
+TiledImageReader::TiledImageReader(const std::string& filename) : filename(filename) {
+    fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Failed to open image: " + filename);
+    }
+
+    unsigned char header[TILED_HEADER_SIZE];
+    bool valid = readAt(fd, header, sizeof(header), 0) && memcmp(header, TILED_MAGIC, 4) == 0 &&
+                 getLittleEndian(header + 4, 4) == TILED_VERSION;
+    if (valid) {
+        width = static_cast<int>(getLittleEndian(header + 8, 4));
+        height = static_cast<int>(getLittleEndian(header + 12, 4));
+        tileWidth = static_cast<int>(getLittleEndian(header + 16, 4));
+        tileHeight = static_cast<int>(getLittleEndian(header + 20, 4));
+        valid = width > 0 && height > 0 && tileWidth > 0 && tileHeight > 0;
+    }
+    if (!valid) {
+        close(fd);
+        throw std::runtime_error("Not a tiled image: " + filename);
+    }
+
+    tilesAcross = (width + tileWidth - 1) / tileWidth;
+    tilesDown = (height + tileHeight - 1) / tileHeight;
+
+    size_t tiles = static_cast<size_t>(tilesAcross) * tilesDown;
+    std::vector<unsigned char> entries(tiles * TILED_ENTRY_SIZE);
+    if (!readAt(fd, entries.data(), entries.size(), TILED_HEADER_SIZE)) {
+        close(fd);
+        throw std::runtime_error("Truncated tile index: " + filename);
+    }
+
+    index.resize(tiles);
+    for (size_t t = 0; t < tiles; ++t) {
+        const unsigned char* entry = &entries[t * TILED_ENTRY_SIZE];
+        index[t].offset = getLittleEndian(entry, 8);
+        index[t].size = static_cast<unsigned int>(getLittleEndian(entry + 8, 4));
+        index[t].codec = static_cast<unsigned int>(getLittleEndian(entry + 12, 4));
+    }
+}
+
+TiledImageReader::~TiledImageReader() {
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+void TiledImageReader::decodeTile(int tx, int ty, unsigned char* out) const {
+    const TileEntry& entry = index[static_cast<size_t>(ty) * tilesAcross + tx];
+    int w = std::min(tileWidth, width - tx * tileWidth);
+    int h = std::min(tileHeight, height - ty * tileHeight);
+    uLongf rawSize = static_cast<uLongf>(w) * h;
+
+    if (entry.codec == TILE_STORED) {
+        if (entry.size != rawSize || !readAt(fd, out, rawSize, entry.offset)) {
+            throw std::runtime_error("Corrupt tile in: " + filename);
+        }
+        return;
+    }
+
+    std::vector<unsigned char> compressed(entry.size);
+    uLongf decoded = rawSize;
+    if (entry.codec != TILE_DEFLATE || !readAt(fd, compressed.data(), compressed.size(), entry.offset) ||
+        uncompress(out, &decoded, compressed.data(), entry.size) != Z_OK || decoded != rawSize) {
+        throw std::runtime_error("Corrupt tile in: " + filename);
+    }
+}
+
+void TiledImageReader::readRegion(int x, int y, int w, int h, unsigned char* out, int threads) const {
+    if (x < 0 || y < 0 || w <= 0 || h <= 0 || x + w > width || y + h > height) {
+        throw std::runtime_error("Region outside the image: " + filename);
+    }
+
+    int firstTx = x / tileWidth;
+    int lastTx = (x + w - 1) / tileWidth;
+    int firstTy = y / tileHeight;
+    int lastTy = (y + h - 1) / tileHeight;
+    int across = lastTx - firstTx + 1;
+    int count = across * (lastTy - firstTy + 1);
+
+    // every overlapping tile is decoded once, then only its intersection with the region is kept
+    ThreadPool::sharedFor(count, [&](int i) {
+        int tx = firstTx + i % across;
+        int ty = firstTy + i / across;
+        int tileX = tx * tileWidth;
+        int tileY = ty * tileHeight;
+        int tileW = std::min(tileWidth, width - tileX);
+
+        std::vector<unsigned char> tile(static_cast<size_t>(tileW) * std::min(tileHeight, height - tileY));
+        decodeTile(tx, ty, tile.data());
+
+        int fromX = std::max(x, tileX);
+        int toX = std::min(x + w, tileX + tileW);
+        int fromY = std::max(y, tileY);
+        int toY = std::min(y + h, tileY + tileHeight);
+        for (int row = fromY; row < toY; ++row) {
+            memcpy(out + static_cast<size_t>(row - y) * w + (fromX - x),
+                   &tile[static_cast<size_t>(row - tileY) * tileW + (fromX - tileX)], toX - fromX);
+        }
+    }, threads);
+}
+
+void TiledImageReader::readRows(int firstRow, int numRows, unsigned char* out, int threads) const {
+    readRegion(0, firstRow, width, numRows, out, threads);
+}
+
+void writeTiledImage(const std::string& filename, const unsigned char* pixels, int width, int height,
+                     const TiledOptions& options) {
+    int tileWidth = std::max(1, options.tileWidth);
+    int tileHeight = std::max(1, options.tileHeight);
+    int tilesAcross = (width + tileWidth - 1) / tileWidth;
+    int tilesDown = (height + tileHeight - 1) / tileHeight;
+    int tiles = tilesAcross * tilesDown;
+
+    // every tile is gathered into its own contiguous buffer and compressed independently
+    std::vector<std::vector<unsigned char>> encoded(tiles);
+    std::vector<unsigned int> codecs(tiles);
+    ThreadPool::sharedFor(tiles, [&](int t) {
+        int tileX = (t % tilesAcross) * tileWidth;
+        int tileY = (t / tilesAcross) * tileHeight;
+        int w = std::min(tileWidth, width - tileX);
+        int h = std::min(tileHeight, height - tileY);
+
+        std::vector<unsigned char> raw(static_cast<size_t>(w) * h);
+        for (int row = 0; row < h; ++row) {
+            memcpy(&raw[static_cast<size_t>(row) * w], pixels + static_cast<size_t>(tileY + row) * width + tileX, w);
+        }
+
+        uLongf size = compressBound(raw.size());
+        encoded[t].resize(size);
+        if (compress2(encoded[t].data(), &size, raw.data(), raw.size(), options.level) == Z_OK && size < raw.size()) {
+            encoded[t].resize(size);
+            codecs[t] = TILE_DEFLATE;
+        } else {
+            encoded[t].swap(raw);
+            codecs[t] = TILE_STORED;
+        }
+    }, options.threads);
+
+    unsigned char header[TILED_HEADER_SIZE] = {};
+    memcpy(header, TILED_MAGIC, 4);
+    putLittleEndian(header + 4, TILED_VERSION, 4);
+    putLittleEndian(header + 8, width, 4);
+    putLittleEndian(header + 12, height, 4);
+    putLittleEndian(header + 16, tileWidth, 4);
+    putLittleEndian(header + 20, tileHeight, 4);
+
+    std::vector<unsigned char> entries(static_cast<size_t>(tiles) * TILED_ENTRY_SIZE);
+    unsigned long long offset = TILED_HEADER_SIZE + entries.size();
+    for (int t = 0; t < tiles; ++t) {
+        unsigned char* entry = &entries[static_cast<size_t>(t) * TILED_ENTRY_SIZE];
+        putLittleEndian(entry, offset, 8);
+        putLittleEndian(entry + 8, encoded[t].size(), 4);
+        putLittleEndian(entry + 12, codecs[t], 4);
+        offset += encoded[t].size();
+    }
+
+    FILE* file = fopen(filename.c_str(), "wb");
+    if (!file) {
+        throw std::runtime_error("Failed to save image: " + filename);
+    }
+    fwrite(header, 1, sizeof(header), file);
+    fwrite(entries.data(), 1, entries.size(), file);
+    for (const auto& tile : encoded) {
+        fwrite(tile.data(), 1, tile.size(), file);
+    }
+
+    bool failed = ferror(file) != 0;
+    failed = (fclose(file) != 0) || failed;
+    if (failed) {
+        throw std::runtime_error("Failed to save image: " + filename);
+    }
+}
@@ -0,0 +1,89 @@
+#pragma once
+#include <string>
+#include <vector>
+
+/*
+    tiled container (.mft), all integers little-endian:
+        header  "MFET", version, width, height, tile width, tile height, 2 reserved (8 x uint32)
+        index   one entry per tile, row-major: offset (uint64), size (uint32), codec (uint32)
+        tiles   each compressed on its own, so any subset can be decoded in parallel
+    edge tiles are clipped to the image, a tile holds its rows contiguously
+*/
+#define TILED_MAGIC "MFET"
+#define TILED_VERSION 1
+#define TILED_HEADER_SIZE 32
+#define TILED_ENTRY_SIZE 16
+
+// tile codecs, a tile that does not shrink is stored
+#define TILE_STORED 0
+#define TILE_DEFLATE 1
+
+struct TiledOptions {
+    int tileWidth = 256;
+    int tileHeight = 256;
+    int level = 1;   // zlib level of the tiles, 1 keeps encoding and decoding cheap
+    int threads = 0; // 0 = whole shared pool
+};
+
+// true when the file starts with the tiled container magic
+bool isTiledImage(const std::string& filename);
+
+// true when an output path asks for the tiled container (.mft)
+bool isTiledPath(const std::string& filename);
+
+/*
+    random access reader: only the header and index are read up front, tiles are read with
+    pread and decoded when a region overlapping them is requested
+*/
+class TiledImageReader {
+public:
+    // throws runtime_error when the file cannot be opened or is not a valid container
+    explicit TiledImageReader(const std::string& filename);
+    ~TiledImageReader();
+
+    TiledImageReader(const TiledImageReader&) = delete;
+    TiledImageReader& operator=(const TiledImageReader&) = delete;
+
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+    int getTileWidth() const { return tileWidth; }
+    int getTileHeight() const { return tileHeight; }
+
+    /*
+        decodes the tiles overlapping a rectangle (in parallel) and copies the rectangle out
+        @param x, y, w, h: rectangle, must lie inside the image
+        @param out: w * h bytes, row by row
+        @param threads: 0 = whole shared pool, 1 = calling thread only
+    */
+    void readRegion(int x, int y, int w, int h, unsigned char* out, int threads = 0) const;
+
+    // full width rows [firstRow, firstRow + numRows), e.g. a strip plus its halo rows
+    void readRows(int firstRow, int numRows, unsigned char* out, int threads = 0) const;
+
+private:
+    struct TileEntry {
+        unsigned long long offset;
+        unsigned int size;
+        unsigned int codec;
+    };
+
+    std::string filename;
+    int fd = -1;
+    int width = 0;
+    int height = 0;
+    int tileWidth = 0;
+    int tileHeight = 0;
+    int tilesAcross = 0;
+    int tilesDown = 0;
+    std::vector<TileEntry> index;
+
+    // decodes tile (tx, ty) into out, clipped tile width * clipped tile height bytes
+    void decodeTile(int tx, int ty, unsigned char* out) const;
+};
+
+/*
+    writes a tiled container, tiles are compressed in parallel on the shared pool
+    @param pixels: width * height bytes, row by row
+*/
+void writeTiledImage(const std::string& filename, const unsigned char* pixels, int width, int height,
+                     const TiledOptions& options = TiledOptions());
@@ -0,0 +1,295 @@
+#pragma once
+/*
+    libmfe: the three-layer feature extraction as an embeddable library
+
+    a context owns the worker threads and the scratch layers, so repeated runs on frames of
+    similar size allocate nothing; every buffer crossing the API belongs to the caller and is
+    described by a pointer and a row stride in bytes, so sub-images and padded capture buffers
+    are used as they are; a context runs one frame at a time, threads wanting to run frames
+    concurrently each create their own
+
+    plain C interface, callable from C and C++; mfe::Context at the end wraps it for C++
+*/
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MFE_VERSION_MAJOR 1
+#define MFE_VERSION_MINOR 0
+
+typedef enum {
+    MFE_OK = 0,
+    MFE_ERROR_INVALID_ARGUMENT, /* null context or input, bad geometry, unknown backend */
+    MFE_ERROR_OUT_OF_MEMORY,    /* scratch layers could not be allocated */
+    MFE_ERROR_INTERNAL          /* anything else, see mfe_last_error */
+} mfe_status;
+
+typedef enum {
+    MFE_BACKEND_SERIAL = 0,  /* the calling thread only */
+    MFE_BACKEND_THREADS      /* rows spread over a pool owned by the context */
+} mfe_backend;
+
+typedef enum {
+    MFE_PRECISION_DOUBLE = 0, /* bit-identical to the command line implementations */
+    MFE_PRECISION_FLOAT       /* half the scratch memory, a pixel may differ by 1 where rounding crosses an integer */
+} mfe_precision;
+
+typedef struct {
+    mfe_backend backend;
+    int threads;              /* MFE_BACKEND_THREADS only, 0 = one per hardware thread */
+    mfe_precision precision;
+} mfe_options;
+
+/* 8-bit greyscale image, rows stride bytes apart (stride >= width) */
+typedef struct {
+    const uint8_t* data;
+    int width;
+    int height;
+    size_t stride;
+} mfe_image;
+
+typedef struct {
+    uint8_t* data;
+    size_t stride;
+} mfe_output;
+
+/*
+    the layers as normalized values (0 - 255) in the precision of the context: double or float
+    elements, rows stride bytes apart; a plane with a null data pointer is skipped
+*/
+typedef struct {
+    void* data;
+    size_t stride;
+} mfe_plane;
+
+typedef struct mfe_context mfe_context;
+
+/* serial backend, double precision */
+mfe_options mfe_default_options(void);
+
+/*
+    creates a context, *context is left null on failure
+    @param options: null for mfe_default_options()
+*/
+mfe_status mfe_create(const mfe_options* options, mfe_context** context);
+
+void mfe_destroy(mfe_context* context);
+
+/*
+    runs the three layers and writes the final feature map, quantized to bytes
+    @param output: width * height bytes at output->data, rows output->stride apart
+*/
+mfe_status mfe_run(mfe_context* context, const mfe_image* input, const mfe_output* output);
+
+/*
+    same, also handing out every layer
+    @param layers: three planes (layer 1, 2 and 3), null ones skipped
+    @param output: may be null when only the layers are wanted
+*/
+mfe_status mfe_run_layers(mfe_context* context, const mfe_image* input, const mfe_plane layers[3],
+                          const mfe_output* output);
+
+/*
+    temporal prediction, for contexts fed consecutive frames of a stream: layers 1 and 2 are
+    normalized with the min / max the previous frame had, in the same pass as their convolution,
+    instead of a convolution pass plus a min / max barrier and a normalization sweep; a layer whose
+    real range moved by more than tolerance (a fraction of the predicted range) is convolved again
+    with its real range, so tolerance 0 keeps the results exact and larger values trade accuracy
+    for fewer passes; the history and the statistics are reset on every call and the history
+    whenever the frame size changes
+    @param enabled: 0 turns it off (the default)
+*/
+mfe_status mfe_set_temporal(mfe_context* context, int enabled, double tolerance);
+
+typedef struct {
+    long long frames;            /* frames run with a prediction available */
+    long long layers_predicted;  /* layers that kept the predicted range, one pass each */
+    long long layers_recomputed; /* layers convolved again with their real range */
+} mfe_temporal_stats;
+
+mfe_status mfe_get_temporal_stats(const mfe_context* context, mfe_temporal_stats* stats);
+
+/*
+    incremental recomputation, for an image that keeps changing in small rectangles (overlays,
+    annotations, partial sensor updates): the state keeps the raw layers, and an update only
+    recomputes the changed rectangle grown by the kernel radii (6 pixels over the three layers);
+    the min / max of the last layer is only rescanned when the rectangle held an extremum that is
+    gone, and the output is only rewritten outside the rectangle when that range moved
+    the layers are chained unnormalized and only the last one is normalized, so results may be 1
+    off the other implementations on a few pixels; an update gives exactly what a new state on the
+    updated image would
+    the state uses the context's threads: the context must outlive it, and runs on the two must
+    not overlap
+*/
+typedef struct mfe_incremental mfe_incremental;
+
+typedef struct {
+    long long updates;
+    long long recomputed_pixels; /* summed over the three layers */
+    long long rescans;           /* full min / max scans after an extremum was overwritten */
+    long long full_requantizes;  /* updates that moved the range, rewriting every output pixel */
+} mfe_incremental_stats;
+
+/* computes the whole image once, writing output, and keeps its layers in *state */
+mfe_status mfe_incremental_create(mfe_context* context, const mfe_image* input, const mfe_output* output,
+                                  mfe_incremental** state);
+
+/*
+    @param input: the whole updated image, same size as the one the state was created with
+    @param x, y, width, height: the rectangle that changed
+    @param output: holding the result of the previous create / update, only changed pixels are written
+*/
+mfe_status mfe_incremental_update(mfe_incremental* state, const mfe_image* input, int x, int y,
+                                  int width, int height, const mfe_output* output);
+
+mfe_status mfe_incremental_get_stats(const mfe_incremental* state, mfe_incremental_stats* stats);
+
+void mfe_incremental_destroy(mfe_incremental* state);
+
+/*
+    on-demand tiles, for viewers showing small regions of images too large to run whole: a tile
+    reads only its input region grown by the kernel radii (6 pixels); the raw layers are chained
+    and only the last one is normalized, with the global min / max of a summary, so a tile matches
+    the same pixels of mfe_run up to the rounding of the intermediate normalizations (a handful of
+    pixels 1 apart, as with mfe_incremental); the summary is computed once per image by
+    mfe_summarize, one pass over bands of rows that never holds the whole image, and is meant to
+    be stored next to it
+    the raw last layer of the most recently rendered tiles is kept, so a revisited tile only
+    costs its quantization; a tile set holds no threads, every render runs on the context it is
+    given, so threads with contexts of their own can share one tile set
+*/
+
+/*
+    copies the rectangle (x, y, width, height) of the source image into out, rows stride bytes
+    apart; may be called from several threads at once, returns 0 on success
+*/
+typedef int (*mfe_region_reader)(void* user, int x, int y, int width, int height, uint8_t* out, size_t stride);
+
+typedef struct {
+    mfe_region_reader read;
+    void* user;
+    int width;
+    int height;
+} mfe_source;
+
+/* min / max of the three raw layers over the whole image, each convolved from the previous one unnormalized */
+typedef struct {
+    double min[3];
+    double max[3];
+} mfe_summary;
+
+typedef struct mfe_tiles mfe_tiles;
+
+typedef struct {
+    long long rendered;
+    long long cache_hits;   /* tiles quantized from their cached raw layer */
+    long long cache_misses; /* tiles computed from their input region */
+    long long evictions;
+} mfe_tiles_stats;
+
+/* @param tile_size: rows of the bands the work is split into */
+mfe_status mfe_summarize(mfe_context* context, const mfe_source* source, int tile_size, mfe_summary* summary);
+
+/*
+    @param tile_size: edge of the tiles mfe_tiles_render addresses, in pixels
+    @param cache_tiles: raw tiles kept, 0 disables the cache
+*/
+mfe_status mfe_tiles_create(const mfe_source* source, const mfe_summary* summary, int tile_size,
+                            size_t cache_tiles, mfe_tiles** tiles);
+
+/*
+    renders tile (tx, ty), clipped to the image at the right and bottom edges
+    @param output: tile width * tile height bytes, rows output->stride apart
+*/
+mfe_status mfe_tiles_render(mfe_context* context, mfe_tiles* tiles, int tx, int ty, const mfe_output* output);
+
+mfe_status mfe_tiles_get_stats(const mfe_tiles* tiles, mfe_tiles_stats* stats);
+
+void mfe_tiles_destroy(mfe_tiles* tiles);
+
+/*
+    multiscale runs: a Gaussian pyramid of the input, every level the previous one blurred with
+    the binomial kernel (1 4 6 4 1) / 16 and halved in the same pass, then the three layers on
+    every level in one call, decoding and threads shared; the levels run concurrently, largest
+    first, with the context's threads shared out between them by their size; level 0 is the input
+    itself, its output is what mfe_run gives
+*/
+#define MFE_PYRAMID_MAX_LEVELS 16
+
+/* edge of pyramid level `level` for an input edge of size: halved at every level, rounding up */
+int mfe_pyramid_level_size(int size, int level);
+
+/*
+    @param levels: 1 to MFE_PYRAMID_MAX_LEVELS
+    @param outputs: one per level, mfe_pyramid_level_size(width, k) * mfe_pyramid_level_size(height, k)
+                    bytes for level k
+*/
+mfe_status mfe_run_pyramid(mfe_context* context, const mfe_image* input, int levels, const mfe_output* outputs);
+
+/* message of the last failed call on this context, "" if none */
+const char* mfe_last_error(const mfe_context* context);
+
+const char* mfe_status_string(mfe_status status);
+
+#ifdef __cplusplus
+}
+
+#include <stdexcept>
+#include <string>
+
+namespace mfe {
+
+// owning wrapper, throws runtime_error where the C calls return an error
+class Context {
+public:
+    explicit Context(const mfe_options& options = mfe_default_options()) {
+        mfe_status status = mfe_create(&options, &context);
+        if (status != MFE_OK) {
+            throw std::runtime_error(std::string("mfe_create: ") + mfe_status_string(status));
+        }
+    }
+
+    ~Context() { mfe_destroy(context); }
+
+    Context(const Context&) = delete;
+    Context& operator=(const Context&) = delete;
+
+    void run(const mfe_image& input, const mfe_output& output) {
+        check(mfe_run(context, &input, &output));
+    }
+
+    void runLayers(const mfe_image& input, const mfe_plane layers[3], const mfe_output* output = nullptr) {
+        check(mfe_run_layers(context, &input, layers, output));
+    }
+
+    void setTemporal(bool enabled, double tolerance = 0.0) {
+        check(mfe_set_temporal(context, enabled ? 1 : 0, tolerance));
+    }
+
+    void runPyramid(const mfe_image& input, int levels, const mfe_output* outputs) {
+        check(mfe_run_pyramid(context, &input, levels, outputs));
+    }
+
+    mfe_temporal_stats temporalStats() const {
+        mfe_temporal_stats stats;
+        check(mfe_get_temporal_stats(context, &stats));
+        return stats;
+    }
+
+    mfe_context* get() const { return context; }
+
+private:
+    mfe_context* context = nullptr;
+
+    void check(mfe_status status) const {
+        if (status != MFE_OK) {
+            throw std::runtime_error(mfe_last_error(context));
+        }
+    }
+};
+
+} // namespace mfe
+#endif
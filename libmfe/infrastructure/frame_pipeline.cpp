@@ -0,0 +1,233 @@
+#include "frame_pipeline.h"
+#include "../helpers/batch_inputs.h"
+#include "../helpers/image.h"
+#include "../helpers/preview.h"
+#include "../helpers/row_source.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+
+using namespace std;
+using namespace std::chrono;
+
+static long long microsSince(steady_clock::time_point start) {
+    return duration_cast<microseconds>(steady_clock::now() - start).count();
+}
+
+FramePipeline::FramePipeline(mfe::Context& context, const FrameOptions& options)
+    : context(context), options(options), slots(max(1, options.slots)),
+      freeSlots(slots.size()), decoded(slots.size()), computed(slots.size()) {}
+
+int FramePipeline::run(const FrameSource& source) {
+    if (!options.outputDir.empty()) {
+        filesystem::create_directories(options.outputDir);
+    }
+    if (!source.rawPath.empty()) {
+        if (source.rawWidth <= 0 || source.rawHeight <= 0) {
+            throw runtime_error("Raw frames need a size");
+        }
+        rawInput = source.rawPath == "-" ? stdin : fopen(source.rawPath.c_str(), "rb");
+        if (!rawInput) {
+            throw runtime_error("Cannot open " + source.rawPath);
+        }
+    }
+    if (!options.outputStream.empty()) {
+        rawOutput = options.outputStream == "-" ? stdout : fopen(options.outputStream.c_str(), "wb");
+        if (!rawOutput) {
+            throw runtime_error("Cannot create " + options.outputStream);
+        }
+    }
+
+    for (int i = 0; i < static_cast<int>(slots.size()); ++i) {
+        freeSlots.push(i);
+    }
+    frames = 0;
+    dropped = 0;
+    failed = 0;
+    latencies.clear();
+    decodeDone = false;
+    computeDone = false;
+
+    auto start = steady_clock::now();
+    thread decoder(&FramePipeline::decodeLoop, this, cref(source));
+    thread encoder(&FramePipeline::encodeLoop, this);
+
+    // the calling thread drives the layers, the context's pool does the rows
+    computeLoop();
+
+    decoder.join();
+    encoder.join();
+    seconds = duration<double>(steady_clock::now() - start).count();
+
+    if (rawInput && rawInput != stdin) {
+        fclose(rawInput);
+    }
+    rawInput = nullptr;
+    if (rawOutput) {
+        if (rawOutput == stdout) {
+            fflush(stdout);
+        } else {
+            fclose(rawOutput);
+        }
+    }
+    rawOutput = nullptr;
+    return static_cast<int>(failed);
+}
+
+double FramePipeline::getLatencyMs(double p) const {
+    if (latencies.empty()) {
+        return 0.0;
+    }
+    vector<double> sorted = latencies;
+    sort(sorted.begin(), sorted.end());
+    size_t rank = static_cast<size_t>(ceil(p * sorted.size()));
+    return sorted[max<size_t>(rank, 1) - 1];
+}
+
+void FramePipeline::decodeLoop(const FrameSource& source) {
+    size_t count = source.rawPath.empty() ? source.files.size() : SIZE_MAX;
+    for (size_t index = 0; index < count; ++index) {
+        // waiting here is the backpressure: no more frames in flight than slots
+        int slotIndex;
+        popWaiting(freeSlots, slotIndex);
+        Slot& slot = slots[slotIndex];
+        slot.index = index;
+        slot.started = steady_clock::now();
+
+        bool read;
+        try {
+            read = decode(source, index, slot);
+        } catch (const exception& e) {
+            cerr << e.what() << endl;
+            read = false;
+        }
+        decodeMicros += microsSince(slot.started);
+
+        if (!read) {
+            pushWaiting(freeSlots, slotIndex);
+            // the end of a raw stream is not a failure
+            if (!source.rawPath.empty()) {
+                break;
+            }
+            ++failed;
+            continue;
+        }
+        ++waitingDecoded;
+        pushWaiting(decoded, slotIndex);
+    }
+    decodeDone.store(true, memory_order_release);
+}
+
+bool FramePipeline::decode(const FrameSource& source, long long index, Slot& slot) {
+    if (!source.rawPath.empty()) {
+        int factor = previewFactor();
+        slot.name.clear();
+        if (factor == 1) {
+            slot.width = source.rawWidth;
+            slot.height = source.rawHeight;
+            slot.input.resize(static_cast<size_t>(slot.width) * slot.height);
+            return fread(slot.input.data(), 1, slot.input.size(), rawInput) == slot.input.size();
+        }
+
+        slot.raw.resize(static_cast<size_t>(source.rawWidth) * source.rawHeight);
+        if (fread(slot.raw.data(), 1, slot.raw.size(), rawInput) != slot.raw.size()) {
+            return false;
+        }
+        slot.width = previewSize(source.rawWidth, factor);
+        slot.height = previewSize(source.rawHeight, factor);
+        slot.input.resize(static_cast<size_t>(slot.width) * slot.height);
+        boxDownsample(slot.raw.data(), source.rawWidth, source.rawHeight, source.rawWidth, factor, slot.input.data(), 1);
+        return true;
+    }
+
+    // rows land straight in the slot, which keeps its buffer while the resolution does not change;
+    // like encoding, decoding stays on this thread, tiled bands included, so it never waits on a pool
+    slot.name = source.files[index];
+    size_t offset = 0;
+    bool read = streamGreyRows(slot.name,
+        [&](int width, int height) {
+            slot.width = width;
+            slot.height = height;
+            slot.input.resize(static_cast<size_t>(width) * height);
+        },
+        [&](const unsigned char* row) {
+            memcpy(slot.input.data() + offset, row, slot.width);
+            offset += slot.width;
+        }, 1);
+    if (!read) {
+        cerr << "Skipping unreadable frame: " << slot.name << endl;
+    }
+    return read;
+}
+
+void FramePipeline::computeLoop() {
+    int slotIndex;
+    while (popOrFinish(decoded, decodeDone, slotIndex)) {
+        Slot& slot = slots[slotIndex];
+        int newer = --waitingDecoded;
+
+        // bounded latency: a late frame is skipped when a fresher one is already waiting
+        if (options.maxLatencyMs > 0.0 && newer > 0
+            && microsSince(slot.started) > options.maxLatencyMs * 1000.0) {
+            ++dropped;
+            pushWaiting(freeSlots, slotIndex);
+            continue;
+        }
+
+        auto start = steady_clock::now();
+        try {
+            slot.output.resize(slot.input.size());
+            context.run(mfe_image{ slot.input.data(), slot.width, slot.height, static_cast<size_t>(slot.width) },
+                        mfe_output{ slot.output.data(), static_cast<size_t>(slot.width) });
+        } catch (const exception& e) {
+            cerr << "Frame " << slot.index << ": " << e.what() << endl;
+            ++failed;
+            computeMicros += microsSince(start);
+            pushWaiting(freeSlots, slotIndex);
+            continue;
+        }
+        computeMicros += microsSince(start);
+        pushWaiting(computed, slotIndex);
+    }
+    computeDone.store(true, memory_order_release);
+}
+
+void FramePipeline::encodeLoop() {
+    // one frame is encoded at a time, serially (tiled outputs too), so the compute stage keeps the cores
+    PngOptions pngOptions = defaultPngOptions();
+    pngOptions.threads = 1;
+
+    int slotIndex;
+    while (popOrFinish(computed, computeDone, slotIndex)) {
+        Slot& slot = slots[slotIndex];
+        auto start = steady_clock::now();
+        try {
+            if (rawOutput) {
+                if (fwrite(slot.output.data(), 1, slot.output.size(), rawOutput) != slot.output.size()) {
+                    throw runtime_error("Cannot write " + options.outputStream);
+                }
+            } else if (!options.outputDir.empty()) {
+                string path;
+                if (slot.name.empty()) {
+                    char name[32];
+                    snprintf(name, sizeof(name), "frame_%06lld.png", slot.index);
+                    path = (filesystem::path(options.outputDir) / name).string();
+                } else {
+                    path = batchOutputPath(options.outputDir, slot.name);
+                }
+                GreyScaleImage::saveBytes(path, slot.output.data(), slot.width, slot.height, pngOptions);
+            }
+            ++frames;
+            latencies.push_back(microsSince(slot.started) / 1000.0);
+        } catch (const exception& e) {
+            cerr << e.what() << endl;
+            ++failed;
+        }
+        encodeMicros += microsSince(start);
+        pushWaiting(freeSlots, slotIndex);
+    }
+}
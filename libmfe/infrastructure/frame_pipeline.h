@@ -0,0 +1,96 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "mfe.h"
+#include "../helpers/mpmc_queue.h"
+
+// frames in flight when no count is given: one decoding, one in the layers, one encoding
+#define FRAME_SLOTS 3
+
+// where the frames of a sequence come from
+struct FrameSource {
+    std::vector<std::string> files; // image files in order (PNG, PGM, raw, ...)
+    std::string rawPath;            // or fixed-size 8-bit frames back to back, "-" for stdin
+    int rawWidth = 0;
+    int rawHeight = 0;
+};
+
+struct FrameOptions {
+    int slots = FRAME_SLOTS;    // frames in flight, every one owns its buffers for the whole run
+    double maxLatencyMs = 0.0;  // > 0: a frame older than this is dropped when a newer one is waiting
+    std::string outputDir;      // one image per frame, named after its input (frame_<n>.png for raw input)
+    std::string outputStream;   // or every output frame back to back in one raw file, "-" for stdout
+};
+
+/*
+    runs a sequence of same-size frames through three overlapping stages: frame N is decoded
+    while frame N-1 goes through the layers and frame N-2 is encoded; a fixed ring of slots
+    carries the frames, so buffers are allocated once and the number of frames in flight, and
+    with it the latency of a frame, is bounded by the slot count
+*/
+class FramePipeline {
+public:
+    // @param context: libmfe context running the layers, its pool stays warm across frames
+    FramePipeline(mfe::Context& context, const FrameOptions& options);
+
+    // @return number of frames that failed
+    int run(const FrameSource& source);
+
+    long long getFrames() const { return frames; }
+    long long getDropped() const { return dropped; }
+    long long getFailed() const { return failed; }
+    double getSeconds() const { return seconds; }
+    double getFps() const { return seconds > 0.0 ? frames / seconds : 0.0; }
+
+    // decode start to encode end of a written frame, p in [0, 1]
+    double getLatencyMs(double p) const;
+
+    // time spent working in each stage
+    long long getDecodeMs() const { return decodeMicros / 1000; }
+    long long getComputeMs() const { return computeMicros / 1000; }
+    long long getEncodeMs() const { return encodeMicros / 1000; }
+
+private:
+    struct Slot {
+        std::vector<unsigned char> input;
+        std::vector<unsigned char> output;
+        std::vector<unsigned char> raw; // a raw frame before its preview downsample
+        int width = 0;
+        int height = 0;
+        long long index = 0;
+        std::string name;
+        std::chrono::steady_clock::time_point started;
+    };
+
+    mfe::Context& context;
+    FrameOptions options;
+
+    std::vector<Slot> slots;
+    MpmcQueue<int> freeSlots;
+    MpmcQueue<int> decoded;
+    MpmcQueue<int> computed;
+    std::atomic<int> waitingDecoded{0};
+    std::atomic<bool> decodeDone{false};
+    std::atomic<bool> computeDone{false};
+    FILE* rawInput = nullptr;
+    FILE* rawOutput = nullptr;
+
+    long long frames = 0;   // written, encode stage only
+    long long dropped = 0;  // compute stage only
+    std::atomic<long long> failed{0};
+    double seconds = 0.0;
+    std::vector<double> latencies;
+    std::atomic<long long> decodeMicros{0};
+    std::atomic<long long> computeMicros{0};
+    std::atomic<long long> encodeMicros{0};
+
+    void decodeLoop(const FrameSource& source);
+    bool decode(const FrameSource& source, long long index, Slot& slot);
+    void computeLoop();
+    void encodeLoop();
+};
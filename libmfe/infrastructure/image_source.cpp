@@ -0,0 +1,77 @@
+#include "image_source.h"
+#include "../helpers/result_cache.h"
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+using namespace std;
+
+// MFES files held the ranges of the normalized layers, they are recomputed
+#define SUMMARY_MAGIC "MFS2"
+
+// may run on every pool thread at once: tiled reads use pread, the rest only reads bytes
+static int readImageRegion(void* user, int x, int y, int width, int height, uint8_t* out, size_t stride) {
+    const GreyScaleImage& image = *static_cast<const GreyScaleImage*>(user);
+    try {
+        if (const TiledImageReader* tiled = image.getTiledInput()) {
+            if (stride == static_cast<size_t>(width)) {
+                tiled->readRegion(x, y, width, height, out, 1);
+            } else {
+                vector<unsigned char> region(static_cast<size_t>(width) * height);
+                tiled->readRegion(x, y, width, height, region.data(), 1);
+                for (int row = 0; row < height; ++row) {
+                    memcpy(out + row * stride, region.data() + static_cast<size_t>(row) * width, width);
+                }
+            }
+            return 0;
+        }
+        const unsigned char* pixels = image.getBytes();
+        for (int row = 0; row < height; ++row) {
+            memcpy(out + row * stride, pixels + static_cast<size_t>(y + row) * image.getWidth() + x, width);
+        }
+        return 0;
+    } catch (const exception& e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
+}
+
+mfe_source imageSource(const GreyScaleImage& image) {
+    // decoded now, so no reader thread decodes it lazily while the others wait
+    if (!image.getTiledInput()) {
+        image.getBytes();
+    }
+    return mfe_source{ readImageRegion, const_cast<GreyScaleImage*>(&image), image.getWidth(), image.getHeight() };
+}
+
+bool loadSummary(const string& path, int width, int height, mfe_summary& summary) {
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file) {
+        return false;
+    }
+    char magic[4];
+    uint64_t hash = 0;
+    int32_t size[2] = { 0, 0 };
+    bool read = fread(magic, 1, 4, file) == 4 && fread(&hash, sizeof(hash), 1, file) == 1
+             && fread(size, sizeof(size), 1, file) == 1 && fread(&summary, sizeof(summary), 1, file) == 1;
+    fclose(file);
+    // a summary of another image or of other kernels is recomputed
+    return read && memcmp(magic, SUMMARY_MAGIC, 4) == 0 && hash == configurationHash()
+        && size[0] == width && size[1] == height;
+}
+
+void saveSummary(const string& path, int width, int height, const mfe_summary& summary) {
+    FILE* file = fopen(path.c_str(), "wb");
+    if (!file) {
+        throw runtime_error("Cannot create " + path);
+    }
+    uint64_t hash = configurationHash();
+    int32_t size[2] = { width, height };
+    bool written = fwrite(SUMMARY_MAGIC, 1, 4, file) == 4 && fwrite(&hash, sizeof(hash), 1, file) == 1
+                && fwrite(size, sizeof(size), 1, file) == 1 && fwrite(&summary, sizeof(summary), 1, file) == 1;
+    if (fclose(file) != 0 || !written) {
+        throw runtime_error("Cannot write " + path);
+    }
+}
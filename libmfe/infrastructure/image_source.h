@@ -0,0 +1,22 @@
+#pragma once
+#include <string>
+
+#include "mfe.h"
+#include "../helpers/image.h"
+
+/*
+    an image as a libmfe tile source: tiled inputs (.mft) decode only the tiles under a region,
+    mapped PGM / raw inputs are copied from the page cache, anything else is decoded whole here
+    @param image: must outlive the source and the tile sets built on it
+*/
+mfe_source imageSource(const GreyScaleImage& image);
+
+/*
+    summary file: "MFS2", pipeline configuration hash (uint64), width, height (int32), then the
+    min / max of the three layers (mfe_summary)
+    @return false when the file is missing or belongs to another size or other kernels
+*/
+bool loadSummary(const std::string& path, int width, int height, mfe_summary& summary);
+
+// throws runtime_error when the file cannot be written
+void saveSummary(const std::string& path, int width, int height, const mfe_summary& summary);
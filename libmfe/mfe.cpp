@@ -0,0 +1,371 @@
+#include <iostream>
+#include <algorithm>
+#include <memory>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <vector>
+#include "../helpers/image.h"
+#include "../helpers/quantize.h"
+#include "../helpers/batch_inputs.h"
+#include "../helpers/result_cache.h"
+#include "../helpers/preview.h"
+#include "mfe.h"
+#include "frame_pipeline.h"
+#include "image_source.h"
+
+using namespace std;
+using namespace std::chrono;
+
+// writes one normalized layer as an 8-bit image, truncated like the final output
+template <typename T>
+static void saveLayer(const string& filename, const vector<T>& layer, int width, int height) {
+    vector<unsigned char> pixels(static_cast<size_t>(width) * height);
+    for (int y = 0; y < height; ++y) {
+        size_t offset = static_cast<size_t>(y) * width;
+        quantizeRow(layer.data() + offset, width, pixels.data() + offset, Quantizer());
+    }
+    GreyScaleImage::saveBytes(filename, pixels.data(), width, height);
+}
+
+template <typename T>
+static void runLayers(mfe::Context& context, const mfe_image& input, const mfe_output& output, const string& prefix) {
+    size_t count = static_cast<size_t>(input.width) * input.height;
+    vector<T> layers[3] = { vector<T>(count), vector<T>(count), vector<T>(count) };
+    mfe_plane planes[3];
+    for (int i = 0; i < 3; ++i) {
+        planes[i].data = layers[i].data();
+        planes[i].stride = input.width * sizeof(T);
+    }
+    context.runLayers(input, planes, &output);
+    for (int i = 0; i < 3; ++i) {
+        saveLayer(prefix + "_layer" + to_string(i + 1) + ".png", layers[i], input.width, input.height);
+    }
+}
+
+// frame-sequence mode: decode, layers and encode of consecutive frames overlap
+// @param temporal: < 0 off, otherwise the drift tolerance of the min / max prediction
+static int runSequence(const mfe_options& options, const FrameSource& source, const FrameOptions& frameOptions,
+                       double temporal) {
+    // with the frames on stdout the report goes to stderr
+    ostream& report = frameOptions.outputStream == "-" ? cerr : cout;
+    try {
+        mfe::Context context(options);
+        if (temporal >= 0.0) {
+            context.setTemporal(true, temporal);
+        }
+        FramePipeline pipeline(context, frameOptions);
+        int failed = pipeline.run(source);
+
+        report << "Frames: " << pipeline.getFrames() << " written, " << pipeline.getDropped() << " dropped, "
+               << failed << " failed in " << pipeline.getSeconds() << " s (" << pipeline.getFps() << " fps)" << endl;
+        report << "Latency: p50 " << pipeline.getLatencyMs(0.50) << " ms, p99 " << pipeline.getLatencyMs(0.99)
+               << " ms, max " << pipeline.getLatencyMs(1.0) << " ms" << endl;
+        report << "Stage time: decode " << pipeline.getDecodeMs() << " ms, layers " << pipeline.getComputeMs()
+               << " ms, encode " << pipeline.getEncodeMs() << " ms" << endl;
+        if (temporal >= 0.0) {
+            mfe_temporal_stats stats = context.temporalStats();
+            report << "Temporal prediction: " << stats.layers_predicted << " layers in one pass, "
+                   << stats.layers_recomputed << " recomputed over " << stats.frames << " predicted frames" << endl;
+        }
+        return failed == 0 ? 0 : 1;
+    } catch (const exception& e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
+}
+
+// incremental mode: the input once, then an updated copy of it where only rect changed
+static int runIncremental(const mfe_options& options, const GreyScaleImage& img, const string& updatedPath,
+                          const int rect[4], const string& outputPath) {
+    GreyScaleImage updated(updatedPath);
+    if (!updated.getBytes()) {
+        return 1;
+    }
+    int width = img.getWidth();
+    int height = img.getHeight();
+    vector<unsigned char> result(static_cast<size_t>(width) * height);
+    mfe_output output{ result.data(), static_cast<size_t>(width) };
+
+    try {
+        mfe::Context context(options);
+        mfe_incremental* state = nullptr;
+        mfe_image input{ img.getBytes(), width, height, static_cast<size_t>(width) };
+
+        auto start = high_resolution_clock::now();
+        if (mfe_incremental_create(context.get(), &input, &output, &state) != MFE_OK) {
+            throw runtime_error(mfe_last_error(context.get()));
+        }
+        auto created = high_resolution_clock::now();
+
+        mfe_image next{ updated.getBytes(), updated.getWidth(), updated.getHeight(), static_cast<size_t>(updated.getWidth()) };
+        mfe_status status = mfe_incremental_update(state, &next, rect[0], rect[1], rect[2], rect[3], &output);
+        auto stop = high_resolution_clock::now();
+        mfe_incremental_stats stats;
+        mfe_incremental_get_stats(state, &stats);
+        mfe_incremental_destroy(state);
+        if (status != MFE_OK) {
+            throw runtime_error(mfe_last_error(context.get()));
+        }
+
+        cout << "Full computation: " << duration_cast<microseconds>(created - start).count() / 1000.0 << " ms" << endl;
+        cout << "Update: " << duration_cast<microseconds>(stop - created).count() / 1000.0 << " ms, "
+             << stats.recomputed_pixels << " layer pixels recomputed, " << stats.rescans << " min/max rescans, "
+             << stats.full_requantizes << " full requantizations" << endl;
+    } catch (const exception& e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
+    GreyScaleImage::saveBytes(outputPath, result.data(), width, height);
+    return 0;
+}
+
+// on-demand tiles: the summary (loaded from summaryPath when it matches), then only the tiles asked for
+static int runTiles(const mfe_options& options, const GreyScaleImage& img, const vector<pair<int, int>>& tiles,
+                    int tileSize, const string& summaryPath, const string& outputPath) {
+    int width = img.getWidth();
+    int height = img.getHeight();
+    mfe_source source = imageSource(img);
+
+    try {
+        mfe::Context context(options);
+        mfe_summary summary;
+        auto start = high_resolution_clock::now();
+        bool loaded = !summaryPath.empty() && loadSummary(summaryPath, width, height, summary);
+        if (!loaded) {
+            if (mfe_summarize(context.get(), &source, tileSize, &summary) != MFE_OK) {
+                throw runtime_error(mfe_last_error(context.get()));
+            }
+            if (!summaryPath.empty()) {
+                saveSummary(summaryPath, width, height, summary);
+            }
+        }
+        cout << "Summary: " << (loaded ? "loaded" : "computed") << " in "
+             << duration_cast<microseconds>(high_resolution_clock::now() - start).count() / 1000.0 << " ms" << endl;
+
+        mfe_tiles* set = nullptr;
+        if (mfe_tiles_create(&source, &summary, tileSize, tiles.size(), &set) != MFE_OK) {
+            throw runtime_error("cannot create the tile set");
+        }
+        unique_ptr<mfe_tiles, void (*)(mfe_tiles*)> owned(set, mfe_tiles_destroy);
+
+        // several tiles are saved as <output>_<tx>_<ty>.<ext>
+        filesystem::path base(outputPath);
+        vector<unsigned char> pixels(static_cast<size_t>(tileSize) * tileSize);
+        for (const auto& tile : tiles) {
+            auto tileStart = high_resolution_clock::now();
+            mfe_output output{ pixels.data(), static_cast<size_t>(tileSize) };
+            if (mfe_tiles_render(context.get(), set, tile.first, tile.second, &output) != MFE_OK) {
+                throw runtime_error(mfe_last_error(context.get()));
+            }
+            double ms = duration_cast<microseconds>(high_resolution_clock::now() - tileStart).count() / 1000.0;
+
+            int tileWidth = min(tileSize, width - tile.first * tileSize);
+            int tileHeight = min(tileSize, height - tile.second * tileSize);
+            string path = outputPath;
+            if (tiles.size() > 1) {
+                path = (base.parent_path() / (base.stem().string() + "_" + to_string(tile.first) + "_" +
+                                              to_string(tile.second) + base.extension().string())).string();
+            }
+            // the tile rows are tileSize bytes apart, packed before saving
+            for (int y = 1; y < tileHeight; ++y) {
+                memmove(pixels.data() + static_cast<size_t>(y) * tileWidth, pixels.data() + static_cast<size_t>(y) * tileSize, tileWidth);
+            }
+            GreyScaleImage::saveBytes(path, pixels.data(), tileWidth, tileHeight);
+            cout << "Tile " << tile.first << "," << tile.second << ": " << ms << " ms" << endl;
+        }
+
+        mfe_tiles_stats stats;
+        mfe_tiles_get_stats(set, &stats);
+        cout << "Tiles: " << stats.rendered << " rendered, " << stats.cache_hits << " from the raw layer cache" << endl;
+        return 0;
+    } catch (const exception& e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
+}
+
+// pyramid mode: every level of the input's Gaussian pyramid through the layers in one run
+static int runPyramid(const mfe_options& options, const GreyScaleImage& img, int levels, const string& outputPath) {
+    int width = img.getWidth();
+    int height = img.getHeight();
+    vector<vector<unsigned char>> results(levels);
+    vector<mfe_output> outputs(levels);
+    for (int k = 0; k < levels; ++k) {
+        int levelWidth = mfe_pyramid_level_size(width, k);
+        results[k].resize(static_cast<size_t>(levelWidth) * mfe_pyramid_level_size(height, k));
+        outputs[k] = mfe_output{ results[k].data(), static_cast<size_t>(levelWidth) };
+    }
+
+    try {
+        mfe::Context context(options);
+        mfe_image input{ img.getBytes(), width, height, static_cast<size_t>(width) };
+        auto start = high_resolution_clock::now();
+        context.runPyramid(input, levels, outputs.data());
+        cout << "Pyramid: " << levels << " levels in "
+             << duration_cast<microseconds>(high_resolution_clock::now() - start).count() / 1000.0 << " ms" << endl;
+    } catch (const exception& e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
+
+    // level k is saved as <output>_level<k>.<ext>
+    filesystem::path base(outputPath);
+    for (int k = 0; k < levels; ++k) {
+        string path = (base.parent_path() / (base.stem().string() + "_level" + to_string(k) + base.extension().string())).string();
+        GreyScaleImage::saveBytes(path, results[k].data(), mfe_pyramid_level_size(width, k), mfe_pyramid_level_size(height, k));
+    }
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    // --png-level <0-9>, --png-filter <name>, --png-fast, --png-threads <n> pick how the output is encoded
+    setDefaultPngOptions(parsePngOptions(argc, argv));
+    // --preview 2|4|8 runs on the input box-downsampled by that factor, for a quick look
+    setPreviewFactor(parsePreviewFactor(argc, argv));
+
+    // usage: mfe [--input <image>] [--output <image>] [--backend serial|threads] [--threads <n>]
+    //            [--precision double|float] [--layers <prefix>]
+    //        mfe (--frames <directory|manifest> | --raw-frames <file|-> --size <W>x<H>)
+    //            [--out-dir <directory> | --frame-output <file|->] [--slots <n>] [--max-latency <ms>]
+    //            [--temporal <tolerance>]
+    //        mfe [--input <image>] --update <image> --rect <x>,<y>,<w>,<h> [--output <image>]
+    //        mfe [--input <image>] --tile <tx>,<ty> [--tile <tx>,<ty> ...] [--tile-size <n>] [--summary <file>]
+    //            [--output <image>]
+    //        mfe [--input <image>] --pyramid <levels> [--output <image>]
+    // --cache-dir <dir> [--cache-mb <mb>] serves repeated single images (double precision) from a ResultCache
+    string inputPath = "../images/image.png";
+    string outputPath = "../images/output_mfe.png";
+    string layersPrefix;
+    mfe_options options = mfe_default_options();
+    string frames;
+    FrameSource source;
+    FrameOptions frameOptions;
+    double temporal = -1.0;
+    string updatePath;
+    int rect[4] = { 0, 0, 0, 0 };
+    string cacheDir;
+    vector<pair<int, int>> tiles;
+    int tileSize = 256;
+    string summaryPath;
+    int pyramidLevels = 0;
+    bool outputGiven = false;
+    size_t cacheBytes = static_cast<size_t>(4096) << 20;
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--input" && i + 1 < argc) {
+            inputPath = argv[++i];
+        } else if (arg == "--output" && i + 1 < argc) {
+            outputPath = argv[++i];
+            outputGiven = true;
+        } else if (arg == "--backend" && i + 1 < argc) {
+            options.backend = string(argv[++i]) == "threads" ? MFE_BACKEND_THREADS : MFE_BACKEND_SERIAL;
+        } else if (arg == "--threads" && i + 1 < argc) {
+            options.threads = stoi(argv[++i]);
+        } else if (arg == "--precision" && i + 1 < argc) {
+            options.precision = string(argv[++i]) == "float" ? MFE_PRECISION_FLOAT : MFE_PRECISION_DOUBLE;
+        } else if (arg == "--layers" && i + 1 < argc) {
+            layersPrefix = argv[++i];
+        } else if (arg == "--frames" && i + 1 < argc) {
+            frames = argv[++i];
+        } else if (arg == "--raw-frames" && i + 1 < argc) {
+            source.rawPath = argv[++i];
+        } else if (arg == "--size" && i + 1 < argc) {
+            sscanf(argv[++i], "%dx%d", &source.rawWidth, &source.rawHeight);
+        } else if (arg == "--out-dir" && i + 1 < argc) {
+            frameOptions.outputDir = argv[++i];
+        } else if (arg == "--frame-output" && i + 1 < argc) {
+            frameOptions.outputStream = argv[++i];
+        } else if (arg == "--slots" && i + 1 < argc) {
+            frameOptions.slots = stoi(argv[++i]);
+        } else if (arg == "--max-latency" && i + 1 < argc) {
+            frameOptions.maxLatencyMs = stod(argv[++i]);
+        } else if (arg == "--temporal" && i + 1 < argc) {
+            temporal = stod(argv[++i]);
+        } else if (arg == "--update" && i + 1 < argc) {
+            updatePath = argv[++i];
+        } else if (arg == "--rect" && i + 1 < argc) {
+            sscanf(argv[++i], "%d,%d,%d,%d", &rect[0], &rect[1], &rect[2], &rect[3]);
+        } else if (arg == "--tile" && i + 1 < argc) {
+            pair<int, int> tile(0, 0);
+            sscanf(argv[++i], "%d,%d", &tile.first, &tile.second);
+            tiles.push_back(tile);
+        } else if (arg == "--tile-size" && i + 1 < argc) {
+            tileSize = max(8, stoi(argv[++i]));
+        } else if (arg == "--pyramid" && i + 1 < argc) {
+            pyramidLevels = stoi(argv[++i]);
+        } else if (arg == "--summary" && i + 1 < argc) {
+            summaryPath = argv[++i];
+        } else if (arg == "--cache-dir" && i + 1 < argc) {
+            cacheDir = argv[++i];
+        } else if (arg == "--cache-mb" && i + 1 < argc) {
+            cacheBytes = static_cast<size_t>(max(0, stoi(argv[++i]))) << 20;
+        }
+    }
+
+    if (!frames.empty() || !source.rawPath.empty()) {
+        if (!frames.empty()) {
+            source.files = listBatchInputs(frames);
+        }
+        return runSequence(options, source, frameOptions, temporal);
+    }
+
+    auto start = high_resolution_clock::now();
+
+    GreyScaleImage img(inputPath);
+    // a tiled input is not decoded for tiles, they read their regions from it
+    if (!tiles.empty() && img.getWidth() > 0) {
+        return runTiles(options, img, tiles, tileSize, summaryPath, outputGiven ? outputPath : "../images/output_tile.png");
+    }
+    if (!img.getBytes()) {
+        return 1;
+    }
+    if (!updatePath.empty()) {
+        return runIncremental(options, img, updatePath, rect, outputPath);
+    }
+    if (pyramidLevels > 0) {
+        return runPyramid(options, img, pyramidLevels, outputPath);
+    }
+    int width = img.getWidth();
+    int height = img.getHeight();
+    vector<unsigned char> result(static_cast<size_t>(width) * height);
+
+    try {
+        mfe::Context context(options);
+        mfe_image input{ img.getBytes(), width, height, static_cast<size_t>(width) };
+        mfe_output output{ result.data(), static_cast<size_t>(width) };
+        // float results differ from the cached double ones, so only double precision shares the cache
+        unique_ptr<ResultCache> cache;
+        if (!cacheDir.empty() && layersPrefix.empty() && options.precision == MFE_PRECISION_DOUBLE) {
+            cache.reset(new ResultCache(cacheDir, cacheBytes));
+        }
+        if (cache) {
+            CacheKey key = ResultCache::key(input.data, width, height, input.stride);
+            unique_ptr<CachedResult> hit = cache->lookup(key);
+            if (hit) {
+                copy(hit->pixels(), hit->pixels() + result.size(), result.begin());
+            } else {
+                context.run(input, output);
+                cache->store(key, result.data(), width);
+            }
+            cout << "Cache " << (hit ? "hit" : "miss") << endl;
+        } else if (layersPrefix.empty()) {
+            context.run(input, output);
+        } else if (options.precision == MFE_PRECISION_FLOAT) {
+            runLayers<float>(context, input, output, layersPrefix);
+        } else {
+            runLayers<double>(context, input, output, layersPrefix);
+        }
+    } catch (const exception& e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
+    GreyScaleImage::saveBytes(outputPath, result.data(), width, height);
+
+    auto stop = high_resolution_clock::now();
+    auto duration = duration_cast<milliseconds>(stop - start);
+    cout << "Processing time: " << duration.count() << " ms" << endl;
+    return 0;
+}
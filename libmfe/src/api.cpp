@@ -0,0 +1,426 @@
+#include "../include/mfe.h"
+#include "engine.h"
+#include "incremental.h"
+#include "pyramid.h"
+#include "tile_renderer.h"
+#include <algorithm>
+#include <exception>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+struct mfe_context {
+    mfe_options options;
+    unique_ptr<Engine<double>> doubleEngine; // one of the two, by precision
+    unique_ptr<Engine<float>> floatEngine;
+    unique_ptr<Pyramid<double>> doublePyramid; // created by the first pyramid run
+    unique_ptr<Pyramid<float>> floatPyramid;
+    string lastError;
+
+    ThreadPool& pool() { return doubleEngine ? doubleEngine->getPool() : floatEngine->getPool(); }
+};
+
+struct mfe_incremental {
+    mfe_context* context;
+    unique_ptr<IncrementalState> state;
+};
+
+struct mfe_tiles {
+    unique_ptr<TileRenderer> renderer;
+};
+
+namespace {
+
+mfe_status fail(mfe_context* context, mfe_status status, const string& message) {
+    context->lastError = message;
+    return status;
+}
+
+bool validImage(const mfe_image* image) {
+    return image && image->data && image->width > 0 && image->height > 0
+        && image->stride >= static_cast<size_t>(image->width);
+}
+
+template <typename T>
+void runEngine(Engine<T>& engine, const mfe_image* input, const mfe_plane* layers, const mfe_output* output) {
+    typename Engine<T>::Plane planes[3];
+    if (layers) {
+        for (int i = 0; i < 3; ++i) {
+            planes[i].data = static_cast<T*>(layers[i].data);
+            planes[i].stride = layers[i].stride;
+        }
+    }
+    engine.run(input->data, input->stride, input->width, input->height, layers ? planes : nullptr,
+               output ? output->data : nullptr, output ? output->stride : 0);
+}
+
+bool validSource(const mfe_source* source) {
+    return source && source->read && source->width > 0 && source->height > 0;
+}
+
+// the C reader behind the renderer's callback, a failed read becomes an exception
+TileRenderer::RegionReader regionReader(const mfe_source& source) {
+    return [source](int x, int y, int width, int height, unsigned char* out, size_t stride) {
+        if (source.read(source.user, x, y, width, height, out, stride) != 0) {
+            throw runtime_error("cannot read region " + to_string(width) + "x" + to_string(height) + " at " +
+                                to_string(x) + "," + to_string(y));
+        }
+    };
+}
+
+template <typename Stats>
+void copyStats(const Stats& source, mfe_temporal_stats* stats) {
+    stats->frames = source.frames;
+    stats->layers_predicted = source.predicted;
+    stats->layers_recomputed = source.recomputed;
+}
+
+} // namespace
+
+extern "C" {
+
+mfe_options mfe_default_options(void) {
+    mfe_options options;
+    options.backend = MFE_BACKEND_SERIAL;
+    options.threads = 0;
+    options.precision = MFE_PRECISION_DOUBLE;
+    return options;
+}
+
+mfe_status mfe_create(const mfe_options* options, mfe_context** context) {
+    if (!context) {
+        return MFE_ERROR_INVALID_ARGUMENT;
+    }
+    *context = nullptr;
+
+    mfe_options chosen = options ? *options : mfe_default_options();
+    if ((chosen.backend != MFE_BACKEND_SERIAL && chosen.backend != MFE_BACKEND_THREADS)
+        || (chosen.precision != MFE_PRECISION_DOUBLE && chosen.precision != MFE_PRECISION_FLOAT)
+        || chosen.threads < 0) {
+        return MFE_ERROR_INVALID_ARGUMENT;
+    }
+
+    try {
+        unique_ptr<mfe_context> created(new mfe_context());
+        created->options = chosen;
+        int threads = chosen.backend == MFE_BACKEND_SERIAL ? 1 : chosen.threads;
+        if (chosen.precision == MFE_PRECISION_DOUBLE) {
+            created->doubleEngine.reset(new Engine<double>(threads));
+        } else {
+            created->floatEngine.reset(new Engine<float>(threads));
+        }
+        *context = created.release();
+        return MFE_OK;
+    } catch (const bad_alloc&) {
+        return MFE_ERROR_OUT_OF_MEMORY;
+    } catch (...) {
+        return MFE_ERROR_INTERNAL;
+    }
+}
+
+void mfe_destroy(mfe_context* context) {
+    delete context;
+}
+
+mfe_status mfe_run(mfe_context* context, const mfe_image* input, const mfe_output* output) {
+    // the layers are optional, the output is not
+    if (context && !output) {
+        return fail(context, MFE_ERROR_INVALID_ARGUMENT, "output needs data and a stride of at least the width");
+    }
+    return mfe_run_layers(context, input, nullptr, output);
+}
+
+mfe_status mfe_run_layers(mfe_context* context, const mfe_image* input, const mfe_plane layers[3],
+                          const mfe_output* output) {
+    if (!context) {
+        return MFE_ERROR_INVALID_ARGUMENT;
+    }
+    context->lastError.clear();
+    if (!validImage(input)) {
+        return fail(context, MFE_ERROR_INVALID_ARGUMENT, "input needs data, a positive size and a stride of at least the width");
+    }
+
+    size_t element = context->doubleEngine ? sizeof(double) : sizeof(float);
+    if (layers) {
+        for (int i = 0; i < 3; ++i) {
+            if (layers[i].data && layers[i].stride < input->width * element) {
+                return fail(context, MFE_ERROR_INVALID_ARGUMENT, "layer " + to_string(i + 1) + " stride is below width * element size");
+            }
+        }
+    }
+    if (output && (!output->data || output->stride < static_cast<size_t>(input->width))) {
+        return fail(context, MFE_ERROR_INVALID_ARGUMENT, "output needs data and a stride of at least the width");
+    }
+
+    try {
+        if (context->doubleEngine) {
+            runEngine(*context->doubleEngine, input, layers, output);
+        } else {
+            runEngine(*context->floatEngine, input, layers, output);
+        }
+        return MFE_OK;
+    } catch (const bad_alloc&) {
+        return fail(context, MFE_ERROR_OUT_OF_MEMORY, "cannot allocate the scratch layers");
+    } catch (const exception& e) {
+        return fail(context, MFE_ERROR_INTERNAL, e.what());
+    }
+}
+
+mfe_status mfe_set_temporal(mfe_context* context, int enabled, double tolerance) {
+    if (!context) {
+        return MFE_ERROR_INVALID_ARGUMENT;
+    }
+    if (!(tolerance >= 0.0)) {
+        return fail(context, MFE_ERROR_INVALID_ARGUMENT, "tolerance must be zero or positive");
+    }
+    if (context->doubleEngine) {
+        context->doubleEngine->setTemporal(enabled != 0, tolerance);
+    } else {
+        context->floatEngine->setTemporal(enabled != 0, tolerance);
+    }
+    return MFE_OK;
+}
+
+mfe_status mfe_get_temporal_stats(const mfe_context* context, mfe_temporal_stats* stats) {
+    if (!context || !stats) {
+        return MFE_ERROR_INVALID_ARGUMENT;
+    }
+    if (context->doubleEngine) {
+        copyStats(context->doubleEngine->getTemporalStats(), stats);
+    } else {
+        copyStats(context->floatEngine->getTemporalStats(), stats);
+    }
+    return MFE_OK;
+}
+
+int mfe_pyramid_level_size(int size, int level) {
+    return pyramidLevelSize(size, level);
+}
+
+mfe_status mfe_run_pyramid(mfe_context* context, const mfe_image* input, int levels, const mfe_output* outputs) {
+    if (!context) {
+        return MFE_ERROR_INVALID_ARGUMENT;
+    }
+    context->lastError.clear();
+    if (!validImage(input)) {
+        return fail(context, MFE_ERROR_INVALID_ARGUMENT, "input needs data, a positive size and a stride of at least the width");
+    }
+    if (levels < 1 || levels > MFE_PYRAMID_MAX_LEVELS) {
+        return fail(context, MFE_ERROR_INVALID_ARGUMENT, "levels must be between 1 and " + to_string(MFE_PYRAMID_MAX_LEVELS));
+    }
+    if (!outputs) {
+        return fail(context, MFE_ERROR_INVALID_ARGUMENT, "one output per level is needed");
+    }
+    vector<unsigned char*> data(levels);
+    vector<size_t> strides(levels);
+    for (int k = 0; k < levels; ++k) {
+        if (!outputs[k].data || outputs[k].stride < static_cast<size_t>(pyramidLevelSize(input->width, k))) {
+            return fail(context, MFE_ERROR_INVALID_ARGUMENT, "output " + to_string(k) + " needs data and a stride of at least the level width");
+        }
+        data[k] = outputs[k].data;
+        strides[k] = outputs[k].stride;
+    }
+
+    try {
+        if (context->doubleEngine) {
+            if (!context->doublePyramid) {
+                context->doublePyramid.reset(new Pyramid<double>(context->pool()));
+            }
+            context->doublePyramid->run(input->data, input->stride, input->width, input->height, levels, data.data(), strides.data());
+        } else {
+            if (!context->floatPyramid) {
+                context->floatPyramid.reset(new Pyramid<float>(context->pool()));
+            }
+            context->floatPyramid->run(input->data, input->stride, input->width, input->height, levels, data.data(), strides.data());
+        }
+        return MFE_OK;
+    } catch (const bad_alloc&) {
+        return fail(context, MFE_ERROR_OUT_OF_MEMORY, "cannot allocate the pyramid levels");
+    } catch (const exception& e) {
+        return fail(context, MFE_ERROR_INTERNAL, e.what());
+    }
+}
+
+mfe_status mfe_incremental_create(mfe_context* context, const mfe_image* input, const mfe_output* output,
+                                  mfe_incremental** state) {
+    if (!context || !state) {
+        return MFE_ERROR_INVALID_ARGUMENT;
+    }
+    *state = nullptr;
+    context->lastError.clear();
+    if (!validImage(input)) {
+        return fail(context, MFE_ERROR_INVALID_ARGUMENT, "input needs data, a positive size and a stride of at least the width");
+    }
+    if (!output || !output->data || output->stride < static_cast<size_t>(input->width)) {
+        return fail(context, MFE_ERROR_INVALID_ARGUMENT, "output needs data and a stride of at least the width");
+    }
+
+    try {
+        unique_ptr<mfe_incremental> created(new mfe_incremental());
+        created->context = context;
+        created->state.reset(new IncrementalState(context->pool(), input->data, input->stride, input->width,
+                                                  input->height, output->data, output->stride));
+        *state = created.release();
+        return MFE_OK;
+    } catch (const bad_alloc&) {
+        return fail(context, MFE_ERROR_OUT_OF_MEMORY, "cannot allocate the layers");
+    } catch (const exception& e) {
+        return fail(context, MFE_ERROR_INTERNAL, e.what());
+    }
+}
+
+mfe_status mfe_incremental_update(mfe_incremental* state, const mfe_image* input, int x, int y,
+                                  int width, int height, const mfe_output* output) {
+    if (!state) {
+        return MFE_ERROR_INVALID_ARGUMENT;
+    }
+    mfe_context* context = state->context;
+    context->lastError.clear();
+    if (!validImage(input) || input->width != state->state->getWidth() || input->height != state->state->getHeight()) {
+        return fail(context, MFE_ERROR_INVALID_ARGUMENT, "the updated image must have the size the state was created with");
+    }
+    if (!output || !output->data || output->stride < static_cast<size_t>(input->width)) {
+        return fail(context, MFE_ERROR_INVALID_ARGUMENT, "output needs data and a stride of at least the width");
+    }
+    if (width < 0 || height < 0) {
+        return fail(context, MFE_ERROR_INVALID_ARGUMENT, "the changed rectangle needs a size of at least 0");
+    }
+
+    try {
+        state->state->update(input->data, input->stride, x, y, width, height, output->data, output->stride);
+        return MFE_OK;
+    } catch (const exception& e) {
+        return fail(context, MFE_ERROR_INTERNAL, e.what());
+    }
+}
+
+mfe_status mfe_incremental_get_stats(const mfe_incremental* state, mfe_incremental_stats* stats) {
+    if (!state || !stats) {
+        return MFE_ERROR_INVALID_ARGUMENT;
+    }
+    const IncrementalState::Stats& source = state->state->getStats();
+    stats->updates = source.updates;
+    stats->recomputed_pixels = source.recomputedPixels;
+    stats->rescans = source.rescans;
+    stats->full_requantizes = source.fullRequantizes;
+    return MFE_OK;
+}
+
+void mfe_incremental_destroy(mfe_incremental* state) {
+    delete state;
+}
+
+mfe_status mfe_summarize(mfe_context* context, const mfe_source* source, int tile_size, mfe_summary* summary) {
+    if (!context) {
+        return MFE_ERROR_INVALID_ARGUMENT;
+    }
+    context->lastError.clear();
+    if (!validSource(source) || !summary || tile_size <= 0) {
+        return fail(context, MFE_ERROR_INVALID_ARGUMENT, "summary needs a source with a reader and a positive size, and a positive tile size");
+    }
+
+    try {
+        TileRenderer::Summary computed = TileRenderer::summarize(context->pool(), regionReader(*source),
+                                                                 source->width, source->height, tile_size);
+        for (int i = 0; i < 3; ++i) {
+            summary->min[i] = computed.layers[i].min;
+            summary->max[i] = computed.layers[i].max;
+        }
+        return MFE_OK;
+    } catch (const bad_alloc&) {
+        return fail(context, MFE_ERROR_OUT_OF_MEMORY, "cannot allocate a band of rows");
+    } catch (const exception& e) {
+        return fail(context, MFE_ERROR_INTERNAL, e.what());
+    }
+}
+
+mfe_status mfe_tiles_create(const mfe_source* source, const mfe_summary* summary, int tile_size,
+                            size_t cache_tiles, mfe_tiles** tiles) {
+    if (!tiles) {
+        return MFE_ERROR_INVALID_ARGUMENT;
+    }
+    *tiles = nullptr;
+    if (!validSource(source) || !summary || tile_size <= 0) {
+        return MFE_ERROR_INVALID_ARGUMENT;
+    }
+
+    try {
+        TileRenderer::Summary ranges;
+        for (int i = 0; i < 3; ++i) {
+            ranges.layers[i] = TileRenderer::Range{ summary->min[i], summary->max[i] };
+        }
+        unique_ptr<mfe_tiles> created(new mfe_tiles());
+        created->renderer.reset(new TileRenderer(regionReader(*source), source->width, source->height, ranges,
+                                                 tile_size, cache_tiles));
+        *tiles = created.release();
+        return MFE_OK;
+    } catch (const bad_alloc&) {
+        return MFE_ERROR_OUT_OF_MEMORY;
+    } catch (...) {
+        return MFE_ERROR_INTERNAL;
+    }
+}
+
+mfe_status mfe_tiles_render(mfe_context* context, mfe_tiles* tiles, int tx, int ty, const mfe_output* output) {
+    if (!context) {
+        return MFE_ERROR_INVALID_ARGUMENT;
+    }
+    context->lastError.clear();
+    if (!tiles) {
+        return fail(context, MFE_ERROR_INVALID_ARGUMENT, "no tile set");
+    }
+    TileRenderer& renderer = *tiles->renderer;
+    if (tx < 0 || ty < 0 || tx >= renderer.getTilesAcross() || ty >= renderer.getTilesDown()) {
+        return fail(context, MFE_ERROR_INVALID_ARGUMENT, "tile " + to_string(tx) + "," + to_string(ty) + " is outside the " +
+                    to_string(renderer.getTilesAcross()) + "x" + to_string(renderer.getTilesDown()) + " grid");
+    }
+    int width = min(renderer.getTileSize(), renderer.getWidth() - tx * renderer.getTileSize());
+    if (!output || !output->data || output->stride < static_cast<size_t>(width)) {
+        return fail(context, MFE_ERROR_INVALID_ARGUMENT, "output needs data and a stride of at least the tile width");
+    }
+
+    try {
+        renderer.render(context->pool(), tx, ty, output->data, output->stride);
+        return MFE_OK;
+    } catch (const bad_alloc&) {
+        return fail(context, MFE_ERROR_OUT_OF_MEMORY, "cannot allocate a tile window");
+    } catch (const exception& e) {
+        return fail(context, MFE_ERROR_INTERNAL, e.what());
+    }
+}
+
+mfe_status mfe_tiles_get_stats(const mfe_tiles* tiles, mfe_tiles_stats* stats) {
+    if (!tiles || !stats) {
+        return MFE_ERROR_INVALID_ARGUMENT;
+    }
+    TileRenderer::Stats source = tiles->renderer->getStats();
+    stats->rendered = source.rendered;
+    stats->cache_hits = source.hits;
+    stats->cache_misses = source.misses;
+    stats->evictions = source.evictions;
+    return MFE_OK;
+}
+
+void mfe_tiles_destroy(mfe_tiles* tiles) {
+    delete tiles;
+}
+
+const char* mfe_last_error(const mfe_context* context) {
+    return context ? context->lastError.c_str() : "";
+}
+
+const char* mfe_status_string(mfe_status status) {
+    switch (status) {
+        case MFE_OK: return "ok";
+        case MFE_ERROR_INVALID_ARGUMENT: return "invalid argument";
+        case MFE_ERROR_OUT_OF_MEMORY: return "out of memory";
+        case MFE_ERROR_INTERNAL: return "internal error";
+    }
+    return "unknown status";
+}
+
+} // extern "C"
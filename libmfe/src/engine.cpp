@@ -0,0 +1,192 @@
+#include "engine.h"
+#include "../helpers/kernels.h"
+#include "../helpers/quantize.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+
+using namespace std;
+
+// rows handled by one pool task
+#define ENGINE_BLOCK_ROWS 16
+
+template <typename T>
+Engine<T>::Engine(int threads) : pool(threads) {}
+
+template <typename T>
+void Engine<T>::run(const unsigned char* input, size_t inputStride, int width, int height,
+                    const Plane* layers, unsigned char* output, size_t outputStride) {
+    // scratch only grows, so a stream of similar frames allocates once
+    size_t count = static_cast<size_t>(width) * height;
+    if (first.size() < count) {
+        first.resize(count);
+        second.resize(count);
+    }
+    T* a = first.data();
+    T* b = second.data();
+
+    if (havePrediction && (width != predictedWidth || height != predictedHeight)) {
+        havePrediction = false;
+    }
+    if (temporal && havePrediction) {
+        ++temporalStats.frames;
+    }
+
+    // the input is integral, so convolving its bytes gives the same sums as its doubles
+    normalizedLayer(0, input, inputStride, a, width, height, LAYER_1_KERNEL, LAYER_1_DIV, LAYER_1_PADDING);
+    if (layers) {
+        copyOut(a, width, height, layers[0], nullptr);
+    }
+
+    normalizedLayer(1, a, width, b, width, height, LAYER_2_KERNEL, LAYER_2_DIV, LAYER_2_PADDING);
+    if (layers) {
+        copyOut(b, width, height, layers[1], nullptr);
+    }
+    if (temporal) {
+        havePrediction = true;
+        predictedWidth = width;
+        predictedHeight = height;
+    }
+
+    // the last layer is normalized on its way out instead of in place, its range is never predicted
+    Range range = convolve(b, width, a, width, height, LAYER_3_KERNEL, LAYER_3_DIV, LAYER_3_PADDING);
+    if (layers) {
+        copyOut(a, width, height, layers[2], &range);
+    }
+    if (!output) {
+        return;
+    }
+    Quantizer quantizer = normalizingQuantizer(range.min, range.max);
+    int blocks = (height + ENGINE_BLOCK_ROWS - 1) / ENGINE_BLOCK_ROWS;
+    pool.parallelFor(blocks, [&](int block) {
+        int last = min(height, (block + 1) * ENGINE_BLOCK_ROWS);
+        for (int y = block * ENGINE_BLOCK_ROWS; y < last; ++y) {
+            quantizeRow(a + static_cast<size_t>(y) * width, width, output + y * outputStride, quantizer);
+        }
+    });
+}
+
+template <typename T>
+void Engine<T>::setTemporal(bool enabled, double tolerance) {
+    temporal = enabled;
+    this->tolerance = max(0.0, tolerance);
+    havePrediction = false;
+    temporalStats = TemporalStats();
+}
+
+template <typename T>
+template <typename S>
+void Engine<T>::normalizedLayer(int layer, const S* in, size_t stride, T* out, int width, int height,
+                                const vector<vector<int>>& kernel, double divisor, int padding) {
+    Range& predicted = predictedRanges[layer];
+    if (!temporal || !havePrediction) {
+        Range range = convolve(in, stride, out, width, height, kernel, divisor, padding);
+        normalize(out, width, height, range);
+        predicted = range;
+        return;
+    }
+
+    // one pass: convolved and normalized with last frame's range, the real range checked afterwards
+    Range range = convolve(in, stride, out, width, height, kernel, divisor, padding, &predicted);
+    double span = (predicted.max - predicted.min == 0.0) ? 1.0 : (predicted.max - predicted.min);
+    double drift = max(fabs(range.min - predicted.min), fabs(range.max - predicted.max)) / span;
+    if (drift > tolerance) {
+        convolve(in, stride, out, width, height, kernel, divisor, padding, &range);
+        ++temporalStats.recomputed;
+    } else {
+        ++temporalStats.predicted;
+    }
+    predicted = range;
+}
+
+template <typename T>
+template <typename S>
+typename Engine<T>::Range Engine<T>::convolve(const S* in, size_t stride, T* out, int width, int height,
+                                              const vector<vector<int>>& kernel, double divisor, int padding,
+                                              const Range* normalizeWith) {
+    int blocks = (height + ENGINE_BLOCK_ROWS - 1) / ENGINE_BLOCK_ROWS;
+    vector<Range> ranges(blocks, Range{ DBL_MAX, -DBL_MAX });
+
+    // same expression as normalize(), applied while the value is still in a register
+    double normalizeMin = normalizeWith ? normalizeWith->min : 0.0;
+    double normalizeSpan = 1.0;
+    if (normalizeWith && normalizeWith->max - normalizeWith->min != 0.0) {
+        normalizeSpan = normalizeWith->max - normalizeWith->min;
+    }
+
+    // every block writes its own rows and records their range
+    pool.parallelFor(blocks, [&](int block) {
+        Range& local = ranges[block];
+        int last = min(height, (block + 1) * ENGINE_BLOCK_ROWS);
+        for (int y = block * ENGINE_BLOCK_ROWS; y < last; ++y) {
+            T* row = out + static_cast<size_t>(y) * width;
+            for (int x = 0; x < width; ++x) {
+                double sum = 0.0;
+                for (int ky = -padding; ky <= padding; ++ky) {
+                    int iy = min(max(y + ky, 0), height - 1);
+                    const S* source = in + iy * stride;
+                    const int* k = kernel[ky + padding].data();
+                    for (int kx = -padding; kx <= padding; ++kx) {
+                        int ix = min(max(x + kx, 0), width - 1);
+                        sum += static_cast<double>(source[ix]) * k[kx + padding];
+                    }
+                }
+                T value = static_cast<T>(sum / divisor);
+                row[x] = normalizeWith ? static_cast<T>(255.0 * (value - normalizeMin) / normalizeSpan) : value;
+                local.min = min<double>(local.min, value);
+                local.max = max<double>(local.max, value);
+            }
+        }
+    });
+
+    Range range{ DBL_MAX, -DBL_MAX };
+    for (const Range& local : ranges) {
+        range.min = min(range.min, local.min);
+        range.max = max(range.max, local.max);
+    }
+    return range;
+}
+
+template <typename T>
+void Engine<T>::normalize(T* data, int width, int height, const Range& range) {
+    // same expression as normalizeMatrix
+    double span = (range.max - range.min == 0.0) ? 1.0 : (range.max - range.min);
+    int blocks = (height + ENGINE_BLOCK_ROWS - 1) / ENGINE_BLOCK_ROWS;
+    pool.parallelFor(blocks, [&](int block) {
+        size_t begin = static_cast<size_t>(block) * ENGINE_BLOCK_ROWS * width;
+        size_t end = static_cast<size_t>(min(height, (block + 1) * ENGINE_BLOCK_ROWS)) * width;
+        for (size_t i = begin; i < end; ++i) {
+            data[i] = static_cast<T>(255.0 * (data[i] - range.min) / span);
+        }
+    });
+}
+
+template <typename T>
+void Engine<T>::copyOut(const T* data, int width, int height, const Plane& plane, const Range* range) {
+    if (!plane.data) {
+        return;
+    }
+    double span = 1.0;
+    if (range) {
+        span = (range->max - range->min == 0.0) ? 1.0 : (range->max - range->min);
+    }
+    int blocks = (height + ENGINE_BLOCK_ROWS - 1) / ENGINE_BLOCK_ROWS;
+    pool.parallelFor(blocks, [&](int block) {
+        int last = min(height, (block + 1) * ENGINE_BLOCK_ROWS);
+        for (int y = block * ENGINE_BLOCK_ROWS; y < last; ++y) {
+            const T* source = data + static_cast<size_t>(y) * width;
+            T* target = reinterpret_cast<T*>(reinterpret_cast<unsigned char*>(plane.data) + y * plane.stride);
+            if (!range) {
+                memcpy(target, source, width * sizeof(T));
+                continue;
+            }
+            for (int x = 0; x < width; ++x) {
+                target[x] = static_cast<T>(255.0 * (source[x] - range->min) / span);
+            }
+        }
+    });
+}
+
+template class Engine<double>;
+template class Engine<float>;
@@ -0,0 +1,92 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+#include "../helpers/thread_pool.h"
+
+/*
+    the three-layer pipeline on strided 8-bit frames, with the rows of every pass spread over a
+    pool that lives as long as the engine and scratch layers reused from run to run; with T =
+    double the results match the other implementations bit for bit (same summation order, same
+    normalization expression), T = float halves the scratch memory
+*/
+template <typename T>
+class Engine {
+public:
+    // @param threads: threads of the engine's own pool, 1 runs everything on the caller (0 = one per hardware thread)
+    explicit Engine(int threads);
+
+    Engine(const Engine&) = delete;
+    Engine& operator=(const Engine&) = delete;
+
+    // a layer handed out to the caller, null data to skip it
+    struct Plane {
+        T* data = nullptr;
+        size_t stride = 0; // bytes
+    };
+
+    /*
+        @param input: rows of width bytes, inputStride bytes apart
+        @param layers: null, or the three layers as normalized values
+        @param output: null, or the final layer quantized to bytes, rows outputStride bytes apart
+    */
+    void run(const unsigned char* input, size_t inputStride, int width, int height,
+             const Plane* layers, unsigned char* output, size_t outputStride);
+
+    int getThreads() const { return pool.size(); }
+
+    // the engine's pool, for other passes run on the same threads
+    ThreadPool& getPool() { return pool; }
+
+    /*
+        temporal prediction for frame streams: layers 1 and 2 are normalized with the range the
+        previous frame had, in the same pass as the convolution; a layer whose real range drifted
+        further than tolerance (a fraction of the predicted range) is convolved once more with
+        its real range, so with tolerance 0 the results stay exact
+        the history is cleared here and whenever the frame size changes
+    */
+    void setTemporal(bool enabled, double tolerance);
+
+    struct TemporalStats {
+        long long frames = 0;     // frames run with a prediction available
+        long long predicted = 0;  // layers that kept the predicted range
+        long long recomputed = 0; // layers convolved again with their real range
+    };
+
+    const TemporalStats& getTemporalStats() const { return temporalStats; }
+
+private:
+    struct Range {
+        double min;
+        double max;
+    };
+
+    ThreadPool pool;
+    std::vector<T> first;
+    std::vector<T> second;
+
+    bool temporal = false;
+    double tolerance = 0.0;
+    bool havePrediction = false;
+    int predictedWidth = 0;
+    int predictedHeight = 0;
+    Range predictedRanges[2];
+    TemporalStats temporalStats;
+
+    /*
+        convolves in (rows stride elements apart) into out and returns the range of the raw values
+        @param normalizeWith: null to store raw values, otherwise the range they are normalized with on the way
+    */
+    template <typename S>
+    Range convolve(const S* in, size_t stride, T* out, int width, int height,
+                   const std::vector<std::vector<int>>& kernel, double divisor, int padding,
+                   const Range* normalizeWith = nullptr);
+
+    // one normalized layer (1 or 2), from the prediction when there is one
+    template <typename S>
+    void normalizedLayer(int layer, const S* in, size_t stride, T* out, int width, int height,
+                         const std::vector<std::vector<int>>& kernel, double divisor, int padding);
+
+    void normalize(T* data, int width, int height, const Range& range);
+
+    void copyOut(const T* data, int width, int height, const Plane& plane, const Range* range);
+};
@@ -0,0 +1,163 @@
+#include "incremental.h"
+#include "../helpers/kernels.h"
+#include "../helpers/quantize.h"
+#include <algorithm>
+#include <cfloat>
+
+using namespace std;
+
+// rows handled by one pool task
+#define INCREMENTAL_BLOCK_ROWS 16
+
+IncrementalState::IncrementalState(ThreadPool& pool, const unsigned char* input, size_t inputStride,
+                                   int width, int height, unsigned char* output, size_t outputStride)
+    : pool(pool), width(width), height(height) {
+    size_t count = static_cast<size_t>(width) * height;
+    for (auto& layer : layers) {
+        layer.resize(count);
+    }
+
+    Rect all{ 0, 0, width - 1, height - 1 };
+    Range replaced, written;
+    convolveRect(input, inputStride, layers[0].data(), all, LAYER_1_KERNEL, LAYER_1_DIV, LAYER_1_PADDING, replaced, written);
+    convolveRect(layers[0].data(), width, layers[1].data(), all, LAYER_2_KERNEL, LAYER_2_DIV, LAYER_2_PADDING, replaced, written);
+    convolveRect(layers[1].data(), width, layers[2].data(), all, LAYER_3_KERNEL, LAYER_3_DIV, LAYER_3_PADDING, replaced, written);
+    lastRange = written;
+    quantize(all, output, outputStride);
+}
+
+void IncrementalState::update(const unsigned char* input, size_t inputStride, int x, int y, int w, int h,
+                              unsigned char* output, size_t outputStride) {
+    Rect dirty{ max(x, 0), max(y, 0), min(x + w, width) - 1, min(y + h, height) - 1 };
+    if (dirty.x0 > dirty.x1 || dirty.y0 > dirty.y1) {
+        return;
+    }
+    ++stats.updates;
+
+    // every layer is recomputed over the previous one's region grown by its own radius
+    Rect first = dilate(dirty, LAYER_1_PADDING);
+    Rect second = dilate(first, LAYER_2_PADDING);
+    Rect third = dilate(second, LAYER_3_PADDING);
+    Range replaced, written;
+    convolveRect(input, inputStride, layers[0].data(), first, LAYER_1_KERNEL, LAYER_1_DIV, LAYER_1_PADDING, replaced, written);
+    convolveRect(layers[0].data(), width, layers[1].data(), second, LAYER_2_KERNEL, LAYER_2_DIV, LAYER_2_PADDING, replaced, written);
+    convolveRect(layers[1].data(), width, layers[2].data(), third, LAYER_3_KERNEL, LAYER_3_DIV, LAYER_3_PADDING, replaced, written);
+    for (const Rect& rect : { first, second, third }) {
+        stats.recomputedPixels += static_cast<long long>(rect.x1 - rect.x0 + 1) * (rect.y1 - rect.y0 + 1);
+    }
+
+    // the range only needs a scan when the region held an extremum and no longer reaches it
+    Range range = lastRange;
+    bool rescan = false;
+    if (written.min <= range.min) {
+        range.min = written.min;
+    } else if (replaced.min == range.min) {
+        rescan = true;
+    }
+    if (written.max >= range.max) {
+        range.max = written.max;
+    } else if (replaced.max == range.max) {
+        rescan = true;
+    }
+    if (rescan) {
+        range = scan(layers[2].data());
+        ++stats.rescans;
+    }
+
+    // a new range moves every output pixel, otherwise only the recomputed region changes
+    if (range.min != lastRange.min || range.max != lastRange.max) {
+        lastRange = range;
+        quantize(Rect{ 0, 0, width - 1, height - 1 }, output, outputStride);
+        ++stats.fullRequantizes;
+    } else {
+        quantize(third, output, outputStride);
+    }
+}
+
+template <typename S>
+void IncrementalState::convolveRect(const S* in, size_t stride, double* out, const Rect& rect,
+                                    const vector<vector<int>>& kernel, double divisor, int padding,
+                                    Range& replaced, Range& written) {
+    int rows = rect.y1 - rect.y0 + 1;
+    int blocks = (rows + INCREMENTAL_BLOCK_ROWS - 1) / INCREMENTAL_BLOCK_ROWS;
+    vector<Range> oldRanges(blocks, Range{ DBL_MAX, -DBL_MAX });
+    vector<Range> newRanges(blocks, Range{ DBL_MAX, -DBL_MAX });
+
+    // same summation order and clamped borders as the other implementations
+    pool.parallelFor(blocks, [&](int block) {
+        Range& oldLocal = oldRanges[block];
+        Range& newLocal = newRanges[block];
+        int first = rect.y0 + block * INCREMENTAL_BLOCK_ROWS;
+        int last = min(rect.y1, first + INCREMENTAL_BLOCK_ROWS - 1);
+        for (int y = first; y <= last; ++y) {
+            double* row = out + static_cast<size_t>(y) * width;
+            for (int x = rect.x0; x <= rect.x1; ++x) {
+                double sum = 0.0;
+                for (int ky = -padding; ky <= padding; ++ky) {
+                    int iy = min(max(y + ky, 0), height - 1);
+                    const S* source = in + iy * stride;
+                    const int* k = kernel[ky + padding].data();
+                    for (int kx = -padding; kx <= padding; ++kx) {
+                        int ix = min(max(x + kx, 0), width - 1);
+                        sum += static_cast<double>(source[ix]) * k[kx + padding];
+                    }
+                }
+                double value = sum / divisor;
+                oldLocal.min = min(oldLocal.min, row[x]);
+                oldLocal.max = max(oldLocal.max, row[x]);
+                row[x] = value;
+                newLocal.min = min(newLocal.min, value);
+                newLocal.max = max(newLocal.max, value);
+            }
+        }
+    });
+
+    replaced = Range{ DBL_MAX, -DBL_MAX };
+    written = Range{ DBL_MAX, -DBL_MAX };
+    for (int i = 0; i < blocks; ++i) {
+        replaced.min = min(replaced.min, oldRanges[i].min);
+        replaced.max = max(replaced.max, oldRanges[i].max);
+        written.min = min(written.min, newRanges[i].min);
+        written.max = max(written.max, newRanges[i].max);
+    }
+}
+
+IncrementalState::Range IncrementalState::scan(const double* data) {
+    int blocks = (height + INCREMENTAL_BLOCK_ROWS - 1) / INCREMENTAL_BLOCK_ROWS;
+    vector<Range> ranges(blocks, Range{ DBL_MAX, -DBL_MAX });
+    pool.parallelFor(blocks, [&](int block) {
+        size_t begin = static_cast<size_t>(block) * INCREMENTAL_BLOCK_ROWS * width;
+        size_t end = static_cast<size_t>(min(height, (block + 1) * INCREMENTAL_BLOCK_ROWS)) * width;
+        for (size_t i = begin; i < end; ++i) {
+            ranges[block].min = min(ranges[block].min, data[i]);
+            ranges[block].max = max(ranges[block].max, data[i]);
+        }
+    });
+
+    Range range{ DBL_MAX, -DBL_MAX };
+    for (const Range& local : ranges) {
+        range.min = min(range.min, local.min);
+        range.max = max(range.max, local.max);
+    }
+    return range;
+}
+
+void IncrementalState::quantize(const Rect& rect, unsigned char* output, size_t outputStride) {
+    Quantizer quantizer = normalizingQuantizer(lastRange.min, lastRange.max);
+    const double* data = layers[2].data();
+    int rows = rect.y1 - rect.y0 + 1;
+    int blocks = (rows + INCREMENTAL_BLOCK_ROWS - 1) / INCREMENTAL_BLOCK_ROWS;
+    pool.parallelFor(blocks, [&](int block) {
+        int first = rect.y0 + block * INCREMENTAL_BLOCK_ROWS;
+        int last = min(rect.y1, first + INCREMENTAL_BLOCK_ROWS - 1);
+        for (int y = first; y <= last; ++y) {
+            quantizeRow(data + static_cast<size_t>(y) * width + rect.x0, rect.x1 - rect.x0 + 1,
+                        output + y * outputStride + rect.x0, quantizer);
+        }
+    });
+}
+
+IncrementalState::Rect IncrementalState::dilate(const Rect& rect, int radius) const {
+    return Rect{ max(rect.x0 - radius, 0), max(rect.y0 - radius, 0),
+                 min(rect.x1 + radius, width - 1), min(rect.y1 + radius, height - 1) };
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+#include "../helpers/thread_pool.h"
+
+/*
+    keeps the raw (unnormalized) layers of one image so an update confined to a rectangle only
+    recomputes what it can reach: a change spreads by the kernel radii, 2 + 3 + 1 = 6 pixels
+    through the three layers; since normalization is affine with a positive scale and the clamped
+    convolutions are linear, chaining the raw layers and normalizing only the last one gives the
+    normalized pipeline's result (up to the rounding of the intermediate normalizations, as in the
+    streaming implementation), and the raw layers are exact integers with the current kernels
+*/
+class IncrementalState {
+public:
+    struct Rect {
+        int x0, y0, x1, y1; // inclusive
+    };
+
+    struct Stats {
+        long long updates = 0;
+        long long recomputedPixels = 0; // over the three layers
+        long long rescans = 0;          // full min / max scans after the extremum was overwritten
+        long long fullRequantizes = 0;  // updates that moved the range, so every output pixel changed
+    };
+
+    /*
+        computes every layer once and writes the output
+        @param pool: runs the rows, must outlive the state
+    */
+    IncrementalState(ThreadPool& pool, const unsigned char* input, size_t inputStride, int width, int height,
+                     unsigned char* output, size_t outputStride);
+
+    /*
+        recomputes the layers around a changed rectangle and updates the output in place
+        @param input: the whole updated image
+        @param x, y, w, h: rectangle that changed, clipped to the image
+        @param output: must hold the result of the previous call, only pixels that change are written
+    */
+    void update(const unsigned char* input, size_t inputStride, int x, int y, int w, int h,
+                unsigned char* output, size_t outputStride);
+
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+    const Stats& getStats() const { return stats; }
+
+private:
+    struct Range {
+        double min;
+        double max;
+    };
+
+    ThreadPool& pool;
+    int width;
+    int height;
+    std::vector<double> layers[3];
+    Range lastRange; // range of the raw last layer
+
+    // recomputes rect of layer from its source and returns the range of the values it replaced and wrote
+    template <typename S>
+    void convolveRect(const S* in, size_t stride, double* out, const Rect& rect,
+                      const std::vector<std::vector<int>>& kernel, double divisor, int padding,
+                      Range& replaced, Range& written);
+
+    Range scan(const double* data);
+    void quantize(const Rect& rect, unsigned char* output, size_t outputStride);
+    Rect dilate(const Rect& rect, int radius) const;
+
+    Stats stats;
+};
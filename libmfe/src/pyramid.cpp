@@ -0,0 +1,148 @@
+#include "pyramid.h"
+#include <algorithm>
+
+using namespace std;
+
+// output rows of a level handled by one pool task
+#define PYRAMID_BLOCK_ROWS 16
+
+int pyramidLevelSize(int size, int level) {
+    for (int i = 0; i < level; ++i) {
+        size = (size + 1) / 2;
+    }
+    return size;
+}
+
+void pyramidReduce(ThreadPool& pool, const unsigned char* in, size_t stride, int width, int height, unsigned char* out) {
+    int outWidth = pyramidLevelSize(width, 1);
+    int outHeight = pyramidLevelSize(height, 1);
+    int blocks = (outHeight + PYRAMID_BLOCK_ROWS - 1) / PYRAMID_BLOCK_ROWS;
+
+    pool.parallelFor(blocks, [&](int block) {
+        // vertical sums of one kept row, 16 * 255 at most
+        vector<unsigned> column(width);
+        int lastRow = min(outHeight, (block + 1) * PYRAMID_BLOCK_ROWS);
+        for (int y = block * PYRAMID_BLOCK_ROWS; y < lastRow; ++y) {
+            // only the even rows are kept, each blurred from the 5 around it, borders clamped
+            const unsigned char* rows[5];
+            for (int k = 0; k < 5; ++k) {
+                rows[k] = in + static_cast<size_t>(min(max(2 * y + k - 2, 0), height - 1)) * stride;
+            }
+            for (int x = 0; x < width; ++x) {
+                column[x] = rows[0][x] + 4u * (rows[1][x] + rows[3][x]) + 6u * rows[2][x] + rows[4][x];
+            }
+
+            // and of those only the even columns, the weights sum to 256
+            unsigned char* row = out + static_cast<size_t>(y) * outWidth;
+            for (int x = 0; x < outWidth; ++x) {
+                int c = 2 * x;
+                unsigned sum;
+                if (c >= 2 && c + 2 < width) {
+                    sum = column[c - 2] + 4u * (column[c - 1] + column[c + 1]) + 6u * column[c] + column[c + 2];
+                } else {
+                    auto at = [&](int i) { return column[min(max(i, 0), width - 1)]; };
+                    sum = at(c - 2) + 4u * (at(c - 1) + at(c + 1)) + 6u * at(c) + at(c + 2);
+                }
+                row[x] = static_cast<unsigned char>((sum + 128) >> 8);
+            }
+        }
+    });
+}
+
+template <typename T>
+Pyramid<T>::Pyramid(ThreadPool& pool) : pool(pool) {}
+
+template <typename T>
+void Pyramid<T>::plan(const vector<double>& work) {
+    int levels = static_cast<int>(work.size());
+    int budget = pool.size();
+    int count = min(budget, levels);
+
+    vector<int> order(levels);
+    for (int k = 0; k < levels; ++k) {
+        order[k] = k;
+    }
+    stable_sort(order.begin(), order.end(), [&](int a, int b) { return work[a] > work[b]; });
+
+    // longest processing time first: every level, largest first, goes to the least loaded lane
+    vector<vector<int>> assigned(count);
+    vector<double> load(count, 0.0);
+    for (int level : order) {
+        int lane = static_cast<int>(min_element(load.begin(), load.end()) - load.begin());
+        assigned[lane].push_back(level);
+        load[lane] += work[level];
+    }
+
+    // one thread each, then every spare one to the lane with the most work per thread
+    vector<int> threads(count, 1);
+    for (int spare = budget - count; spare > 0; --spare) {
+        int busiest = 0;
+        for (int lane = 1; lane < count; ++lane) {
+            if (load[lane] / threads[lane] > load[busiest] / threads[busiest]) {
+                busiest = lane;
+            }
+        }
+        ++threads[busiest];
+    }
+
+    // heaviest lane first, so it is picked up first
+    vector<int> byLoad(count);
+    for (int lane = 0; lane < count; ++lane) {
+        byLoad[lane] = lane;
+    }
+    stable_sort(byLoad.begin(), byLoad.end(), [&](int a, int b) { return load[a] > load[b]; });
+
+    if (!lanePool || lanePool->size() != count) {
+        lanePool.reset(new ThreadPool(count));
+    }
+    lanes.resize(count);
+    for (int i = 0; i < count; ++i) {
+        Lane& lane = lanes[i];
+        int from = byLoad[i];
+        lane.levels = assigned[from];
+        if (!lane.engine || lane.threads != threads[from]) {
+            lane.engine.reset(new Engine<T>(threads[from]));
+        }
+        lane.threads = threads[from];
+    }
+}
+
+template <typename T>
+void Pyramid<T>::run(const unsigned char* input, size_t inputStride, int width, int height, int levels,
+                     unsigned char* const* outputs, const size_t* outputStrides) {
+    vector<const unsigned char*> sources(levels);
+    vector<size_t> strides(levels);
+    vector<int> widths(levels);
+    vector<int> heights(levels);
+    vector<double> work(levels);
+    sources[0] = input;
+    strides[0] = inputStride;
+
+    // the levels depend on each other, so they are built one after the other, rows in parallel
+    images.resize(levels - 1);
+    for (int k = 0; k < levels; ++k) {
+        widths[k] = pyramidLevelSize(width, k);
+        heights[k] = pyramidLevelSize(height, k);
+        work[k] = static_cast<double>(widths[k]) * heights[k];
+        if (k == 0) {
+            continue;
+        }
+        vector<unsigned char>& image = images[k - 1];
+        image.resize(static_cast<size_t>(widths[k]) * heights[k]);
+        pyramidReduce(pool, sources[k - 1], strides[k - 1], widths[k - 1], heights[k - 1], image.data());
+        sources[k] = image.data();
+        strides[k] = widths[k];
+    }
+
+    plan(work);
+    int count = static_cast<int>(lanes.size());
+    lanePool->parallelFor(count, [&](int index) {
+        Lane& lane = lanes[index];
+        for (int k : lane.levels) {
+            lane.engine->run(sources[k], strides[k], widths[k], heights[k], nullptr, outputs[k], outputStrides[k]);
+        }
+    }, count);
+}
+
+template class Pyramid<double>;
+template class Pyramid<float>;
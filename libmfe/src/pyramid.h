@@ -0,0 +1,62 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <vector>
+#include "engine.h"
+#include "../helpers/thread_pool.h"
+
+/*
+    multiscale runs: a Gaussian pyramid of the input, every level the previous one blurred with
+    the binomial kernel (1 4 6 4 1) / 16 in both directions and halved, then the three-layer
+    pipeline on every level; the blur is fused with the decimation, so only the pixels a level
+    keeps are ever filtered, each from the 5 rows it needs
+    once built the levels are independent, so they run at once on threads of their own: levels
+    are packed onto lanes largest first, each to the lane with the least work so far (longest
+    processing time first), and the threads are shared out so no lane has much more work per
+    thread than the others;
+    the full-resolution level, three quarters of the work, gets most of them instead of the
+    small levels queueing behind it
+    level 0 is the input itself, its output matches the other implementations bit for bit
+*/
+template <typename T>
+class Pyramid {
+public:
+    // @param pool: builds the levels, its size is the thread budget of the lanes
+    explicit Pyramid(ThreadPool& pool);
+
+    Pyramid(const Pyramid&) = delete;
+    Pyramid& operator=(const Pyramid&) = delete;
+
+    /*
+        @param levels: levels run, 1 for the input alone
+        @param outputs: one per level, pyramidLevelSize(width, k) * pyramidLevelSize(height, k)
+                        bytes for level k, rows outputStrides[k] bytes apart
+    */
+    void run(const unsigned char* input, size_t inputStride, int width, int height, int levels,
+             unsigned char* const* outputs, const size_t* outputStrides);
+
+private:
+    struct Lane {
+        std::vector<int> levels; // largest first
+        int threads = 1;
+        std::unique_ptr<Engine<T>> engine; // kept while its thread count does not change
+    };
+
+    ThreadPool& pool;
+    std::vector<std::vector<unsigned char>> images; // levels 1 and up
+    std::vector<Lane> lanes;
+    // one thread per lane, apart from pool so the lane engines' pools never run inside its tasks
+    std::unique_ptr<ThreadPool> lanePool;
+
+    // @param work: pixels of every level
+    void plan(const std::vector<double>& work);
+};
+
+// edge of pyramid level `level` for an input edge of size, an odd edge rounds up
+int pyramidLevelSize(int size, int level);
+
+/*
+    one pyramid step: blur and halve in the same pass, rows spread over the pool
+    @param out: pyramidLevelSize(width, 1) * pyramidLevelSize(height, 1) bytes, row by row
+*/
+void pyramidReduce(ThreadPool& pool, const unsigned char* in, size_t stride, int width, int height, unsigned char* out);
@@ -0,0 +1,251 @@
+#include "tile_renderer.h"
+#include "../helpers/kernels.h"
+#include "../helpers/quantize.h"
+#include <algorithm>
+#include <cfloat>
+
+using namespace std;
+
+// rows of a tile handled by one pool task
+#define TILE_BLOCK_ROWS 16
+
+namespace {
+
+struct LayerSpec {
+    vector<vector<int>> kernel;
+    double divisor;
+    int padding;
+};
+
+const LayerSpec& layerSpec(int layer) {
+    static const LayerSpec specs[3] = {
+        { LAYER_1_KERNEL, LAYER_1_DIV, LAYER_1_PADDING },
+        { LAYER_2_KERNEL, LAYER_2_DIV, LAYER_2_PADDING },
+        { LAYER_3_KERNEL, LAYER_3_DIV, LAYER_3_PADDING },
+    };
+    return specs[layer];
+}
+
+// one row of a layer over the columns x0 .. x1, with the summation order and clamped borders of
+// the whole-image pipeline; rows[ky] is source row y + ky - padding clamped to the image, and
+// column x of a source row is at x - offset
+template <typename S>
+void convolveRow(const LayerSpec& spec, const S* const* rows, int offset, int x0, int x1, int width, double* out) {
+    int padding = spec.padding;
+    for (int x = x0; x <= x1; ++x) {
+        double sum = 0.0;
+        for (int ky = 0; ky <= 2 * padding; ++ky) {
+            const S* row = rows[ky];
+            const int* k = spec.kernel[ky].data();
+            for (int kx = -padding; kx <= padding; ++kx) {
+                sum += static_cast<double>(row[min(max(x + kx, 0), width - 1) - offset]) * k[kx + padding];
+            }
+        }
+        out[x - x0] = sum / spec.divisor;
+    }
+}
+
+} // namespace
+
+TileRenderer::TileRenderer(RegionReader read, int width, int height, const Summary& summary, int tileSize,
+                           size_t cacheTiles)
+    : read(std::move(read)), width(width), height(height), summary(summary), tileSize(tileSize),
+      cacheTiles(cacheTiles) {}
+
+TileRenderer::Rect TileRenderer::tileRect(int tx, int ty, int tileSize, int width, int height) {
+    return Rect{ tx * tileSize, ty * tileSize, min(width, (tx + 1) * tileSize) - 1, min(height, (ty + 1) * tileSize) - 1 };
+}
+
+void TileRenderer::chain(const RegionReader& read, int width, int height, const Rect& tile, vector<double>& raw,
+                         ThreadPool* pool) {
+    // the region of every layer is the next one's grown by that one's radius, clipped to the image
+    Rect rects[4];
+    rects[3] = tile;
+    for (int layer = 2; layer >= 0; --layer) {
+        int radius = layerSpec(layer).padding;
+        const Rect& next = rects[layer + 1];
+        rects[layer] = Rect{ max(next.x0 - radius, 0), max(next.y0 - radius, 0),
+                             min(next.x1 + radius, width - 1), min(next.y1 + radius, height - 1) };
+    }
+
+    vector<unsigned char> input(static_cast<size_t>(rects[0].getWidth()) * rects[0].getHeight());
+    read(rects[0].x0, rects[0].y0, rects[0].getWidth(), rects[0].getHeight(), input.data(), rects[0].getWidth());
+
+    vector<double> layers[2];
+    for (int layer = 0; layer < 3; ++layer) {
+        const LayerSpec& spec = layerSpec(layer);
+        const Rect& from = rects[layer];
+        const Rect& to = rects[layer + 1];
+        vector<double>& out = layer == 2 ? raw : layers[layer];
+        out.resize(static_cast<size_t>(to.getWidth()) * to.getHeight());
+        int blocks = (to.getHeight() + TILE_BLOCK_ROWS - 1) / TILE_BLOCK_ROWS;
+
+        // raw layers are chained, in global coordinates
+        auto rows = [&](int block) {
+            auto convolve = [&](const auto* in) {
+                vector<decltype(in)> sources(2 * spec.padding + 1);
+                int firstRow = to.y0 + block * TILE_BLOCK_ROWS;
+                int lastRow = min(to.y1, firstRow + TILE_BLOCK_ROWS - 1);
+                for (int y = firstRow; y <= lastRow; ++y) {
+                    for (int ky = -spec.padding; ky <= spec.padding; ++ky) {
+                        sources[ky + spec.padding] = in + static_cast<size_t>(min(max(y + ky, 0), height - 1) - from.y0) * from.getWidth();
+                    }
+                    convolveRow(spec, sources.data(), from.x0, to.x0, to.x1, width,
+                                out.data() + static_cast<size_t>(y - to.y0) * to.getWidth());
+                }
+            };
+            if (layer == 0) {
+                convolve(input.data());
+            } else {
+                convolve(static_cast<const double*>(layers[layer - 1].data()));
+            }
+        };
+        if (pool) {
+            pool->parallelFor(blocks, rows);
+        } else {
+            for (int block = 0; block < blocks; ++block) {
+                rows(block);
+            }
+        }
+    }
+}
+
+TileRenderer::Summary TileRenderer::summarize(ThreadPool& pool, const RegionReader& read, int width, int height,
+                                              int tileSize) {
+    int bands = (height + tileSize - 1) / tileSize;
+    vector<Summary> local(bands);
+
+    // every band streams its rows through the three layers once, keeping only the rows the next
+    // layer still reads; the layer rows around a band are computed again by it, not exchanged
+    pool.parallelFor(bands, [&](int band) {
+        Summary& ranges = local[band];
+        for (Range& range : ranges.layers) {
+            range = Range{ DBL_MAX, -DBL_MAX };
+        }
+        int first = band * tileSize;
+        int last = min(height, first + tileSize) - 1;
+
+        // rows of every layer the band needs, the last layer's being its own
+        int firstRows[4];
+        int lastRows[4];
+        firstRows[3] = first;
+        lastRows[3] = last;
+        for (int layer = 2; layer >= 0; --layer) {
+            int radius = layerSpec(layer).padding;
+            firstRows[layer] = max(firstRows[layer + 1] - radius, 0);
+            lastRows[layer] = min(lastRows[layer + 1] + radius, height - 1);
+        }
+
+        vector<unsigned char> input(static_cast<size_t>(lastRows[0] - firstRows[0] + 1) * width);
+        read(0, firstRows[0], width, lastRows[0] - firstRows[0] + 1, input.data(), width);
+
+        // a ring of the last 2 * padding + 1 rows of layers 1 and 2, enough for one row of the next layer
+        vector<double> rings[2];
+        int ringRows[2];
+        for (int layer = 0; layer < 2; ++layer) {
+            ringRows[layer] = 2 * layerSpec(layer + 1).padding + 1;
+            rings[layer].resize(static_cast<size_t>(ringRows[layer]) * width);
+        }
+        vector<double> lastLayer(width);
+        int next[3] = { firstRows[1], firstRows[2], firstRows[3] };
+
+        // computes the rows of layer up to y, those of the layers before it first
+        function<void(int, int)> advance = [&](int layer, int y) {
+            const LayerSpec& spec = layerSpec(layer);
+            for (; next[layer] <= y; ++next[layer]) {
+                int row = next[layer];
+                double* out = layer < 2 ? rings[layer].data() + static_cast<size_t>(row % ringRows[layer]) * width
+                                        : lastLayer.data();
+                if (layer == 0) {
+                    vector<const unsigned char*> sources(2 * spec.padding + 1);
+                    for (int ky = -spec.padding; ky <= spec.padding; ++ky) {
+                        int source = min(max(row + ky, 0), height - 1);
+                        sources[ky + spec.padding] = input.data() + static_cast<size_t>(source - firstRows[0]) * width;
+                    }
+                    convolveRow(spec, sources.data(), 0, 0, width - 1, width, out);
+                } else {
+                    advance(layer - 1, min(row + spec.padding, height - 1));
+                    vector<const double*> sources(2 * spec.padding + 1);
+                    for (int ky = -spec.padding; ky <= spec.padding; ++ky) {
+                        int source = min(max(row + ky, 0), height - 1);
+                        sources[ky + spec.padding] = rings[layer - 1].data() + static_cast<size_t>(source % ringRows[layer - 1]) * width;
+                    }
+                    convolveRow(spec, sources.data(), 0, 0, width - 1, width, out);
+                }
+
+                // a row belongs to the range of the band that owns it
+                if (row >= first && row <= last) {
+                    Range& range = ranges.layers[layer];
+                    for (int x = 0; x < width; ++x) {
+                        range.min = min(range.min, out[x]);
+                        range.max = max(range.max, out[x]);
+                    }
+                }
+            }
+        };
+        advance(2, last);
+    });
+
+    Summary summary;
+    for (int layer = 0; layer < 3; ++layer) {
+        Range range{ DBL_MAX, -DBL_MAX };
+        for (const Summary& ranges : local) {
+            range.min = min(range.min, ranges.layers[layer].min);
+            range.max = max(range.max, ranges.layers[layer].max);
+        }
+        summary.layers[layer] = range;
+    }
+    return summary;
+}
+
+TileRenderer::RawTile TileRenderer::rawTile(ThreadPool& pool, int tx, int ty) {
+    long long key = static_cast<long long>(ty) * getTilesAcross() + tx;
+    {
+        lock_guard<std::mutex> lock(cacheMutex);
+        ++stats.rendered;
+        auto found = cache.find(key);
+        if (found != cache.end()) {
+            recency.splice(recency.begin(), recency, found->second.second);
+            ++stats.hits;
+            return found->second.first;
+        }
+        ++stats.misses;
+    }
+
+    // computed outside the lock, two threads asking for the same new tile both compute it
+    auto computed = make_shared<vector<double>>();
+    chain(read, width, height, tileRect(tx, ty, tileSize, width, height), *computed, &pool);
+    RawTile tile = computed;
+    if (cacheTiles == 0) {
+        return tile;
+    }
+
+    lock_guard<std::mutex> lock(cacheMutex);
+    if (cache.find(key) == cache.end()) {
+        recency.push_front(key);
+        cache[key] = { tile, recency.begin() };
+        while (cache.size() > cacheTiles) {
+            cache.erase(recency.back());
+            recency.pop_back();
+            ++stats.evictions;
+        }
+    }
+    return tile;
+}
+
+void TileRenderer::render(ThreadPool& pool, int tx, int ty, unsigned char* output, size_t outputStride) {
+    RawTile tile = rawTile(pool, tx, ty);
+    Rect rect = tileRect(tx, ty, tileSize, width, height);
+    int tileWidth = rect.getWidth();
+
+    // the only normalization, fused into quantization as in the other implementations
+    Quantizer quantizer = normalizingQuantizer(summary.layers[2].min, summary.layers[2].max);
+    for (int y = 0; y < rect.getHeight(); ++y) {
+        quantizeRow(tile->data() + static_cast<size_t>(y) * tileWidth, tileWidth, output + y * outputStride, quantizer);
+    }
+}
+
+TileRenderer::Stats TileRenderer::getStats() const {
+    lock_guard<std::mutex> lock(cacheMutex);
+    return stats;
+}
@@ -0,0 +1,107 @@
+#pragma once
+#include <cstddef>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "../helpers/thread_pool.h"
+
+/*
+    renders output tiles on demand, for viewers that look at small regions of huge images:
+    a tile only needs its input region grown by the kernel radii (2 + 3 + 1 = 6 pixels) and the
+    global min / max of the last layer; as in IncrementalState the raw layers are chained and only
+    the last one is normalized, so a tile matches the single pass streaming implementation bit for
+    bit and a full run up to the rounding of its intermediate normalizations
+    the summary itself comes from summarize(), one pass over bands of rows that never holds more
+    than a band of input, computed once per image and kept by the caller
+    the raw (unnormalized) last layer of the most recently used tiles is cached, so revisiting a
+    tile or panning back only costs its quantization; the renderer holds no threads, every call
+    runs on the pool it is given, so threads with pools of their own can share one renderer
+*/
+class TileRenderer {
+public:
+    struct Range {
+        double min;
+        double max;
+    };
+
+    // min / max of the three raw layers, each convolved from the previous one unnormalized
+    struct Summary {
+        Range layers[3];
+    };
+
+    struct Stats {
+        long long rendered = 0;
+        long long hits = 0;      // tiles served from the raw layer cache
+        long long misses = 0;    // tiles computed from their input window
+        long long evictions = 0;
+    };
+
+    /*
+        copies the rectangle (x, y, w, h), inside the image, into out, rows stride bytes apart;
+        throws on read errors, called concurrently when renders overlap
+    */
+    typedef std::function<void(int, int, int, int, unsigned char*, size_t)> RegionReader;
+
+    /*
+        computes the summary in one pass: bands of tileSize rows are spread over the pool, each
+        streaming its rows through the three layers with a ring of the rows the next layer reads
+    */
+    static Summary summarize(ThreadPool& pool, const RegionReader& read, int width, int height, int tileSize);
+
+    // @param cacheTiles: raw last-layer tiles kept, 0 disables the cache
+    TileRenderer(RegionReader read, int width, int height, const Summary& summary, int tileSize, size_t cacheTiles);
+
+    TileRenderer(const TileRenderer&) = delete;
+    TileRenderer& operator=(const TileRenderer&) = delete;
+
+    /*
+        writes output tile (tx, ty), clipped to the image at the right and bottom edges
+        @param pool: runs the rows of the tile
+        @param output: tile width * tile height bytes, rows outputStride bytes apart
+    */
+    void render(ThreadPool& pool, int tx, int ty, unsigned char* output, size_t outputStride);
+
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+    int getTileSize() const { return tileSize; }
+    int getTilesAcross() const { return (width + tileSize - 1) / tileSize; }
+    int getTilesDown() const { return (height + tileSize - 1) / tileSize; }
+    Stats getStats() const;
+
+private:
+    struct Rect {
+        int x0, y0, x1, y1; // inclusive
+        int getWidth() const { return x1 - x0 + 1; }
+        int getHeight() const { return y1 - y0 + 1; }
+    };
+
+    typedef std::shared_ptr<const std::vector<double>> RawTile;
+
+    RegionReader read;
+    int width;
+    int height;
+    Summary summary;
+    int tileSize;
+    size_t cacheTiles;
+
+    mutable std::mutex cacheMutex;
+    std::map<long long, std::pair<RawTile, std::list<long long>::iterator>> cache;
+    std::list<long long> recency; // most recent first
+    Stats stats;
+
+    RawTile rawTile(ThreadPool& pool, int tx, int ty);
+
+    /*
+        chains the three raw layers over tile, every layer computed on the previous one's region
+        grown by its radius
+        @param raw: the tile's raw last layer, row by row
+        @param pool: runs the rows, null for the calling thread only
+    */
+    static void chain(const RegionReader& read, int width, int height, const Rect& tile,
+                      std::vector<double>& raw, ThreadPool* pool);
+
+    static Rect tileRect(int tx, int ty, int tileSize, int width, int height);
+};
@@ -12,18 +12,42 @@ enum COMM_TAGS {
     DIMENSIONS,
     IMAGE_DATA,
     RESULT_DATA,
-    MIN_MAX_DATA
+    MIN_MAX_DATA,
+    BAND_TASK,
+    BAND_RESULT,
+    IMAGE_REQUEST,
+    IMAGE_JOB
 };
 
+// outcome of the previous job, reported by batch workers when asking for the next one
+enum JOB_STATUS {
+    NONE,
+    DONE,
+    FAILED
+};
+
+// inCodec of a layer one strip that the worker reads from the tiled input itself,
+// the master sends the input path instead of the pixels
+#define TILED_INPUT_CODEC -1
+
 struct __attribute__((packed)) ProcessDims {
     int totalRows;
     int width;
     int rowsForWorker;
     int padding;
     int offset;
+    int inCodec;  // WIRE_CODEC of the scattered rows
+    int outCodec; // WIRE_CODEC of the gathered rows
+    int firstRow; // whole image row of the first received row, halo included
 
-    ProcessDims(int tRows, int w, int rfw, int pad, int off)
-        : totalRows(tRows), width(w), rowsForWorker(rfw), padding(pad), offset(off) {}
+    ProcessDims(int tRows, int w, int rfw, int pad, int off, int inC = 0, int outC = 0, int first = 0)
+        : totalRows(tRows), width(w), rowsForWorker(rfw), padding(pad), offset(off), inCodec(inC), outCodec(outC),
+          firstRow(first) {}
+
+    // pixel counts and offsets are 64-bit, a strip can hold more than INT_MAX pixels
+    long long totalPixels() const { return static_cast<long long>(totalRows) * width; }
+    long long workingPixels() const { return static_cast<long long>(rowsForWorker) * width; }
+    long long rowIndex(long long row) const { return row * width; }
 };
 
 struct __attribute__((packed)) MinMaxVals {
@@ -37,3 +61,30 @@ struct __attribute__((packed)) MinMaxVals {
         : min(0.0), max(0.0) {}
 };
 
+
+// a row band handed out by the farm master
+struct __attribute__((packed)) BandTask {
+    int layer;           // LAYER to apply, or -1 when there is no more work
+    int startRow;        // first computed row, in whole image coordinates
+    ProcessDims dims;    // band geometry, halo rows included
+    MinMaxVals previous; // min/max of the previous layer, used to normalize the band first
+
+    BandTask(int l, int start, ProcessDims d, MinMaxVals prev)
+        : layer(l), startRow(start), dims(d), previous(prev) {}
+
+    BandTask()
+        : layer(-1), startRow(0), dims(0, 0, 0, 0, 0), previous() {}
+};
+
+// header sent back by a farm worker ahead of the raw band values
+struct __attribute__((packed)) BandResult {
+    int startRow;
+    int rows;
+    MinMaxVals minMax; // min/max of the raw band values
+
+    BandResult(int start, int r, MinMaxVals mm)
+        : startRow(start), rows(r), minMax(mm) {}
+
+    BandResult()
+        : startRow(0), rows(0), minMax() {}
+};
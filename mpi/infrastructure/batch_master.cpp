@@ -0,0 +1,120 @@
+#include "batch_master.h"
+#include "master.h"
+#include "solo.h"
+#include "../helpers/batch_inputs.h"
+#include "../helpers/image.h"
+#include <mpi.h>
+#include <algorithm>
+#include <filesystem>
+#include <iostream>
+#include <utility>
+
+using namespace std;
+namespace fs = std::filesystem;
+
+BatchMaster::BatchMaster(int numtasks, int rank, string inputs, string outputDir, long long stripThreshold, WIRE_MODE wireMode,
+                         int threads)
+    : Entity(numtasks, rank), inputs(inputs), outputDir(outputDir), stripThreshold(stripThreshold), wireMode(wireMode),
+      rowPool(max(1, threads)) {}
+
+BatchMaster::~BatchMaster() {
+}
+
+void BatchMaster::run() {
+    fs::create_directories(outputDir);
+
+    // split the list by size, probing only the image headers
+    vector<string> stripJobs;
+    vector<pair<long long, string>> imageJobs;
+    for (const auto& path : listBatchInputs(inputs)) {
+        int width = 0, height = 0;
+        if (!GreyScaleImage::probe(path, width, height)) {
+            cerr << "Skipping unreadable image: " << path << endl;
+            ++failed;
+            continue;
+        }
+
+        long long size = static_cast<long long>(width) * height;
+        if (numtasks > 1 && size >= stripThreshold) {
+            stripJobs.push_back(path);
+        } else {
+            imageJobs.emplace_back(size, path);
+        }
+    }
+
+    // large images: every rank works on the same image, as in the single image mode
+    int stripImages = static_cast<int>(stripJobs.size());
+    MPI_Bcast(&stripImages, 1, MPI_INT, MASTER_RANK, MPI_COMM_WORLD);
+    for (const auto& path : stripJobs) {
+        Master master(numtasks, rank, path, batchOutputPath(outputDir, path), wireMode);
+
+        // the header probe passed, the decode can still fail: the crew only joins loaded images
+        int loaded = master.isLoaded() ? 1 : 0;
+        MPI_Bcast(&loaded, 1, MPI_INT, MASTER_RANK, MPI_COMM_WORLD);
+        if (!loaded) {
+            cerr << "Skipping unreadable image: " << path << endl;
+            ++failed;
+            continue;
+        }
+        // a failed save still gathers every strip, so the crew is free for the next image
+        try {
+            master.run();
+            ++succeeded;
+        } catch (const exception& e) {
+            cerr << e.what() << endl;
+            ++failed;
+        }
+    }
+
+    // largest first, so the last images handed out are the cheap ones
+    sort(imageJobs.begin(), imageJobs.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+    vector<string> jobs;
+    for (const auto& job : imageJobs) {
+        jobs.push_back(job.second);
+    }
+    farmImages(jobs);
+
+    cout << "Batch: " << succeeded << " images processed (" << stripImages << " strip-parallel), "
+         << failed << " failed, " << rowPool.size() << " threads per rank for whole images" << endl;
+}
+
+void BatchMaster::farmImages(const vector<string>& jobs) {
+    // alone, the master runs everything itself
+    if (numtasks == 1) {
+        for (const auto& path : jobs) {
+            try {
+                Solo(numtasks, rank, path, batchOutputPath(outputDir, path), &rowPool).run();
+                ++succeeded;
+            } catch (const exception& e) {
+                cerr << e.what() << endl;
+                ++failed;
+            }
+        }
+        return;
+    }
+
+    // every request reports the previous job and asks for the next one
+    size_t next = 0;
+    int active = numtasks - 1;
+    while (active > 0) {
+        int lastStatus;
+        MPI_Status status;
+        MPI_Recv(&lastStatus, 1, MPI_INT, MPI_ANY_SOURCE, COMM_TAGS::IMAGE_REQUEST, MPI_COMM_WORLD, &status);
+
+        if (lastStatus == JOB_STATUS::DONE) {
+            ++succeeded;
+        } else if (lastStatus == JOB_STATUS::FAILED) {
+            ++failed;
+        }
+
+        string job;
+        if (next < jobs.size()) {
+            job = jobs[next] + "\n" + batchOutputPath(outputDir, jobs[next]);
+            ++next;
+        } else {
+            --active;
+        }
+
+        MPI_Send(job.data(), static_cast<int>(job.size()), MPI_CHAR, status.MPI_SOURCE, COMM_TAGS::IMAGE_JOB, MPI_COMM_WORLD);
+    }
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include "entity.h"
+#include "auxs.h"
+#include "wire.h"
+#include <string>
+#include <vector>
+
+// images with at least this many pixels are split into strips across all ranks,
+// smaller ones are handed out whole to single ranks
+#define BATCH_STRIP_THRESHOLD 8000000LL
+
+// batch master: runs a list of images, large ones strip-parallel on every rank,
+// the rest image-parallel with one image per rank handed out on demand
+class BatchMaster : public Entity {
+public:
+    // @param threads: threads of this rank for whole images, see Solo::threadsPerRank
+    BatchMaster(int numtasks, int rank, std::string inputs, std::string outputDir,
+                long long stripThreshold = BATCH_STRIP_THRESHOLD, WIRE_MODE wireMode = WIRE_MODE_DOUBLE,
+                int threads = 1);
+    ~BatchMaster() override;
+    void run() override;
+
+private:
+    std::string inputs;
+    std::string outputDir;
+    long long stripThreshold;
+    WIRE_MODE wireMode;
+    ThreadPool rowPool; // rows of the whole images this rank runs
+
+    int succeeded = 0;
+    int failed = 0;
+
+    void farmImages(const std::vector<std::string>& jobs);
+};
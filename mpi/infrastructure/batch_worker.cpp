@@ -0,0 +1,60 @@
+#include "batch_worker.h"
+#include "worker.h"
+#include "solo.h"
+#include <iostream>
+#include <vector>
+
+using namespace std;
+
+BatchCrew::BatchCrew(int numtasks, int rank, int threads) : Entity(numtasks, rank), rowPool(max(1, threads)) {}
+
+BatchCrew::~BatchCrew() {
+}
+
+void BatchCrew::run() {
+    // strip-parallel images first, in the order the master runs them
+    int stripImages = 0;
+    MPI_Bcast(&stripImages, 1, MPI_INT, MASTER_RANK, MPI_COMM_WORLD);
+    for (int i = 0; i < stripImages; ++i) {
+        int loaded = 0;
+        MPI_Bcast(&loaded, 1, MPI_INT, MASTER_RANK, MPI_COMM_WORLD);
+        if (loaded) {
+            Crew(numtasks, rank).run();
+        }
+    }
+
+    // then whole images, one at a time
+    int status = JOB_STATUS::NONE;
+    string inputPath, outputPath;
+    while (requestJob(status, inputPath, outputPath)) {
+        try {
+            Solo(numtasks, rank, inputPath, outputPath, &rowPool).run();
+            status = JOB_STATUS::DONE;
+        } catch (const exception& e) {
+            cerr << "Rank " << rank << ": " << e.what() << endl;
+            status = JOB_STATUS::FAILED;
+        }
+    }
+}
+
+bool BatchCrew::requestJob(int lastStatus, string& inputPath, string& outputPath) {
+    MPI_Send(&lastStatus, 1, MPI_INT, MASTER_RANK, COMM_TAGS::IMAGE_REQUEST, MPI_COMM_WORLD);
+
+    // job is "input\noutput", an empty job means the list is exhausted
+    MPI_Status status;
+    int length = 0;
+    MPI_Probe(MASTER_RANK, COMM_TAGS::IMAGE_JOB, MPI_COMM_WORLD, &status);
+    MPI_Get_count(&status, MPI_CHAR, &length);
+
+    vector<char> job(length);
+    MPI_Recv(job.data(), length, MPI_CHAR, MASTER_RANK, COMM_TAGS::IMAGE_JOB, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    if (length == 0) {
+        return false;
+    }
+
+    string text(job.begin(), job.end());
+    size_t split = text.find('\n');
+    inputPath = text.substr(0, split);
+    outputPath = text.substr(split + 1);
+    return true;
+}
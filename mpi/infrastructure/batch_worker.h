@@ -0,0 +1,21 @@
+#pragma once
+
+#include <mpi.h>
+#include <string>
+
+#include "auxs.h"
+#include "entity.h"
+
+// batch worker: joins the strip-parallel images, then asks for whole images until none are left
+class BatchCrew : public Entity {
+public:
+    // @param threads: threads of this rank for whole images, see Solo::threadsPerRank
+    BatchCrew(int numtasks, int rank, int threads = 1);
+    ~BatchCrew() override;
+    void run() override;
+
+private:
+    ThreadPool rowPool; // rows of the whole images this rank runs
+
+    bool requestJob(int lastStatus, std::string& inputPath, std::string& outputPath);
+};
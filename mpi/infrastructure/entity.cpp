@@ -2,24 +2,51 @@
 
 using namespace std;
 
+// rows handled by one pool task
+#define ENTITY_BLOCK_ROWS 16
+
+void Entity::forRowBlocks(int numRows, const function<void(int, int)>& rows) const {
+    if (!pool) {
+        rows(0, numRows);
+        return;
+    }
+    int blocks = (numRows + ENTITY_BLOCK_ROWS - 1) / ENTITY_BLOCK_ROWS;
+    pool->parallelFor(blocks, [&](int block) {
+        rows(block * ENTITY_BLOCK_ROWS, min(numRows, (block + 1) * ENTITY_BLOCK_ROWS));
+    });
+}
+
 void Entity::computeMinMax() {
+    MinMaxVals localMinMax = computeLocalMinMax();
+
+    MPI_Allreduce(&localMinMax.min, &minMax.min, 1, MPI_DOUBLE, MPI_MIN, MPI_COMM_WORLD);
+    MPI_Allreduce(&localMinMax.max, &minMax.max, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+}
+
+MinMaxVals Entity::computeLocalMinMax() const {
     MinMaxVals localMinMax{DBL_MAX, -DBL_MAX};
-    
-    // compute local min/max for worker's rows using flat array
-    for (int i = 0; i < dims.rowsForWorker; ++i) {
-        for (int j = 0; j < dims.width; ++j) {
-            double val = at(dims.offset + i, j);
-            if (val < localMinMax.min) {
-                localMinMax.min = val;
-            }
-            if (val > localMinMax.max) {
-                localMinMax.max = val;
+    mutex merge;
+
+    // compute local min/max for worker's rows using flat array, one partial range per block
+    forRowBlocks(dims.rowsForWorker, [&](int first, int last) {
+        MinMaxVals block{DBL_MAX, -DBL_MAX};
+        for (int i = first; i < last; ++i) {
+            for (int j = 0; j < dims.width; ++j) {
+                double val = at(dims.offset + i, j);
+                if (val < block.min) {
+                    block.min = val;
+                }
+                if (val > block.max) {
+                    block.max = val;
+                }
             }
         }
-    }
-    
-    MPI_Allreduce(&localMinMax.min, &minMax.min, 1, MPI_DOUBLE, MPI_MIN, MPI_COMM_WORLD);
-    MPI_Allreduce(&localMinMax.max, &minMax.max, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+        lock_guard<mutex> lock(merge);
+        localMinMax.min = min(localMinMax.min, block.min);
+        localMinMax.max = max(localMinMax.max, block.max);
+    });
+
+    return localMinMax;
 }
 
 void Entity::process(LAYER layer) {
@@ -35,43 +62,53 @@ void Entity::process(LAYER layer) {
     int kernelRadius = kernelSize / 2;
     
     // create a flat result array for the processed rows (without padding)
-    vector<double> result(dims.rowsForWorker * dims.width);
+    vector<double> result(dims.workingPixels());
     
     // apply convolution only to the working rows
-    for (int i = 0; i < dims.rowsForWorker; ++i) {
-        for (int j = 0; j < dims.width; ++j) {
-            double sum = 0.0;
-            
-            for (int ki = 0; ki < kernelSize; ++ki) {
-                for (int kj = 0; kj < kernelSize; ++kj) {
-                    int pixelRow = dims.offset + i + (ki - kernelRadius);
-                    int pixelCol = j + (kj - kernelRadius);
-                    
-                    pixelRow = max(0, min(pixelRow, dims.totalRows - 1));
-                    pixelCol = max(0, min(pixelCol, dims.width - 1));
-                    
-                    sum += at(pixelRow, pixelCol) * kernel[ki][kj];
+    forRowBlocks(dims.rowsForWorker, [&](int first, int last) {
+        for (int i = first; i < last; ++i) {
+            for (int j = 0; j < dims.width; ++j) {
+                double sum = 0.0;
+
+                for (int ki = 0; ki < kernelSize; ++ki) {
+                    for (int kj = 0; kj < kernelSize; ++kj) {
+                        int pixelRow = dims.offset + i + (ki - kernelRadius);
+                        int pixelCol = j + (kj - kernelRadius);
+
+                        pixelRow = max(0, min(pixelRow, dims.totalRows - 1));
+                        pixelCol = max(0, min(pixelCol, dims.width - 1));
+
+                        sum += at(pixelRow, pixelCol) * kernel[ki][kj];
+                    }
                 }
+
+                result[dims.rowIndex(i) + j] = sum / divisor;
             }
-            
-            result[i * dims.width + j] = sum / divisor;
         }
-    }
-    
+    });
+
     // copy result back to working rows in pixels
-    for (int i = 0; i < dims.rowsForWorker; ++i) {
-        for (int j = 0; j < dims.width; ++j) {
-            at(dims.offset + i, j) = result[i * dims.width + j];
+    forRowBlocks(dims.rowsForWorker, [&](int first, int last) {
+        for (int i = first; i < last; ++i) {
+            for (int j = 0; j < dims.width; ++j) {
+                at(dims.offset + i, j) = result[dims.rowIndex(i) + j];
+            }
         }
-    }
+    });
 }
 
 void Entity::normalize() {
+    normalizeRows(dims.offset, dims.rowsForWorker);
+}
+
+void Entity::normalizeRows(int firstRow, int numRows) {
     double range = (minMax.max - minMax.min == 0) ? 1.0 : (minMax.max - minMax.min);
 
-    for (int i = 0; i < dims.rowsForWorker; ++i) {
-        for (int j = 0; j < dims.width; ++j) {
-            at(dims.offset + i, j) = 255.0 * (at(dims.offset + i, j) - minMax.min) / range;
+    forRowBlocks(numRows, [&](int first, int last) {
+        for (int i = firstRow + first; i < firstRow + last; ++i) {
+            for (int j = 0; j < dims.width; ++j) {
+                at(i, j) = 255.0 * (at(i, j) - minMax.min) / range;
+            }
         }
-    }
+    });
 }
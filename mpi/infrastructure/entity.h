@@ -5,12 +5,15 @@
 #include <cfloat>
 #include <vector>
 #include <algorithm>
+#include <functional>
+#include <mutex>
 
 #include "../helpers/kernels.h"
 #include "auxs.h"
 #include "entity.h"
 #include "../helpers/image.h"
 #include "../helpers/kernels.h"
+#include "../helpers/thread_pool.h"
 
 // abstract class
 class Entity {
@@ -27,11 +30,23 @@ protected:
     ProcessDims dims{0,0,0,0,0};
     MinMaxVals minMax{DBL_MAX, -DBL_MAX};
 
+    // when set, the rows of process, the min/max and normalize are spread over it
+    ThreadPool* pool = nullptr;
+
     void process(LAYER layer);
     void computeMinMax();
     void normalize();
 
+    // min/max of the working rows of this rank only (no reduction)
+    MinMaxVals computeLocalMinMax() const;
+
+    // normalizes any rows of the local buffer (padding included) with the current minMax
+    void normalizeRows(int firstRow, int numRows);
+
+    // rows(first, last) over [0, numRows) in blocks on the pool, or all at once on this thread
+    void forRowBlocks(int numRows, const std::function<void(int, int)>& rows) const;
+
     // helper to access pixel at (row, col) in flat array
-    inline double& at(int row, int col) { return pixels[row * dims.width + col]; }
-    inline const double& at(int row, int col) const { return pixels[row * dims.width + col]; }
+    inline double& at(int row, int col) { return pixels[dims.rowIndex(row) + col]; }
+    inline const double& at(int row, int col) const { return pixels[dims.rowIndex(row) + col]; }
 };
\ No newline at end of file
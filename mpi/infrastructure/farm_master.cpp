@@ -0,0 +1,142 @@
+#include "farm_master.h"
+#include <mpi.h>
+#include <cfloat>
+#include <cmath>
+#include <algorithm>
+
+using namespace std;
+
+FarmMaster::FarmMaster(int numtasks, int rank, string inputImagePath, string outputImagePath, WIRE_MODE wireMode)
+    : Master(numtasks, rank, inputImagePath, outputImagePath, wireMode),
+      rates(numtasks, 0.0), dispatchTime(numtasks, 0.0), pending(numtasks, MPI_REQUEST_NULL), staging(numtasks) {
+    height = image->getHeight();
+    width = image->getWidth();
+}
+
+FarmMaster::~FarmMaster() {
+}
+
+void FarmMaster::run() {
+    current = image->getFlattenedMatrix();
+    next.resize(current.size());
+
+    // layers are farmed one at a time: a layer's bands are only handed out once every band
+    // of the previous layer is back, so its global min/max is final before anyone normalizes
+    MinMaxVals previous;
+    for (int layer = LAYER::ONE; layer <= LAYER::THREE; ++layer) {
+        previous = farmLayer(static_cast<LAYER>(layer), previous);
+        swap(current, next);
+    }
+
+    stopWorkers();
+
+    // the last layer is normalized here, workers only ever return raw values; it is
+    // normalized while it is quantized for the encoder
+    pixels.swap(current);
+    image->setQuantizedFlattenedMatrix(pixels, normalizingQuantizer(previous.min, previous.max));
+    saveImage();
+}
+
+MinMaxVals FarmMaster::farmLayer(LAYER layer, const MinMaxVals& previous) {
+    MinMaxVals layerMinMax{DBL_MAX, -DBL_MAX};
+    WIRE_CODEC outCodec = rawCodec(wireMode);
+
+    nextRow = 0;
+    int outstanding = 0;
+    for (int worker = 1; worker < numtasks; ++worker) {
+        if (dispatch(worker, layer, previous)) {
+            ++outstanding;
+        }
+    }
+
+    // whichever worker reports back first gets the next band
+    while (outstanding > 0) {
+        BandResult result;
+        MPI_Status status;
+        MPI_Recv(&result, sizeof(BandResult), MPI_BYTE, MPI_ANY_SOURCE, COMM_TAGS::BAND_RESULT, MPI_COMM_WORLD, &status);
+        int worker = status.MPI_SOURCE;
+
+        recvPixels(&next[static_cast<long long>(result.startRow) * width], static_cast<long long>(result.rows) * width, outCodec, worker, COMM_TAGS::RESULT_DATA);
+        wireBytes += static_cast<long long>(result.rows) * width * wireBytesPerPixel(outCodec);
+        --outstanding;
+
+        // exponential moving average of the worker's throughput, shapes its next bands
+        double elapsed = max(MPI_Wtime() - dispatchTime[worker], 1e-6);
+        double rate = result.rows / elapsed;
+        rates[worker] = (rates[worker] > 0.0) ? 0.5 * rates[worker] + 0.5 * rate : rate;
+
+        layerMinMax.min = min(layerMinMax.min, result.minMax.min);
+        layerMinMax.max = max(layerMinMax.max, result.minMax.max);
+
+        if (dispatch(worker, layer, previous)) {
+            ++outstanding;
+        }
+    }
+
+    // band data sends have all been consumed, release them before the buffers are swapped
+    MPI_Waitall(numtasks, pending.data(), MPI_STATUSES_IGNORE);
+
+    return layerMinMax;
+}
+
+bool FarmMaster::dispatch(int worker, LAYER layer, const MinMaxVals& previous) {
+    if (nextRow >= height) {
+        return false;
+    }
+
+    int padding = getPaddingForLayer(layer);
+    int rows = bandRowsFor(worker);
+
+    // layer one ships the integral input, later layers the raw previous layer
+    WIRE_CODEC inCodec = (layer == LAYER::ONE) ? inputCodec(wireMode) : rawCodec(wireMode);
+    WIRE_CODEC outCodec = rawCodec(wireMode);
+
+    int actualStart = max(0, nextRow - padding);
+    int actualEnd = min(height, nextRow + rows + padding);
+    int totalRows = actualEnd - actualStart;
+
+    BandTask task(layer, nextRow, ProcessDims(totalRows, width, rows, padding, nextRow - actualStart, inCodec, outCodec), previous);
+
+    // the worker's previous band has come back, so its last data send is complete
+    MPI_Wait(&pending[worker], MPI_STATUS_IGNORE);
+
+    MPI_Send(&task, sizeof(BandTask), MPI_BYTE, worker, COMM_TAGS::BAND_TASK, MPI_COMM_WORLD);
+    isendPixels(current.data() + static_cast<long long>(actualStart) * width, static_cast<long long>(totalRows) * width, inCodec, staging[worker],
+                worker, COMM_TAGS::IMAGE_DATA, &pending[worker]);
+    wireBytes += static_cast<long long>(totalRows) * width * wireBytesPerPixel(inCodec);
+
+    dispatchTime[worker] = MPI_Wtime();
+    nextRow += rows;
+    return true;
+}
+
+int FarmMaster::bandRowsFor(int worker) const {
+    int remaining = height - nextRow;
+    int numWorkers = numtasks - 1;
+
+    // guided self-scheduling: bands shrink as the layer drains, so stragglers finish together
+    double share = static_cast<double>(remaining) / (FARM_GUIDED_FACTOR * numWorkers);
+
+    // scale by how fast this worker is compared to the workers measured so far
+    double rateSum = 0.0;
+    int measured = 0;
+    for (int w = 1; w < numtasks; ++w) {
+        if (rates[w] > 0.0) {
+            rateSum += rates[w];
+            ++measured;
+        }
+    }
+    if (rates[worker] > 0.0 && measured > 0) {
+        share *= rates[worker] / (rateSum / measured);
+    }
+
+    int rows = static_cast<int>(lround(share));
+    return min(remaining, max(rows, FARM_MIN_BAND_ROWS));
+}
+
+void FarmMaster::stopWorkers() {
+    BandTask stop;
+    for (int worker = 1; worker < numtasks; ++worker) {
+        MPI_Send(&stop, sizeof(BandTask), MPI_BYTE, worker, COMM_TAGS::BAND_TASK, MPI_COMM_WORLD);
+    }
+}
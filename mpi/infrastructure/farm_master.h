@@ -0,0 +1,38 @@
+#pragma once
+#include "master.h"
+#include "auxs.h"
+#include "wire.h"
+#include <vector>
+
+// smallest band handed out, keeps the halo overhead and message count bounded
+#define FARM_MIN_BAND_ROWS 8
+// each dispatch hands out 1 / (FARM_GUIDED_FACTOR * workers) of the remaining rows
+#define FARM_GUIDED_FACTOR 2
+
+// task-farm master: hands out row bands on demand instead of a static split,
+// so faster (or less oversubscribed) ranks end up processing more rows
+class FarmMaster : public Master {
+public:
+    FarmMaster(int numtasks, int rank, std::string inputImagePath, std::string outputImagePath,
+               WIRE_MODE wireMode = WIRE_MODE_DOUBLE);
+    ~FarmMaster() override;
+    void run() override;
+
+private:
+    int height = 0;
+    int width = 0;
+    int nextRow = 0;             // first row of the current layer not handed out yet
+
+    std::vector<double> current; // input of the layer being farmed (raw previous layer)
+    std::vector<double> next;    // raw results of the layer being farmed
+
+    std::vector<double> rates;        // measured rows per second, per worker
+    std::vector<double> dispatchTime; // MPI_Wtime of the last dispatch, per worker
+    std::vector<MPI_Request> pending; // outstanding band data send, per worker
+    std::vector<std::vector<unsigned char>> staging;
+
+    MinMaxVals farmLayer(LAYER layer, const MinMaxVals& previous);
+    bool dispatch(int worker, LAYER layer, const MinMaxVals& previous);
+    int bandRowsFor(int worker) const;
+    void stopWorkers();
+};
@@ -0,0 +1,36 @@
+#include "farm_worker.h"
+
+using namespace std;
+
+FarmCrew::FarmCrew(int numtasks, int rank) : Entity(numtasks, rank) {}
+
+FarmCrew::~FarmCrew() {
+}
+
+void FarmCrew::run() {
+    while (true) {
+        BandTask task;
+        MPI_Recv(&task, sizeof(BandTask), MPI_BYTE, MASTER_RANK, COMM_TAGS::BAND_TASK, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+        if (task.layer < 0) {
+            break;
+        }
+
+        dims = task.dims;
+        pixels.resize(dims.totalPixels());
+        recvPixels(pixels.data(), dims.totalPixels(), static_cast<WIRE_CODEC>(dims.inCodec),
+                   MASTER_RANK, COMM_TAGS::IMAGE_DATA);
+
+        // later layers arrive raw, normalize the whole band (halo included) with the previous layer's range
+        if (task.layer != LAYER::ONE) {
+            minMax = task.previous;
+            normalizeRows(0, dims.totalRows);
+        }
+
+        process(static_cast<LAYER>(task.layer));
+
+        BandResult result(task.startRow, dims.rowsForWorker, computeLocalMinMax());
+        MPI_Send(&result, sizeof(BandResult), MPI_BYTE, MASTER_RANK, COMM_TAGS::BAND_RESULT, MPI_COMM_WORLD);
+        sendPixels(&pixels[dims.rowIndex(dims.offset)], dims.workingPixels(), static_cast<WIRE_CODEC>(dims.outCodec),
+                   MASTER_RANK, COMM_TAGS::RESULT_DATA);
+    }
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <mpi.h>
+#include <vector>
+
+#include "auxs.h"
+#include "entity.h"
+#include "wire.h"
+
+// task-farm worker: processes row bands until the master runs out of work
+class FarmCrew : public Entity {
+public:
+    FarmCrew(int numtasks, int rank);
+    ~FarmCrew() override;
+    void run() override;
+};
@@ -2,12 +2,18 @@
 #include <mpi.h>
 #include <cfloat>
 #include "../helpers/kernels.h"
+#include "../helpers/png_writer.h"
 #include <algorithm>
+#include <string>
+#include <stdexcept>
+#include <memory>
 
 using namespace std;
 
-Master::Master(int numtasks, int rank, string inputImagePath, string outputImagePath) : Entity(numtasks, rank) {
+Master::Master(int numtasks, int rank, string inputImagePath, string outputImagePath, WIRE_MODE wireMode)
+    : Entity(numtasks, rank), wireMode(wireMode) {
     image = make_unique<GreyScaleImage>(inputImagePath);
+    inImagePath = inputImagePath;
     outImagePath = outputImagePath;
 }
 
@@ -20,19 +26,50 @@ void Master::run() {
         process(static_cast<LAYER>(layer));
         computeMinMax();
         normalize();
+
+        if (layer == LAYER::THREE && streamsFinalLayer()) {
+            streamAndSaveLayer();
+            return;
+        }
         gatherAndSaveLayer();
     }
 
     saveImage();
 }
 
-void Master::scatter(LAYER layer) {
+void Master::keepOutput(bool keep) {
+    keepOutputBytes = keep;
+}
 
-    // image data
-    const auto& flattenMatrix = image->getFlattenedMatrix();
+bool Master::streamsFinalLayer() const {
+    // only PNG outputs are streamed, the other formats go through GreyScaleImage::save
+    return !outImagePath.empty() && greyFormatForPath(outImagePath) == GREY_FORMAT_NONE &&
+           !isTiledPath(outImagePath);
+}
+
+void Master::scatter(LAYER layer) {
     int height = image->getHeight();
     int width = image->getWidth();
     int padding = getPaddingForLayer(layer);
+
+    // a tiled input is never decoded here: every rank reads the tiles under its own rows and halo
+    const TiledImageReader* tiled = (layer == LAYER::ONE) ? image->getTiledInput() : nullptr;
+    if (tiled) {
+        scatterTiled(*tiled, padding);
+        return;
+    }
+
+    // image data
+    const auto& flattenMatrix = image->getFlattenedMatrix();
+
+    // layer one scatters the raw (integral) input, later layers the normalized previous layer
+    WIRE_CODEC inCodec = (layer == LAYER::ONE) ? inputCodec(wireMode) : payloadCodec(wireMode);
+    WIRE_CODEC outCodec = payloadCodec(wireMode);
+
+    // a streamed final layer comes back already quantized to the output bytes
+    if (layer == LAYER::THREE && streamsFinalLayer()) {
+        outCodec = WIRE_UINT8;
+    }
     
     // number of workers (excluding master)
     int numWorkers = numtasks;
@@ -42,6 +79,7 @@ void Master::scatter(LAYER layer) {
     int remainder = height % numWorkers;
 
     vector<MPI_Request> requests((numtasks - 1) * 2);
+    vector<vector<unsigned char>> staging(numtasks);
     int reqIdx = 0;
 
     int startRow = 0;    
@@ -55,20 +93,22 @@ void Master::scatter(LAYER layer) {
         int totalRows = actualEnd - actualStart;
         
         // prep dimensions
-        ProcessDims dims(totalRows, width, rowsForWorker, padding, startRow - actualStart);
+        ProcessDims dims(totalRows, width, rowsForWorker, padding, startRow - actualStart, inCodec, outCodec);
 
         // prep work for self
         if (worker == MASTER_RANK) {
             this->dims = dims;
-            pixels.resize(dims.totalRows * dims.width);
-            copy(flattenMatrix.begin() + actualStart * width, flattenMatrix.begin() + actualStart * width + totalRows * width, pixels.begin());
+            pixels.resize(dims.totalPixels());
+            copy(flattenMatrix.begin() + static_cast<long long>(actualStart) * width, flattenMatrix.begin() + static_cast<long long>(actualStart) * width + static_cast<long long>(totalRows) * width, pixels.begin());
             startRow += rowsForWorker;
             continue;
         }
         
         // non-blocking send to worker for overlapping communication
         MPI_Isend(&dims, sizeof(ProcessDims), MPI_BYTE, worker, COMM_TAGS::DIMENSIONS, MPI_COMM_WORLD, &requests[reqIdx++]);
-        MPI_Isend(flattenMatrix.data() + actualStart * width, totalRows * width, MPI_DOUBLE, worker, COMM_TAGS::IMAGE_DATA, MPI_COMM_WORLD, &requests[reqIdx++]);
+        isendPixels(flattenMatrix.data() + static_cast<long long>(actualStart) * width, static_cast<long long>(totalRows) * width, inCodec, staging[worker],
+                    worker, COMM_TAGS::IMAGE_DATA, &requests[reqIdx++]);
+        wireBytes += static_cast<long long>(totalRows) * width * wireBytesPerPixel(inCodec);
         
         startRow += rowsForWorker;
     }
@@ -77,6 +117,50 @@ void Master::scatter(LAYER layer) {
     MPI_Waitall(reqIdx, requests.data(), MPI_STATUSES_IGNORE);
 }
 
+void Master::scatterTiled(const TiledImageReader& tiled, int padding) {
+    int height = tiled.getHeight();
+    int width = tiled.getWidth();
+    WIRE_CODEC outCodec = payloadCodec(wireMode);
+
+    int baseRows = height / numtasks;
+    int remainder = height % numtasks;
+
+    vector<MPI_Request> requests((numtasks - 1) * 2);
+    vector<ProcessDims> sent(numtasks, ProcessDims(0, 0, 0, 0, 0));
+    int reqIdx = 0;
+
+    int startRow = 0;
+    for (int worker = 0; worker < numtasks; ++worker) {
+        int rowsForWorker = baseRows + (worker < remainder ? 1 : 0);
+        int actualStart = max(0, startRow - padding);
+        int actualEnd = min(height, startRow + rowsForWorker + padding);
+        int totalRows = actualEnd - actualStart;
+
+        sent[worker] = ProcessDims(totalRows, width, rowsForWorker, padding, startRow - actualStart,
+                                   TILED_INPUT_CODEC, outCodec, actualStart);
+        startRow += rowsForWorker;
+
+        if (worker == MASTER_RANK) {
+            continue;
+        }
+
+        // the path replaces the pixel payload
+        MPI_Isend(&sent[worker], sizeof(ProcessDims), MPI_BYTE, worker, COMM_TAGS::DIMENSIONS, MPI_COMM_WORLD,
+                  &requests[reqIdx++]);
+        MPI_Isend(inImagePath.data(), static_cast<int>(inImagePath.size()), MPI_CHAR, worker, COMM_TAGS::IMAGE_DATA,
+                  MPI_COMM_WORLD, &requests[reqIdx++]);
+        wireBytes += static_cast<long long>(inImagePath.size());
+    }
+
+    // own rows straight from the tiles, while the workers decode theirs
+    dims = sent[MASTER_RANK];
+    vector<unsigned char> bytes(static_cast<size_t>(dims.totalRows) * width);
+    tiled.readRows(dims.firstRow, dims.totalRows, bytes.data());
+    pixels.assign(bytes.begin(), bytes.end());
+
+    MPI_Waitall(reqIdx, requests.data(), MPI_STATUSES_IGNORE);
+}
+
 int Master::getPaddingForLayer(LAYER layer) {
     switch (layer) {
         case LAYER::ONE:
@@ -94,7 +178,7 @@ void Master::gatherAndSaveLayer() {
     int height = image->getHeight();
     int width = image->getWidth();
 
-    vector<double> pixels(height * width);
+    vector<double> pixels(static_cast<long long>(height) * width);
 
     // number of workers 
     int numWorkers = numtasks;
@@ -105,16 +189,20 @@ void Master::gatherAndSaveLayer() {
 
     // gather from self
     int rowsForMaster = baseRows + (0 < remainder ? 1 : 0);
-    copy(this->pixels.begin() + dims.offset * dims.width, this->pixels.begin() + (dims.offset + dims.rowsForWorker) * dims.width, pixels.begin());
+    copy(this->pixels.begin() + dims.rowIndex(dims.offset), this->pixels.begin() + dims.rowIndex(dims.offset + dims.rowsForWorker), pixels.begin());
 
     // post all receives concurrently
+    WIRE_CODEC outCodec = static_cast<WIRE_CODEC>(dims.outCodec);
     vector<MPI_Request> requests(numtasks - 1);
+    vector<vector<unsigned char>> staging(numtasks);
     int startRow = rowsForMaster;    
     for (int worker = 1; worker < numtasks; ++worker) {
         // rows for this worker (distribute remainder)
         int rowsForWorker = baseRows + (worker < remainder ? 1 : 0);
         
-        MPI_Irecv(&pixels[startRow * width], rowsForWorker * width, MPI_DOUBLE, worker, COMM_TAGS::RESULT_DATA, MPI_COMM_WORLD, &requests[worker - 1]);
+        irecvPixels(&pixels[static_cast<long long>(startRow) * width], static_cast<long long>(rowsForWorker) * width, outCodec, staging[worker],
+                    worker, COMM_TAGS::RESULT_DATA, &requests[worker - 1]);
+        wireBytes += static_cast<long long>(rowsForWorker) * width * wireBytesPerPixel(outCodec);
         
         startRow += rowsForWorker;
     }
@@ -122,9 +210,100 @@ void Master::gatherAndSaveLayer() {
     // wait for all receives to complete
     MPI_Waitall(numtasks - 1, requests.data(), MPI_STATUSES_IGNORE);
 
+    // decode the compressed strips in place
+    startRow = rowsForMaster;
+    for (int worker = 1; worker < numtasks; ++worker) {
+        int rowsForWorker = baseRows + (worker < remainder ? 1 : 0);
+        finishRecvPixels(&pixels[static_cast<long long>(startRow) * width], static_cast<long long>(rowsForWorker) * width, outCodec, staging[worker]);
+        startRow += rowsForWorker;
+    }
+
     image->setFlattenedMatrix(pixels);
 }
 
+void Master::streamAndSaveLayer() {
+    int height = image->getHeight();
+    int width = image->getWidth();
+
+    // the previous layer was only needed for the scatter, the final layer never exists as doubles here
+    image.reset();
+
+    int baseRows = height / numtasks;
+    int remainder = height % numtasks;
+
+    // post all receives up front, strips arrive as output bytes
+    vector<MPI_Request> requests(numtasks, MPI_REQUEST_NULL);
+    vector<vector<unsigned char>> strips(numtasks);
+    vector<int> stripRows(numtasks);
+    for (int worker = 0; worker < numtasks; ++worker) {
+        stripRows[worker] = baseRows + (worker < remainder ? 1 : 0);
+        if (worker == MASTER_RANK) {
+            continue;
+        }
+
+        strips[worker].resize(static_cast<size_t>(stripRows[worker]) * width);
+        wireIrecv(strips[worker].data(), static_cast<long long>(stripRows[worker]) * width, MPI_BYTE, worker,
+                  COMM_TAGS::RESULT_DATA, &requests[worker]);
+        wireBytes += static_cast<long long>(stripRows[worker]) * width;
+    }
+
+    // a write error is rethrown only once every strip is in, so no rank is left sending
+    unique_ptr<PngStreamWriter> writer;
+    string failure;
+    try {
+        writer = make_unique<PngStreamWriter>(outImagePath, width, height);
+    } catch (const exception& e) {
+        failure = e.what();
+    }
+
+    // own rows first, then every strip in rank (= row) order as soon as it is in,
+    // so encoding overlaps with the ranks that are still sending
+    packPixels(&pixels[dims.rowIndex(dims.offset)], dims.workingPixels(), WIRE_UINT8, strips[MASTER_RANK]);
+    for (int worker = 0; worker < numtasks; ++worker) {
+        MPI_Wait(&requests[worker], MPI_STATUS_IGNORE);
+        if (writer) {
+            try {
+                writeOutputRows(*writer, strips[worker].data(), stripRows[worker], width);
+            } catch (const exception& e) {
+                failure = e.what();
+                writer.reset();
+            }
+        }
+        vector<unsigned char>().swap(strips[worker]);
+    }
+
+    if (writer) {
+        writer->finish();
+    }
+    if (!failure.empty()) {
+        throw runtime_error(failure);
+    }
+}
+
+void Master::writeOutputRows(PngStreamWriter& writer, const unsigned char* rows, int count, int width) {
+    writer.writeRows(rows, count);
+    if (keepOutputBytes) {
+        outputBytes.insert(outputBytes.end(), rows, rows + static_cast<size_t>(count) * width);
+    }
+}
+
 void Master::saveImage() {
+    // the bytes the encoder gets, the same whatever the output format
+    if (keepOutputBytes) {
+        const unsigned char* bytes = image->getBytes();
+        outputBytes.assign(bytes, bytes + static_cast<size_t>(image->getWidth()) * image->getHeight());
+    }
+    if (outImagePath.empty()) {
+        return;
+    }
+
     image->save(outImagePath);
 }
+
+bool Master::isLoaded() const {
+    return image->getWidth() > 0 && image->getHeight() > 0;
+}
+
+long long Master::getWireBytes() const {
+    return wireBytes;
+}
@@ -0,0 +1,57 @@
+#include "solo.h"
+#include <stdexcept>
+#include <thread>
+
+using namespace std;
+
+Solo::Solo(int numtasks, int rank, string inputImagePath, string outputImagePath, ThreadPool* pool)
+    : Entity(numtasks, rank), inImagePath(inputImagePath), outImagePath(outputImagePath) {
+    this->pool = pool;
+}
+
+int Solo::threadsPerRank(int requested) {
+    // ranks sharing a node, found even when the caller asked for a fixed count so every rank takes part
+    MPI_Comm node;
+    int ranksOnNode = 1;
+    MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, 0, MPI_INFO_NULL, &node);
+    MPI_Comm_size(node, &ranksOnNode);
+    MPI_Comm_free(&node);
+
+    if (requested > 0) {
+        return requested;
+    }
+    int hardware = max(1u, thread::hardware_concurrency());
+    return max(1, hardware / ranksOnNode);
+}
+
+Solo::~Solo() {
+}
+
+void Solo::run() {
+    int threads = pool ? pool->size() : 1;
+    GreyScaleImage image;
+    if (!image.load(inImagePath, previewFactor(), threads)) {
+        throw runtime_error("Failed to load image: " + inImagePath);
+    }
+
+    // the whole image is this rank's working set, there are no padding rows to receive
+    pixels = image.getFlattenedMatrix();
+    dims = ProcessDims(image.getHeight(), image.getWidth(), image.getHeight(), 0, 0);
+
+    for (int layer = LAYER::ONE; layer <= LAYER::THREE; ++layer) {
+        process(static_cast<LAYER>(layer));
+        minMax = computeLocalMinMax();
+
+        // the last layer is normalized while it is quantized for the encoder
+        if (layer != LAYER::THREE) {
+            normalize();
+        }
+    }
+
+    image.setQuantizedFlattenedMatrix(pixels, normalizingQuantizer(minMax.min, minMax.max));
+    PngOptions options = defaultPngOptions();
+    if (options.threads == 0) {
+        options.threads = threads;
+    }
+    image.save(outImagePath, options);
+}
@@ -0,0 +1,26 @@
+#pragma once
+#include "entity.h"
+#include "../helpers/image.h"
+#include <string>
+
+// runs the whole pipeline for one image inside a single rank, no communication
+class Solo : public Entity {
+public:
+    /*
+        @param pool: spreads the rows of every layer over the rank's threads, null for this thread
+                     only; decoding and encoding get the same number of threads of the shared pool
+    */
+    Solo(int numtasks, int rank, std::string inputImagePath, std::string outputImagePath, ThreadPool* pool = nullptr);
+    ~Solo() override;
+    void run() override;
+
+    /*
+        threads of every rank for whole-image jobs, collective over MPI_COMM_WORLD
+        @param requested: threads per rank, 0 shares the hardware threads among the ranks on the node
+    */
+    static int threadsPerRank(int requested);
+
+private:
+    std::string inImagePath;
+    std::string outImagePath;
+};
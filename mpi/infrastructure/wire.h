@@ -0,0 +1,242 @@
+#pragma once
+
+#include <mpi.h>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+// encodings used for pixel payloads exchanged between ranks
+enum WIRE_CODEC {
+    WIRE_DOUBLE,   // 8 bytes per pixel, lossless
+    WIRE_FLOAT32,  // 4 bytes per pixel, ~7 significant digits
+    WIRE_FIXED16,  // 2 bytes per pixel, [0, 255] with 8 fractional bits, |error| <= 1/512
+    WIRE_UINT8     // 1 byte per pixel, only lossless for integral values in [0, 255]
+};
+
+// codec selected on the command line, mapped to per-payload codecs by the master
+enum WIRE_MODE {
+    WIRE_MODE_DOUBLE,  // everything as doubles (original behaviour)
+    WIRE_MODE_UINT8,   // uint8 for the layer one input, doubles for the rest (lossless)
+    WIRE_MODE_FLOAT32, // uint8 for the layer one input, float32 for the rest
+    WIRE_MODE_FIXED16  // uint8 for the layer one input, fixed16 for the rest
+};
+
+inline WIRE_MODE parseWireMode(const std::string& name) {
+    if (name == "double")  return WIRE_MODE_DOUBLE;
+    if (name == "uint8")   return WIRE_MODE_UINT8;
+    if (name == "float32") return WIRE_MODE_FLOAT32;
+    if (name == "fixed16") return WIRE_MODE_FIXED16;
+    throw std::invalid_argument("Unknown wire codec: " + name + " (expected double, uint8, float32 or fixed16)");
+}
+
+// codec for the raw layer one input, which is always integral
+inline WIRE_CODEC inputCodec(WIRE_MODE mode) {
+    return mode == WIRE_MODE_DOUBLE ? WIRE_DOUBLE : WIRE_UINT8;
+}
+
+// codec for normalized payloads, which live in [0, 255]
+inline WIRE_CODEC payloadCodec(WIRE_MODE mode) {
+    switch (mode) {
+        case WIRE_MODE_FLOAT32: return WIRE_FLOAT32;
+        case WIRE_MODE_FIXED16: return WIRE_FIXED16;
+        default:                return WIRE_DOUBLE;
+    }
+}
+
+// codec for raw (not yet normalized) payloads, which have no fixed range
+inline WIRE_CODEC rawCodec(WIRE_MODE mode) {
+    return mode == WIRE_MODE_FLOAT32 ? WIRE_FLOAT32 : WIRE_DOUBLE;
+}
+
+inline int wireBytesPerPixel(WIRE_CODEC codec) {
+    switch (codec) {
+        case WIRE_FLOAT32: return 4;
+        case WIRE_FIXED16: return 2;
+        case WIRE_UINT8:   return 1;
+        default:           return 8;
+    }
+}
+
+// MPI counts are int: larger payloads are sent as one element of a derived type
+// (WIRE_BLOCK-sized blocks plus the remainder), both can be lowered to exercise that path
+#ifndef WIRE_MAX_COUNT
+#define WIRE_MAX_COUNT INT_MAX
+#endif
+#ifndef WIRE_BLOCK
+#define WIRE_BLOCK (1 << 20)
+#endif
+
+// count and datatype to hand to MPI for count elements of base, free with releaseWireType
+struct WireType {
+    int count;
+    MPI_Datatype type;
+    bool derived;
+};
+
+inline WireType wireType(long long count, MPI_Datatype base) {
+    if (count <= WIRE_MAX_COUNT) {
+        return WireType{ static_cast<int>(count), base, false };
+    }
+
+    MPI_Aint lowerBound, extent;
+    MPI_Type_get_extent(base, &lowerBound, &extent);
+
+    long long blocks = count / WIRE_BLOCK;
+    int rest = static_cast<int>(count % WIRE_BLOCK);
+    MPI_Datatype block, blockRun, whole;
+    MPI_Type_contiguous(WIRE_BLOCK, base, &block);
+    MPI_Type_contiguous(static_cast<int>(blocks), block, &blockRun);
+
+    int lengths[2] = { 1, rest };
+    MPI_Aint displacements[2] = { 0, static_cast<MPI_Aint>(blocks * WIRE_BLOCK) * extent };
+    MPI_Datatype types[2] = { blockRun, base };
+    MPI_Type_create_struct(2, lengths, displacements, types, &whole);
+    MPI_Type_commit(&whole);
+
+    MPI_Type_free(&blockRun);
+    MPI_Type_free(&block);
+    return WireType{ 1, whole, true };
+}
+
+// a derived type can be released as soon as the call using it was posted
+inline void releaseWireType(WireType& wire) {
+    if (wire.derived) {
+        MPI_Type_free(&wire.type);
+    }
+}
+
+inline void wireIsend(const void* buffer, long long count, MPI_Datatype base, int dest, int tag, MPI_Request* request) {
+    WireType wire = wireType(count, base);
+    MPI_Isend(buffer, wire.count, wire.type, dest, tag, MPI_COMM_WORLD, request);
+    releaseWireType(wire);
+}
+
+inline void wireSend(const void* buffer, long long count, MPI_Datatype base, int dest, int tag) {
+    WireType wire = wireType(count, base);
+    MPI_Send(buffer, wire.count, wire.type, dest, tag, MPI_COMM_WORLD);
+    releaseWireType(wire);
+}
+
+inline void wireIrecv(void* buffer, long long count, MPI_Datatype base, int source, int tag, MPI_Request* request) {
+    WireType wire = wireType(count, base);
+    MPI_Irecv(buffer, wire.count, wire.type, source, tag, MPI_COMM_WORLD, request);
+    releaseWireType(wire);
+}
+
+// encodes count pixels from src into out (resized to fit)
+inline void packPixels(const double* src, long long count, WIRE_CODEC codec, std::vector<unsigned char>& out) {
+    out.resize(static_cast<size_t>(count) * wireBytesPerPixel(codec));
+
+    switch (codec) {
+        case WIRE_DOUBLE:
+            memcpy(out.data(), src, static_cast<size_t>(count) * sizeof(double));
+            break;
+        case WIRE_FLOAT32: {
+            float* dst = reinterpret_cast<float*>(out.data());
+            for (long long i = 0; i < count; ++i) {
+                dst[i] = static_cast<float>(src[i]);
+            }
+            break;
+        }
+        case WIRE_FIXED16: {
+            unsigned short* dst = reinterpret_cast<unsigned short*>(out.data());
+            for (long long i = 0; i < count; ++i) {
+                double q = std::nearbyint(src[i] * 256.0);
+                dst[i] = static_cast<unsigned short>(q < 0.0 ? 0.0 : (q > 65535.0 ? 65535.0 : q));
+            }
+            break;
+        }
+        case WIRE_UINT8: {
+            unsigned char* dst = out.data();
+            for (long long i = 0; i < count; ++i) {
+                double q = src[i];
+                dst[i] = static_cast<unsigned char>(q < 0.0 ? 0.0 : (q > 255.0 ? 255.0 : q));
+            }
+            break;
+        }
+    }
+}
+
+// decodes count pixels from src into dst
+inline void unpackPixels(const unsigned char* src, long long count, WIRE_CODEC codec, double* dst) {
+    switch (codec) {
+        case WIRE_DOUBLE:
+            memcpy(dst, src, static_cast<size_t>(count) * sizeof(double));
+            break;
+        case WIRE_FLOAT32: {
+            const float* in = reinterpret_cast<const float*>(src);
+            for (long long i = 0; i < count; ++i) {
+                dst[i] = in[i];
+            }
+            break;
+        }
+        case WIRE_FIXED16: {
+            const unsigned short* in = reinterpret_cast<const unsigned short*>(src);
+            for (long long i = 0; i < count; ++i) {
+                dst[i] = in[i] / 256.0;
+            }
+            break;
+        }
+        case WIRE_UINT8:
+            for (long long i = 0; i < count; ++i) {
+                dst[i] = src[i];
+            }
+            break;
+    }
+}
+
+// non-blocking send of count pixels; doubles go out directly, other codecs through staging
+// staging must stay alive until the request completes
+inline void isendPixels(const double* src, long long count, WIRE_CODEC codec, std::vector<unsigned char>& staging,
+                        int dest, int tag, MPI_Request* request) {
+    if (codec == WIRE_DOUBLE) {
+        wireIsend(src, count, MPI_DOUBLE, dest, tag, request);
+        return;
+    }
+
+    packPixels(src, count, codec, staging);
+    wireIsend(staging.data(), static_cast<long long>(staging.size()), MPI_BYTE, dest, tag, request);
+}
+
+// blocking send of count pixels
+inline void sendPixels(const double* src, long long count, WIRE_CODEC codec, int dest, int tag) {
+    if (codec == WIRE_DOUBLE) {
+        wireSend(src, count, MPI_DOUBLE, dest, tag);
+        return;
+    }
+
+    std::vector<unsigned char> staging;
+    packPixels(src, count, codec, staging);
+    wireSend(staging.data(), static_cast<long long>(staging.size()), MPI_BYTE, dest, tag);
+}
+
+// non-blocking receive of count pixels; for non-double codecs the payload lands in staging
+// and must be decoded with finishRecvPixels once the request completes
+inline void irecvPixels(double* dst, long long count, WIRE_CODEC codec, std::vector<unsigned char>& staging,
+                        int source, int tag, MPI_Request* request) {
+    if (codec == WIRE_DOUBLE) {
+        wireIrecv(dst, count, MPI_DOUBLE, source, tag, request);
+        return;
+    }
+
+    staging.resize(static_cast<size_t>(count) * wireBytesPerPixel(codec));
+    wireIrecv(staging.data(), static_cast<long long>(staging.size()), MPI_BYTE, source, tag, request);
+}
+
+inline void finishRecvPixels(double* dst, long long count, WIRE_CODEC codec, const std::vector<unsigned char>& staging) {
+    if (codec != WIRE_DOUBLE) {
+        unpackPixels(staging.data(), count, codec, dst);
+    }
+}
+
+// blocking receive of count pixels
+inline void recvPixels(double* dst, long long count, WIRE_CODEC codec, int source, int tag) {
+    std::vector<unsigned char> staging;
+    MPI_Request request;
+    irecvPixels(dst, count, codec, staging, source, tag, &request);
+    MPI_Wait(&request, MPI_STATUS_IGNORE);
+    finishRecvPixels(dst, count, codec, staging);
+}
@@ -1,5 +1,6 @@
 #include "worker.h"
 #include <algorithm>
+#include <string>
 
 using namespace std;
 
@@ -23,12 +24,35 @@ void Crew::receive() {
     MPI_Recv(&dims, sizeof(ProcessDims), MPI_BYTE, MASTER_RANK, COMM_TAGS::DIMENSIONS, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
     this->dims = dims;
 
+    // tiled input: only the path comes over the wire, the strip and its halo are decoded here
+    if (dims.inCodec == TILED_INPUT_CODEC) {
+        MPI_Status status;
+        int length;
+        MPI_Probe(MASTER_RANK, COMM_TAGS::IMAGE_DATA, MPI_COMM_WORLD, &status);
+        MPI_Get_count(&status, MPI_CHAR, &length);
+
+        string path(length, '\0');
+        MPI_Recv(&path[0], length, MPI_CHAR, MASTER_RANK, COMM_TAGS::IMAGE_DATA, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+
+        vector<unsigned char> bytes(static_cast<size_t>(dims.totalRows) * dims.width);
+        try {
+            TiledImageReader(path).readRows(dims.firstRow, dims.totalRows, bytes.data());
+        } catch (const runtime_error& e) {
+            cerr << "Rank " << rank << ": " << e.what() << endl;
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        pixels.assign(bytes.begin(), bytes.end());
+        return;
+    }
+
     // receive directly into flat array
-    pixels.resize(dims.totalRows * dims.width);
-    MPI_Recv(pixels.data(), dims.totalRows * dims.width, MPI_DOUBLE, MASTER_RANK, COMM_TAGS::IMAGE_DATA, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    pixels.resize(dims.totalPixels());
+    recvPixels(pixels.data(), dims.totalPixels(), static_cast<WIRE_CODEC>(dims.inCodec),
+               MASTER_RANK, COMM_TAGS::IMAGE_DATA);
 }
 
 void Crew::send() {
-    int startIdx = dims.offset * dims.width;
-    MPI_Send(&pixels[startIdx], dims.rowsForWorker * dims.width, MPI_DOUBLE, MASTER_RANK, COMM_TAGS::RESULT_DATA, MPI_COMM_WORLD);
+    long long startIdx = dims.rowIndex(dims.offset);
+    sendPixels(&pixels[startIdx], dims.workingPixels(), static_cast<WIRE_CODEC>(dims.outCodec),
+               MASTER_RANK, COMM_TAGS::RESULT_DATA);
 }
@@ -1,40 +1,191 @@
 #include <mpi.h>
 #include <memory>
 #include <chrono>
+#include <cmath>
+#include <string>
+#include <stdexcept>
 
 #include "infrastructure/master.h"
 #include "infrastructure/worker.h"
+#include "infrastructure/farm_master.h"
+#include "infrastructure/farm_worker.h"
+#include "infrastructure/batch_master.h"
+#include "infrastructure/batch_worker.h"
+#include "infrastructure/solo.h"
 #include "infrastructure/entity.h"
+#include "infrastructure/wire.h"
+#include "../helpers/png_writer.h"
+#include "../helpers/preview.h"
 
 using namespace std;
 using namespace std::chrono;
 
+// compares the output bytes of a compressed-wire run against those of the full-double run
+void reportWireAccuracy(const vector<unsigned char>& reference, const vector<unsigned char>& result,
+                        long long referenceBytes, long long resultBytes);
+
 int main(int argc, char** argv) {
 
-	int numtasks, rank;
-	MPI_Init(&argc, &argv);
+	int numtasks, rank, provided;
+	// batch ranks run whole images on threads of their own, only the main thread talks to MPI
+	MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
 
 	MPI_Comm_size(MPI_COMM_WORLD, &numtasks);
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
 
-	unique_ptr<Entity> entity;
+	// --png-level <0-9>, --png-filter <name>, --png-fast, --png-threads <n> pick how outputs are encoded
+	setDefaultPngOptions(parsePngOptions(argc, argv));
+	// --preview 2|4|8 runs on the input box-downsampled by that factor, for a quick look
+	setPreviewFactor(parsePreviewFactor(argc, argv));
+
+	const char* usage = "usage: mpi [--input <image>] [--output <image>] [--wire double|uint8|float32|fixed16] [--wire-report] [--farm]\n"
+	                    "           [--batch <directory|manifest> [--out-dir <directory>] [--strip-threshold <pixels>] [--threads <n>]]";
+	// --threads: threads of every rank for the images it runs whole, 0 shares the node's among its ranks
+	string inputPath = "../images/image.png";
+	string outputPath = "../images/output_mpi.png";
+	WIRE_MODE wireMode = WIRE_MODE_DOUBLE;
+	bool wireReport = false;
+	bool farm = false;
+	string batchInputs;
+	string batchOutputDir = "../images/batch";
+	long long stripThreshold = BATCH_STRIP_THRESHOLD;
+	int batchThreads = 0;
+	for (int i = 1; i < argc; ++i) {
+		string arg = argv[i];
+		if (arg == "--input" && i + 1 < argc) {
+			inputPath = argv[++i];
+		} else if (arg == "--output" && i + 1 < argc) {
+			outputPath = argv[++i];
+		} else if (arg == "--wire" && i + 1 < argc) {
+			try {
+				wireMode = parseWireMode(argv[++i]);
+			} catch (const invalid_argument& e) {
+				// every rank parses the same arguments, so they all stop here together
+				if (rank == MASTER_RANK) {
+					cerr << e.what() << endl << usage << endl;
+				}
+				MPI_Finalize();
+				return 1;
+			}
+		} else if (arg == "--wire-report") {
+			wireReport = true;
+		} else if (arg == "--farm") {
+			farm = true;
+		} else if (arg == "--batch" && i + 1 < argc) {
+			batchInputs = argv[++i];
+		} else if (arg == "--out-dir" && i + 1 < argc) {
+			batchOutputDir = argv[++i];
+		} else if (arg == "--strip-threshold" && i + 1 < argc) {
+			stripThreshold = stoll(argv[++i]);
+		} else if (arg == "--threads" && i + 1 < argc) {
+			batchThreads = stoi(argv[++i]);
+		}
+	}
+
+	// batch mode: many images, each either split across ranks or given to a single rank
+	if (!batchInputs.empty()) {
+		int threads = Solo::threadsPerRank(batchThreads);
+		unique_ptr<Entity> entity;
+		if (rank == MASTER_RANK) {
+			auto start = high_resolution_clock::now();
+
+			entity = make_unique<BatchMaster>(numtasks, rank, batchInputs, batchOutputDir, stripThreshold, wireMode,
+			                                       threads);
+			entity->run();
+
+			auto stop = high_resolution_clock::now();
+			auto duration = duration_cast<milliseconds>(stop - start);
+			cout << "Processing time: " << duration.count() << " ms" << endl;
+		} else {
+			entity = make_unique<BatchCrew>(numtasks, rank, threads);
+			entity->run();
+		}
+
+		MPI_Finalize();
+		return 0;
+	}
+
+	// the farm needs at least one worker besides the master
+	farm = farm && numtasks > 1;
+
+	// reference run with the lossless double wire format, its output bytes kept in memory only
+	vector<unsigned char> reference;
+	long long referenceBytes = 0;
+	if (wireReport) {
+		if (rank == MASTER_RANK) {
+			auto master = make_unique<Master>(numtasks, rank, inputPath, "", WIRE_MODE_DOUBLE);
+			master->keepOutput(true);
+			master->run();
+			reference = master->getOutput();
+			referenceBytes = master->getWireBytes();
+		} else {
+			Crew(numtasks, rank).run();
+		}
+	}
 
 	if (rank == MASTER_RANK) {
 		auto start = high_resolution_clock::now();
 
-		entity = make_unique<Master>(numtasks, rank, "../images/image.png", "../images/output_mpi.png");
-		entity->run();
+		unique_ptr<Master> master;
+		if (farm) {
+			master = make_unique<FarmMaster>(numtasks, rank, inputPath, outputPath, wireMode);
+		} else {
+			master = make_unique<Master>(numtasks, rank, inputPath, outputPath, wireMode);
+		}
+		master->keepOutput(wireReport);
+		master->run();
 
 		auto stop = high_resolution_clock::now();
 		auto duration = duration_cast<milliseconds>(stop - start);
 		cout << "Processing time: " << duration.count() << " ms" << endl;
 
+		if (wireReport) {
+			reportWireAccuracy(reference, master->getOutput(), referenceBytes, master->getWireBytes());
+		}
+
 	} else {
-		entity = make_unique<Crew>(numtasks, rank);
+		unique_ptr<Entity> entity;
+		if (farm) {
+			entity = make_unique<FarmCrew>(numtasks, rank);
+		} else {
+			entity = make_unique<Crew>(numtasks, rank);
+		}
 		entity->run();
 	}
 
 	MPI_Finalize();
 
 	return 0;
-}
\ No newline at end of file
+}
+
+void reportWireAccuracy(const vector<unsigned char>& reference, const vector<unsigned char>& result,
+                        long long referenceBytes, long long resultBytes) {
+	int maxError = 0;
+	double sumError = 0.0;
+	double sumSquared = 0.0;
+	long long changedPixels = 0;
+
+	// both are the output bytes as saved, so the final layer went through its usual path in each run
+	for (size_t i = 0; i < reference.size(); ++i) {
+		int error = abs(static_cast<int>(reference[i]) - static_cast<int>(result[i]));
+		maxError = max(maxError, error);
+		sumError += error;
+		sumSquared += static_cast<double>(error) * error;
+		if (error != 0) {
+			++changedPixels;
+		}
+	}
+
+	double count = reference.empty() ? 1.0 : static_cast<double>(reference.size());
+	double mse = sumSquared / count;
+
+	cout << "Wire bytes: " << resultBytes << " (double: " << referenceBytes << ", "
+	     << (referenceBytes ? 100.0 * resultBytes / referenceBytes : 0.0) << "%)" << endl;
+	cout << "Max abs error: " << maxError << ", mean abs error: " << sumError / count << endl;
+	if (mse > 0.0) {
+		cout << "PSNR: " << 10.0 * log10(255.0 * 255.0 / mse) << " dB" << endl;
+	} else {
+		cout << "PSNR: inf (identical)" << endl;
+	}
+	cout << "Output pixels changed: " << changedPixels << " / " << reference.size() << endl;
+}
@@ -0,0 +1,39 @@
+#include "backend.h"
+#include "cpu_backend.h"
+#include "cuda_backend.h"
+#include <iostream>
+
+using namespace std;
+
+BACKEND_KIND parseBackendKind(const string& name) {
+    if (name == "cuda") return BACKEND_CUDA;
+    if (name == "cpu") return BACKEND_CPU;
+    return BACKEND_AUTO;
+}
+
+BACKEND_KIND resolveBackend(BACKEND_KIND requested, int rank) {
+    if (requested == BACKEND_CPU) {
+        return BACKEND_CPU;
+    }
+
+#ifndef MFE_NO_CUDA
+    if (cudaDeviceCountOrZero() > 0) {
+        return BACKEND_CUDA;
+    }
+#endif
+
+    if (requested == BACKEND_CUDA) {
+        cerr << "Rank " << rank << ": CUDA backend requested but no CUDA device is available" << endl;
+        exit(1);
+    }
+    return BACKEND_CPU;
+}
+
+unique_ptr<Backend> createBackend(BACKEND_KIND kind, int rank) {
+#ifndef MFE_NO_CUDA
+    if (kind == BACKEND_CUDA) {
+        return make_unique<CudaBackend>(rank);
+    }
+#endif
+    return make_unique<CpuBackend>();
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "../helpers/kernels.h"
+#include "auxs.h"
+
+// devices a rank can run its strip on
+enum BACKEND_KIND {
+    BACKEND_AUTO,   // cuda when the rank sees a device, cpu otherwise
+    BACKEND_CUDA,
+    BACKEND_CPU
+};
+
+/*
+    computes one rank's strip of a layer, the entity owns the pixels and the MPI traffic
+
+    the working rows live in pixels[offset * width ..] between calls: convolve() reads the
+    padded strip and leaves the raw result where localMinMax() and normalize() can find it,
+    normalize() writes the normalized working rows back into pixels
+*/
+class Backend {
+public:
+    virtual ~Backend() {}
+
+    virtual const char* name() const = 0;
+
+    /*
+        (re)allocates the buffers for a strip, called once per layer since padding changes
+        @param dims: dimensions of the strip about to be processed
+    */
+    virtual void prepare(const ProcessDims& dims) = 0;
+
+    // releases the buffers allocated by prepare()
+    virtual void release() = 0;
+
+    virtual void convolve(LAYER layer, const ProcessDims& dims, std::vector<double>& pixels) = 0;
+    virtual MinMaxVals localMinMax(const ProcessDims& dims, const std::vector<double>& pixels) = 0;
+    virtual void normalize(const ProcessDims& dims, std::vector<double>& pixels, const MinMaxVals& minMax) = 0;
+};
+
+// parses the --backend argument, unknown values fall back to auto
+BACKEND_KIND parseBackendKind(const std::string& name);
+
+/*
+    decides which backend a rank runs on, auto picks cuda when a device is visible
+    exits when cuda is requested explicitly but not available
+*/
+BACKEND_KIND resolveBackend(BACKEND_KIND requested, int rank);
+
+// creates the backend for an already resolved kind
+std::unique_ptr<Backend> createBackend(BACKEND_KIND kind, int rank);
@@ -0,0 +1,122 @@
+#include "cpu_backend.h"
+#include <cfloat>
+#include <cstring>
+#include <algorithm>
+
+using namespace std;
+
+// largest kernel side in kernels.h
+#define MAX_KERNEL_SIZE 7
+
+CpuBackend::CpuBackend() {}
+
+CpuBackend::~CpuBackend() {}
+
+void CpuBackend::prepare(const ProcessDims& dims) {
+    result.resize(static_cast<size_t>(dims.rowsForWorker) * dims.width);
+}
+
+void CpuBackend::release() {
+    vector<double>().swap(result);
+}
+
+void CpuBackend::convolve(LAYER layer, const ProcessDims& dims, vector<double>& pixels) {
+    const auto& kernel = (layer == LAYER::ONE) ? LAYER_1_KERNEL :
+                         (layer == LAYER::TWO) ? LAYER_2_KERNEL :
+                         LAYER_3_KERNEL;
+
+    const double divisor = (layer == LAYER::ONE) ? LAYER_1_DIV :
+                           (layer == LAYER::TWO) ? LAYER_2_DIV :
+                           LAYER_3_DIV;
+
+    const int kernelSize = kernel.size();
+    const int radius = kernelSize / 2;
+    const int width = dims.width;
+
+    // flattened kernel as doubles, so the inner loop does no int conversions
+    double weights[MAX_KERNEL_SIZE * MAX_KERNEL_SIZE];
+    for (int ki = 0; ki < kernelSize; ++ki) {
+        for (int kj = 0; kj < kernelSize; ++kj) {
+            weights[ki * kernelSize + kj] = kernel[ki][kj];
+        }
+    }
+
+    // columns whose window never leaves the row, they skip the clamping
+    const int interiorStart = min(radius, width);
+    const int interiorEnd = max(interiorStart, width - radius);
+
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < dims.rowsForWorker; ++i) {
+        // clamped source rows of the window, resolved once per output row
+        const double* rows[MAX_KERNEL_SIZE];
+        for (int ki = 0; ki < kernelSize; ++ki) {
+            int pixelRow = dims.offset + i + (ki - radius);
+            pixelRow = max(0, min(pixelRow, dims.totalRows - 1));
+            rows[ki] = &pixels[static_cast<size_t>(pixelRow) * width];
+        }
+
+        double* out = &result[static_cast<size_t>(i) * width];
+
+        // same accumulation order as the serial version, results are bit-identical
+        auto borderPixel = [&](int j) {
+            double sum = 0.0;
+            for (int ki = 0; ki < kernelSize; ++ki) {
+                for (int kj = 0; kj < kernelSize; ++kj) {
+                    int pixelCol = max(0, min(j + (kj - radius), width - 1));
+                    sum += rows[ki][pixelCol] * weights[ki * kernelSize + kj];
+                }
+            }
+            out[j] = sum / divisor;
+        };
+
+        for (int j = 0; j < interiorStart; ++j) {
+            borderPixel(j);
+        }
+
+        for (int j = interiorStart; j < interiorEnd; ++j) {
+            double sum = 0.0;
+            for (int ki = 0; ki < kernelSize; ++ki) {
+                const double* src = rows[ki] + j - radius;
+                const double* w = weights + ki * kernelSize;
+                for (int kj = 0; kj < kernelSize; ++kj) {
+                    sum += src[kj] * w[kj];
+                }
+            }
+            out[j] = sum / divisor;
+        }
+
+        for (int j = interiorEnd; j < width; ++j) {
+            borderPixel(j);
+        }
+    }
+
+    // raw result replaces the working rows, the padding rows stay untouched
+    memcpy(&pixels[static_cast<size_t>(dims.offset) * width], result.data(), result.size() * sizeof(double));
+}
+
+MinMaxVals CpuBackend::localMinMax(const ProcessDims& dims, const vector<double>& pixels) {
+    const double* data = &pixels[static_cast<size_t>(dims.offset) * dims.width];
+    long long size = static_cast<long long>(dims.rowsForWorker) * dims.width;
+
+    double localMin = DBL_MAX;
+    double localMax = -DBL_MAX;
+
+    #pragma omp parallel for reduction(min:localMin) reduction(max:localMax)
+    for (long long i = 0; i < size; ++i) {
+        localMin = min(localMin, data[i]);
+        localMax = max(localMax, data[i]);
+    }
+
+    return MinMaxVals(localMin, localMax);
+}
+
+void CpuBackend::normalize(const ProcessDims& dims, vector<double>& pixels, const MinMaxVals& minMax) {
+    double range = (minMax.max - minMax.min == 0) ? 1.0 : (minMax.max - minMax.min);
+    double* data = &pixels[static_cast<size_t>(dims.offset) * dims.width];
+    long long size = static_cast<long long>(dims.rowsForWorker) * dims.width;
+
+    #pragma omp parallel for schedule(static)
+    for (long long i = 0; i < size; ++i) {
+        data[i] = 255.0 * (data[i] - minMax.min) / range;
+    }
+}
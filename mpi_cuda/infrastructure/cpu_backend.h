@@ -0,0 +1,20 @@
+#pragma once
+
+#include "backend.h"
+
+// runs the strip on the host cores with OpenMP, for ranks without a GPU
+class CpuBackend : public Backend {
+public:
+    CpuBackend();
+    ~CpuBackend() override;
+
+    const char* name() const override { return "cpu"; }
+    void prepare(const ProcessDims& dims) override;
+    void release() override;
+    void convolve(LAYER layer, const ProcessDims& dims, std::vector<double>& pixels) override;
+    MinMaxVals localMinMax(const ProcessDims& dims, const std::vector<double>& pixels) override;
+    void normalize(const ProcessDims& dims, std::vector<double>& pixels, const MinMaxVals& minMax) override;
+
+private:
+    std::vector<double> result; // convolved working rows, rowsForWorker * width
+};
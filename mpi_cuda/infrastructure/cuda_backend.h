@@ -0,0 +1,33 @@
+#pragma once
+
+#ifndef MFE_NO_CUDA
+
+#include <cuda_runtime.h>
+#include "backend.h"
+
+// number of visible devices, 0 when the driver or runtime is missing
+int cudaDeviceCountOrZero();
+
+// runs the strip on the GPU, the raw result stays on the device until normalize()
+class CudaBackend : public Backend {
+public:
+    explicit CudaBackend(int rank);
+    ~CudaBackend() override;
+
+    const char* name() const override { return "cuda"; }
+    void prepare(const ProcessDims& dims) override;
+    void release() override;
+    void convolve(LAYER layer, const ProcessDims& dims, std::vector<double>& pixels) override;
+    MinMaxVals localMinMax(const ProcessDims& dims, const std::vector<double>& pixels) override;
+    void normalize(const ProcessDims& dims, std::vector<double>& pixels, const MinMaxVals& minMax) override;
+
+private:
+    const int rank;
+
+    // CUDA device memory
+    double *d_input = nullptr;   // size: totalRows * width (includes padding)
+    double *d_output = nullptr;  // size: rowsForWorker * width (no padding)
+    bool allocated = false;
+};
+
+#endif
@@ -3,11 +3,12 @@
 #include <mpi.h>
 #include <cfloat>
 #include <vector>
+#include <memory>
 #include <algorithm>
-#include <cuda_runtime.h>
 
 #include "../helpers/kernels.h"
 #include "auxs.h"
+#include "backend.h"
 #include "../helpers/image.h"
 
 // abstract class
@@ -17,6 +18,9 @@ public:
     virtual ~Entity();
     virtual void run() {};
 
+    // device this rank computes on, auto (the default) picks cuda when a device is visible
+    void selectBackend(BACKEND_KIND kind);
+
 protected:
     const int numtasks;
     const int rank;
@@ -25,18 +29,15 @@ protected:
     ProcessDims dims{0,0,0,0,0};
     MinMaxVals minMax{DBL_MAX, -DBL_MAX};
 
-    // CUDA device memory
-    double *d_input;   // size: totalRows * width (includes padding)
-    double *d_output;  // size: rowsForWorker * width (no padding)
-    bool cudaInitialized;
+    std::unique_ptr<Backend> backend;
 
-    void initCUDA();
-    void cleanupCUDA();
+    void initBackend();
+    void cleanupBackend();
     void process(LAYER layer);
     void computeMinMax();
     void normalize();
 
     // helper to access pixel at (row, col) in flat array
-    inline double& at(int row, int col) { return pixels[row * dims.width + col]; }
-    inline const double& at(int row, int col) const { return pixels[row * dims.width + col]; }
-};
\ No newline at end of file
+    inline double& at(int row, int col) { return pixels[dims.rowIndex(row) + col]; }
+    inline const double& at(int row, int col) const { return pixels[dims.rowIndex(row) + col]; }
+};
@@ -2,11 +2,13 @@
 #include <mpi.h>
 #include <cfloat>
 #include "../helpers/kernels.h"
+#include "../helpers/png_writer.h"
 #include <algorithm>
 
 using namespace std;
 
-Master::Master(int numtasks, int rank, string inputImagePath, string outputImagePath) : Entity(numtasks, rank) {
+Master::Master(int numtasks, int rank, string inputImagePath, string outputImagePath, WIRE_MODE wireMode)
+    : Entity(numtasks, rank), wireMode(wireMode) {
     image = make_unique<GreyScaleImage>(inputImagePath);
     outImagePath = outputImagePath;
 }
@@ -18,19 +20,32 @@ void Master::run() {
     for (int layer = LAYER::ONE; layer <= LAYER::THREE; ++layer) {
         scatter(static_cast<LAYER>(layer));
         
-        // initialize/reinitialize CUDA for each layer (dimensions change due to padding)
-        initCUDA();
+        // (re)allocate the backend buffers for each layer (dimensions change due to padding)
+        initBackend();
         
         process(static_cast<LAYER>(layer));
         computeMinMax();
         normalize();
+
+        if (layer == LAYER::THREE && streamsFinalLayer()) {
+            streamAndSaveLayer();
+            return;
+        }
         gatherAndSaveLayer();
     }
     
-    cleanupCUDA();
+    cleanupBackend();
     saveImage();
 }
 
+void Master::keepOutput(bool keep) {
+    keepOutputBytes = keep;
+}
+
+bool Master::streamsFinalLayer() const {
+    return !outImagePath.empty();
+}
+
 void Master::scatter(LAYER layer) {
 
     // image data
@@ -38,6 +53,15 @@ void Master::scatter(LAYER layer) {
     int height = image->getHeight();
     int width = image->getWidth();
     int padding = getPaddingForLayer(layer);
+
+    // layer one scatters the raw (integral) input, later layers the normalized previous layer
+    WIRE_CODEC inCodec = (layer == LAYER::ONE) ? inputCodec(wireMode) : payloadCodec(wireMode);
+    WIRE_CODEC outCodec = payloadCodec(wireMode);
+
+    // a streamed final layer comes back already quantized to the output bytes
+    if (layer == LAYER::THREE && streamsFinalLayer()) {
+        outCodec = WIRE_UINT8;
+    }
     
     // number of workers (excluding master)
     int numWorkers = numtasks;
@@ -47,6 +71,7 @@ void Master::scatter(LAYER layer) {
     int remainder = height % numWorkers;
 
     vector<MPI_Request> requests((numtasks - 1) * 2);
+    vector<vector<unsigned char>> staging(numtasks);
     int reqIdx = 0;
 
     int startRow = 0;    
@@ -60,20 +85,22 @@ void Master::scatter(LAYER layer) {
         int totalRows = actualEnd - actualStart;
         
         // prep dimensions
-        ProcessDims dims(totalRows, width, rowsForWorker, padding, startRow - actualStart);
+        ProcessDims dims(totalRows, width, rowsForWorker, padding, startRow - actualStart, inCodec, outCodec);
 
         // prep work for self
         if (worker == MASTER_RANK) {
             this->dims = dims;
-            pixels.resize(dims.totalRows * dims.width);
-            copy(flattenMatrix.begin() + actualStart * width, flattenMatrix.begin() + actualStart * width + totalRows * width, pixels.begin());
+            pixels.resize(dims.totalPixels());
+            copy(flattenMatrix.begin() + static_cast<long long>(actualStart) * width, flattenMatrix.begin() + static_cast<long long>(actualStart) * width + static_cast<long long>(totalRows) * width, pixels.begin());
             startRow += rowsForWorker;
             continue;
         }
         
         // non-blocking send to worker for overlapping communication
         MPI_Isend(&dims, sizeof(ProcessDims), MPI_BYTE, worker, COMM_TAGS::DIMENSIONS, MPI_COMM_WORLD, &requests[reqIdx++]);
-        MPI_Isend(flattenMatrix.data() + actualStart * width, totalRows * width, MPI_DOUBLE, worker, COMM_TAGS::IMAGE_DATA, MPI_COMM_WORLD, &requests[reqIdx++]);
+        isendPixels(flattenMatrix.data() + static_cast<long long>(actualStart) * width, static_cast<long long>(totalRows) * width, inCodec, staging[worker],
+                    worker, COMM_TAGS::IMAGE_DATA, &requests[reqIdx++]);
+        wireBytes += static_cast<long long>(totalRows) * width * wireBytesPerPixel(inCodec);
         
         startRow += rowsForWorker;
     }
@@ -99,7 +126,7 @@ void Master::gatherAndSaveLayer() {
     int height = image->getHeight();
     int width = image->getWidth();
 
-    vector<double> pixels(height * width);
+    vector<double> pixels(static_cast<long long>(height) * width);
 
     // number of workers 
     int numWorkers = numtasks;
@@ -110,16 +137,20 @@ void Master::gatherAndSaveLayer() {
 
     // gather from self
     int rowsForMaster = baseRows + (0 < remainder ? 1 : 0);
-    copy(this->pixels.begin() + dims.offset * dims.width, this->pixels.begin() + (dims.offset + dims.rowsForWorker) * dims.width, pixels.begin());
+    copy(this->pixels.begin() + dims.rowIndex(dims.offset), this->pixels.begin() + dims.rowIndex(dims.offset + dims.rowsForWorker), pixels.begin());
 
     // post all receives concurrently
+    WIRE_CODEC outCodec = static_cast<WIRE_CODEC>(dims.outCodec);
     vector<MPI_Request> requests(numtasks - 1);
+    vector<vector<unsigned char>> staging(numtasks);
     int startRow = rowsForMaster;    
     for (int worker = 1; worker < numtasks; ++worker) {
         // rows for this worker (distribute remainder)
         int rowsForWorker = baseRows + (worker < remainder ? 1 : 0);
         
-        MPI_Irecv(&pixels[startRow * width], rowsForWorker * width, MPI_DOUBLE, worker, COMM_TAGS::RESULT_DATA, MPI_COMM_WORLD, &requests[worker - 1]);
+        irecvPixels(&pixels[static_cast<long long>(startRow) * width], static_cast<long long>(rowsForWorker) * width, outCodec, staging[worker],
+                    worker, COMM_TAGS::RESULT_DATA, &requests[worker - 1]);
+        wireBytes += static_cast<long long>(rowsForWorker) * width * wireBytesPerPixel(outCodec);
         
         startRow += rowsForWorker;
     }
@@ -127,9 +158,77 @@ void Master::gatherAndSaveLayer() {
     // wait for all receives to complete
     MPI_Waitall(numtasks - 1, requests.data(), MPI_STATUSES_IGNORE);
 
+    // decode the compressed strips in place
+    startRow = rowsForMaster;
+    for (int worker = 1; worker < numtasks; ++worker) {
+        int rowsForWorker = baseRows + (worker < remainder ? 1 : 0);
+        finishRecvPixels(&pixels[static_cast<long long>(startRow) * width], static_cast<long long>(rowsForWorker) * width, outCodec, staging[worker]);
+        startRow += rowsForWorker;
+    }
+
     image->setFlattenedMatrix(pixels);
 }
 
+void Master::streamAndSaveLayer() {
+    int height = image->getHeight();
+    int width = image->getWidth();
+
+    // the previous layer was only needed for the scatter, the final layer never exists as doubles here
+    image.reset();
+
+    int baseRows = height / numtasks;
+    int remainder = height % numtasks;
+
+    // post all receives up front, strips arrive as output bytes
+    vector<MPI_Request> requests(numtasks, MPI_REQUEST_NULL);
+    vector<vector<unsigned char>> strips(numtasks);
+    vector<int> stripRows(numtasks);
+    for (int worker = 0; worker < numtasks; ++worker) {
+        stripRows[worker] = baseRows + (worker < remainder ? 1 : 0);
+        if (worker == MASTER_RANK) {
+            continue;
+        }
+
+        strips[worker].resize(static_cast<size_t>(stripRows[worker]) * width);
+        wireIrecv(strips[worker].data(), static_cast<long long>(stripRows[worker]) * width, MPI_BYTE, worker,
+                  COMM_TAGS::RESULT_DATA, &requests[worker]);
+        wireBytes += static_cast<long long>(stripRows[worker]) * width;
+    }
+
+    PngStreamWriter writer(outImagePath, width, height);
+
+    // own rows first, then every strip in rank (= row) order as soon as it is in,
+    // so encoding overlaps with the ranks that are still sending
+    packPixels(&pixels[dims.rowIndex(dims.offset)], dims.workingPixels(), WIRE_UINT8, strips[MASTER_RANK]);
+    for (int worker = 0; worker < numtasks; ++worker) {
+        MPI_Wait(&requests[worker], MPI_STATUS_IGNORE);
+        writeOutputRows(writer, strips[worker].data(), stripRows[worker], width);
+        vector<unsigned char>().swap(strips[worker]);
+    }
+
+    writer.finish();
+}
+
+void Master::writeOutputRows(PngStreamWriter& writer, const unsigned char* rows, int count, int width) {
+    writer.writeRows(rows, count);
+    if (keepOutputBytes) {
+        outputBytes.insert(outputBytes.end(), rows, rows + static_cast<size_t>(count) * width);
+    }
+}
+
 void Master::saveImage() {
+    // the bytes the encoder gets, the same whatever the output format
+    if (keepOutputBytes) {
+        const unsigned char* bytes = image->getBytes();
+        outputBytes.assign(bytes, bytes + static_cast<size_t>(image->getWidth()) * image->getHeight());
+    }
+    if (outImagePath.empty()) {
+        return;
+    }
+
     image->save(outImagePath);
 }
+
+long long Master::getWireBytes() const {
+    return wireBytes;
+}
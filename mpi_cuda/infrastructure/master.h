@@ -2,21 +2,40 @@
 #include "./entity.h"
 #include "../helpers/image.h"
 #include "auxs.h"
+#include "wire.h"
+#include "../helpers/png_writer.h"
 #include <memory>
 
 class Master : public Entity {
 public:
-    Master(int numtasks, int rank, std::string inputImagePath, std::string outputImagePath);
+    Master(int numtasks, int rank, std::string inputImagePath, std::string outputImagePath,
+           WIRE_MODE wireMode = WIRE_MODE_DOUBLE);
     ~Master() override;
     void run() override;
 
+    // output bytes as run() saved them, when keepOutput was set
+    const std::vector<unsigned char>& getOutput() const { return outputBytes; }
+
+    // pixel payload bytes sent and received by the master during run()
+    long long getWireBytes() const;
+
+    // keeps a copy of the output bytes for getOutput(), the final layer takes the same path either way
+    void keepOutput(bool keep);
+
 private:
 
     std::string outImagePath;
     std::unique_ptr<GreyScaleImage> image;
+    WIRE_MODE wireMode;
+    long long wireBytes = 0;
+    bool keepOutputBytes = false;
+    std::vector<unsigned char> outputBytes;
 
     void scatter(LAYER layer);
     int getPaddingForLayer(LAYER layer);
     void gatherAndSaveLayer();
+    bool streamsFinalLayer() const;
+    void streamAndSaveLayer();
+    void writeOutputRows(PngStreamWriter& writer, const unsigned char* rows, int count, int width);
     void saveImage();
 };
\ No newline at end of file
@@ -12,8 +12,8 @@ void Crew::run() {
     for (int layer = LAYER::ONE; layer <= LAYER::THREE; ++layer) {
         receive();
         
-        // initialize/reinitialize CUDA for each layer (dimensions change due to padding)
-        initCUDA();
+        // (re)allocate the backend buffers for each layer (dimensions change due to padding)
+        initBackend();
         
         process(static_cast<LAYER>(layer));
         computeMinMax();
@@ -21,7 +21,7 @@ void Crew::run() {
         send();
     }
     
-    cleanupCUDA();
+    cleanupBackend();
 }
 
 void Crew::receive() {
@@ -30,11 +30,13 @@ void Crew::receive() {
     this->dims = dims;
 
     // receive directly into flat array
-    pixels.resize(dims.totalRows * dims.width);
-    MPI_Recv(pixels.data(), dims.totalRows * dims.width, MPI_DOUBLE, MASTER_RANK, COMM_TAGS::IMAGE_DATA, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    pixels.resize(dims.totalPixels());
+    recvPixels(pixels.data(), dims.totalPixels(), static_cast<WIRE_CODEC>(dims.inCodec),
+               MASTER_RANK, COMM_TAGS::IMAGE_DATA);
 }
 
 void Crew::send() {
-    int startIdx = dims.offset * dims.width;
-    MPI_Send(&pixels[startIdx], dims.rowsForWorker * dims.width, MPI_DOUBLE, MASTER_RANK, COMM_TAGS::RESULT_DATA, MPI_COMM_WORLD);
+    long long startIdx = dims.rowIndex(dims.offset);
+    sendPixels(&pixels[startIdx], dims.workingPixels(), static_cast<WIRE_CODEC>(dims.outCodec),
+               MASTER_RANK, COMM_TAGS::RESULT_DATA);
 }
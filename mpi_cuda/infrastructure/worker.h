@@ -7,6 +7,7 @@
 #include "../helpers/kernels.h"
 #include "auxs.h"
 #include "entity.h"
+#include "wire.h"
 #include "../helpers/image.h"
 
 class Crew : public Entity {
@@ -1,14 +1,29 @@
 #include <mpi.h>
 #include <memory>
 #include <chrono>
+#include <cmath>
+#include <string>
+#include <stdexcept>
+#include <algorithm>
 
 #include "infrastructure/master.h"
 #include "infrastructure/worker.h"
 #include "infrastructure/entity.h"
+#include "infrastructure/wire.h"
+#include "../helpers/png_writer.h"
+#include "../helpers/preview.h"
+#include "infrastructure/backend.h"
 
 using namespace std;
 using namespace std::chrono;
 
+// compares the output bytes of a compressed-wire run against those of the full-double run
+void reportWireAccuracy(const vector<unsigned char>& reference, const vector<unsigned char>& result,
+                        long long referenceBytes, long long resultBytes);
+
+// prints how many ranks run on each backend
+void reportBackends(int numtasks, int rank, BACKEND_KIND kind);
+
 int main(int argc, char** argv) {
 
 	int numtasks, rank;
@@ -17,24 +32,123 @@ int main(int argc, char** argv) {
 	MPI_Comm_size(MPI_COMM_WORLD, &numtasks);
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
 
-	unique_ptr<Entity> entity;
+	// --png-level <0-9>, --png-filter <name>, --png-fast, --png-threads <n> pick how outputs are encoded
+	setDefaultPngOptions(parsePngOptions(argc, argv));
+	// --preview 2|4|8 runs on the input box-downsampled by that factor, for a quick look
+	setPreviewFactor(parsePreviewFactor(argc, argv));
+
+	const char* usage = "usage: mpi_cuda [--wire double|uint8|float32|fixed16] [--wire-report] [--backend auto|cuda|cpu]";
+	WIRE_MODE wireMode = WIRE_MODE_DOUBLE;
+	bool wireReport = false;
+	BACKEND_KIND backendKind = BACKEND_AUTO;
+	for (int i = 1; i < argc; ++i) {
+		string arg = argv[i];
+		if (arg == "--wire" && i + 1 < argc) {
+			try {
+				wireMode = parseWireMode(argv[++i]);
+			} catch (const invalid_argument& e) {
+				// every rank parses the same arguments, so they all stop here together
+				if (rank == MASTER_RANK) {
+					cerr << e.what() << endl << usage << endl;
+				}
+				MPI_Finalize();
+				return 1;
+			}
+		} else if (arg == "--wire-report") {
+			wireReport = true;
+		} else if (arg == "--backend" && i + 1 < argc) {
+			backendKind = parseBackendKind(argv[++i]);
+		}
+	}
+
+	// every rank settles on its device once, ranks without a GPU fall back to the cpu
+	backendKind = resolveBackend(backendKind, rank);
+	reportBackends(numtasks, rank, backendKind);
+
+	// reference run with the lossless double wire format, its output bytes kept in memory only
+	vector<unsigned char> reference;
+	long long referenceBytes = 0;
+	if (wireReport) {
+		if (rank == MASTER_RANK) {
+			auto master = make_unique<Master>(numtasks, rank, "../images/image.png", "", WIRE_MODE_DOUBLE);
+			master->keepOutput(true);
+			master->selectBackend(backendKind);
+			master->run();
+			reference = master->getOutput();
+			referenceBytes = master->getWireBytes();
+		} else {
+			Crew crew(numtasks, rank);
+			crew.selectBackend(backendKind);
+			crew.run();
+		}
+	}
 
 	if (rank == MASTER_RANK) {
 		auto start = high_resolution_clock::now();
 
-		entity = make_unique<Master>(numtasks, rank, "../images/image.png", "../images/output_mpi_cuda.png");
-		entity->run();
+		auto master = make_unique<Master>(numtasks, rank, "../images/image.png", "../images/output_mpi_cuda.png", wireMode);
+		master->keepOutput(wireReport);
+		master->selectBackend(backendKind);
+		master->run();
 
 		auto stop = high_resolution_clock::now();
 		auto duration = duration_cast<milliseconds>(stop - start);
 		cout << "Processing time: " << duration.count() << " ms" << endl;
 
+		if (wireReport) {
+			reportWireAccuracy(reference, master->getOutput(), referenceBytes, master->getWireBytes());
+		}
+
 	} else {
-		entity = make_unique<Crew>(numtasks, rank);
+		unique_ptr<Entity> entity = make_unique<Crew>(numtasks, rank);
+		entity->selectBackend(backendKind);
 		entity->run();
 	}
 
 	MPI_Finalize();
 
 	return 0;
-}
\ No newline at end of file
+}
+
+void reportWireAccuracy(const vector<unsigned char>& reference, const vector<unsigned char>& result,
+                        long long referenceBytes, long long resultBytes) {
+	int maxError = 0;
+	double sumError = 0.0;
+	double sumSquared = 0.0;
+	long long changedPixels = 0;
+
+	// both are the output bytes as saved, so the final layer went through its usual path in each run
+	for (size_t i = 0; i < reference.size(); ++i) {
+		int error = abs(static_cast<int>(reference[i]) - static_cast<int>(result[i]));
+		maxError = max(maxError, error);
+		sumError += error;
+		sumSquared += static_cast<double>(error) * error;
+		if (error != 0) {
+			++changedPixels;
+		}
+	}
+
+	double count = reference.empty() ? 1.0 : static_cast<double>(reference.size());
+	double mse = sumSquared / count;
+
+	cout << "Wire bytes: " << resultBytes << " (double: " << referenceBytes << ", "
+	     << (referenceBytes ? 100.0 * resultBytes / referenceBytes : 0.0) << "%)" << endl;
+	cout << "Max abs error: " << maxError << ", mean abs error: " << sumError / count << endl;
+	if (mse > 0.0) {
+		cout << "PSNR: " << 10.0 * log10(255.0 * 255.0 / mse) << " dB" << endl;
+	} else {
+		cout << "PSNR: inf (identical)" << endl;
+	}
+	cout << "Output pixels changed: " << changedPixels << " / " << reference.size() << endl;
+}
+
+void reportBackends(int numtasks, int rank, BACKEND_KIND kind) {
+	int code = kind;
+	vector<int> codes(numtasks);
+	MPI_Gather(&code, 1, MPI_INT, codes.data(), 1, MPI_INT, MASTER_RANK, MPI_COMM_WORLD);
+
+	if (rank == MASTER_RANK) {
+		int cudaRanks = count(codes.begin(), codes.end(), static_cast<int>(BACKEND_CUDA));
+		cout << "Backends: " << cudaRanks << " cuda, " << numtasks - cudaRanks << " cpu" << endl;
+	}
+}
@@ -21,9 +21,18 @@ struct __attribute__((packed)) ProcessDims {
     int rowsForWorker;
     int padding;
     int offset;
-
-    ProcessDims(int tRows, int w, int rfw, int pad, int off)
-        : totalRows(tRows), width(w), rowsForWorker(rfw), padding(pad), offset(off) {}
+    int inCodec;  // WIRE_CODEC of the scattered rows
+    int outCodec; // WIRE_CODEC of the gathered rows
+    int chunkRows; // rows per message when strips are split for the communication thread, 0 = one message
+
+    ProcessDims(int tRows, int w, int rfw, int pad, int off, int inC = 0, int outC = 0, int chunk = 0)
+        : totalRows(tRows), width(w), rowsForWorker(rfw), padding(pad), offset(off), inCodec(inC), outCodec(outC),
+          chunkRows(chunk) {}
+
+    // pixel counts and offsets are 64-bit, a strip can hold more than INT_MAX pixels
+    long long totalPixels() const { return static_cast<long long>(totalRows) * width; }
+    long long workingPixels() const { return static_cast<long long>(rowsForWorker) * width; }
+    long long rowIndex(long long row) const { return row * width; }
 };
 
 struct __attribute__((packed)) MinMaxVals {
@@ -0,0 +1,98 @@
+#include "comm_thread.h"
+#include "wire.h"
+
+using namespace std;
+
+CommThread::CommThread() : thread(&CommThread::loop, this) {}
+
+CommThread::~CommThread() {
+    drain();
+    submit(COMM_STOP, nullptr, 0, MPI_BYTE, 0, 0, -1);
+    thread.join();
+}
+
+void CommThread::submit(COMM_OP op, void* buffer, long long count, MPI_Datatype type, int peer, int tag, int id) {
+    CommTask task{op, buffer, count, type, peer, tag, id};
+    while (!tasks.push(task)) {
+        this_thread::yield();
+    }
+
+    if (op != COMM_STOP) {
+        ++submitted;
+    }
+}
+
+int CommThread::waitAny() {
+    int id;
+    while (!completions.pop(id)) {
+        this_thread::yield();
+    }
+
+    ++completed;
+    return id;
+}
+
+void CommThread::drain() {
+    while (completed < submitted) {
+        waitAny();
+    }
+}
+
+void CommThread::loop() {
+    vector<MPI_Request> requests;
+    vector<int> ids;
+    vector<int> indices;
+    bool stopping = false;
+
+    while (!stopping || !requests.empty()) {
+        // post everything the compute side has queued
+        CommTask task;
+        while (!stopping && tasks.pop(task)) {
+            if (task.op == COMM_STOP) {
+                stopping = true;
+                break;
+            }
+
+            MPI_Request request;
+            if (task.op == COMM_SEND) {
+                wireIsend(task.buffer, task.count, task.type, task.peer, task.tag, &request);
+            } else {
+                wireIrecv(task.buffer, task.count, task.type, task.peer, task.tag, &request);
+            }
+            requests.push_back(request);
+            ids.push_back(task.id);
+        }
+
+        if (requests.empty()) {
+            this_thread::yield();
+            continue;
+        }
+
+        // drive progress and report whatever finished
+        int done = 0;
+        indices.resize(requests.size());
+        MPI_Testsome(static_cast<int>(requests.size()), requests.data(), &done, indices.data(), MPI_STATUSES_IGNORE);
+        if (done == MPI_UNDEFINED || done == 0) {
+            this_thread::yield();
+            continue;
+        }
+
+        for (int i = 0; i < done; ++i) {
+            while (!completions.push(ids[indices[i]])) {
+                this_thread::yield();
+            }
+        }
+
+        // completed requests were set to MPI_REQUEST_NULL, compact them away
+        size_t kept = 0;
+        for (size_t i = 0; i < requests.size(); ++i) {
+            if (requests[i] != MPI_REQUEST_NULL) {
+                requests[kept] = requests[i];
+                ids[kept] = ids[i];
+                ++kept;
+            }
+        }
+        requests.resize(kept);
+        ids.resize(kept);
+    }
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <mpi.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "spsc_queue.h"
+
+// how many messages a strip is split into when the communication thread is on
+#define COMM_CHUNKS 8
+// capacity of the task and completion queues
+#define COMM_QUEUE_SIZE 4096
+
+enum COMM_OP {
+    COMM_SEND,
+    COMM_RECV,
+    COMM_STOP
+};
+
+// a point-to-point transfer handed to the communication thread
+struct CommTask {
+    COMM_OP op;
+    void* buffer;
+    long long count;
+    MPI_Datatype type;
+    int peer;
+    int tag;
+    int id;   // reported back once the transfer has completed
+};
+
+// dedicated MPI progress thread (needs MPI_THREAD_MULTIPLE): the compute team queues
+// sends and receives and keeps computing, the thread posts and completes them
+class CommThread {
+public:
+    CommThread();
+    ~CommThread();
+
+    // queues a transfer, called from the compute side only
+    void submit(COMM_OP op, void* buffer, long long count, MPI_Datatype type, int peer, int tag, int id);
+
+    // next completed transfer id, blocks (spinning) until one is available
+    int waitAny();
+
+    // waits until every submitted transfer has completed
+    void drain();
+
+private:
+    SpscQueue<CommTask> tasks{COMM_QUEUE_SIZE};
+    SpscQueue<int> completions{COMM_QUEUE_SIZE};
+    std::thread thread;
+
+    // compute side bookkeeping
+    long long submitted = 0;
+    long long completed = 0;
+
+    void loop();
+};
@@ -25,6 +25,21 @@ void Entity::computeMinMax() {
 }
 
 void Entity::process(LAYER layer) {
+    // create a flat result array for the processed rows (without padding)
+    vector<double> result(dims.workingPixels());
+
+    convolveRows(layer, 0, dims.rowsForWorker, result);
+    
+    // copy result back to working rows in pixels with OpenMP parallelization
+    #pragma omp parallel for collapse(2)
+    for (int i = 0; i < dims.rowsForWorker; ++i) {
+        for (int j = 0; j < dims.width; ++j) {
+            at(dims.offset + i, j) = result[dims.rowIndex(i) + j];
+        }
+    }
+}
+
+void Entity::convolveRows(LAYER layer, int firstRow, int lastRow, vector<double>& result) {
     const auto& kernel = (layer == LAYER::ONE) ? LAYER_1_KERNEL :
                          (layer == LAYER::TWO) ? LAYER_2_KERNEL :
                          LAYER_3_KERNEL;
@@ -36,12 +51,9 @@ void Entity::process(LAYER layer) {
     int kernelSize = kernel.size();
     int kernelRadius = kernelSize / 2;
     
-    // create a flat result array for the processed rows (without padding)
-    vector<double> result(dims.rowsForWorker * dims.width);
-    
     // apply convolution only to the working rows with OpenMP parallelization
     #pragma omp parallel for schedule(static)
-    for (int i = 0; i < dims.rowsForWorker; ++i) {
+    for (int i = firstRow; i < lastRow; ++i) {
         for (int j = 0; j < dims.width; ++j) {
             double sum = 0.0;
             
@@ -57,26 +69,31 @@ void Entity::process(LAYER layer) {
                 }
             }
             
-            result[i * dims.width + j] = sum / divisor;
-        }
-    }
-    
-    // copy result back to working rows in pixels with OpenMP parallelization
-    #pragma omp parallel for collapse(2)
-    for (int i = 0; i < dims.rowsForWorker; ++i) {
-        for (int j = 0; j < dims.width; ++j) {
-            at(dims.offset + i, j) = result[i * dims.width + j];
+            result[dims.rowIndex(i) + j] = sum / divisor;
         }
     }
 }
 
 void Entity::normalize() {
+    normalizeRows(0, dims.rowsForWorker);
+}
+
+void Entity::normalizeRows(int firstRow, int lastRow) {
     double range = (minMax.max - minMax.min == 0) ? 1.0 : (minMax.max - minMax.min);
 
     #pragma omp parallel for
-    for (int i = 0; i < dims.rowsForWorker; ++i) {
+    for (int i = firstRow; i < lastRow; ++i) {
         for (int j = 0; j < dims.width; ++j) {
             at(dims.offset + i, j) = 255.0 * (at(dims.offset + i, j) - minMax.min) / range;
         }
     }
 }
+
+vector<pair<int, int>> Entity::chunkRanges(int rows, int chunkRows) {
+    vector<pair<int, int>> ranges;
+    int step = chunkRows > 0 ? chunkRows : max(rows, 1);
+    for (int first = 0; first < rows; first += step) {
+        ranges.emplace_back(first, min(rows, first + step));
+    }
+    return ranges;
+}
@@ -7,11 +7,13 @@
 #include <algorithm>
 #include <omp.h>
 
+#include <memory>
+#include <utility>
+
 #include "../helpers/kernels.h"
 #include "auxs.h"
-#include "entity.h"
+#include "comm_thread.h"
 #include "../helpers/image.h"
-#include "../helpers/kernels.h"
 
 // abstract class
 class Entity {
@@ -20,6 +22,9 @@ public:
     virtual ~Entity() {};
     virtual void run() {};
 
+    // hands point-to-point traffic to a dedicated thread so it overlaps with the OpenMP team
+    void enableCommThread() { comm = std::make_unique<CommThread>(); }
+
 protected:
     const int numtasks;
     const int rank;
@@ -27,12 +32,22 @@ protected:
     std::vector<double> pixels; // flat array
     ProcessDims dims{0,0,0,0,0};
     MinMaxVals minMax{DBL_MAX, -DBL_MAX};
+    std::unique_ptr<CommThread> comm;
 
     void process(LAYER layer);
     void computeMinMax();
     void normalize();
 
+    // convolves working rows [firstRow, lastRow) into result (rowsForWorker * width, no padding)
+    void convolveRows(LAYER layer, int firstRow, int lastRow, std::vector<double>& result);
+
+    // normalizes working rows [firstRow, lastRow) with the current minMax
+    void normalizeRows(int firstRow, int lastRow);
+
+    // splits rows into [first, last) message ranges of chunkRows rows (0 = a single range)
+    static std::vector<std::pair<int, int>> chunkRanges(int rows, int chunkRows);
+
     // helper to access pixel at (row, col) in flat array
-    inline double& at(int row, int col) { return pixels[row * dims.width + col]; }
-    inline const double& at(int row, int col) const { return pixels[row * dims.width + col]; }
+    inline double& at(int row, int col) { return pixels[dims.rowIndex(row) + col]; }
+    inline const double& at(int row, int col) const { return pixels[dims.rowIndex(row) + col]; }
 };
\ No newline at end of file
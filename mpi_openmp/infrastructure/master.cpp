@@ -2,11 +2,13 @@
 #include <mpi.h>
 #include <cfloat>
 #include "../helpers/kernels.h"
+#include "../helpers/png_writer.h"
 #include <algorithm>
 
 using namespace std;
 
-Master::Master(int numtasks, int rank, string inputImagePath, string outputImagePath) : Entity(numtasks, rank) {
+Master::Master(int numtasks, int rank, string inputImagePath, string outputImagePath, WIRE_MODE wireMode)
+    : Entity(numtasks, rank), wireMode(wireMode) {
     image = make_unique<GreyScaleImage>(inputImagePath);
     outImagePath = outputImagePath;
 }
@@ -20,19 +22,42 @@ void Master::run() {
         process(static_cast<LAYER>(layer));
         computeMinMax();
         normalize();
+
+        if (layer == LAYER::THREE && streamsFinalLayer()) {
+            streamAndSaveLayer();
+            return;
+        }
         gatherAndSaveLayer();
     }
 
     saveImage();
 }
 
+void Master::keepOutput(bool keep) {
+    keepOutputBytes = keep;
+}
+
+bool Master::streamsFinalLayer() const {
+    return !outImagePath.empty();
+}
+
 void Master::scatter(LAYER layer) {
 
-    // image data
-    const auto& flattenMatrix = image->getFlattenedMatrix();
+    // image data, kept as a member since queued sends may still read it after scatter returns
+    scatterSource = image->getFlattenedMatrix();
+    const auto& flattenMatrix = scatterSource;
     int height = image->getHeight();
     int width = image->getWidth();
     int padding = getPaddingForLayer(layer);
+
+    // layer one scatters the raw (integral) input, later layers the normalized previous layer
+    WIRE_CODEC inCodec = (layer == LAYER::ONE) ? inputCodec(wireMode) : payloadCodec(wireMode);
+    WIRE_CODEC outCodec = payloadCodec(wireMode);
+
+    // a streamed final layer comes back already quantized to the output bytes
+    if (layer == LAYER::THREE && streamsFinalLayer()) {
+        outCodec = WIRE_UINT8;
+    }
     
     // number of workers (excluding master)
     int numWorkers = numtasks;
@@ -42,8 +67,21 @@ void Master::scatter(LAYER layer) {
     int remainder = height % numWorkers;
 
     vector<MPI_Request> requests((numtasks - 1) * 2);
+    vector<vector<unsigned char>> staging(numtasks);
     int reqIdx = 0;
 
+    // with the communication thread strips travel in chunks, so workers can start on the first rows
+    // and the master can start writing the first results while the rest is still in flight
+    int chunkRows = 0;
+    if (comm) {
+        chunkRows = max(1, (baseRows + 1 + 2 * padding) / COMM_CHUNKS);
+        scatterDims.assign(numtasks, ProcessDims(0, 0, 0, 0, 0));
+        scatterStaging.clear();
+        gatherChunks.clear();
+        gatherChunks.reserve(numtasks * (COMM_CHUNKS + 1));
+        gathered.assign(static_cast<size_t>(height) * width, 0.0);
+    }
+
     int startRow = 0;    
     for (int worker = 0; worker < numtasks; ++worker) {
         // rows for this worker (distribute remainder)
@@ -55,20 +93,30 @@ void Master::scatter(LAYER layer) {
         int totalRows = actualEnd - actualStart;
         
         // prep dimensions
-        ProcessDims dims(totalRows, width, rowsForWorker, padding, startRow - actualStart);
+        ProcessDims dims(totalRows, width, rowsForWorker, padding, startRow - actualStart, inCodec, outCodec, chunkRows);
 
         // prep work for self
         if (worker == MASTER_RANK) {
             this->dims = dims;
-            pixels.resize(dims.totalRows * dims.width);
-            copy(flattenMatrix.begin() + actualStart * width, flattenMatrix.begin() + actualStart * width + totalRows * width, pixels.begin());
+            pixels.resize(dims.totalPixels());
+            copy(flattenMatrix.begin() + static_cast<long long>(actualStart) * width, flattenMatrix.begin() + static_cast<long long>(actualStart) * width + static_cast<long long>(totalRows) * width, pixels.begin());
+            startRow += rowsForWorker;
+            continue;
+        }
+
+        // hand the strip to the communication thread and pre-post the receives for its result
+        if (comm) {
+            queueScatter(worker, dims, flattenMatrix.data() + static_cast<long long>(actualStart) * width);
+            queueGather(worker, startRow, dims);
             startRow += rowsForWorker;
             continue;
         }
         
         // non-blocking send to worker for overlapping communication
         MPI_Isend(&dims, sizeof(ProcessDims), MPI_BYTE, worker, COMM_TAGS::DIMENSIONS, MPI_COMM_WORLD, &requests[reqIdx++]);
-        MPI_Isend(flattenMatrix.data() + actualStart * width, totalRows * width, MPI_DOUBLE, worker, COMM_TAGS::IMAGE_DATA, MPI_COMM_WORLD, &requests[reqIdx++]);
+        isendPixels(flattenMatrix.data() + static_cast<long long>(actualStart) * width, static_cast<long long>(totalRows) * width, inCodec, staging[worker],
+                    worker, COMM_TAGS::IMAGE_DATA, &requests[reqIdx++]);
+        wireBytes += static_cast<long long>(totalRows) * width * wireBytesPerPixel(inCodec);
         
         startRow += rowsForWorker;
     }
@@ -77,6 +125,51 @@ void Master::scatter(LAYER layer) {
     MPI_Waitall(reqIdx, requests.data(), MPI_STATUSES_IGNORE);
 }
 
+void Master::queueScatter(int worker, const ProcessDims& dims, const double* source) {
+    WIRE_CODEC inCodec = static_cast<WIRE_CODEC>(dims.inCodec);
+
+    scatterDims[worker] = dims;
+    comm->submit(COMM_SEND, &scatterDims[worker], sizeof(ProcessDims), MPI_BYTE, worker, COMM_TAGS::DIMENSIONS, -1);
+
+    for (const auto& chunk : chunkRanges(dims.totalRows, dims.chunkRows)) {
+        const double* first = source + static_cast<size_t>(chunk.first) * dims.width;
+        long long count = dims.rowIndex(chunk.second - chunk.first);
+
+        if (inCodec == WIRE_DOUBLE) {
+            comm->submit(COMM_SEND, const_cast<double*>(first), count, MPI_DOUBLE, worker, COMM_TAGS::IMAGE_DATA, -1);
+        } else {
+            scatterStaging.emplace_back();
+            packPixels(first, count, inCodec, scatterStaging.back());
+            comm->submit(COMM_SEND, scatterStaging.back().data(), static_cast<long long>(scatterStaging.back().size()), MPI_BYTE,
+                         worker, COMM_TAGS::IMAGE_DATA, -1);
+        }
+        wireBytes += static_cast<long long>(count) * wireBytesPerPixel(inCodec);
+    }
+}
+
+void Master::queueGather(int worker, int startRow, const ProcessDims& dims) {
+    WIRE_CODEC outCodec = static_cast<WIRE_CODEC>(dims.outCodec);
+
+    // chunks are queued in row order, their index doubles as the completion id
+    for (const auto& chunk : chunkRanges(dims.rowsForWorker, dims.chunkRows)) {
+        int rows = chunk.second - chunk.first;
+        long long count = dims.rowIndex(rows);
+        int id = static_cast<int>(gatherChunks.size());
+        gatherChunks.push_back(GatherChunk{startRow + chunk.first, rows, {}});
+        GatherChunk& gatherChunk = gatherChunks.back();
+
+        if (outCodec == WIRE_DOUBLE) {
+            comm->submit(COMM_RECV, &gathered[static_cast<size_t>(gatherChunk.startRow) * dims.width], count, MPI_DOUBLE,
+                         worker, COMM_TAGS::RESULT_DATA, id);
+        } else {
+            gatherChunk.staging.resize(static_cast<size_t>(count) * wireBytesPerPixel(outCodec));
+            comm->submit(COMM_RECV, gatherChunk.staging.data(), static_cast<long long>(gatherChunk.staging.size()), MPI_BYTE,
+                         worker, COMM_TAGS::RESULT_DATA, id);
+        }
+        wireBytes += static_cast<long long>(count) * wireBytesPerPixel(outCodec);
+    }
+}
+
 int Master::getPaddingForLayer(LAYER layer) {
     switch (layer) {
         case LAYER::ONE:
@@ -94,7 +187,21 @@ void Master::gatherAndSaveLayer() {
     int height = image->getHeight();
     int width = image->getWidth();
 
-    vector<double> pixels(height * width);
+    // receives were queued during the scatter, only the master's own rows are left to place
+    if (comm) {
+        copy(this->pixels.begin() + dims.rowIndex(dims.offset), this->pixels.begin() + dims.rowIndex(dims.offset + dims.rowsForWorker), gathered.begin());
+        comm->drain();
+
+        WIRE_CODEC outCodec = static_cast<WIRE_CODEC>(dims.outCodec);
+        for (const auto& chunk : gatherChunks) {
+            finishRecvPixels(&gathered[static_cast<size_t>(chunk.startRow) * width], chunk.rows * width, outCodec, chunk.staging);
+        }
+
+        image->setFlattenedMatrix(gathered);
+        return;
+    }
+
+    vector<double> pixels(static_cast<long long>(height) * width);
 
     // number of workers 
     int numWorkers = numtasks;
@@ -105,16 +212,20 @@ void Master::gatherAndSaveLayer() {
 
     // gather from self
     int rowsForMaster = baseRows + (0 < remainder ? 1 : 0);
-    copy(this->pixels.begin() + dims.offset * dims.width, this->pixels.begin() + (dims.offset + dims.rowsForWorker) * dims.width, pixels.begin());
+    copy(this->pixels.begin() + dims.rowIndex(dims.offset), this->pixels.begin() + dims.rowIndex(dims.offset + dims.rowsForWorker), pixels.begin());
 
     // post all receives concurrently
+    WIRE_CODEC outCodec = static_cast<WIRE_CODEC>(dims.outCodec);
     vector<MPI_Request> requests(numtasks - 1);
+    vector<vector<unsigned char>> staging(numtasks);
     int startRow = rowsForMaster;    
     for (int worker = 1; worker < numtasks; ++worker) {
         // rows for this worker (distribute remainder)
         int rowsForWorker = baseRows + (worker < remainder ? 1 : 0);
         
-        MPI_Irecv(&pixels[startRow * width], rowsForWorker * width, MPI_DOUBLE, worker, COMM_TAGS::RESULT_DATA, MPI_COMM_WORLD, &requests[worker - 1]);
+        irecvPixels(&pixels[static_cast<long long>(startRow) * width], static_cast<long long>(rowsForWorker) * width, outCodec, staging[worker],
+                    worker, COMM_TAGS::RESULT_DATA, &requests[worker - 1]);
+        wireBytes += static_cast<long long>(rowsForWorker) * width * wireBytesPerPixel(outCodec);
         
         startRow += rowsForWorker;
     }
@@ -122,9 +233,106 @@ void Master::gatherAndSaveLayer() {
     // wait for all receives to complete
     MPI_Waitall(numtasks - 1, requests.data(), MPI_STATUSES_IGNORE);
 
+    // decode the compressed strips in place
+    startRow = rowsForMaster;
+    for (int worker = 1; worker < numtasks; ++worker) {
+        int rowsForWorker = baseRows + (worker < remainder ? 1 : 0);
+        finishRecvPixels(&pixels[static_cast<long long>(startRow) * width], static_cast<long long>(rowsForWorker) * width, outCodec, staging[worker]);
+        startRow += rowsForWorker;
+    }
+
     image->setFlattenedMatrix(pixels);
 }
 
+void Master::streamAndSaveLayer() {
+    int height = image->getHeight();
+    int width = image->getWidth();
+
+    // the previous layer was only needed for the scatter, the final layer never exists as doubles here
+    image.reset();
+
+    if (comm) {
+        PngStreamWriter writer(outImagePath, width, height);
+
+        vector<unsigned char> own;
+        packPixels(&pixels[dims.rowIndex(dims.offset)], dims.workingPixels(), WIRE_UINT8, own);
+        writeOutputRows(writer, own.data(), dims.rowsForWorker, width);
+
+        // chunks complete in any order, encode the longest finished prefix each time one comes in
+        vector<bool> arrived(gatherChunks.size(), false);
+        size_t nextChunk = 0;
+        while (nextChunk < gatherChunks.size()) {
+            int id = comm->waitAny();
+            if (id >= 0) {
+                arrived[id] = true;
+            }
+
+            while (nextChunk < gatherChunks.size() && arrived[nextChunk]) {
+                writeOutputRows(writer, gatherChunks[nextChunk].staging.data(), gatherChunks[nextChunk].rows, width);
+                vector<unsigned char>().swap(gatherChunks[nextChunk].staging);
+                ++nextChunk;
+            }
+        }
+
+        comm->drain();
+        vector<double>().swap(scatterSource);
+        writer.finish();
+        return;
+    }
+
+    int baseRows = height / numtasks;
+    int remainder = height % numtasks;
+
+    // post all receives up front, strips arrive as output bytes
+    vector<MPI_Request> requests(numtasks, MPI_REQUEST_NULL);
+    vector<vector<unsigned char>> strips(numtasks);
+    vector<int> stripRows(numtasks);
+    for (int worker = 0; worker < numtasks; ++worker) {
+        stripRows[worker] = baseRows + (worker < remainder ? 1 : 0);
+        if (worker == MASTER_RANK) {
+            continue;
+        }
+
+        strips[worker].resize(static_cast<size_t>(stripRows[worker]) * width);
+        wireIrecv(strips[worker].data(), static_cast<long long>(stripRows[worker]) * width, MPI_BYTE, worker,
+                  COMM_TAGS::RESULT_DATA, &requests[worker]);
+        wireBytes += static_cast<long long>(stripRows[worker]) * width;
+    }
+
+    PngStreamWriter writer(outImagePath, width, height);
+
+    // own rows first, then every strip in rank (= row) order as soon as it is in,
+    // so encoding overlaps with the ranks that are still sending
+    packPixels(&pixels[dims.rowIndex(dims.offset)], dims.workingPixels(), WIRE_UINT8, strips[MASTER_RANK]);
+    for (int worker = 0; worker < numtasks; ++worker) {
+        MPI_Wait(&requests[worker], MPI_STATUS_IGNORE);
+        writeOutputRows(writer, strips[worker].data(), stripRows[worker], width);
+        vector<unsigned char>().swap(strips[worker]);
+    }
+
+    writer.finish();
+}
+
+void Master::writeOutputRows(PngStreamWriter& writer, const unsigned char* rows, int count, int width) {
+    writer.writeRows(rows, count);
+    if (keepOutputBytes) {
+        outputBytes.insert(outputBytes.end(), rows, rows + static_cast<size_t>(count) * width);
+    }
+}
+
 void Master::saveImage() {
+    // the bytes the encoder gets, the same whatever the output format
+    if (keepOutputBytes) {
+        const unsigned char* bytes = image->getBytes();
+        outputBytes.assign(bytes, bytes + static_cast<size_t>(image->getWidth()) * image->getHeight());
+    }
+    if (outImagePath.empty()) {
+        return;
+    }
+
     image->save(outImagePath);
 }
+
+long long Master::getWireBytes() const {
+    return wireBytes;
+}
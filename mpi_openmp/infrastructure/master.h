@@ -2,21 +2,56 @@
 #include "entity.h"
 #include "../helpers/image.h"
 #include "auxs.h"
+#include "wire.h"
+#include "../helpers/png_writer.h"
 #include <memory>
 
 class Master : public Entity {
 public:
-    Master(int numtasks, int rank, std::string inputImagePath, std::string outputImagePath);
+    Master(int numtasks, int rank, std::string inputImagePath, std::string outputImagePath,
+           WIRE_MODE wireMode = WIRE_MODE_DOUBLE);
     ~Master() override;
     void run() override;
 
+    // output bytes as run() saved them, when keepOutput was set
+    const std::vector<unsigned char>& getOutput() const { return outputBytes; }
+
+    // pixel payload bytes sent and received by the master during run()
+    long long getWireBytes() const;
+
+    // keeps a copy of the output bytes for getOutput(), the final layer takes the same path either way
+    void keepOutput(bool keep);
+
 private:
     
     std::string outImagePath;
     std::unique_ptr<GreyScaleImage> image;
+    WIRE_MODE wireMode;
+    long long wireBytes = 0;
+    bool keepOutputBytes = false;
+    std::vector<unsigned char> outputBytes;
+
+    // a slice of a worker's result, received by the communication thread
+    struct GatherChunk {
+        int startRow;
+        int rows;
+        std::vector<unsigned char> staging; // encoded payload, empty for doubles received in place
+    };
+
+    // state of the transfers queued on the communication thread for the current layer
+    std::vector<double> scatterSource;
+    std::vector<ProcessDims> scatterDims;
+    std::vector<std::vector<unsigned char>> scatterStaging;
+    std::vector<double> gathered;
+    std::vector<GatherChunk> gatherChunks;
 
     void scatter(LAYER layer);
     int getPaddingForLayer(LAYER layer);
     void gatherAndSaveLayer();
+    void queueScatter(int worker, const ProcessDims& dims, const double* source);
+    void queueGather(int worker, int startRow, const ProcessDims& dims);
+    bool streamsFinalLayer() const;
+    void streamAndSaveLayer();
+    void writeOutputRows(PngStreamWriter& writer, const unsigned char* rows, int count, int width);
     void saveImage();
 };
\ No newline at end of file
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+// bounded single-producer / single-consumer ring buffer, lock-free:
+// the producer only writes tail, the consumer only writes head
+template <typename T>
+class SpscQueue {
+public:
+    explicit SpscQueue(size_t capacity) : slots(capacity + 1) {}
+
+    // producer side, returns false when the queue is full
+    bool push(const T& value) {
+        size_t tail = tailIdx.load(std::memory_order_relaxed);
+        size_t next = (tail + 1) % slots.size();
+        if (next == headIdx.load(std::memory_order_acquire)) {
+            return false;
+        }
+
+        slots[tail] = value;
+        tailIdx.store(next, std::memory_order_release);
+        return true;
+    }
+
+    // consumer side, returns false when the queue is empty
+    bool pop(T& value) {
+        size_t head = headIdx.load(std::memory_order_relaxed);
+        if (head == tailIdx.load(std::memory_order_acquire)) {
+            return false;
+        }
+
+        value = slots[head];
+        headIdx.store((head + 1) % slots.size(), std::memory_order_release);
+        return true;
+    }
+
+private:
+    std::vector<T> slots;
+
+    // kept on separate cache lines so producer and consumer do not false-share
+    alignas(64) std::atomic<size_t> headIdx{0};
+    alignas(64) std::atomic<size_t> tailIdx{0};
+};
@@ -10,6 +10,13 @@ Crew::~Crew() {
 
 void Crew::run() {
     for (int layer = LAYER::ONE; layer <= LAYER::THREE; ++layer) {
+        if (comm) {
+            receiveAndProcess(static_cast<LAYER>(layer));
+            computeMinMax();
+            normalizeAndSend();
+            continue;
+        }
+
         receive();
         process(static_cast<LAYER>(layer));
         computeMinMax();
@@ -24,11 +31,92 @@ void Crew::receive() {
     this->dims = dims;
 
     // receive directly into flat array
-    pixels.resize(dims.totalRows * dims.width);
-    MPI_Recv(pixels.data(), dims.totalRows * dims.width, MPI_DOUBLE, MASTER_RANK, COMM_TAGS::IMAGE_DATA, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    pixels.resize(dims.totalPixels());
+    recvPixels(pixels.data(), dims.totalPixels(), static_cast<WIRE_CODEC>(dims.inCodec),
+               MASTER_RANK, COMM_TAGS::IMAGE_DATA);
 }
 
 void Crew::send() {
-    int startIdx = dims.offset * dims.width;
-    MPI_Send(&pixels[startIdx], dims.rowsForWorker * dims.width, MPI_DOUBLE, MASTER_RANK, COMM_TAGS::RESULT_DATA, MPI_COMM_WORLD);
+    long long startIdx = dims.rowIndex(dims.offset);
+    sendPixels(&pixels[startIdx], dims.workingPixels(), static_cast<WIRE_CODEC>(dims.outCodec),
+               MASTER_RANK, COMM_TAGS::RESULT_DATA);
+}
+
+void Crew::receiveAndProcess(LAYER layer) {
+    ProcessDims dims(0,0,0,0,0);
+    MPI_Recv(&dims, sizeof(ProcessDims), MPI_BYTE, MASTER_RANK, COMM_TAGS::DIMENSIONS, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    this->dims = dims;
+    pixels.resize(dims.totalPixels());
+
+    // queue a receive per chunk, the chunk index is its completion id
+    WIRE_CODEC inCodec = static_cast<WIRE_CODEC>(dims.inCodec);
+    auto chunks = chunkRanges(dims.totalRows, dims.chunkRows);
+    vector<vector<unsigned char>> staging(chunks.size());
+    for (size_t c = 0; c < chunks.size(); ++c) {
+        long long count = dims.rowIndex(chunks[c].second - chunks[c].first);
+        if (inCodec == WIRE_DOUBLE) {
+            comm->submit(COMM_RECV, &pixels[dims.rowIndex(chunks[c].first)], count, MPI_DOUBLE,
+                         MASTER_RANK, COMM_TAGS::IMAGE_DATA, static_cast<int>(c));
+        } else {
+            staging[c].resize(static_cast<size_t>(count) * wireBytesPerPixel(inCodec));
+            comm->submit(COMM_RECV, staging[c].data(), static_cast<long long>(staging[c].size()), MPI_BYTE,
+                         MASTER_RANK, COMM_TAGS::IMAGE_DATA, static_cast<int>(c));
+        }
+    }
+
+    // output row i reads input rows up to offset + i + padding, so it can be convolved
+    // as soon as every chunk up to that row is in
+    vector<double> result(dims.workingPixels());
+    vector<bool> arrived(chunks.size(), false);
+    size_t contiguous = 0;
+    int readyRows = 0;
+    int doneRows = 0;
+    while (doneRows < dims.rowsForWorker) {
+        int c = comm->waitAny();
+        finishRecvPixels(&pixels[dims.rowIndex(chunks[c].first)], dims.rowIndex(chunks[c].second - chunks[c].first),
+                         inCodec, staging[c]);
+        arrived[c] = true;
+
+        while (contiguous < chunks.size() && arrived[contiguous]) {
+            readyRows = chunks[contiguous].second;
+            ++contiguous;
+        }
+
+        // rows past the end of the strip are clamped to its last row, which must be in as well
+        int computable = (readyRows == dims.totalRows) ? dims.rowsForWorker
+                         : max(0, min(dims.rowsForWorker, readyRows - dims.padding - dims.offset));
+        if (computable > doneRows) {
+            convolveRows(layer, doneRows, computable, result);
+            doneRows = computable;
+        }
+    }
+
+    #pragma omp parallel for
+    for (int i = 0; i < dims.rowsForWorker; ++i) {
+        copy(result.begin() + dims.rowIndex(i), result.begin() + dims.rowIndex(i + 1), pixels.begin() + dims.rowIndex(dims.offset + i));
+    }
+}
+
+void Crew::normalizeAndSend() {
+    WIRE_CODEC outCodec = static_cast<WIRE_CODEC>(dims.outCodec);
+    auto chunks = chunkRanges(dims.rowsForWorker, dims.chunkRows);
+    vector<vector<unsigned char>> staging(chunks.size());
+
+    // the team normalizes chunk c + 1 while the communication thread ships chunk c
+    for (size_t c = 0; c < chunks.size(); ++c) {
+        normalizeRows(chunks[c].first, chunks[c].second);
+
+        double* first = &at(dims.offset + chunks[c].first, 0);
+        long long count = dims.rowIndex(chunks[c].second - chunks[c].first);
+        if (outCodec == WIRE_DOUBLE) {
+            comm->submit(COMM_SEND, first, count, MPI_DOUBLE, MASTER_RANK, COMM_TAGS::RESULT_DATA, -1);
+        } else {
+            packPixels(first, count, outCodec, staging[c]);
+            comm->submit(COMM_SEND, staging[c].data(), static_cast<long long>(staging[c].size()), MPI_BYTE,
+                         MASTER_RANK, COMM_TAGS::RESULT_DATA, -1);
+        }
+    }
+
+    // pixels and staging are reused by the next layer
+    comm->drain();
 }
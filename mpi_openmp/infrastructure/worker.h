@@ -7,6 +7,7 @@
 #include "../helpers/kernels.h"
 #include "auxs.h"
 #include "entity.h"
+#include "wire.h"
 #include "../helpers/image.h"
 #include "../helpers/kernels.h"
 
@@ -19,4 +20,8 @@ public:
 private:
     void receive();
     void send();
+
+    // communication thread variants: compute on chunks as they arrive, send chunks as they are normalized
+    void receiveAndProcess(LAYER layer);
+    void normalizeAndSend();
 };
\ No newline at end of file
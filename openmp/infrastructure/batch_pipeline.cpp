@@ -0,0 +1,137 @@
+#include "batch_pipeline.h"
+#include "../helpers/batch_inputs.h"
+#include <omp.h>
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <thread>
+
+using namespace std;
+using namespace std::chrono;
+
+static long long microsSince(high_resolution_clock::time_point start) {
+    return duration_cast<microseconds>(high_resolution_clock::now() - start).count();
+}
+
+BatchPipeline::BatchPipeline(const BatchOptions& options, BatchCompute compute)
+    : options(options), compute(move(compute)), decoded(max(1, options.queueDepth)), computed(max(1, options.queueDepth)) {
+    int hardware = max(1u, thread::hardware_concurrency());
+    if (this->options.decodeThreads <= 0) {
+        this->options.decodeThreads = max(1, hardware / 4);
+    }
+    if (this->options.encodeThreads <= 0) {
+        this->options.encodeThreads = max(1, hardware / 4);
+    }
+    if (this->options.computeThreads <= 0) {
+        this->options.computeThreads = max(1, hardware - this->options.decodeThreads - this->options.encodeThreads);
+    }
+}
+
+int BatchPipeline::run(const vector<string>& inputs, const string& outputDir) {
+    filesystem::create_directories(outputDir);
+
+    jobs.clear();
+    jobs.resize(inputs.size());
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        jobs[i].input = inputs[i];
+        jobs[i].output = batchOutputPath(outputDir, inputs[i]);
+    }
+    nextInput = 0;
+    decodersLeft = options.decodeThreads;
+    decodeDone = false;
+    computeDone = false;
+
+    vector<thread> threads;
+    for (int i = 0; i < options.decodeThreads; ++i) {
+        threads.emplace_back(&BatchPipeline::decodeLoop, this);
+    }
+    for (int i = 0; i < options.encodeThreads; ++i) {
+        threads.emplace_back(&BatchPipeline::encodeLoop, this);
+    }
+
+    // the calling thread drives the compute stage and its OpenMP team
+    computeLoop();
+
+    for (auto& t : threads) {
+        t.join();
+    }
+    return failed;
+}
+
+void BatchPipeline::decodeLoop() {
+    for (;;) {
+        int index = nextInput++;
+        if (index >= static_cast<int>(jobs.size())) {
+            break;
+        }
+
+        Job& job = jobs[index];
+        auto start = high_resolution_clock::now();
+        // images are decoded side by side, so each one is decoded on its own thread
+        job.image = make_unique<GreyScaleImage>();
+        bool loaded = job.image->load(job.input, previewFactor(), 1) && job.image->getBytes();
+        decodeMicros += microsSince(start);
+
+        if (!loaded) {
+            cerr << "Skipping unreadable image: " << job.input << endl;
+            job.image.reset();
+            ++failed;
+            continue;
+        }
+        job.width = job.image->getWidth();
+        job.height = job.image->getHeight();
+        pushWaiting(decoded, index);
+    }
+
+    if (--decodersLeft == 0) {
+        decodeDone.store(true, memory_order_release);
+    }
+}
+
+void BatchPipeline::computeLoop() {
+    omp_set_num_threads(options.computeThreads);
+
+    int index;
+    while (popOrFinish(decoded, decodeDone, index)) {
+        Job& job = jobs[index];
+        auto start = high_resolution_clock::now();
+        try {
+            job.result.resize(static_cast<size_t>(job.width) * job.height);
+            compute(job.image->getBytes(), job.width, job.height, job.result.data());
+        } catch (const exception& e) {
+            cerr << job.input << ": " << e.what() << endl;
+            job.image.reset();
+            job.result = vector<unsigned char>();
+            ++failed;
+            computeMicros += microsSince(start);
+            continue;
+        }
+        job.image.reset();
+        computeMicros += microsSince(start);
+        pushWaiting(computed, index);
+    }
+
+    computeDone.store(true, memory_order_release);
+}
+
+void BatchPipeline::encodeLoop() {
+    // images are encoded side by side, so each one is encoded serially
+    PngOptions pngOptions = defaultPngOptions();
+    pngOptions.threads = 1;
+
+    int index;
+    while (popOrFinish(computed, computeDone, index)) {
+        Job& job = jobs[index];
+        auto start = high_resolution_clock::now();
+        try {
+            GreyScaleImage::saveBytes(job.output, job.result.data(), job.width, job.height, pngOptions);
+            ++succeeded;
+        } catch (const exception& e) {
+            cerr << job.output << ": " << e.what() << endl;
+            ++failed;
+        }
+        job.result = vector<unsigned char>();
+        encodeMicros += microsSince(start);
+    }
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "../helpers/image.h"
+#include "../helpers/mpmc_queue.h"
+
+// images allowed to wait between two stages when no depth is given
+#define BATCH_QUEUE_DEPTH 4
+
+// threads given to each stage of a batch run, 0 picks a default from the hardware threads
+struct BatchOptions {
+    int decodeThreads = 0;  // images decoded at once, default a quarter of the threads
+    int computeThreads = 0; // OpenMP team of the compute stage, default what decode and encode leave
+    int encodeThreads = 0;  // images encoded at once (each one serially), default a quarter of the threads
+    int queueDepth = BATCH_QUEUE_DEPTH;
+};
+
+// the three layers of one image: width * height input bytes to width * height output bytes
+typedef std::function<void(const unsigned char* input, int width, int height, unsigned char* output)> BatchCompute;
+
+/*
+    runs a list of images through decode -> compute -> encode stages that overlap, connected by
+    bounded lock-free queues: while one image is computed, the next ones are decoded and the
+    previous ones encoded, each stage on its own threads
+*/
+class BatchPipeline {
+public:
+    BatchPipeline(const BatchOptions& options, BatchCompute compute);
+
+    /*
+        processes every input, writing each result to batchOutputPath(outputDir, input)
+        @return number of images that failed
+    */
+    int run(const std::vector<std::string>& inputs, const std::string& outputDir);
+
+    int getSucceeded() const { return succeeded; }
+    int getFailed() const { return failed; }
+    const BatchOptions& getOptions() const { return options; }
+
+    // time spent working, summed over the threads of a stage
+    long long getDecodeMs() const { return decodeMicros / 1000; }
+    long long getComputeMs() const { return computeMicros / 1000; }
+    long long getEncodeMs() const { return encodeMicros / 1000; }
+
+private:
+    struct Job {
+        std::string input;
+        std::string output;
+        std::unique_ptr<GreyScaleImage> image; // set by decode, released by compute
+        std::vector<unsigned char> result;     // set by compute, released by encode
+        int width = 0;
+        int height = 0;
+    };
+
+    BatchOptions options;
+    BatchCompute compute;
+
+    std::vector<Job> jobs;
+    MpmcQueue<int> decoded;
+    MpmcQueue<int> computed;
+    std::atomic<int> nextInput{0};
+    std::atomic<int> decodersLeft{0};
+    std::atomic<bool> decodeDone{false};
+    std::atomic<bool> computeDone{false};
+
+    std::atomic<int> succeeded{0};
+    std::atomic<int> failed{0};
+    std::atomic<long long> decodeMicros{0};
+    std::atomic<long long> computeMicros{0};
+    std::atomic<long long> encodeMicros{0};
+
+    void decodeLoop();
+    void computeLoop();
+    void encodeLoop();
+};
@@ -3,8 +3,11 @@
 #include <vector>
 #include <climits>
 #include <omp.h>
+#include "../helpers/batch_inputs.h"
 #include "../helpers/image.h"
 #include "../helpers/kernels.h"
+#include "../helpers/preview.h"
+#include "infrastructure/batch_pipeline.h"
 
 using namespace std;
 using namespace chrono;
@@ -13,34 +16,130 @@ vector<vector<double>> applyKernel(const vector<vector<double>> &input,
     const vector<vector<int>> &kernel,
     double divisor, int padding);
 
+// first layer straight from the 8-bit input (for mapped PGM / raw files: from the page cache)
+vector<vector<double>> applyKernel(const unsigned char *input, int width, int height,
+    const vector<vector<int>> &kernel,
+    double divisor, int padding);
+
+template <typename T>
+vector<vector<double>> convolveRows(const vector<const T*> &rows, int width,
+    const vector<vector<int>> &kernel,
+    double divisor, int padding);
+
+void findMinMax(const vector<vector<double>> &matrix, double &minVal, double &maxVal);
+
 void normalizeMatrix(vector<vector<double>> &matrix);
 
-int main() {
+// all three layers of an 8-bit image, the last one left raw with its range in minVal / maxVal
+vector<vector<double>> runLayers(const unsigned char *input, int width, int height, double &minVal, double &maxVal);
+
+int runBatch(const string &inputs, const string &outputDir, const BatchOptions &options);
+
+int main(int argc, char** argv) {
+    // --png-level <0-9>, --png-filter <name>, --png-fast, --png-threads <n> pick how the output is encoded
+    setDefaultPngOptions(parsePngOptions(argc, argv));
+    // --preview 2|4|8 runs on the input box-downsampled by that factor, for a quick look
+    setPreviewFactor(parsePreviewFactor(argc, argv));
+
+    // usage: openmp [--input <png|pgm|raw>] [--output <png|pgm|raw>]
+    //               [--batch <directory|manifest> [--out-dir <directory>] [--decode-threads <n>]
+    //                [--compute-threads <n>] [--encode-threads <n>] [--queue-depth <images>]]
+    string inputPath = "../images/image.png";
+    string outputPath = "../images/output_parallel.png";
+    string batchInputs;
+    string batchOutputDir = "../images/batch";
+    BatchOptions batchOptions;
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--input" && i + 1 < argc) {
+            inputPath = argv[++i];
+        } else if (arg == "--output" && i + 1 < argc) {
+            outputPath = argv[++i];
+        } else if (arg == "--batch" && i + 1 < argc) {
+            batchInputs = argv[++i];
+        } else if (arg == "--out-dir" && i + 1 < argc) {
+            batchOutputDir = argv[++i];
+        } else if (arg == "--decode-threads" && i + 1 < argc) {
+            batchOptions.decodeThreads = stoi(argv[++i]);
+        } else if (arg == "--compute-threads" && i + 1 < argc) {
+            batchOptions.computeThreads = stoi(argv[++i]);
+        } else if (arg == "--encode-threads" && i + 1 < argc) {
+            batchOptions.encodeThreads = stoi(argv[++i]);
+        } else if (arg == "--queue-depth" && i + 1 < argc) {
+            batchOptions.queueDepth = stoi(argv[++i]);
+        }
+    }
+
+    // batch mode: many images through overlapped decode, compute and encode stages
+    if (!batchInputs.empty()) {
+        return runBatch(batchInputs, batchOutputDir, batchOptions);
+    }
+
     auto start = high_resolution_clock::now();
 
-    GreyScaleImage img("../images/image.png");
-    const auto &inputMat = img.getMatrix();
+    GreyScaleImage img(inputPath);
+    if (!img.getBytes()) {
+        return 1;
+    }
+    double minVal, maxVal;
+    vector<vector<double>> layer3 = runLayers(img.getBytes(), img.getWidth(), img.getHeight(), minVal, maxVal);
+
+    // the last layer is normalized while it is quantized for the encoder
+    img.setQuantizedMatrix(layer3, normalizingQuantizer(minVal, maxVal));
+    img.save(outputPath);
+
+    auto stop = high_resolution_clock::now();
+    auto duration = duration_cast<milliseconds>(stop - start);
+    cout << "Processing time: " << duration.count() << " ms" << endl;
+    return 0;
+}
+
+vector<vector<double>> runLayers(const unsigned char *input, int width, int height, double &minVal, double &maxVal)
+{
     vector<vector<double>> layer1, layer2, layer3;
 
     {
-        layer1 = applyKernel(inputMat, LAYER_1_KERNEL, LAYER_1_DIV, LAYER_1_PADDING);
+        // the input is integral, so convolving its bytes gives the same sums as its doubles
+        layer1 = applyKernel(input, width, height, LAYER_1_KERNEL, LAYER_1_DIV, LAYER_1_PADDING);
+        normalizeMatrix(layer1);
     }
 
     {
         layer2 = applyKernel(layer1, LAYER_2_KERNEL, LAYER_2_DIV, LAYER_2_PADDING);
+        normalizeMatrix(layer2);
     }
 
     {
         layer3 = applyKernel(layer2, LAYER_3_KERNEL, LAYER_3_DIV, LAYER_3_PADDING);
     }
 
-    img.setMatrix(layer3);
-    img.save("../images/output_parallel.png");
+    findMinMax(layer3, minVal, maxVal);
+    return layer3;
+}
 
-    auto stop = high_resolution_clock::now();
-    auto duration = duration_cast<milliseconds>(stop - start);
-    cout << "Processing time: " << duration.count() << " ms" << endl;
-    return 0;
+int runBatch(const string &inputs, const string &outputDir, const BatchOptions &options)
+{
+    vector<string> paths = listBatchInputs(inputs);
+
+    // the compute stage quantizes with its own team size, the encoders never touch the shared pool
+    BatchPipeline pipeline(options, [](const unsigned char *input, int width, int height, unsigned char *output) {
+        double minVal, maxVal;
+        vector<vector<double>> layer3 = runLayers(input, width, height, minVal, maxVal);
+        quantizeRows(layer3, output, normalizingQuantizer(minVal, maxVal), omp_get_max_threads());
+    });
+
+    auto start = high_resolution_clock::now();
+    pipeline.run(paths, outputDir);
+    auto duration = duration_cast<milliseconds>(high_resolution_clock::now() - start);
+
+    const BatchOptions &used = pipeline.getOptions();
+    double seconds = max<long long>(duration.count(), 1) / 1000.0;
+    cout << "Batch: " << pipeline.getSucceeded() << " images processed, " << pipeline.getFailed() << " failed" << endl;
+    cout << "Processing time: " << duration.count() << " ms (" << pipeline.getSucceeded() / seconds << " images/s)" << endl;
+    cout << "Stage busy time: decode " << pipeline.getDecodeMs() << " ms (" << used.decodeThreads << " threads), compute "
+         << pipeline.getComputeMs() << " ms (" << used.computeThreads << " threads), encode " << pipeline.getEncodeMs()
+         << " ms (" << used.encodeThreads << " threads)" << endl;
+    return pipeline.getFailed() > 0 ? 1 : 0;
 }
 
 vector<vector<double>> applyKernel(
@@ -48,8 +147,32 @@ vector<vector<double>> applyKernel(
     const vector<vector<int>> &kernel,
     double divisor, int padding)
 {
-    int height = input.size();
-    int width = input[0].size();
+    vector<const double*> rows(input.size());
+    for (size_t y = 0; y < input.size(); ++y) {
+        rows[y] = input[y].data();
+    }
+    return convolveRows(rows, input[0].size(), kernel, divisor, padding);
+}
+
+vector<vector<double>> applyKernel(
+    const unsigned char *input, int width, int height,
+    const vector<vector<int>> &kernel,
+    double divisor, int padding)
+{
+    vector<const unsigned char*> rows(height);
+    for (int y = 0; y < height; ++y) {
+        rows[y] = input + static_cast<size_t>(y) * width;
+    }
+    return convolveRows(rows, width, kernel, divisor, padding);
+}
+
+template <typename T>
+vector<vector<double>> convolveRows(
+    const vector<const T*> &rows, int width,
+    const vector<vector<int>> &kernel,
+    double divisor, int padding)
+{
+    int height = rows.size();
 
     vector<vector<double>> outMat(height, vector<double>(width, 0.0));
 
@@ -63,34 +186,44 @@ vector<vector<double>> applyKernel(
                 for (int kx = -padding; kx <= padding; ++kx) {
                     int iy = (y + ky < 0) ? 0 : (y + ky >= height ? height - 1 : y + ky);
                     int ix = (x + kx < 0) ? 0 : (x + kx >= width ? width - 1 : x + kx);
-                    sum += input[iy][ix] * kernel[ky + padding][kx + padding];
+                    sum += static_cast<double>(rows[iy][ix]) * kernel[ky + padding][kx + padding];
                 }
             }
             outMat[y][x] = sum / divisor;
         }
     }
 
-    normalizeMatrix(outMat);
     return outMat;
 }
 
-void normalizeMatrix(vector<vector<double>> &matrix)
+void findMinMax(const vector<vector<double>> &matrix, double &minVal, double &maxVal)
 {
-    double minVal = INT_MAX;
-    double maxVal = INT_MIN;
+    double lowest = INT_MAX;
+    double highest = INT_MIN;
     int height = matrix.size();
     int width = matrix[0].size();
 
     // reduction to find min and max values
-    #pragma omp parallel for reduction(min:minVal) reduction(max:maxVal)
+    #pragma omp parallel for reduction(min:lowest) reduction(max:highest)
     for (int i = 0; i < height; ++i) {
         for (int j = 0; j < width; ++j) {
             double v = matrix[i][j];
-            if (v < minVal) minVal = v;
-            if (v > maxVal) maxVal = v;
+            if (v < lowest) lowest = v;
+            if (v > highest) highest = v;
         }
     }
 
+    minVal = lowest;
+    maxVal = highest;
+}
+
+void normalizeMatrix(vector<vector<double>> &matrix)
+{
+    double minVal, maxVal;
+    findMinMax(matrix, minVal, maxVal);
+    int height = matrix.size();
+    int width = matrix[0].size();
+
     double range = (maxVal - minVal == 0.0) ? 1.0 : (maxVal - minVal);
 
     // normalization step where each pixel is processed in parallel
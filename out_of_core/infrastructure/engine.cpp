@@ -0,0 +1,325 @@
+#include "engine.h"
+#include "../helpers/kernels.h"
+#include "../helpers/mapped_image.h"
+#include "../helpers/png_writer.h"
+#include "../helpers/quantize.h"
+#include "../helpers/row_source.h"
+#include "../helpers/tiled_image.h"
+#include <algorithm>
+#include <cfloat>
+#include <stdexcept>
+
+using namespace std;
+
+static const int MAX_PADDING = max(LAYER_1_PADDING, max(LAYER_2_PADDING, LAYER_3_PADDING));
+
+OutOfCoreEngine::OutOfCoreEngine(const EngineOptions& options) : options(options) {}
+
+void OutOfCoreEngine::setupCache(int width) {
+    long long tileSize = options.tileSize;
+    long long tileBytes = tileSize * tileSize * static_cast<long long>(sizeof(double));
+
+    // window + output tile of a layer, and the byte band of the ingest / output passes
+    long long windowEdge = tileSize + 2 * MAX_PADDING;
+    long long working = (windowEdge * windowEdge + tileSize * tileSize) * static_cast<long long>(sizeof(double)) +
+                        static_cast<long long>(width) * tileSize;
+
+    // one window spans this many tiles per axis, all of them have to fit at once
+    long long span = (windowEdge + tileSize - 1) / tileSize + 1;
+    long long windowTiles = span * span;
+
+    long long capacity = (options.memoryBudget - working) / tileBytes;
+    if (capacity < windowTiles) {
+        long long needed = (working + windowTiles * tileBytes + (1 << 20) - 1) >> 20;
+        throw runtime_error("Memory budget too small for " + to_string(options.tileSize) + " px tiles, need at least " +
+                            to_string(needed) + " MB");
+    }
+
+    // read ahead only as far as the budget leaves room for
+    lookahead = static_cast<int>(min<long long>(options.prefetch, capacity / windowTiles - 1));
+    cache = make_unique<TileCache>(static_cast<size_t>(capacity));
+    prefetcher = make_unique<Prefetcher>(*cache);
+}
+
+void OutOfCoreEngine::run(const string& inputPath, const string& outputPath) {
+    if (isTiledPath(outputPath)) {
+        throw runtime_error("Tiled outputs are not supported out of core: " + outputPath);
+    }
+
+    unique_ptr<TileStore> input = ingest(inputPath);
+    LayerRange range1, range2, range3;
+
+    // every store is dropped from the cache (after pending prefetches) before it is deleted
+    unique_ptr<TileStore> layer1 = convolveLayer(*input, nullptr, LAYER_1_KERNEL, LAYER_1_DIV, LAYER_1_PADDING, range1);
+    prefetcher->drain();
+    cache->drop(*input);
+    input.reset();
+
+    unique_ptr<TileStore> layer2 = convolveLayer(*layer1, &range1, LAYER_2_KERNEL, LAYER_2_DIV, LAYER_2_PADDING, range2);
+    prefetcher->drain();
+    cache->drop(*layer1);
+    layer1.reset();
+
+    unique_ptr<TileStore> layer3 = convolveLayer(*layer2, &range2, LAYER_3_KERNEL, LAYER_3_DIV, LAYER_3_PADDING, range3);
+    prefetcher->drain();
+    cache->drop(*layer2);
+    layer2.reset();
+
+    writeOutput(*layer3, range3, outputPath);
+    prefetcher->drain();
+    cache->drop(*layer3);
+}
+
+unique_ptr<TileStore> OutOfCoreEngine::ingest(const string& inputPath) {
+    unique_ptr<TileStore> store;
+    int tileSize = options.tileSize;
+    int width = 0, height = 0, bandRows = 0, bandStart = 0;
+    vector<unsigned char> band;
+    vector<double> tile(static_cast<size_t>(tileSize) * tileSize);
+
+    // a band of tileSize rows is collected, then cut into tiles
+    auto flush = [&]() {
+        int ty = bandStart / tileSize;
+        for (int tx = 0; tx < store->getTilesAcross(); ++tx) {
+            int x0 = tx * tileSize;
+            int w = min(tileSize, width - x0);
+            fill(tile.begin(), tile.end(), 0.0);
+            for (int y = 0; y < bandRows; ++y) {
+                const unsigned char* src = &band[static_cast<size_t>(y) * width + x0];
+                double* dst = &tile[static_cast<size_t>(y) * tileSize];
+                for (int x = 0; x < w; ++x) {
+                    dst[x] = src[x];
+                }
+            }
+            store->writeTile(tx, ty, tile.data());
+        }
+        bandStart += bandRows;
+        bandRows = 0;
+    };
+
+    bool read = streamGreyRows(inputPath,
+        [&](int w, int h) {
+            width = w;
+            height = h;
+            setupCache(width);
+            store = make_unique<TileStore>(options.spillDirectory, width, height, tileSize);
+            band.resize(static_cast<size_t>(width) * tileSize);
+        },
+        [&](const unsigned char* row) {
+            copy(row, row + width, band.begin() + static_cast<size_t>(bandRows) * width);
+            if (++bandRows == tileSize || bandStart + bandRows == height) {
+                flush();
+            }
+        });
+    if (!read) {
+        throw runtime_error("Failed to load image: " + inputPath);
+    }
+    return store;
+}
+
+void OutOfCoreEngine::prefetchWindow(const TileStore& input, int tx, int ty, int padding) {
+    int tileSize = input.getTileSize();
+    int firstTx = max(0, tx * tileSize - padding) / tileSize;
+    int lastTx = min(input.getWidth() - 1, (tx + 1) * tileSize - 1 + padding) / tileSize;
+    int firstTy = max(0, ty * tileSize - padding) / tileSize;
+    int lastTy = min(input.getHeight() - 1, (ty + 1) * tileSize - 1 + padding) / tileSize;
+
+    for (int y = firstTy; y <= lastTy; ++y) {
+        for (int x = firstTx; x <= lastTx; ++x) {
+            prefetcher->request(input, x, y);
+        }
+    }
+}
+
+void OutOfCoreEngine::buildWindow(const TileStore& input, const LayerRange* inputRange, int x0, int y0, int w,
+                                  int h, int padding, double* window) {
+    int width = input.getWidth();
+    int height = input.getHeight();
+    int tileSize = input.getTileSize();
+    int windowWidth = w + 2 * padding;
+
+    int left = x0 - padding;
+    int from = max(left, 0);
+    int to = min(x0 + w + padding, width);
+    int firstTx = from / tileSize;
+    int lastTx = (to - 1) / tileSize;
+    int firstTy = max(0, y0 - padding) / tileSize;
+    int lastTy = min(height - 1, y0 + h - 1 + padding) / tileSize;
+    int across = lastTx - firstTx + 1;
+
+    // the tiles stay pinned (held here) while the window is assembled, even if the cache evicts them
+    vector<TileData> tiles(static_cast<size_t>(across) * (lastTy - firstTy + 1));
+    for (int ty = firstTy; ty <= lastTy; ++ty) {
+        for (int tx = firstTx; tx <= lastTx; ++tx) {
+            tiles[(ty - firstTy) * across + (tx - firstTx)] = cache->get(input, tx, ty);
+        }
+    }
+
+    // same expression as normalizeMatrix, applied while reading
+    double minVal = inputRange ? inputRange->min : 0.0;
+    double span = 1.0;
+    if (inputRange && inputRange->max - inputRange->min != 0.0) {
+        span = inputRange->max - inputRange->min;
+    }
+
+    for (int wy = 0; wy < h + 2 * padding; ++wy) {
+        int gy = min(max(y0 - padding + wy, 0), height - 1);
+        int ty = gy / tileSize;
+        double* dst = window + static_cast<size_t>(wy) * windowWidth;
+
+        for (int gx = from; gx < to;) {
+            int tx = gx / tileSize;
+            int end = min(to, (tx + 1) * tileSize);
+            const double* src = tiles[(ty - firstTy) * across + (tx - firstTx)]->data() +
+                                static_cast<size_t>(gy - ty * tileSize) * tileSize + (gx - tx * tileSize);
+            double* out = dst + (gx - left);
+            if (inputRange) {
+                for (int i = 0; i < end - gx; ++i) {
+                    out[i] = 255.0 * (src[i] - minVal) / span;
+                }
+            } else {
+                copy(src, src + (end - gx), out);
+            }
+            gx = end;
+        }
+
+        // clamped columns repeat the first / last image column
+        for (int gx = left; gx < from; ++gx) {
+            dst[gx - left] = dst[from - left];
+        }
+        for (int gx = to; gx < x0 + w + padding; ++gx) {
+            dst[gx - left] = dst[to - 1 - left];
+        }
+    }
+}
+
+unique_ptr<TileStore> OutOfCoreEngine::convolveLayer(const TileStore& input, const LayerRange* inputRange,
+                                                     const vector<vector<int>>& kernel, double divisor,
+                                                     int padding, LayerRange& range) {
+    int width = input.getWidth();
+    int height = input.getHeight();
+    int tileSize = input.getTileSize();
+    int across = input.getTilesAcross();
+    int tiles = across * input.getTilesDown();
+    int size = 2 * padding + 1;
+
+    auto output = make_unique<TileStore>(options.spillDirectory, width, height, tileSize);
+    vector<double> window(static_cast<size_t>(tileSize + 2 * padding) * (tileSize + 2 * padding));
+    vector<double> result(static_cast<size_t>(tileSize) * tileSize);
+
+    double minVal = DBL_MAX;
+    double maxVal = -DBL_MAX;
+
+    for (int i = 0; i < lookahead && i < tiles; ++i) {
+        prefetchWindow(input, i % across, i / across, padding);
+    }
+
+    // tiles in row-major order, the inputs of the next ones are read while this one is computed
+    for (int t = 0; t < tiles; ++t) {
+        if (t + lookahead < tiles) {
+            prefetchWindow(input, (t + lookahead) % across, (t + lookahead) / across, padding);
+        }
+
+        int tx = t % across;
+        int ty = t / across;
+        int x0 = tx * tileSize;
+        int y0 = ty * tileSize;
+        int w = min(tileSize, width - x0);
+        int h = min(tileSize, height - y0);
+        int windowWidth = w + 2 * padding;
+
+        buildWindow(input, inputRange, x0, y0, w, h, padding, window.data());
+        fill(result.begin(), result.end(), 0.0);
+
+        // rows of the tile are split among threads, the sum order matches the other implementations
+        #pragma omp parallel for reduction(min:minVal) reduction(max:maxVal)
+        for (int y = 0; y < h; ++y) {
+            for (int x = 0; x < w; ++x) {
+                double sum = 0.0;
+                for (int ky = 0; ky < size; ++ky) {
+                    const double* in = &window[static_cast<size_t>(y + ky) * windowWidth + x];
+                    for (int kx = 0; kx < size; ++kx) {
+                        sum += in[kx] * kernel[ky][kx];
+                    }
+                }
+                double value = sum / divisor;
+                result[static_cast<size_t>(y) * tileSize + x] = value;
+                minVal = min(minVal, value);
+                maxVal = max(maxVal, value);
+            }
+        }
+
+        output->writeTile(tx, ty, result.data());
+    }
+
+    range = LayerRange{ minVal, maxVal };
+    return output;
+}
+
+void OutOfCoreEngine::writeOutput(const TileStore& input, const LayerRange& range, const string& outputPath) {
+    int width = input.getWidth();
+    int height = input.getHeight();
+    int tileSize = input.getTileSize();
+    int across = input.getTilesAcross();
+    Quantizer quantizer = normalizingQuantizer(range.min, range.max);
+
+    unique_ptr<MappedGreyOutput> mapped;
+    unique_ptr<PngStreamWriter> writer;
+    GREY_FORMAT format = greyFormatForPath(outputPath);
+    if (format != GREY_FORMAT_NONE) {
+        mapped = make_unique<MappedGreyOutput>(outputPath, width, height, format);
+    } else {
+        writer = make_unique<PngStreamWriter>(outputPath, width, height);
+    }
+
+    int tiles = across * input.getTilesDown();
+    for (int i = 0; i < lookahead && i < tiles; ++i) {
+        prefetcher->request(input, i % across, i / across);
+    }
+
+    vector<unsigned char> band(static_cast<size_t>(width) * tileSize);
+    for (int ty = 0; ty < input.getTilesDown(); ++ty) {
+
+        int y0 = ty * tileSize;
+        int rows = min(tileSize, height - y0);
+        unsigned char* out = mapped ? mapped->pixels() + static_cast<size_t>(y0) * width : band.data();
+
+        // same normalization and truncation as normalizeMatrix + GreyScaleImage::setMatrix
+        // tiles in row-major order, no further ahead than the layers read, so none is evicted unused
+        for (int tx = 0; tx < across; ++tx) {
+            int t = ty * across + tx;
+            if (t + lookahead < tiles) {
+                prefetcher->request(input, (t + lookahead) % across, (t + lookahead) / across);
+            }
+            TileData tile = cache->get(input, tx, ty);
+            int x0 = tx * tileSize;
+            int w = min(tileSize, width - x0);
+            for (int y = 0; y < rows; ++y) {
+                quantizeRow(tile->data() + static_cast<size_t>(y) * tileSize, w,
+                            out + static_cast<size_t>(y) * width + x0, quantizer);
+            }
+        }
+
+        if (writer) {
+            writer->writeRows(band.data(), rows);
+        }
+    }
+
+    if (writer) {
+        writer->finish();
+    } else {
+        mapped->finish();
+    }
+}
+
+long long OutOfCoreEngine::getCacheHits() const {
+    return cache ? cache->getHits() : 0;
+}
+
+long long OutOfCoreEngine::getCacheMisses() const {
+    return cache ? cache->getMisses() : 0;
+}
+
+size_t OutOfCoreEngine::getCacheCapacity() const {
+    return cache ? cache->getCapacity() : 0;
+}
@@ -0,0 +1,68 @@
+#pragma once
+#include <memory>
+#include <string>
+#include <vector>
+#include "tile_cache.h"
+#include "prefetcher.h"
+#include "tile_store.h"
+
+// min/max of a whole raw layer
+struct LayerRange {
+    double min;
+    double max;
+};
+
+struct EngineOptions {
+    long long memoryBudget = 256LL << 20; // bytes for the tile cache and the working buffers
+    int tileSize = 256;                   // tile edge in pixels
+    int prefetch = 2;                     // output tiles whose inputs are read ahead
+    std::string spillDirectory = "/tmp";  // where the tile stores are created
+};
+
+/*
+    runs the three layers over disk-backed tile stores, one layer at a time:
+    every output tile is computed from a window (tile + halo) assembled from cached input tiles
+    and written straight to the next store, while its min/max is tracked
+
+    a layer's store keeps the raw values and the normalization of the previous layer is applied
+    while its tiles are read into a window, with the same expression as normalizeMatrix, so the
+    result is bit-identical to the whole image implementations
+*/
+class OutOfCoreEngine {
+public:
+    explicit OutOfCoreEngine(const EngineOptions& options);
+
+    // processes input into output, throws runtime_error on I/O errors or a too small budget
+    void run(const std::string& inputPath, const std::string& outputPath);
+
+    long long getCacheHits() const;
+    long long getCacheMisses() const;
+    size_t getCacheCapacity() const;
+
+private:
+    EngineOptions options;
+    std::unique_ptr<TileCache> cache;
+    std::unique_ptr<Prefetcher> prefetcher;
+    int lookahead = 0;
+
+    std::unique_ptr<TileStore> ingest(const std::string& inputPath);
+
+    std::unique_ptr<TileStore> convolveLayer(const TileStore& input, const LayerRange* inputRange,
+                                             const std::vector<std::vector<int>>& kernel, double divisor,
+                                             int padding, LayerRange& range);
+
+    void writeOutput(const TileStore& input, const LayerRange& range, const std::string& outputPath);
+
+    // queues the input tiles under the window of output tile (tx, ty)
+    void prefetchWindow(const TileStore& input, int tx, int ty, int padding);
+
+    /*
+        copies the clamped window [x0 - padding, x0 + w + padding) x [y0 - padding, y0 + h + padding)
+        of input into window, normalizing with inputRange when given
+    */
+    void buildWindow(const TileStore& input, const LayerRange* inputRange, int x0, int y0, int w, int h,
+                     int padding, double* window);
+
+    // sizes the cache from the budget once the image width is known
+    void setupCache(int width);
+};
@@ -0,0 +1,60 @@
+#include "prefetcher.h"
+
+using namespace std;
+
+Prefetcher::Prefetcher(TileCache& cache) : cache(cache) {
+    worker = thread(&Prefetcher::loop, this);
+}
+
+Prefetcher::~Prefetcher() {
+    drain();
+    {
+        lock_guard<mutex> lock(queueMutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    worker.join();
+}
+
+void Prefetcher::request(const TileStore& store, int tx, int ty) {
+    if (cache.contains(store, tx, ty)) {
+        return;
+    }
+    {
+        lock_guard<mutex> lock(queueMutex);
+        queue.push_back(Request{ &store, tx, ty });
+    }
+    wake.notify_one();
+}
+
+void Prefetcher::drain() {
+    unique_lock<mutex> lock(queueMutex);
+    idle.wait(lock, [this] { return queue.empty() && !busy; });
+}
+
+void Prefetcher::loop() {
+    unique_lock<mutex> lock(queueMutex);
+    for (;;) {
+        wake.wait(lock, [this] { return stopping || !queue.empty(); });
+        if (queue.empty()) {
+            return;
+        }
+
+        Request next = queue.front();
+        queue.pop_front();
+        busy = true;
+        lock.unlock();
+
+        // a failed read is left to the compute thread, which reads the tile again and reports it
+        try {
+            cache.get(*next.store, next.tx, next.ty);
+        } catch (...) {
+        }
+
+        lock.lock();
+        busy = false;
+        if (queue.empty()) {
+            idle.notify_all();
+        }
+    }
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include "tile_cache.h"
+
+/*
+    background thread that reads the tiles the scheduler will need next into the cache,
+    so disk reads overlap with the convolution of the current tile
+*/
+class Prefetcher {
+public:
+    explicit Prefetcher(TileCache& cache);
+
+    // finishes the queued reads and stops the thread
+    ~Prefetcher();
+
+    Prefetcher(const Prefetcher&) = delete;
+    Prefetcher& operator=(const Prefetcher&) = delete;
+
+    // queues a tile, ignored when it is already cached or being read
+    void request(const TileStore& store, int tx, int ty);
+
+    // waits until every queued read is done, needed before a store is dropped
+    void drain();
+
+private:
+    struct Request {
+        const TileStore* store;
+        int tx;
+        int ty;
+    };
+
+    TileCache& cache;
+    std::mutex queueMutex;
+    std::condition_variable wake;
+    std::condition_variable idle;
+    std::deque<Request> queue;
+    bool busy = false;
+    bool stopping = false;
+    std::thread worker;
+
+    void loop();
+};
@@ -0,0 +1,72 @@
+#include "tile_cache.h"
+#include <algorithm>
+
+using namespace std;
+
+TileCache::TileCache(size_t capacity) : capacity(max<size_t>(1, capacity)) {}
+
+TileCache::Key TileCache::keyOf(const TileStore& store, int tx, int ty) {
+    return Key(&store, static_cast<long long>(ty) * store.getTilesAcross() + tx);
+}
+
+TileData TileCache::get(const TileStore& store, int tx, int ty) {
+    Key key = keyOf(store, tx, ty);
+    unique_lock<mutex> lock(cacheMutex);
+
+    // a tile being read by another thread is waited for rather than read twice
+    for (;;) {
+        auto it = entries.find(key);
+        if (it != entries.end()) {
+            ++hits;
+            recency.splice(recency.begin(), recency, it->second.position);
+            return it->second.tile;
+        }
+        if (loading.count(key) == 0) {
+            break;
+        }
+        loaded.wait(lock);
+    }
+    ++misses;
+    loading.insert(key);
+    lock.unlock();
+
+    shared_ptr<vector<double>> tile;
+    try {
+        tile = make_shared<vector<double>>(store.tileValues());
+        store.readTile(tx, ty, tile->data());
+    } catch (...) {
+        lock.lock();
+        loading.erase(key);
+        loaded.notify_all();
+        throw;
+    }
+
+    lock.lock();
+    loading.erase(key);
+    recency.push_front(key);
+    entries[key] = Entry{ tile, recency.begin() };
+    while (entries.size() > capacity) {
+        entries.erase(recency.back());
+        recency.pop_back();
+    }
+    loaded.notify_all();
+    return tile;
+}
+
+bool TileCache::contains(const TileStore& store, int tx, int ty) {
+    Key key = keyOf(store, tx, ty);
+    lock_guard<mutex> lock(cacheMutex);
+    return entries.count(key) > 0 || loading.count(key) > 0;
+}
+
+void TileCache::drop(const TileStore& store) {
+    lock_guard<mutex> lock(cacheMutex);
+    for (auto it = recency.begin(); it != recency.end();) {
+        if (it->first == &store) {
+            entries.erase(*it);
+            it = recency.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
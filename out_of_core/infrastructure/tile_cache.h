@@ -0,0 +1,55 @@
+#pragma once
+#include <condition_variable>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <utility>
+#include <vector>
+#include "tile_store.h"
+
+typedef std::shared_ptr<const std::vector<double>> TileData;
+
+/*
+    least recently used cache of tiles read from TileStores, shared by the compute threads and
+    the prefetcher: a tile is read from disk once even when several threads ask for it together,
+    and an evicted tile stays valid for whoever still holds its TileData
+*/
+class TileCache {
+public:
+    // @param capacity: tiles kept, at least 1
+    explicit TileCache(size_t capacity);
+
+    // the tile, from memory or read from the store (the caller waits for the read)
+    TileData get(const TileStore& store, int tx, int ty);
+
+    // true when the tile is cached or being read
+    bool contains(const TileStore& store, int tx, int ty);
+
+    // forgets every tile of a store, before the store goes away
+    void drop(const TileStore& store);
+
+    size_t getCapacity() const { return capacity; }
+    long long getHits() const { return hits; }
+    long long getMisses() const { return misses; }
+
+private:
+    typedef std::pair<const TileStore*, long long> Key;
+
+    struct Entry {
+        TileData tile;
+        std::list<Key>::iterator position; // in recency, most recent first
+    };
+
+    size_t capacity;
+    std::mutex cacheMutex;
+    std::condition_variable loaded;
+    std::map<Key, Entry> entries;
+    std::list<Key> recency;
+    std::set<Key> loading;
+    long long hits = 0;
+    long long misses = 0;
+
+    static Key keyOf(const TileStore& store, int tx, int ty);
+};
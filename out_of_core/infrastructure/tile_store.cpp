@@ -0,0 +1,58 @@
+#include "tile_store.h"
+#include <cstdlib>
+#include <stdexcept>
+#include <unistd.h>
+
+using namespace std;
+
+TileStore::TileStore(const string& directory, int width, int height, int tileSize)
+    : width(width), height(height), tileSize(tileSize),
+      tilesAcross((width + tileSize - 1) / tileSize), tilesDown((height + tileSize - 1) / tileSize) {
+    string path = directory + "/mfe_tiles_XXXXXX";
+    fd = mkstemp(&path[0]);
+    if (fd < 0) {
+        throw runtime_error("Failed to create tile store in: " + directory);
+    }
+    unlink(path.c_str());
+}
+
+TileStore::~TileStore() {
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+long long TileStore::offsetOf(int tx, int ty) const {
+    long long tile = static_cast<long long>(ty) * tilesAcross + tx;
+    return tile * static_cast<long long>(tileValues() * sizeof(double));
+}
+
+void TileStore::readTile(int tx, int ty, double* out) const {
+    char* dst = reinterpret_cast<char*>(out);
+    size_t length = tileValues() * sizeof(double);
+    off_t offset = static_cast<off_t>(offsetOf(tx, ty));
+    while (length > 0) {
+        ssize_t got = pread(fd, dst, length, offset);
+        if (got <= 0) {
+            throw runtime_error("Failed to read tile from store");
+        }
+        dst += got;
+        length -= static_cast<size_t>(got);
+        offset += got;
+    }
+}
+
+void TileStore::writeTile(int tx, int ty, const double* values) {
+    const char* src = reinterpret_cast<const char*>(values);
+    size_t length = tileValues() * sizeof(double);
+    off_t offset = static_cast<off_t>(offsetOf(tx, ty));
+    while (length > 0) {
+        ssize_t put = pwrite(fd, src, length, offset);
+        if (put <= 0) {
+            throw runtime_error("Failed to write tile to store");
+        }
+        src += put;
+        length -= static_cast<size_t>(put);
+        offset += put;
+    }
+}
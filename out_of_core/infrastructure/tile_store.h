@@ -0,0 +1,41 @@
+#pragma once
+#include <string>
+
+/*
+    one layer of doubles on disk, cut into square tiles of fixed size slots (edge tiles are
+    padded), so tile t lives at t * tileSize * tileSize doubles and is read or written with a
+    single pread / pwrite, from any thread
+    the file is unlinked right after it is created: it disappears with the store
+*/
+class TileStore {
+public:
+    // creates the file in directory, throws runtime_error on failure
+    TileStore(const std::string& directory, int width, int height, int tileSize);
+    ~TileStore();
+
+    TileStore(const TileStore&) = delete;
+    TileStore& operator=(const TileStore&) = delete;
+
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+    int getTileSize() const { return tileSize; }
+    int getTilesAcross() const { return tilesAcross; }
+    int getTilesDown() const { return tilesDown; }
+
+    // doubles per tile slot
+    size_t tileValues() const { return static_cast<size_t>(tileSize) * tileSize; }
+
+    // tileSize * tileSize values, row by row, throws runtime_error on an I/O error
+    void readTile(int tx, int ty, double* out) const;
+    void writeTile(int tx, int ty, const double* values);
+
+private:
+    int fd = -1;
+    int width;
+    int height;
+    int tileSize;
+    int tilesAcross;
+    int tilesDown;
+
+    long long offsetOf(int tx, int ty) const;
+};
@@ -0,0 +1,64 @@
+#include <iostream>
+#include <chrono>
+#include <cstdlib>
+#include <string>
+#include <sys/resource.h>
+#include "../helpers/png_writer.h"
+#include "../helpers/preview.h"
+#include "infrastructure/engine.h"
+
+using namespace std;
+using namespace std::chrono;
+
+int main(int argc, char** argv) {
+    // --png-level <0-9>, --png-filter <name>, --png-fast, --png-threads <n> pick how the output is encoded
+    setDefaultPngOptions(parsePngOptions(argc, argv));
+    // --preview 2|4|8 runs on the input box-downsampled by that factor, for a quick look
+    setPreviewFactor(parsePreviewFactor(argc, argv));
+
+    // usage: out_of_core [--input <png|pgm|raw|mft>] [--output <png|pgm|raw>] [--memory <MB>]
+    //                    [--tile <pixels>] [--prefetch <tiles>] [--spill-dir <directory>]
+    string inputPath = "../images/image.png";
+    string outputPath = "../images/output_out_of_core.png";
+    EngineOptions options;
+    const char* tmpdir = getenv("TMPDIR");
+    if (tmpdir) {
+        options.spillDirectory = tmpdir;
+    }
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--input" && i + 1 < argc) {
+            inputPath = argv[++i];
+        } else if (arg == "--output" && i + 1 < argc) {
+            outputPath = argv[++i];
+        } else if (arg == "--memory" && i + 1 < argc) {
+            options.memoryBudget = stoll(argv[++i]) << 20;
+        } else if (arg == "--tile" && i + 1 < argc) {
+            options.tileSize = max(8, stoi(argv[++i]));
+        } else if (arg == "--prefetch" && i + 1 < argc) {
+            options.prefetch = max(0, stoi(argv[++i]));
+        } else if (arg == "--spill-dir" && i + 1 < argc) {
+            options.spillDirectory = argv[++i];
+        }
+    }
+
+    auto start = high_resolution_clock::now();
+
+    OutOfCoreEngine engine(options);
+    try {
+        engine.run(inputPath, outputPath);
+    } catch (const runtime_error& e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
+
+    auto stop = high_resolution_clock::now();
+    auto duration = duration_cast<milliseconds>(stop - start);
+    cout << "Processing time: " << duration.count() << " ms" << endl;
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    cout << "Tile cache: " << engine.getCacheCapacity() << " tiles, " << engine.getCacheHits() << " hits, "
+         << engine.getCacheMisses() << " misses, peak RSS: " << usage.ru_maxrss / 1024 << " MB" << endl;
+    return 0;
+}
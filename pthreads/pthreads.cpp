@@ -1,5 +1,6 @@
 #include "../helpers/image.h"
 #include "../helpers/kernels.h"
+#include "../helpers/preview.h"
 #include "infrastructure/utils.h"
 #include "infrastructure/thread_manager.h"
 #include <thread>
@@ -9,7 +10,12 @@
 using namespace std;
 using namespace std::chrono;
 
-int main() {
+int main(int argc, char** argv) {
+    // --png-level <0-9>, --png-filter <name>, --png-fast, --png-threads <n> pick how the output is encoded
+    setDefaultPngOptions(parsePngOptions(argc, argv));
+    // --preview 2|4|8 runs on the input box-downsampled by that factor, for a quick look
+    setPreviewFactor(parsePreviewFactor(argc, argv));
+
     auto start = high_resolution_clock::now();
 
     GreyScaleImage img("../images/image.png");
@@ -32,6 +38,11 @@ int main() {
         // compute global min and max from all threads
         computeGlobalMinMax(threadData, globalMin, globalMax, numThreads);
 
+        // the last layer is normalized while it is quantized for the encoder
+        if (l == NUM_LAYERS - 1) {
+            break;
+        }
+
         // normalization
         runNormalizationThreads(output, globalMin, globalMax, numThreads);
 
@@ -39,7 +50,7 @@ int main() {
         std::swap(input, output);
     }
 
-    img.setMatrix(input);
+    img.setQuantizedMatrix(output, normalizingQuantizer(globalMin, globalMax));
     img.save("../images/output_pthreads.png");
 
     auto stop = high_resolution_clock::now();
@@ -4,6 +4,7 @@
 #include <climits>
 #include "../helpers/image.h"
 #include "../helpers/kernels.h"
+#include "../helpers/preview.h"
 
 using namespace std;
 using namespace std::chrono;
@@ -12,13 +13,21 @@ std::vector<std::vector<double>> applyKernel(const std::vector<std::vector<doubl
     const std::vector<std::vector<int>> &kernel,
     double divisor, int padding);
 
+void findMinMax(const std::vector<std::vector<double>> &matrix, double &minVal, double &maxVal);
+
 void normalizeMatrix(std::vector<std::vector<double>> &matrix);
 
-int main() {
+int main(int argc, char** argv) {
+    // --png-level <0-9>, --png-filter <name>, --png-fast, --png-threads <n> pick how the output is encoded,
+    // on this thread only unless --png-threads asks for more
+    setDefaultPngOptions(parsePngOptions(argc, argv));
+    // --preview 2|4|8 runs on the input box-downsampled by that factor, for a quick look
+    setPreviewFactor(parsePreviewFactor(argc, argv));
+
     auto start = high_resolution_clock::now();
 
-    //load input image
-    GreyScaleImage img("../images/image.png");
+    //load input image, on this thread only
+    GreyScaleImage img("../images/image.png", 1);
 
     // convert loaded image to a double matrix
     const auto &inputMat = img.getMatrix();
@@ -27,12 +36,14 @@ int main() {
     // layer 1
     {
         layer1 = applyKernel(inputMat, LAYER_1_KERNEL, LAYER_1_DIV, LAYER_1_PADDING);
+        normalizeMatrix(layer1);
         auto stop = high_resolution_clock::now();
     }
 
     // layer 2
     {
         layer2 = applyKernel(layer1, LAYER_2_KERNEL, LAYER_2_DIV, LAYER_2_PADDING);
+        normalizeMatrix(layer2);
         auto stop = high_resolution_clock::now();
     }
 
@@ -42,8 +53,15 @@ int main() {
         auto stop = high_resolution_clock::now();
     }
 
-    img.setMatrix(layer3);
-    img.save("../images/output_serial.png");
+    // the last layer is normalized while it is quantized for the encoder
+    double minVal, maxVal;
+    findMinMax(layer3, minVal, maxVal);
+    img.setQuantizedMatrix(layer3, normalizingQuantizer(minVal, maxVal));
+    PngOptions options = defaultPngOptions();
+    if (options.threads == 0) {
+        options.threads = 1;
+    }
+    img.save("../images/output_serial.png", options);
 
 
     auto stop = high_resolution_clock::now();
@@ -76,20 +94,25 @@ std::vector<std::vector<double>> applyKernel(
         }
     }
 
-    normalizeMatrix(outMat);
     return outMat;
 }
 
-void normalizeMatrix(std::vector<std::vector<double>> &matrix)
+void findMinMax(const std::vector<std::vector<double>> &matrix, double &minVal, double &maxVal)
 {
-    double minVal = INT_MAX;
-    double maxVal = INT_MIN;
+    minVal = INT_MAX;
+    maxVal = INT_MIN;
 
     for (const auto &row : matrix)
         for (double v : row) {
             if (v < minVal) minVal = v;
             if (v > maxVal) maxVal = v;
         }
+}
+
+void normalizeMatrix(std::vector<std::vector<double>> &matrix)
+{
+    double minVal, maxVal;
+    findMinMax(matrix, minVal, maxVal);
 
     double range = (maxVal - minVal == 0.0) ? 1.0 : (maxVal - minVal);
 
@@ -0,0 +1,45 @@
+#include "rolling_layer.h"
+#include <algorithm>
+
+using namespace std;
+
+RollingLayer::RollingLayer(const vector<vector<int>>& kernel, double divisor, int padding, int width, int height)
+    : kernel(kernel), divisor(divisor), padding(padding), width(width), height(height),
+      ring(min(2 * padding + 1, height), vector<double>(width)), output(width) {}
+
+void RollingLayer::push(const double* row, const function<void(const double*)>& onRow) {
+    copy(row, row + width, ring[received % ring.size()].begin());
+    ++received;
+
+    // output row y needs input rows up to y + padding (clamped to the last row)
+    while (emitted < height && min(height - 1, emitted + padding) < received) {
+        emit(emitted++, onRow);
+    }
+}
+
+void RollingLayer::emit(int y, const function<void(const double*)>& onRow) {
+    int size = 2 * padding + 1;
+    vector<const double*> rows(size);
+    for (int ky = -padding; ky <= padding; ++ky) {
+        int iy = min(max(y + ky, 0), height - 1);
+        rows[ky + padding] = ring[iy % ring.size()].data();
+    }
+
+    // columns are split among threads, each writes its own part of the output row
+    #pragma omp parallel for schedule(static)
+    for (int x = 0; x < width; ++x) {
+        double sum = 0.0;
+        bool interior = x >= padding && x + padding < width;
+        for (int ky = 0; ky < size; ++ky) {
+            const double* in = rows[ky];
+            const int* k = kernel[ky].data();
+            for (int kx = -padding; kx <= padding; ++kx) {
+                int ix = interior ? x + kx : min(max(x + kx, 0), width - 1);
+                sum += in[ix] * k[kx + padding];
+            }
+        }
+        output[x] = sum / divisor;
+    }
+
+    onRow(output.data());
+}
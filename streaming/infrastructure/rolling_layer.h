@@ -0,0 +1,42 @@
+#pragma once
+#include <functional>
+#include <vector>
+
+/*
+    one convolution layer over a stream of rows: only the last 2 * padding + 1 input rows are kept,
+    in a ring, and every output row is produced as soon as the rows below it have arrived
+    borders are clamped exactly like the whole image implementations
+*/
+class RollingLayer {
+public:
+    /*
+        @param kernel, divisor, padding: layer definition (see kernels.h)
+        @param width, height: image dimensions, the height is needed to clamp the bottom rows
+    */
+    RollingLayer(const std::vector<std::vector<int>>& kernel, double divisor, int padding, int width, int height);
+
+    /*
+        feeds the next input row (top to bottom) and emits every output row it completes,
+        after the last input row all remaining output rows are emitted
+        @param row: width values
+        @param onRow: called with each output row (width values, valid during the call)
+    */
+    void push(const double* row, const std::function<void(const double*)>& onRow);
+
+    // rows held by the ring, the working set of this layer
+    int ringRows() const { return static_cast<int>(ring.size()); }
+
+private:
+    std::vector<std::vector<int>> kernel;
+    double divisor;
+    int padding;
+    int width;
+    int height;
+
+    std::vector<std::vector<double>> ring; // input row n lives at ring[n % ring.size()]
+    std::vector<double> output;
+    int received = 0;
+    int emitted = 0;
+
+    void emit(int y, const std::function<void(const double*)>& onRow);
+};
@@ -0,0 +1,69 @@
+#include "spill_file.h"
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <unistd.h>
+
+using namespace std;
+
+SpillFile::SpillFile(const string& directory, int width, SPILL_CODEC codec)
+    : width(width), codec(codec),
+      buffer(static_cast<size_t>(width) * (codec == SPILL_INT32 ? sizeof(int32_t) : sizeof(double))) {
+    string path = directory + "/mfe_spill_XXXXXX";
+    int fd = mkstemp(&path[0]);
+    if (fd < 0) {
+        throw runtime_error("Failed to create spill file in: " + directory);
+    }
+
+    // the name is never needed again, the space is released when the file is closed
+    unlink(path.c_str());
+    file = fdopen(fd, "w+b");
+    if (!file) {
+        close(fd);
+        throw runtime_error("Failed to open spill file in: " + directory);
+    }
+}
+
+SpillFile::~SpillFile() {
+    if (file) {
+        fclose(file);
+    }
+}
+
+void SpillFile::append(const double* row) {
+    if (codec == SPILL_INT32) {
+        int32_t* out = reinterpret_cast<int32_t*>(buffer.data());
+        for (int x = 0; x < width; ++x) {
+            out[x] = static_cast<int32_t>(row[x]);
+        }
+    } else {
+        memcpy(buffer.data(), row, buffer.size());
+    }
+
+    if (fwrite(buffer.data(), 1, buffer.size(), file) != buffer.size()) {
+        throw runtime_error("Failed to write spill file");
+    }
+    written += static_cast<long long>(buffer.size());
+}
+
+void SpillFile::rewind() {
+    if (fflush(file) != 0 || fseek(file, 0, SEEK_SET) != 0) {
+        throw runtime_error("Failed to rewind spill file");
+    }
+}
+
+void SpillFile::read(double* out) {
+    if (fread(buffer.data(), 1, buffer.size(), file) != buffer.size()) {
+        throw runtime_error("Failed to read spill file");
+    }
+
+    if (codec == SPILL_INT32) {
+        const int32_t* in = reinterpret_cast<const int32_t*>(buffer.data());
+        for (int x = 0; x < width; ++x) {
+            out[x] = in[x];
+        }
+    } else {
+        memcpy(out, buffer.data(), buffer.size());
+    }
+}
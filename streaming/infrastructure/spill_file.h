@@ -0,0 +1,44 @@
+#pragma once
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// how spilled values are stored
+enum SPILL_CODEC {
+    SPILL_INT32, // 4 bytes per value, only for values known to be integers in int32 range (lossless then)
+    SPILL_DOUBLE // 8 bytes per value, always lossless
+};
+
+/*
+    unnamed temporary file holding rows of the last layer until the global min/max is known
+    rows are appended once, then read back once from the start
+*/
+class SpillFile {
+public:
+    /*
+        creates the file in directory and unlinks it right away, throws runtime_error on failure
+        @param width: values per row
+    */
+    SpillFile(const std::string& directory, int width, SPILL_CODEC codec);
+    ~SpillFile();
+
+    SpillFile(const SpillFile&) = delete;
+    SpillFile& operator=(const SpillFile&) = delete;
+
+    void append(const double* row);
+
+    // switches to reading, rows come back in the order they were appended
+    void rewind();
+
+    // reads the next row into out (width values), throws runtime_error on a short read
+    void read(double* out);
+
+    long long bytesWritten() const { return written; }
+
+private:
+    FILE* file = nullptr;
+    int width;
+    SPILL_CODEC codec;
+    std::vector<unsigned char> buffer;
+    long long written = 0;
+};
@@ -0,0 +1,143 @@
+#include "streaming_pipeline.h"
+#include "../helpers/kernels.h"
+#include "../helpers/mapped_image.h"
+#include "../helpers/png_writer.h"
+#include "../helpers/quantize.h"
+#include "../helpers/tiled_image.h"
+#include <cfloat>
+#include <climits>
+#include <cstdlib>
+#include <stdexcept>
+
+using namespace std;
+
+static const vector<vector<int>> KERNELS[] = { LAYER_1_KERNEL, LAYER_2_KERNEL, LAYER_3_KERNEL };
+static const double DIVISORS[] = { LAYER_1_DIV, LAYER_2_DIV, LAYER_3_DIV };
+static const int PADDINGS[] = { LAYER_1_PADDING, LAYER_2_PADDING, LAYER_3_PADDING };
+
+StreamingPipeline::StreamingPipeline(int width, int height, int layers, const vector<LayerRange>& known,
+                                     const string& spillDirectory)
+    : width(width), height(height), known(known), input(width),
+      normalized(known.size(), vector<double>(width)), range{ DBL_MAX, -DBL_MAX } {
+    for (int layer = 0; layer < layers; ++layer) {
+        this->layers.push_back(make_unique<RollingLayer>(KERNELS[layer], DIVISORS[layer], PADDINGS[layer],
+                                                         width, height));
+    }
+    if (layers == 3) {
+        spill = make_unique<SpillFile>(spillDirectory, width, spillCodec());
+    }
+}
+
+SPILL_CODEC StreamingPipeline::spillCodec() const {
+    // normalized inputs are fractional, only a fully raw chain stays integral
+    if (!known.empty()) {
+        return SPILL_DOUBLE;
+    }
+
+    // the input is integral in [0, 255]: with integer kernels and unit divisors every raw value
+    // is an integer bounded by 255 * the product of the kernels' absolute sums
+    double bound = 255.0;
+    for (int layer = 0; layer < 3; ++layer) {
+        if (DIVISORS[layer] != 1.0) {
+            return SPILL_DOUBLE;
+        }
+        double absoluteSum = 0.0;
+        for (const auto& row : KERNELS[layer]) {
+            for (int k : row) {
+                absoluteSum += abs(k);
+            }
+        }
+        bound *= absoluteSum;
+    }
+    return bound <= INT_MAX ? SPILL_INT32 : SPILL_DOUBLE;
+}
+
+void StreamingPipeline::pushRow(const unsigned char* row) {
+    for (int x = 0; x < width; ++x) {
+        input[x] = row[x];
+    }
+    feed(0, input.data());
+}
+
+void StreamingPipeline::feed(size_t layer, const double* row) {
+    // every completed row flows straight into the next layer, the last one into the range and spill file
+    layers[layer]->push(row, [this, layer](const double* out) {
+        if (layer + 1 == layers.size()) {
+            for (int x = 0; x < width; ++x) {
+                if (out[x] < range.min) range.min = out[x];
+                if (out[x] > range.max) range.max = out[x];
+            }
+            if (spill) {
+                spill->append(out);
+            }
+            return;
+        }
+
+        if (layer < known.size()) {
+            // same expression as normalizeMatrix
+            double minVal = known[layer].min;
+            double span = (known[layer].max - minVal == 0.0) ? 1.0 : (known[layer].max - minVal);
+            double* scaled = normalized[layer].data();
+            for (int x = 0; x < width; ++x) {
+                scaled[x] = 255.0 * (out[x] - minVal) / span;
+            }
+            out = scaled;
+        }
+        feed(layer + 1, out);
+    });
+}
+
+LayerRange StreamingPipeline::getRange() const {
+    return range;
+}
+
+void StreamingPipeline::finish(const string& outputPath) {
+    if (!spill) {
+        throw runtime_error("Only a three layer pipeline can be written out");
+    }
+    if (isTiledPath(outputPath)) {
+        throw runtime_error("Tiled outputs are not supported in streaming mode: " + outputPath);
+    }
+
+    // same normalization and truncation as normalizeMatrix + GreyScaleImage::setMatrix
+    Quantizer quantizer = normalizingQuantizer(range.min, range.max);
+    vector<double> values(width);
+    auto nextRow = [&](unsigned char* out) {
+        spill->read(values.data());
+        quantizeRow(values.data(), width, out, quantizer);
+    };
+
+    spill->rewind();
+    GREY_FORMAT format = greyFormatForPath(outputPath);
+    if (format != GREY_FORMAT_NONE) {
+        MappedGreyOutput output(outputPath, width, height, format);
+        for (int y = 0; y < height; ++y) {
+            nextRow(output.pixels() + static_cast<size_t>(y) * width);
+        }
+        output.finish();
+    } else {
+        PngStreamWriter writer(outputPath, width, height);
+        vector<unsigned char> row(width);
+        for (int y = 0; y < height; ++y) {
+            nextRow(row.data());
+            writer.writeRows(row.data(), 1);
+        }
+        writer.finish();
+    }
+
+    // releases the disk space right away
+    spillBytes = spill->bytesWritten();
+    spill.reset();
+}
+
+long long StreamingPipeline::getSpillBytes() const {
+    return spill ? spill->bytesWritten() : spillBytes;
+}
+
+long long StreamingPipeline::getWorkingBytes() const {
+    long long rows = 1 + static_cast<long long>(normalized.size());
+    for (const auto& layer : layers) {
+        rows += layer->ringRows() + 1;
+    }
+    return rows * width * static_cast<long long>(sizeof(double));
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include <memory>
+#include <string>
+#include <vector>
+#include "rolling_layer.h"
+#include "spill_file.h"
+
+// min/max of a whole raw layer
+struct LayerRange {
+    double min;
+    double max;
+};
+
+/*
+    the layers over a stream of input rows, with working memory proportional to the width
+
+    normalization is affine with a positive scale, and a clamped convolution of a * X + b is
+    a * conv(X) + b * sum(kernel) / divisor, so normalizing a layer and then the next one gives the
+    same result as normalizing only the next one: without known ranges the raw layers are chained
+    and only the min/max of the last one is needed, tracked while its rows go by (single pass)
+
+    in exact arithmetic that is the reference result, in doubles the intermediate normalizations of
+    the whole image implementations round differently and a few pixels can end up 1 apart, so the
+    ranges of the first layers can also be given (found by earlier passes over the input), which
+    reproduces the reference bit for bit
+*/
+class StreamingPipeline {
+public:
+    /*
+        @param width, height: input dimensions
+        @param layers: how many layers to run (1 - 3), only a three layer pipeline can be finished
+        @param known: ranges of the first known.size() layers, their outputs are normalized with them
+        @param spillDirectory: where the temporary file of the last layer is created (three layers only)
+    */
+    StreamingPipeline(int width, int height, int layers, const std::vector<LayerRange>& known,
+                      const std::string& spillDirectory);
+
+    // feeds the next input row (width bytes), top to bottom
+    void pushRow(const unsigned char* row);
+
+    // min/max of the raw last layer, complete once every input row is in
+    LayerRange getRange() const;
+
+    /*
+        after the last input row: normalizes the spilled last layer and writes it row by row,
+        as PNG (streamed encoder) or through a mapped output for .pgm / .raw / .gray paths
+    */
+    void finish(const std::string& outputPath);
+
+    long long getSpillBytes() const;
+
+    // bytes held by the line buffers of the layers
+    long long getWorkingBytes() const;
+
+private:
+    int width;
+    int height;
+    std::vector<std::unique_ptr<RollingLayer>> layers;
+    std::vector<LayerRange> known;
+    std::unique_ptr<SpillFile> spill;
+    std::vector<double> input;
+    std::vector<std::vector<double>> normalized; // normalized output row of every known layer
+    LayerRange range;
+    long long spillBytes = 0;
+
+    void feed(size_t layer, const double* row);
+
+    // int32 when every raw value of the last layer is an integer that fits, doubles otherwise
+    SPILL_CODEC spillCodec() const;
+};
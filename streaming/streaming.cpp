@@ -0,0 +1,92 @@
+#include <iostream>
+#include <chrono>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+#include "../helpers/png_writer.h"
+#include "../helpers/row_source.h"
+#include "../helpers/preview.h"
+#include "infrastructure/streaming_pipeline.h"
+
+using namespace std;
+using namespace std::chrono;
+
+/*
+    runs the pipeline over the input, once (single pass, ranges of the raw layers only) or, with
+    exact, once per layer so every layer is normalized with its own range like the reference
+*/
+unique_ptr<StreamingPipeline> runPipeline(const string& path, bool exact, const string& spillDirectory);
+
+int main(int argc, char** argv) {
+    // --png-level <0-9>, --png-filter <name>, --png-fast, --png-threads <n> pick how the output is encoded
+    setDefaultPngOptions(parsePngOptions(argc, argv));
+    // --preview 2|4|8 runs on the input box-downsampled by that factor, for a quick look
+    setPreviewFactor(parsePreviewFactor(argc, argv));
+
+    // usage: streaming [--input <png|pgm|raw|mft>] [--output <png|pgm|raw>] [--spill-dir <directory>] [--exact]
+    string inputPath = "../images/image.png";
+    string outputPath = "../images/output_streaming.png";
+    const char* tmpdir = getenv("TMPDIR");
+    string spillDirectory = tmpdir ? tmpdir : "/tmp";
+    bool exact = false;
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--input" && i + 1 < argc) {
+            inputPath = argv[++i];
+        } else if (arg == "--output" && i + 1 < argc) {
+            outputPath = argv[++i];
+        } else if (arg == "--spill-dir" && i + 1 < argc) {
+            spillDirectory = argv[++i];
+        } else if (arg == "--exact") {
+            exact = true;
+        }
+    }
+
+    auto start = high_resolution_clock::now();
+
+    unique_ptr<StreamingPipeline> pipeline;
+    try {
+        pipeline = runPipeline(inputPath, exact, spillDirectory);
+        if (!pipeline) {
+            return 1;
+        }
+        pipeline->finish(outputPath);
+    } catch (const runtime_error& e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
+
+    auto stop = high_resolution_clock::now();
+    auto duration = duration_cast<milliseconds>(stop - start);
+    cout << "Processing time: " << duration.count() << " ms" << endl;
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    cout << "Line buffers: " << pipeline->getWorkingBytes() / 1024 << " KB, spilled: "
+         << pipeline->getSpillBytes() / 1024 << " KB, peak RSS: " << usage.ru_maxrss / 1024 << " MB" << endl;
+    return 0;
+}
+
+unique_ptr<StreamingPipeline> runPipeline(const string& path, bool exact, const string& spillDirectory) {
+    vector<LayerRange> known;
+    int passes = exact ? 3 : 1;
+    unique_ptr<StreamingPipeline> pipeline;
+
+    for (int pass = 1; pass <= passes; ++pass) {
+        int layers = exact ? pass : 3;
+        bool read = streamGreyRows(path,
+            [&](int width, int height) {
+                pipeline = make_unique<StreamingPipeline>(width, height, layers, known, spillDirectory);
+            },
+            [&](const unsigned char* row) {
+                pipeline->pushRow(row);
+            });
+        if (!read) {
+            return nullptr;
+        }
+        known.push_back(pipeline->getRange());
+    }
+    return pipeline;
+}
@@ -0,0 +1,70 @@
+#include <chrono>
+#include <iostream>
+#include <string>
+#include "../helpers/image.h"
+#include "../helpers/tiled_image.h"
+
+using namespace std;
+using namespace std::chrono;
+
+/*
+    converts between the supported image formats, picked from the file extensions:
+    PNG (or anything stb reads), binary PGM, headered raw and the tiled container (.mft)
+*/
+int main(int argc, char** argv) {
+    // usage: convert <input> <output> [--tile <size>] [--tile-width <w>] [--tile-height <h>]
+    //                [--tile-level <0-9>] [--png-level <0-9>] [--png-filter <name>] [--png-fast] [--png-threads <n>]
+    setDefaultPngOptions(parsePngOptions(argc, argv));
+
+    string inputPath;
+    string outputPath;
+    TiledOptions tiledOptions;
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--tile" && i + 1 < argc) {
+            tiledOptions.tileWidth = tiledOptions.tileHeight = stoi(argv[++i]);
+        } else if (arg == "--tile-width" && i + 1 < argc) {
+            tiledOptions.tileWidth = stoi(argv[++i]);
+        } else if (arg == "--tile-height" && i + 1 < argc) {
+            tiledOptions.tileHeight = stoi(argv[++i]);
+        } else if (arg == "--tile-level" && i + 1 < argc) {
+            tiledOptions.level = stoi(argv[++i]);
+        } else if (arg == "--png-level" || arg == "--png-filter" || arg == "--png-threads") {
+            ++i;
+        } else if (arg.rfind("--", 0) == 0) {
+            continue;
+        } else if (inputPath.empty()) {
+            inputPath = arg;
+        } else {
+            outputPath = arg;
+        }
+    }
+
+    if (inputPath.empty() || outputPath.empty()) {
+        cerr << "Usage: " << argv[0] << " <input> <output> [--tile <size>] [--tile-level <0-9>]" << endl;
+        return 1;
+    }
+
+    auto start = high_resolution_clock::now();
+
+    GreyScaleImage image;
+    if (!image.load(inputPath)) {
+        return 1;
+    }
+
+    try {
+        if (isTiledPath(outputPath)) {
+            writeTiledImage(outputPath, image.getBytes(), image.getWidth(), image.getHeight(), tiledOptions);
+        } else {
+            image.save(outputPath);
+        }
+    } catch (const runtime_error& e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
+
+    auto stop = high_resolution_clock::now();
+    cout << "Converted " << inputPath << " (" << image.getWidth() << "x" << image.getHeight() << ") to "
+         << outputPath << " in " << duration_cast<milliseconds>(stop - start).count() << " ms" << endl;
+    return 0;
+}